@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# local_client.py
+# Client for the roaster's local WebSocket server, see main/local_server.h. Streams the controller state, sends
+# authenticated commands, and measures how long a command takes to reach the SSRs.
+#
+#   local_client.py roaster.local stream --binary --count 10
+#   local_client.py roaster.local --key "$LOCAL_SERVER_KEY" heat-off
+#   local_client.py roaster.local --key "$LOCAL_SERVER_KEY" latency --count 20 --value 500
+#
+# Only needs the standard library.
+
+import argparse
+import base64
+import hashlib
+import hmac
+import json
+import os
+import socket
+import statistics
+import struct
+import sys
+import time
+
+# local_snapshot_t
+SNAPSHOT_FORMAT = '<BBIfffBBBBfI'
+SNAPSHOT_FIELDS = ('version', 'flags', 'loop_count', 'tc_temp', 'junction_temp', 'ror', 'input_duty',
+                   'output_duty', 'fan_duty', 'balance', 'ratio_override', 'command_latency_us')
+
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xa
+
+
+class WebSocket:
+    def __init__(self, host, port, timeout):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall((f'GET /ws HTTP/1.1\r\nHost: {host}:{port}\r\nUpgrade: websocket\r\n'
+                           f'Connection: Upgrade\r\nSec-WebSocket-Key: {key}\r\n'
+                           f'Sec-WebSocket-Version: 13\r\n\r\n').encode())
+        response = b''
+        while b'\r\n\r\n' not in response:
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                raise ConnectionError('Connection closed during the handshake')
+            response += chunk
+        head, self.buffer = response.split(b'\r\n\r\n', 1)
+        if not head.startswith(b'HTTP/1.1 101'):
+            raise ConnectionError(f'Handshake refused: {head.splitlines()[0].decode()}')
+
+    def _read(self, n):
+        while len(self.buffer) < n:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise ConnectionError('Connection closed')
+            self.buffer += chunk
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def send(self, payload, opcode=OP_TEXT):
+        if isinstance(payload, str):
+            payload = payload.encode()
+        header = bytes([0x80 | opcode])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        elif len(payload) < 1 << 16:
+            header += bytes([0x80 | 126]) + struct.pack('>H', len(payload))
+        else:
+            header += bytes([0x80 | 127]) + struct.pack('>Q', len(payload))
+        # Client frames are always masked
+        mask = os.urandom(4)
+        self.sock.sendall(header + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload)))
+
+    def recv(self):
+        """Next text or binary message, as (opcode, payload) with the time its last byte arrived."""
+        while True:
+            first, second = self._read(2)
+            opcode, length = first & 0x0f, second & 0x7f
+            if length == 126:
+                length = struct.unpack('>H', self._read(2))[0]
+            elif length == 127:
+                length = struct.unpack('>Q', self._read(8))[0]
+            mask = self._read(4) if second & 0x80 else None
+            payload = self._read(length)
+            if mask:
+                payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+            if opcode == OP_PING:
+                self.send(payload, OP_PONG)
+            elif opcode == OP_CLOSE:
+                raise ConnectionError('Closed by the server')
+            elif opcode in (OP_TEXT, OP_BINARY):
+                return opcode, payload, time.monotonic()
+
+
+class Client:
+    def __init__(self, host, port, key, timeout):
+        self.ws = WebSocket(host, port, timeout)
+        self.key = key
+        self.seq = 0
+        self.next_id = 1
+        _, hello, _ = self.ws.recv()
+        self.nonce = json.loads(hello)['nonce']
+
+    def request(self, command, **fields):
+        """Sends a request and returns its id, commands that move the heat are signed."""
+        message = {'command': command, 'id': self.next_id, **fields}
+        self.next_id += 1
+        if command in ('heat_off', 'resume', 'ratio'):
+            if not self.key:
+                raise ValueError('A key is needed for commands, see --key')
+            self.seq += 1
+            signed = f"{self.nonce}:{self.seq}:{command}:{fields.get('value', 0)}:{fields.get('ttl', 0)}"
+            message['seq'] = self.seq
+            message['mac'] = hmac.new(self.key.encode(), signed.encode(), hashlib.sha256).hexdigest()
+        self.ws.send(json.dumps(message, separators=(',', ':')))
+        return message['id']
+
+    def next_message(self):
+        """Next message decoded, replies and JSON pushes as dicts, binary snapshots as a dict of their fields."""
+        opcode, payload, at = self.ws.recv()
+        if opcode == OP_BINARY:
+            return dict(zip(SNAPSHOT_FIELDS, struct.unpack(SNAPSHOT_FORMAT, payload))), at
+        return json.loads(payload), at
+
+    def snapshot(self, message):
+        """Readings out of a JSON push or a binary snapshot, None for anything else."""
+        if 'version' in message:
+            return message
+        return message['data'] if message.get('pushMessage') == 'data' else None
+
+    def reply(self, request_id):
+        while True:
+            message, _ = self.next_message()
+            if message.get('id') == request_id:
+                if 'error' in message:
+                    raise RuntimeError(message['error'])
+                return message
+
+
+def _stream(client, args):
+    client.reply(client.request('subscribe', format='binary' if args.binary else 'json'))
+    for _ in range(args.count or sys.maxsize):
+        message, _ = client.next_message()
+        snapshot = client.snapshot(message)
+        if snapshot:
+            print(json.dumps(snapshot))
+
+
+def _latency(client, args):
+    """Alternates ratio overrides, timing each from sending to the first tick that ran with it."""
+    client.reply(client.request('subscribe', format='binary' if args.binary else 'json'))
+    round_trips, device = [], []
+    for i in range(args.count):
+        value = args.value + (i % 2)
+        sent = time.monotonic()
+        client.request('ratio', value=value, ttl=args.ttl)
+        while True:
+            message, at = client.next_message()
+            if 'error' in message:
+                raise RuntimeError(message['error'])
+            snapshot = client.snapshot(message)
+            # null in JSON and NaN in binary when there is no override, neither compares close
+            override = snapshot and snapshot['ratio_override']
+            if override is not None and abs(override - value / 1000) < 5e-4:
+                round_trips.append((at - sent) * 1000)
+                device.append(snapshot['command_latency_us'] / 1000)
+                print(f"ratio {value / 1000:.3f} applied at tick {snapshot['loop_count']}: "
+                      f"{round_trips[-1]:.1f}ms to the snapshot, {device[-1]:.2f}ms received to SSRs on the device")
+                break
+    client.reply(client.request('ratio', value=0, ttl=0))
+
+    def summary(name, values):
+        values = sorted(values)
+        print(f"{name}: min {values[0]:.2f}ms median {statistics.median(values):.2f}ms "
+              f"p95 {values[int(0.95 * (len(values) - 1))]:.2f}ms max {values[-1]:.2f}ms")
+
+    summary('Command to snapshot', round_trips)
+    summary('Received to SSRs', device)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local WebSocket client for the roaster controller')
+    parser.add_argument('host')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--key', default=os.environ.get('LOCAL_SERVER_KEY'),
+                        help='Key commands are signed with, LOCAL_SERVER_KEY by default')
+    parser.add_argument('--timeout', type=float, default=10)
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    stream = commands.add_parser('stream', help='Print a snapshot per control tick')
+    stream.add_argument('--binary', action='store_true')
+    stream.add_argument('--count', type=int, default=0, help='Snapshots to print, 0 to run until interrupted')
+
+    commands.add_parser('heat-off', help='Both elements off until resumed')
+    commands.add_parser('resume', help='End a heat off and any ratio override')
+
+    ratio = commands.add_parser('ratio', help='Override the secondary heat ratio')
+    ratio.add_argument('value', type=float, help='Ratio, 0 to 1')
+    ratio.add_argument('--ttl', type=int, default=60, help='Seconds the override lasts')
+
+    latency = commands.add_parser('latency', help='Measure command latency with alternating ratio overrides')
+    latency.add_argument('--count', type=int, default=20)
+    latency.add_argument('--value', type=int, default=500, help='Ratio in thousandths, alternated with one more')
+    latency.add_argument('--ttl', type=int, default=5)
+    latency.add_argument('--binary', action='store_true')
+
+    args = parser.parse_args()
+    client = Client(args.host, args.port, args.key, args.timeout)
+    if args.command == 'stream':
+        _stream(client, args)
+    elif args.command == 'latency':
+        _latency(client, args)
+    elif args.command == 'ratio':
+        client.reply(client.request('ratio', value=round(args.value * 1000), ttl=args.ttl))
+    else:
+        client.reply(client.request(args.command.replace('-', '_')))
+
+
+if __name__ == '__main__':
+    main()
@@ -6,6 +6,9 @@
 #include <esp_check.h>
 #include <esp_heap_caps.h>
 #include <esp_attr.h>
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
+#include <atomic>
 
 #define TAG "SSR"
 
@@ -26,10 +29,23 @@ struct duty_packets_t {
 
 struct ssr_ctrl_t {
   ssr_ctrl_config_t cfg;
+  // Bit of the output in the GPIO set and clear registers
+  uint32_t gpio_mask;
   gptimer_handle_t timer_handle;
+  // Duty of the pattern being output, only the alarm changes it
   int duty;
+  // Duty last set, taken by the alarm when the next pattern starts
+  volatile int pending_duty;
+  // Set to cut the output on the next half-cycle, whatever the pattern
+  volatile bool force_off;
   int level = false;
   uint8_t in_state_count;
+  // Alarm timing by esp_timer, the first alarm after power on, 0 until then, and the alarms due since
+  int64_t first_alarm_us;
+  uint64_t alarms;
+  // Written by the alarm only, odd while it is updating the counters
+  std::atomic<uint32_t> counters_seq;
+  ssr_ctrl_counters_t counters;
 };
 
 /**
@@ -37,31 +53,75 @@ struct ssr_ctrl_t {
  */
 static duty_packets_t _duty_map[MAX_DUTY - MIN_DUTY + 1];
 
-static IRAM_ATTR bool _on_ssr_alarm_cb(gptimer_handle_t, const gptimer_alarm_event_data_t *, void *user_ctx) {
-  auto inst = (ssr_ctrl_handle_t) (user_ctx);
-
-  if (inst->duty <= 0) {
+IRAM_ATTR void ssr_ctrl_half_cycle(ssr_ctrl_handle_t inst) {
+  int was_on = inst->level;
+  if (inst->force_off) {
+    inst->force_off = false;
+    inst->duty = 0;
+    inst->level = 0;
+  } else if (inst->duty <= 0 || inst->duty >= 100 ||
+             (!inst->level && inst->in_state_count >= _duty_map[inst->duty - MIN_DUTY].low_level)) {
+    // A pattern is a high run then a low run, a new one starts here with the duty last set. Never switching duty
+    // mid pattern means every pattern output is exactly that of one duty.
+    inst->duty = inst->pending_duty;
+    inst->level = inst->duty > 0;
+    inst->in_state_count = 0;
+  } else if (inst->level && inst->in_state_count >= _duty_map[inst->duty - MIN_DUTY].high_level) {
     inst->level = 0;
-  } else if (inst->duty >= 100) {
-    inst->level = 1;
+    inst->in_state_count = 0;
+  }
+
+  // Straight to the set and clear registers: gpio_set_level() is not in IRAM, and checks the pin every call
+  if (inst->level) {
+    GPIO.out_w1ts = inst->gpio_mask;
   } else {
-    // The idea is to count how many periods we stay in, then once it reaches the desired count we flip
-    // to the opposite level and start counting again for that expected count
-    int target_count;
-    if (inst->level) {
-      target_count = _duty_map[inst->duty - MIN_DUTY].high_level;
-    } else {
-      target_count = _duty_map[inst->duty - MIN_DUTY].low_level;
-    }
+    GPIO.out_w1tc = inst->gpio_mask;
+  }
+  inst->in_state_count++;
 
-    if (inst->in_state_count >= target_count) {
-      inst->level = !inst->level;
-      inst->in_state_count = 0;
-    }
+  // Sequence lock, the 64 bit counters cannot be read in one go from the other core
+  uint32_t seq = inst->counters_seq.load(std::memory_order_relaxed);
+  inst->counters_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  inst->counters.half_cycles++;
+  inst->counters.on_half_cycles += inst->level;
+  inst->counters.commanded += inst->pending_duty;
+  inst->counters.switch_count += inst->level && !was_on;
+  inst->counters_seq.store(seq + 2, std::memory_order_release);
+}
+
+/*
+ * Checks the alarm against when it was due, from the first one after power on. An alarm held off past the next
+ * one only runs once, the half-cycles in between are missed: the output holds its level through them and the
+ * pattern stretches.
+ */
+static IRAM_ATTR void _time_alarm(ssr_ctrl_handle_t inst) {
+  int64_t now = esp_timer_get_time();
+  if (!inst->first_alarm_us) {
+    inst->first_alarm_us = now;
+    return;
+  }
+  const int64_t half_cycle_us = 500000 / inst->cfg.mains_hz;
+  int64_t late_us = now - (inst->first_alarm_us + (int64_t) (++inst->alarms * 500000 / inst->cfg.mains_hz));
+  uint64_t missed = late_us > 0 ? late_us / half_cycle_us : 0;
+  inst->alarms += missed;
+  late_us -= (int64_t) missed * half_cycle_us;
+
+  uint32_t seq = inst->counters_seq.load(std::memory_order_relaxed);
+  inst->counters_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  inst->counters.missed += missed;
+  inst->counters.late += late_us >= SSR_CTRL_LATE_US;
+  if (late_us > inst->counters.max_late_us) {
+    inst->counters.max_late_us = late_us;
   }
+  inst->counters_seq.store(seq + 2, std::memory_order_release);
+}
 
-  gpio_set_level(inst->cfg.gpio, inst->level);
-  inst->in_state_count++;
+static IRAM_ATTR bool _on_ssr_alarm_cb(gptimer_handle_t, const gptimer_alarm_event_data_t *, void *user_ctx) {
+  auto inst = (ssr_ctrl_handle_t) user_ctx;
+  _time_alarm(inst);
+  ssr_ctrl_half_cycle(inst);
   return true;
 }
 
@@ -70,9 +130,13 @@ static IRAM_ATTR bool _on_ssr_alarm_cb(gptimer_handle_t, const gptimer_alarm_eve
  */
 esp_err_t ssr_ctrl_power_off(ssr_ctrl_handle_t inst) {
   ESP_RETURN_ON_FALSE(inst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
-  // Turn off RMT and force pin to zero as safety
+  // Turn off RMT and force pin to zero as safety, with the alarm stopped nothing else touches the pattern
   ESP_ERROR_CHECK(gptimer_stop(inst->timer_handle));
-  ssr_ctrl_set_duty(inst, 0);
+  inst->pending_duty = 0;
+  inst->force_off = false;
+  inst->duty = 0;
+  inst->level = 0;
+  inst->in_state_count = 0;
   ESP_ERROR_CHECK(gpio_set_level(inst->cfg.gpio, 0));
   ESP_LOGI(TAG, "SSR power OFF for gpio %d", inst->cfg.gpio);
 
@@ -82,6 +146,9 @@ esp_err_t ssr_ctrl_power_off(ssr_ctrl_handle_t inst) {
 esp_err_t ssr_ctrl_power_on(ssr_ctrl_handle_t inst) {
   ESP_RETURN_ON_FALSE(inst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
   ESP_LOGI(TAG, "SSR power ON for gpio %d", inst->cfg.gpio);
+  // The timer is stopped, the alarm times itself afresh from its first
+  inst->first_alarm_us = 0;
+  inst->alarms = 0;
   ESP_ERROR_CHECK(gptimer_start(inst->timer_handle));
 
   return ESP_OK;
@@ -95,13 +162,32 @@ esp_err_t ssr_ctrl_set_duty(ssr_ctrl_handle_t inst, int duty) {
     duty = 0;
   }
 
-  inst->duty = duty;
+  inst->pending_duty = duty;
+  return ESP_OK;
+}
+
+IRAM_ATTR esp_err_t ssr_ctrl_force_off(ssr_ctrl_handle_t inst) {
+  ESP_RETURN_ON_FALSE_ISR(inst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+  // Pending first, the alarm may take it as soon as the output is cut
+  inst->pending_duty = 0;
+  inst->force_off = true;
   return ESP_OK;
 }
 
 esp_err_t ssr_ctrl_get_duty(ssr_ctrl_handle_t inst, int &duty) {
   ESP_RETURN_ON_FALSE(inst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
-  duty = inst->duty;
+  duty = inst->pending_duty;
+  return ESP_OK;
+}
+
+esp_err_t ssr_ctrl_get_counters(ssr_ctrl_handle_t inst, ssr_ctrl_counters_t &counters) {
+  ESP_RETURN_ON_FALSE(inst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+  uint32_t seq;
+  do {
+    seq = inst->counters_seq.load(std::memory_order_acquire);
+    counters = inst->counters;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != inst->counters_seq.load(std::memory_order_relaxed));
   return ESP_OK;
 }
 
@@ -188,14 +274,18 @@ esp_err_t ssr_ctrl_new(ssr_ctrl_config_t cfg, ssr_ctrl_handle_t *ret_handle) {
 
   ESP_LOGI(TAG, "Creating new controller for GPIO %d", cfg.gpio);
 
-  ssr_ctrl_t *handle;
+  ssr_ctrl_t *handle = nullptr;
   // Do allocation for handle and go
   ESP_GOTO_ON_FALSE(ret_handle, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
-  handle = (ssr_ctrl_t *) heap_caps_calloc(1, sizeof(ssr_ctrl_t), MALLOC_CAP_DEFAULT);
+  // The alarm only writes the registers of the first bank
+  ESP_GOTO_ON_FALSE(cfg.gpio >= 0 && cfg.gpio < 32, ESP_ERR_INVALID_ARG, err, TAG, "GPIO %d above 31", cfg.gpio);
+  // Internal RAM, the alarm runs with the flash cache disabled
+  handle = (ssr_ctrl_t *) heap_caps_calloc(1, sizeof(ssr_ctrl_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
   ESP_GOTO_ON_FALSE(handle, ESP_ERR_NO_MEM, err, TAG, "no mem for ssr ctrl");
 
   // Store config
   handle->cfg = cfg;
+  handle->gpio_mask = 1u << cfg.gpio;
   _generate_duty_map();
   ESP_GOTO_ON_ERROR(gpio_config(&io_conf), err, TAG, "Failed to configure GPIO");
 
@@ -207,6 +297,7 @@ esp_err_t ssr_ctrl_new(ssr_ctrl_config_t cfg, ssr_ctrl_handle_t *ret_handle) {
   ESP_GOTO_ON_ERROR(gptimer_enable(handle->timer_handle), err, TAG, "Could not enable timer");
 
   ssr_ctrl_set_duty(handle, 0);
+  handle->duty = 0;
   handle->level = 0;
 
   // Good to go
@@ -214,7 +305,7 @@ esp_err_t ssr_ctrl_new(ssr_ctrl_config_t cfg, ssr_ctrl_handle_t *ret_handle) {
   return ret;
 
   err:
-  if (ret_handle) {
+  if (handle) {
     ssr_ctrl_destroy(handle);
   }
   return ret;
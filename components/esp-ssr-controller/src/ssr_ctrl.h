@@ -9,6 +9,30 @@ enum main_hertz_t {
   MAINS_60_HZ = 60,
 };
 
+/**
+ * Lateness of the alarm counted as a late half-cycle, a tenth of one: with the timer not locked to mains, that is
+ * how often the delay moves a switch past a zero crossing.
+ */
+#define SSR_CTRL_LATE_US  1000
+
+/**
+ * Totals of the output since the controller was created, counted by the alarm on every mains half-cycle.
+ */
+struct ssr_ctrl_counters_t {
+  // Half-cycles output, and how many of them were on
+  uint64_t half_cycles;
+  uint64_t on_half_cycles;
+  // Duty set, summed in percent over the same half-cycles, so commanded / 100 compares to on_half_cycles
+  uint64_t commanded;
+  // Times the output turned on, the SSR switching cycles
+  uint64_t switch_count;
+  // Alarms that ran SSR_CTRL_LATE_US or more after they were due, half-cycles no alarm ran for at all, interrupts
+  // held off past a whole half-cycle, and the latest an alarm ran in microseconds
+  uint64_t late;
+  uint64_t missed;
+  uint32_t max_late_us;
+};
+
 /**
  * Handle for an instance of an SSR controller
  */
@@ -27,19 +51,35 @@ struct ssr_ctrl_config_t {
 };
 
 /**
- * Sets a desired duty, as an integer from [0-100]
+ * Sets a desired duty, as an integer from [0-100]. It is double buffered, the output finishes the on and off
+ * pattern of the previous duty first, at most 2 * 100 half-cycles for a duty of 1 or 99, so every pattern is
+ * exactly that of one duty. Use ssr_ctrl_force_off() to cut the output sooner.
  * @param handle controller instance
  * @param duty Desired duty. Note that for safety, this value is trimmed to [0, 100]
  */
 esp_err_t ssr_ctrl_set_duty(ssr_ctrl_handle_t handle, int duty);
 
 /**
- * Current duty set.
+ * Cuts the output from the next half-cycle, mid pattern if need be, and sets the duty to zero. A later
+ * ssr_ctrl_set_duty() starts a new pattern from there. Safe to call from an ISR.
+ * @param handle controller instance
+ */
+esp_err_t ssr_ctrl_force_off(ssr_ctrl_handle_t handle);
+
+/**
+ * Duty last set, which the output may still be finishing the previous pattern before.
  * @param handle controller instance
  * @return Integer in the range of [0, 100]
  */
 esp_err_t ssr_ctrl_get_duty(ssr_ctrl_handle_t handle, int &duty);
 
+/**
+ * Reads the counters without stopping the alarm, which never waits on the reader: a read overlapping an alarm
+ * is retried.
+ * @param handle controller instance
+ */
+esp_err_t ssr_ctrl_get_counters(ssr_ctrl_handle_t handle, ssr_ctrl_counters_t &counters);
+
 /**
  * Powers off the controller and sets output duty to zero.
  * @param handle controller instance
@@ -52,6 +92,13 @@ esp_err_t ssr_ctrl_power_off(ssr_ctrl_handle_t handle);
  */
 esp_err_t ssr_ctrl_power_on(ssr_ctrl_handle_t handle);
 
+/**
+ * Advances the output by one mains half-cycle, which is what the timer alarm does once powered on. Exposed so
+ * the cost of the alarm can be benchmarked, calling it alongside a running timer would disturb the pattern.
+ * @param handle controller instance
+ */
+void ssr_ctrl_half_cycle(ssr_ctrl_handle_t handle);
+
 /**
  * Initialises a controller for an SSR on a given GPIO
  * @param cfg Configuration set desired
@@ -1,79 +1,196 @@
 #include <esp_event.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <cJSON.h>
+#include <atomic>
+#include <esp_check.h>
 #include "app_config.h"
 #include "shadow/shadow_handler.h"
-#include "common/events_common.h"
-#include "fleet_provisioning/mqtt_provision.h"
 #include "control_loop.h"
 #include "telemetry.h"
+#include "schema.h"
+#include "json_reader.h"
+#include "profile.h"
+#include "local_server.h"
+#include "command_topic.h"
 
 #define TAG "app_config"
 
+// Minimum time between two updates of the config shadow, pending changes are coalesced into one publish
+#define UPDATE_WINDOW_US  (2 * 1000 * 1000)
+
 static device_shadow_handle_t shadow_handle;
-static bool _update_required = false;
-static bool _delete_control_required = false;
-static bool _delete_telemetry_required = false;
-
-static void _delete_desired(const char* item) {
-  static const char *format =
-      R"({
-      "state": {
-        "desired": {
-          "%s": null
-          }
-        }
-      })";
-
-  static char payload[512];
-  size_t len = sprintf(payload, format, item);
-  shadow_handler_update(shadow_handle, payload, len);
+// Requests set by the shadow handler and the control task, taken by the telemetry task as it builds an update.
+// Reports every field on the next update, set on boot and when the shadow was deleted
+static std::atomic<bool> _full_report_required{true};
+static std::atomic<bool> _delete_control_required{false};
+static std::atomic<bool> _delete_telemetry_required{false};
+// The local server key is never reported, so the desired section holding it is cleared once applied
+static std::atomic<bool> _delete_local_required{false};
+// Profiles are stored as they arrive, the desired section is then cleared and a summary of the slots reported
+static std::atomic<bool> _profiles_report_required{true};
+static std::atomic<bool> _delete_profiles_required{false};
+// A command is taken once, its desired section then cleared so it is not taken again after a reboot
+static std::atomic<bool> _delete_command_required{false};
+static schema_hash_t s_control_hash;
+static schema_hash_t s_telemetry_hash;
+static schema_hash_t s_local_hash;
+
+// Fields named in a delta are reported back even when unchanged, so the delta is cleared
+static std::atomic<uint32_t> s_control_touched{0};
+static std::atomic<uint32_t> s_telemetry_touched{0};
+static std::atomic<uint32_t> s_local_touched{0};
+
+// What the shadow holds as reported, changes against these are what we send
+static control_cfg_t s_reported_control = {};
+static telemetry_cfg_t s_reported_telemetry = {};
+static local_server_cfg_t s_reported_local = {};
+static int64_t s_last_update_time = 0;
+
+/* Requests and delta fields an update carries, taken all at once */
+struct pending_t {
+  bool full_report;
+  bool delete_control;
+  bool delete_telemetry;
+  bool delete_local;
+  bool profiles_report;
+  bool delete_profiles;
+  bool delete_command;
+  uint32_t control_touched;
+  uint32_t telemetry_touched;
+  uint32_t local_touched;
+};
+
+static void _pending_fields(const pending_t &pending, const control_cfg_t &control, const telemetry_cfg_t &telemetry,
+                            const local_server_cfg_t &local, uint32_t &control_mask, uint32_t &telemetry_mask,
+                            uint32_t &local_mask) {
+  if (pending.full_report) {
+    control_mask = SCHEMA_ALL_FIELDS;
+    telemetry_mask = SCHEMA_ALL_FIELDS;
+    local_mask = SCHEMA_ALL_FIELDS;
+  } else {
+    control_mask = schema_diff(control_cfg_schema, &control, &s_reported_control) | pending.control_touched;
+    telemetry_mask = schema_diff(telemetry_cfg_schema, &telemetry, &s_reported_telemetry) | pending.telemetry_touched;
+    local_mask = schema_diff(local_server_cfg_schema, &local, &s_reported_local) | pending.local_touched;
+  }
+  local_mask &= ~LOCAL_SERVER_SECRET_FIELDS;
 }
 
-void app_config_update_send(char* payload, size_t max_len) {
-  static const char *format =
-      R"({
-      "state": {
-        "reported": {
-          "control": {
-            "max_heat_ratio": %f,
-            "max_tc_temp": %d,
-            "max_board_temp": %d,
-            "mains_hz": %d
-            },
-            "telemetry": {
-              "status_interval": %d,
-              "metrics_interval": %d
-            }
-          }
-        }
-      })";
+/* Clears the requests as they are taken, one coming in while the update is built goes out with the next */
+static pending_t _take_pending() {
+  return {
+      .full_report = _full_report_required.exchange(false),
+      .delete_control = _delete_control_required.exchange(false),
+      .delete_telemetry = _delete_telemetry_required.exchange(false),
+      .delete_local = _delete_local_required.exchange(false),
+      .profiles_report = _profiles_report_required.exchange(false),
+      .delete_profiles = _delete_profiles_required.exchange(false),
+      .delete_command = _delete_command_required.exchange(false),
+      .control_touched = s_control_touched.exchange(0),
+      .telemetry_touched = s_telemetry_touched.exchange(0),
+      .local_touched = s_local_touched.exchange(0),
+  };
+}
+
+static void _restore(std::atomic<bool> &flag, bool taken) {
+  if (taken) {
+    flag = true;
+  }
+}
+
+/* Puts back the requests of an update that was not sent */
+static void _restore_pending(const pending_t &pending) {
+  _restore(_full_report_required, pending.full_report);
+  _restore(_delete_control_required, pending.delete_control);
+  _restore(_delete_telemetry_required, pending.delete_telemetry);
+  _restore(_delete_local_required, pending.delete_local);
+  _restore(_profiles_report_required, pending.profiles_report);
+  _restore(_delete_profiles_required, pending.delete_profiles);
+  _restore(_delete_command_required, pending.delete_command);
+  s_control_touched |= pending.control_touched;
+  s_telemetry_touched |= pending.telemetry_touched;
+  s_local_touched |= pending.local_touched;
+}
 
+void app_config_update_send(char* payload, size_t max_len) {
   auto controller_cfg = controller_get_cfg();
   auto telemetry_cfg = telemetry_get_cfg();
-  size_t len = snprintf(payload, max_len, format,
-                       controller_cfg.max_heat_ratio,
-                       controller_cfg.max_tc_temp,
-                       controller_cfg.max_board_temp,
-                       controller_cfg.mains_hz,
-                       telemetry_cfg.status_interval_s,
-                       telemetry_cfg.metrics_interval_s);
+  auto local_cfg = local_server_get_cfg();
+  pending_t pending = _take_pending();
+  uint32_t control_mask, telemetry_mask, local_mask;
+  _pending_fields(pending, controller_cfg, telemetry_cfg, local_cfg, control_mask, telemetry_mask, local_mask);
+
+  // Reported changes and desired deletes all go out in a single update
+  json_writer_t w;
+  json_writer_init(&w, payload, max_len);
+  json_begin_object(&w, nullptr);
+  json_begin_object(&w, "state");
+  if (control_mask || telemetry_mask || local_mask || pending.profiles_report) {
+    json_begin_object(&w, "reported");
+    if (control_mask) {
+      json_begin_object(&w, "control");
+      json_write_fields(&w, control_cfg_schema, &controller_cfg, control_mask);
+      json_end_object(&w);
+    }
+    if (telemetry_mask) {
+      json_begin_object(&w, "telemetry");
+      json_write_fields(&w, telemetry_cfg_schema, &telemetry_cfg, telemetry_mask);
+      json_end_object(&w);
+    }
+    if (local_mask) {
+      json_begin_object(&w, "local");
+      json_write_fields(&w, local_server_cfg_schema, &local_cfg, local_mask);
+      json_end_object(&w);
+    }
+    if (pending.profiles_report) {
+      json_begin_object(&w, "profiles");
+      for (uint8_t slot = 1; slot <= PROFILE_SLOTS; slot++) {
+        char key[4];
+        snprintf(key, sizeof(key), "%u", slot);
+        profile_json_write_summary(&w, key, slot);
+      }
+      json_end_object(&w);
+    }
+    json_end_object(&w);
+  }
+  if (pending.delete_control || pending.delete_telemetry || pending.delete_local || pending.delete_profiles ||
+      pending.delete_command) {
+    json_begin_object(&w, "desired");
+    if (pending.delete_control) {
+      json_write_null(&w, "control");
+    }
+    if (pending.delete_telemetry) {
+      json_write_null(&w, "telemetry");
+    }
+    if (pending.delete_local) {
+      json_write_null(&w, "local");
+    }
+    if (pending.delete_profiles) {
+      json_write_null(&w, "profiles");
+    }
+    if (pending.delete_command) {
+      json_write_null(&w, "command");
+    }
+    json_end_object(&w);
+  }
+  json_end_object(&w);
+  json_end_object(&w);
+  size_t len = json_writer_finish(&w);
+  s_last_update_time = esp_timer_get_time();
+  if (!len) {
+    ESP_LOGE(TAG, "Config update does not fit in %d bytes, retried next window", (int) max_len);
+    _restore_pending(pending);
+    return;
+  }
 
   ESP_LOGI(TAG, "%.*s\n", len, payload);
   shadow_handler_update(shadow_handle, payload, len);
 
-  // Also run deletes as required
-  if (_delete_telemetry_required) {
-    _delete_desired("telemetry");
-    _delete_telemetry_required = false;
-  }
-
-  if (_delete_control_required) {
-    _delete_desired("control");
-    _delete_control_required = false;
-  }
-
-  _update_required = false;
+  s_reported_control = controller_cfg;
+  s_reported_telemetry = telemetry_cfg;
+  s_reported_local = local_cfg;
 }
 
 void _get_handler(MQTTContext_t *ctx, MQTTPublishInfo_t *pxPublishInfo) {
@@ -83,47 +200,131 @@ void _get_handler(MQTTContext_t *ctx, MQTTPublishInfo_t *pxPublishInfo) {
            pxPublishInfo->payloadLength, (const char *) pxPublishInfo->pPayload);
 }
 
-static esp_err_t _update_controls(cJSON* json) {
+static esp_err_t _update_controls(json_reader_t *reader) {
   control_cfg_t cfg = controller_get_cfg();
+  uint32_t touched = 0;
+  esp_err_t ret = schema_json_read(control_cfg_schema, s_control_hash, reader, &cfg, &touched);
+  s_control_touched |= touched;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Invalid control delta");
+  return controller_set_cfg(cfg);
+}
 
-  cJSON* item = cJSON_GetObjectItem(json, "max_heat_ratio");
-  if (item != nullptr) {
-    cfg.max_heat_ratio = item->valuedouble;
-  }
+static esp_err_t _update_metrics(json_reader_t *reader) {
+  telemetry_cfg_t cfg = telemetry_get_cfg();
+  uint32_t touched = 0;
+  esp_err_t ret = schema_json_read(telemetry_cfg_schema, s_telemetry_hash, reader, &cfg, &touched);
+  s_telemetry_touched |= touched;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Invalid telemetry delta");
+  return telemetry_set_cfg(cfg);
+}
 
-  item = cJSON_GetObjectItem(json, "max_tc_temp");
-  if (item != nullptr) {
-    cfg.max_tc_temp = item->valueint;
+static esp_err_t _update_local(json_reader_t *reader) {
+  local_server_cfg_t cfg = local_server_get_cfg();
+  uint32_t touched = 0;
+  esp_err_t ret = schema_json_read(local_server_cfg_schema, s_local_hash, reader, &cfg, &touched);
+  s_local_touched |= touched;
+  if (touched & LOCAL_SERVER_SECRET_FIELDS) {
+    _delete_local_required = true;
   }
+  ESP_RETURN_ON_ERROR(ret, TAG, "Invalid local server delta");
+  return local_server_set_cfg(cfg);
+}
 
-  item = cJSON_GetObjectItem(json, "max_board_temp");
-  if (item != nullptr) {
-    cfg.max_board_temp = item->valueint;
+/* Stores each profile keyed by its slot number, a null clears the slot */
+static esp_err_t _update_profiles(json_reader_t *reader) {
+  esp_err_t ret = ESP_OK;
+  json_token_t key, value;
+  while (json_next(reader, &key) == JSON_TOKEN_KEY) {
+    json_next(reader, &value);
+    char slot_str[4] = {};
+    memcpy(slot_str, key.str, std::min(key.len, sizeof(slot_str) - 1));
+    auto slot = (uint8_t) atoi(slot_str);
+    profile_t profile = {};
+    esp_err_t err = ESP_OK;
+    if (value.type == JSON_TOKEN_OBJECT_START) {
+      err = profile_json_read(reader, &profile);
+      if (err == ESP_FAIL) {
+        return ESP_FAIL;
+      }
+    } else if (!json_skip(reader, &value)) {
+      return ESP_FAIL;
+    } else if (value.type != JSON_TOKEN_NULL) {
+      err = ESP_ERR_INVALID_ARG;
+    }
+    err = err == ESP_OK ? profile_store(slot, profile) : err;
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Invalid profile for slot %.*s", key.len, key.str);
+      ret = err;
+    }
   }
+  return key.type == JSON_TOKEN_OBJECT_END ? ret : ESP_FAIL;
+}
 
-  item = cJSON_GetObjectItem(json, "mains_hz");
-  if (item != nullptr) {
-    cfg.mains_hz = item->valueint;
+/* Consumes the members of state, applying the sections we know about */
+static esp_err_t _apply_state(json_reader_t *reader) {
+  json_token_t key, value;
+  while (json_next(reader, &key) == JSON_TOKEN_KEY) {
+    json_next(reader, &value);
+    if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "control")) {
+      if (_update_controls(reader) != ESP_OK) {
+        // delete item and set to null then, it is invalid
+        _delete_control_required = true;
+      }
+    } else if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "telemetry")) {
+      if (_update_metrics(reader) != ESP_OK) {
+        // delete item and set to null then, it is invalid
+        _delete_telemetry_required = true;
+      }
+    } else if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "local")) {
+      if (_update_local(reader) != ESP_OK) {
+        // delete item and set to null then, it is invalid
+        _delete_local_required = true;
+      }
+    } else if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "profiles")) {
+      // Too large to keep reported in full, so the desired profiles go once stored, valid or not
+      if (_update_profiles(reader) == ESP_FAIL) {
+        return ESP_FAIL;
+      }
+      _profiles_report_required = true;
+      _delete_profiles_required = true;
+    } else if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "command")) {
+      // Acked whether valid or not, so it goes either way
+      if (command_topic_apply(reader) == ESP_FAIL) {
+        return ESP_FAIL;
+      }
+      _delete_command_required = true;
+    } else if (!json_skip(reader, &value)) {
+      return ESP_FAIL;
+    }
   }
 
-  return controller_set_cfg(cfg);
+  return key.type == JSON_TOKEN_OBJECT_END ? ESP_OK : ESP_FAIL;
 }
 
-static esp_err_t _update_metrics(cJSON* json) {
-  telemetry_cfg_t cfg = telemetry_get_cfg();
-  cJSON* item;
-
-  item = cJSON_GetObjectItem(json, "status_interval");
-  if (item != nullptr) {
-    cfg.status_interval_s = item->valueint;
-  }
-
-  item = cJSON_GetObjectItem(json, "metrics_interval");
-  if (item != nullptr) {
-    cfg.metrics_interval_s = item->valueint;
+esp_err_t app_config_apply_delta(const char *payload, size_t len) {
+  json_reader_t reader;
+  json_token_t key, value;
+
+  // Reject malformed documents up front, before any of the configuration is touched
+  ESP_RETURN_ON_FALSE(json_validate(payload, len, APP_CONFIG_DELTA_MAX_TOKENS), ESP_FAIL, TAG,
+                      "Failed to parse JSON");
+
+  json_reader_init(&reader, payload, len, APP_CONFIG_DELTA_MAX_TOKENS);
+  ESP_RETURN_ON_FALSE(json_next(&reader, &value) == JSON_TOKEN_OBJECT_START, ESP_FAIL, TAG, "Expected an object");
+
+  bool has_state = false;
+  while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+    json_next(&reader, &value);
+    if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "state")) {
+      has_state = true;
+      ESP_RETURN_ON_ERROR(_apply_state(&reader), TAG, "Failed to read state");
+    } else if (!json_skip(&reader, &value)) {
+      return ESP_FAIL;
+    }
   }
 
-  return telemetry_set_cfg(cfg);
+  ESP_RETURN_ON_FALSE(has_state, ESP_FAIL, TAG, "Failed to get state");
+  return ESP_OK;
 }
 
 void _updated_handler(MQTTContext_t *ctx, MQTTPublishInfo_t *pxPublishInfo) {
@@ -133,68 +334,43 @@ void _updated_handler(MQTTContext_t *ctx, MQTTPublishInfo_t *pxPublishInfo) {
 
     ESP_LOGI(TAG, ">>> Receive shadow delta %.*s", pxPublishInfo->payloadLength,
              (const char *) pxPublishInfo->pPayload);
-    cJSON* item, *items;
-    cJSON *root = cJSON_ParseWithLength((const char *) pxPublishInfo->pPayload, pxPublishInfo->payloadLength);
-    if (root == nullptr) {
-      ESP_LOGE(TAG, "Failed to parse JSON");
-      goto error;
-    }
-
-    items = cJSON_GetObjectItem(root, "state");
-    if (items == nullptr) {
-      ESP_LOGE(TAG, "Failed to get state");
-      goto error;
-    }
-
-    cJSON_ArrayForEach(item, items) {
-      if (strcmp(item->string, "control") == 0) {
-        auto ret = _update_controls(item);
-        if (ret == ESP_FAIL) {
-          // delete item and set to null then, it is invalid
-          _delete_control_required = true;
-        }
-      } else if (strcmp(item->string, "telemetry") == 0) {
-        auto ret = _update_metrics(item);
-        if (ret == ESP_FAIL) {
-          // delete item and set to null then, it is invalid
-          _delete_telemetry_required = true;
-        }
-      }
-    }
-
-    cJSON_Delete(root);
-
-    // Set flag now
-    _update_required = true;
-    return;
-
-    error:
-    if (root) {
-      cJSON_Delete(root);
-    }
+    app_config_apply_delta((const char *) pxPublishInfo->pPayload, pxPublishInfo->payloadLength);
   }
 }
 
 static void _deleted_handler(MQTTContext_t *, MQTTPublishInfo_t *pxPublishInfo) {
   // re-create the shadow then
-  _update_required = true;
+  _full_report_required = true;
 }
 
-static void _event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-  if (event_id == CORE_MQTT_CONNECTED_EVENT && !mqtt_provisioning_active()) {
-    // Refresh metrics on new connection
-    _update_required = true;
+bool app_config_update_required() {
+  if (esp_timer_get_time() - s_last_update_time < UPDATE_WINDOW_US) {
+    return false;
   }
+
+  // The shadow keeps our reported state across reconnects, so only changes need to go out
+  pending_t pending = {
+      .full_report = _full_report_required,
+      .control_touched = s_control_touched,
+      .telemetry_touched = s_telemetry_touched,
+      .local_touched = s_local_touched,
+  };
+  uint32_t control_mask, telemetry_mask, local_mask;
+  _pending_fields(pending, controller_get_cfg(), telemetry_get_cfg(), local_server_get_cfg(), control_mask,
+                  telemetry_mask, local_mask);
+  return control_mask || telemetry_mask || local_mask || _delete_control_required || _delete_telemetry_required ||
+         _delete_local_required || _profiles_report_required || _delete_profiles_required || _delete_command_required;
 }
 
-bool app_config_update_required() {
-  return _update_required;
+void app_config_clear_desired_control() {
+  _delete_control_required = true;
 }
 
 void app_config_init() {
+  ESP_ERROR_CHECK(schema_hash_build(control_cfg_schema, &s_control_hash));
+  ESP_ERROR_CHECK(schema_hash_build(telemetry_cfg_schema, &s_telemetry_hash));
+  ESP_ERROR_CHECK(schema_hash_build(local_server_cfg_schema, &s_local_hash));
+
   device_shadow_cfg_t shadow_cfg = {.name = "config", .get = _get_handler, .updated = _updated_handler, .deleted = _deleted_handler};
   ESP_ERROR_CHECK(shadow_handler_init(shadow_cfg, &shadow_handle));
-
-  // Register connect events so we can send shadow on connect
-  ESP_ERROR_CHECK(esp_event_handler_register(CORE_MQTT_EVENT, ESP_EVENT_ANY_ID, &_event_handler, nullptr));
-}
\ No newline at end of file
+}
@@ -1,7 +1,36 @@
 #pragma once
 
+#include <cstddef>
+#include <esp_err.h>
+#include "json_reader.h"
+#include "profile.h"
+
+// Token budget of a shadow delta: every profile slot full and mirrored in the metadata, then the configuration
+// sections and the document around them within the reader's default budget
+#define APP_CONFIG_DELTA_MAX_TOKENS  (PROFILE_SLOTS * PROFILE_DELTA_SLOT_TOKENS + JSON_READER_MAX_TOKENS)
+
+/**
+ * True when fields changed since they were last reported, or desired values must be cleared, and the
+ * coalescing window since the previous update has elapsed.
+ */
 bool app_config_update_required();
 
+/**
+ * Sends the pending changes to the config shadow as one update, only fields that changed are reported.
+ */
 void app_config_update_send(char* payload, size_t max_len);
 
+/**
+ * Applies a shadow delta document to the control, telemetry and local server configuration and the stored
+ * profiles.
+ * @return ESP_OK if the document was well formed, ESP_FAIL otherwise in which case nothing was applied.
+ */
+esp_err_t app_config_apply_delta(const char *payload, size_t len);
+
+/**
+ * Clears the desired control section with the next update, once a one-shot request such as an autotune is done
+ * and must not come back as a delta. Everything it held is already reported.
+ */
+void app_config_clear_desired_control();
+
 void app_config_init();
\ No newline at end of file
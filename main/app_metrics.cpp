@@ -2,8 +2,16 @@
 #include <esp_system.h>
 #include <esp_log.h>
 #include <ctime>
+#include <algorithm>
+#include <cmath>
+#include <esp_wifi.h>
 #include <cstring>
+#include <atomic>
 #include <esp_event.h>
+#include <esp_timer.h>
+#include <esp_core_dump.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "app_metrics.h"
 #include "shadow/shadow_handler.h"
 #include "common/identity.h"
@@ -12,10 +20,27 @@
 #include "sntp/sntp_sync.h"
 #include "common/events_common.h"
 #include "fleet_provisioning/mqtt_provision.h"
+#include "schema.h"
+#include "stats.h"
+#include "flash_ops.h"
+#include "pm_control.h"
+#include "supervisor.h"
+#include "flight_recorder.h"
+#include "boot_profile.h"
 
 #define TAG "app_metrics"
 #define NVS_STATS_NAMESPACE "stats"
 #define TOPIC_MAX_SIZE 128
+#define NVS_LIFETIME_KEY "elements"
+// NVS keys are 15 characters at most, "last_crash_reason" was never stored
+#define NVS_CRASH_REASON_KEY "crash_reason"
+
+// Raw samples waiting for the telemetry task, a power of two, room for some 40 ticks
+#define SAMPLE_SLOTS 256
+
+// Lifetime figures are saved after the elements stay off this long, or once they were on this long since the last
+#define LIFETIME_IDLE_SAVE_S  60
+#define LIFETIME_SAVE_ON_S    360
 
 struct device_metrics_t {
   uint32_t boot_count;
@@ -23,90 +48,295 @@ struct device_metrics_t {
   uint32_t last_crash_reason;
 };
 
+// Use of an element over its life, as stored in NVS
+struct element_lifetime_t {
+  double on_s;
+  double energy_wh;
+  uint64_t switch_count;
+};
+
+// What an element's SSR delivered over the metrics interval
+struct element_interval_t {
+  ssr_ctrl_counters_t counters;
+  double energy_wh;
+};
+
+struct element_metrics_t {
+  float energy_wh;
+  // Duty asked for and delivered over the interval's half-cycles in percent, and their difference, NaN when the
+  // SSR was not running
+  float commanded_duty;
+  float delivered_duty;
+  float realization_error;
+  uint32_t switch_count;
+  // Half-cycles the SSR alarm ran late for or missed, and its latest since boot, see ssr_ctrl_counters_t
+  uint32_t late_half_cycles;
+  uint32_t missed_half_cycles;
+  uint32_t max_late_us;
+  float lifetime_on_h;
+  float lifetime_kwh;
+  uint64_t lifetime_switch_count;
+};
+
+typedef decltype(wifi_connect_get_metrics()) wifi_metrics_t;
+typedef decltype(mqtt_client_get_metrics()) mqtt_metrics_t;
+typedef decltype(sntp_sync_get_metrics()) sntp_metrics_t;
+
+static const schema_field_t s_device_fields[] = {
+    SCHEMA_FIELD(device_metrics_t, boot_count),
+    SCHEMA_FIELD(device_metrics_t, crash_count),
+    SCHEMA_FIELD(device_metrics_t, last_crash_reason),
+};
+static const schema_t s_device_schema = SCHEMA_DEFINE(s_device_fields);
+
+static const schema_field_t s_element_fields[] = {
+    SCHEMA_FIELD_P(element_metrics_t, energy_wh, "energy_wh", 1),
+    SCHEMA_FIELD_P(element_metrics_t, commanded_duty, "commanded_duty", 2),
+    SCHEMA_FIELD_P(element_metrics_t, delivered_duty, "delivered_duty", 2),
+    SCHEMA_FIELD_P(element_metrics_t, realization_error, "realization_error", 2),
+    SCHEMA_FIELD(element_metrics_t, switch_count),
+    SCHEMA_FIELD(element_metrics_t, late_half_cycles),
+    SCHEMA_FIELD(element_metrics_t, missed_half_cycles),
+    SCHEMA_FIELD(element_metrics_t, max_late_us),
+    SCHEMA_FIELD_P(element_metrics_t, lifetime_on_h, "lifetime_on_h", 2),
+    SCHEMA_FIELD_P(element_metrics_t, lifetime_kwh, "lifetime_kwh", 2),
+    SCHEMA_FIELD(element_metrics_t, lifetime_switch_count),
+};
+static const schema_t s_element_schema = SCHEMA_DEFINE(s_element_fields);
+
+static const char *s_element_names[METRICS_ELEMENT_COUNT] = {
+    "main",
+    "secondary",
+};
+
+static const schema_field_t s_wifi_fields[] = {
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, connect_attempt_count, "wifi.connect_attempt_count"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, disconnected_count, "wifi.disconnected_count"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, connected_count, "wifi.connected_count"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, connect_duration_ms, "wifi.connect_duration_ms"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, rssi, "wifi.rssi"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, channel, "wifi.channel"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, ssid, "wifi.ssid"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, ap_bssid, "wifi.ap_bssid"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, ip_addr, "wifi.ip_addr"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, gw_addr, "wifi.gw_addr"),
+    SCHEMA_FIELD_NAMED(wifi_metrics_t, nm_addr, "wifi.nm_addr"),
+};
+static const schema_t s_wifi_schema = SCHEMA_DEFINE(s_wifi_fields);
+
+static const schema_field_t s_sntp_fields[] = {
+    SCHEMA_FIELD_NAMED(sntp_metrics_t, last_sync_time, "sntp.last_sync_time"),
+    SCHEMA_FIELD_NAMED(sntp_metrics_t, sync_duration_ms, "sntp.sync_duration_ms"),
+};
+static const schema_t s_sntp_schema = SCHEMA_DEFINE(s_sntp_fields);
+
+static const schema_field_t s_mqtt_fields[] = {
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, connect_attempt_count, "mqtt.connect_attempt_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, disconnected_count, "mqtt.disconnected_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, connected_count, "mqtt.connected_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, connect_duration_ms, "mqtt.connect_duration_ms"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, tx_pkt_count, "mqtt.tx_pkt_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, tx_bytes_count, "mqtt.tx_bytes_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, rx_pkt_count, "mqtt.rx_pkt_count"),
+    SCHEMA_FIELD_NAMED(mqtt_metrics_t, rx_bytes_count, "mqtt.rx_bytes_count"),
+};
+static const schema_t s_mqtt_schema = SCHEMA_DEFINE(s_mqtt_fields);
+
+enum {
+  STAT_LOOP_LATENCY,
+  STAT_TC_TEMP,
+  STAT_JUNCTION_TEMP,
+  STAT_BALANCE,
+  STAT_DUTY_ERROR,
+  STAT_RSSI,
+  STAT_COMMAND_LATENCY,
+  STAT_WAKE_LATENCY,
+  STAT_COUNT,
+};
+
+static const char *s_stat_names[STAT_COUNT] = {
+    "loop_latency_us",
+    "tc_temp",
+    "junction_temp",
+    "balance",
+    "duty_error",
+    "wifi.rssi",
+    "command_latency_us",
+    "wake_latency_us",
+};
+
+struct stat_sample_t {
+  uint8_t stat;
+  float value;
+};
+
+// Interval statistics, telemetry task only
+static stream_stats_t s_stats[STAT_COUNT];
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Single producer, the control task, and single consumer, the telemetry task, ring of raw samples. The control
+// task only copies values in, the statistics are updated once they were taken.
+static stat_sample_t s_samples[SAMPLE_SLOTS];
+static std::atomic<uint32_t> s_sample_head{0};
+static std::atomic<uint32_t> s_sample_tail{0};
+static std::atomic<uint32_t> s_samples_dropped{0};
+
+// Element use, fed by the control task and read by the telemetry task under the stats lock. The lifetime
+// figures include what was not saved yet.
+static element_interval_t s_interval[METRICS_ELEMENT_COUNT];
+static element_lifetime_t s_lifetime[METRICS_ELEMENT_COUNT];
+static uint32_t s_lifetime_saves = 0;
+// Control task only
+static float s_unsaved_on_s = 0;
+static int64_t s_last_on_us = 0;
+
 static device_metrics_t s_device_metrics = {};
 static time_t _last_report_time = 0;
 static char metrics_topic[TOPIC_MAX_SIZE];
 
+// Why the previous boot ended, its post-mortem is published once connected
+static esp_reset_reason_t s_reset_reason = ESP_RST_UNKNOWN;
+static bool s_crashed = false;
+static bool s_postmortem_pending = false;
+static char postmortem_topic[TOPIC_MAX_SIZE];
+
 static void _record_metrics() {
   nvs_handle_t nvs_handle;
   ESP_ERROR_CHECK(nvs_open(NVS_STATS_NAMESPACE, NVS_READWRITE, &nvs_handle));
   nvs_get_u32(nvs_handle, "boot_count", &s_device_metrics.boot_count);
   nvs_get_u32(nvs_handle, "crash_count", &s_device_metrics.crash_count);
-  nvs_get_u32(nvs_handle, "last_crash_reason", &s_device_metrics.last_crash_reason);
+  nvs_get_u32(nvs_handle, NVS_CRASH_REASON_KEY, &s_device_metrics.last_crash_reason);
 
   auto reason = esp_reset_reason();
+  s_reset_reason = reason;
   if (reason != ESP_RST_DEEPSLEEP && reason != ESP_RST_POWERON && reason != ESP_RST_SW) {
     ESP_LOGE(TAG, "Detected crash with reset reason: %d", reason);
     // Then we have a crash
+    s_crashed = true;
     s_device_metrics.crash_count++;
     s_device_metrics.last_crash_reason = reason;
   }
 
   s_device_metrics.boot_count++;
 
-  nvs_set_u32(nvs_handle, "boot_count", s_device_metrics.boot_count);
-  nvs_set_u32(nvs_handle, "crash_count", s_device_metrics.crash_count);
-  nvs_set_u32(nvs_handle, "last_crash_reason", s_device_metrics.last_crash_reason);
+  nvs_close(nvs_handle);
+
+  flash_ops_write_u32(NVS_STATS_NAMESPACE, "boot_count", s_device_metrics.boot_count);
+  flash_ops_write_u32(NVS_STATS_NAMESPACE, "crash_count", s_device_metrics.crash_count);
+  flash_ops_write_u32(NVS_STATS_NAMESPACE, NVS_CRASH_REASON_KEY, s_device_metrics.last_crash_reason);
+}
 
-  ESP_ERROR_CHECK(nvs_commit(nvs_handle));
+static void _load_lifetime() {
+  nvs_handle_t nvs_handle;
+  ESP_ERROR_CHECK(nvs_open(NVS_STATS_NAMESPACE, NVS_READWRITE, &nvs_handle));
+  size_t size = sizeof(s_lifetime);
+  esp_err_t err = nvs_get_blob(nvs_handle, NVS_LIFETIME_KEY, s_lifetime, &size);
+  if (err != ESP_OK || size != sizeof(s_lifetime)) {
+    ESP_LOGW(TAG, "No element lifetime stored, starting from zero: %s", esp_err_to_name(err));
+    memset(s_lifetime, 0, sizeof(s_lifetime));
+  }
   nvs_close(nvs_handle);
 }
 
-void app_metrics_send(char *buffer, size_t max_len) {
-  static const char *metrics_format =
-      R"({
-      "metrics": {
-        "timestamp": %)" PRIu32 R"(,
-        "boot_count": %)" PRIu32 R"(,
-        "crash_count": %)" PRIu32 R"(,
-        "last_crash_reason": %)" PRIu32 R"(,
-        "heap_free": %)" PRIu32 R"(,
-        "heap_min": %)" PRIu32 R"(,
-        "wifi.connect_attempt_count": %)" PRIu32 R"(,
-        "wifi.disconnected_count": %)" PRIu32 R"(,
-        "wifi.connected_count": %)" PRIu32 R"(,
-        "wifi.connect_duration_ms": %)" PRIu32 R"(,
-        "wifi.rssi": %)" PRId8 R"(,
-        "wifi.channel": %)" PRIu8 R"(,
-        "wifi.ssid": "%s",
-        "wifi.ap_bssid": "%s",
-        "wifi.ip_addr": "%s",
-        "wifi.gw_addr": "%s",
-        "wifi.nm_addr": "%s",
-        "sntp.last_sync_time": %)" PRIu64 R"(,
-        "sntp.sync_duration_ms": %)" PRIu32 R"(,
-        "mqtt.connect_attempt_count": %)" PRIu32 R"(,
-        "mqtt.disconnected_count": %)" PRIu32 R"(,
-        "mqtt.connected_count": %)" PRIu32 R"(,
-        "mqtt.connect_duration_ms": %)" PRIu32 R"(,
-        "mqtt.tx_pkt_count": %)" PRIu32 R"(,
-        "mqtt.tx_bytes_count": %)" PRIu64 R"(,
-        "mqtt.rx_pkt_count": %)" PRIu32 R"(,
-        "mqtt.rx_bytes_count": %)" PRIu64 R"(
-        }
-      })";
+/* Interval and lifetime figures of an element, the interval is then reset. Under the stats lock. */
+static element_metrics_t _element_metrics(int element) {
+  const element_interval_t &interval = s_interval[element];
+  const element_lifetime_t &lifetime = s_lifetime[element];
+  element_metrics_t m = {
+      .energy_wh = (float) interval.energy_wh,
+      .commanded_duty = NAN,
+      .delivered_duty = NAN,
+      .realization_error = NAN,
+      .switch_count = (uint32_t) interval.counters.switch_count,
+      .late_half_cycles = (uint32_t) interval.counters.late,
+      .missed_half_cycles = (uint32_t) interval.counters.missed,
+      .max_late_us = interval.counters.max_late_us,
+      .lifetime_on_h = (float) (lifetime.on_s / 3600),
+      .lifetime_kwh = (float) (lifetime.energy_wh / 1000),
+      .lifetime_switch_count = lifetime.switch_count,
+  };
+  if (interval.counters.half_cycles) {
+    m.commanded_duty = (float) interval.counters.commanded / (float) interval.counters.half_cycles;
+    m.delivered_duty = 100.0f * (float) interval.counters.on_half_cycles / (float) interval.counters.half_cycles;
+    m.realization_error = m.commanded_duty - m.delivered_duty;
+  }
+  // Since boot, kept across intervals
+  s_interval[element] = {.counters = {.max_late_us = interval.counters.max_late_us}};
+  return m;
+}
 
+void app_metrics_send(char *buffer, size_t max_len) {
   time_t report_id = time(nullptr);
   auto wifi_metrics = wifi_connect_get_metrics();
   auto mqtt_metrics = mqtt_client_get_metrics();
   auto sntp_metrics = sntp_sync_get_metrics();
+  auto flash = flash_ops_get_metrics();
+  auto pm = pm_control_get_metrics();
+  auto supervisor = supervisor_get_metrics();
+  auto boot = boot_profile_get_metrics();
 
-  size_t len = snprintf(buffer, max_len, metrics_format,
-                        (uint32_t) report_id,
-                        s_device_metrics.boot_count, s_device_metrics.crash_count, s_device_metrics.last_crash_reason,
-                        (uint32_t)esp_get_free_heap_size(),
-                        (uint32_t)esp_get_minimum_free_heap_size(),
-                        wifi_metrics.connect_attempt_count, wifi_metrics.disconnected_count,
-                        wifi_metrics.connected_count, wifi_metrics.connect_duration_ms, wifi_metrics.rssi,
-                        wifi_metrics.channel,
-                        wifi_metrics.ssid, wifi_metrics.ap_bssid, wifi_metrics.ip_addr, wifi_metrics.gw_addr,
-                        wifi_metrics.nm_addr,
-                        (uint64_t) sntp_metrics.last_sync_time, sntp_metrics.sync_duration_ms,
-                        mqtt_metrics.connect_attempt_count, mqtt_metrics.disconnected_count,
-                        mqtt_metrics.connected_count,
-                        mqtt_metrics.connect_duration_ms,
-                        mqtt_metrics.tx_pkt_count, mqtt_metrics.tx_bytes_count,
-                        mqtt_metrics.rx_pkt_count, mqtt_metrics.rx_bytes_count);
+  json_writer_t w;
+  json_writer_init(&w, buffer, max_len);
+  json_begin_object(&w, nullptr);
+  json_begin_object(&w, "metrics");
+  json_write_uint(&w, "timestamp", (uint32_t) report_id);
+  json_write_fields(&w, s_device_schema, &s_device_metrics);
+  json_write_uint(&w, "heap_free", esp_get_free_heap_size());
+  json_write_uint(&w, "heap_min", esp_get_minimum_free_heap_size());
+  // We are called from the telemetry task, track how close it is to its stack limit
+  json_write_uint(&w, "telemetry.stack_free", uxTaskGetStackHighWaterMark(nullptr));
+  json_write_uint(&w, "stats.dropped", s_samples_dropped.load(std::memory_order_relaxed));
+  json_write_fields(&w, s_wifi_schema, &wifi_metrics);
+  json_write_fields(&w, s_sntp_schema, &sntp_metrics);
+  json_write_fields(&w, s_mqtt_schema, &mqtt_metrics);
+
+  // Aggregates since the last report, then start a new interval
+  app_metrics_take_samples();
+  stats_summary_t summaries[STAT_COUNT];
+  for (int i = 0; i < STAT_COUNT; i++) {
+    summaries[i] = stream_stats_summary(&s_stats[i]);
+    stream_stats_reset(&s_stats[i]);
+  }
+  element_metrics_t elements[METRICS_ELEMENT_COUNT];
+  portENTER_CRITICAL(&s_stats_lock);
+  for (int i = 0; i < METRICS_ELEMENT_COUNT; i++) {
+    elements[i] = _element_metrics(i);
+  }
+  uint32_t lifetime_saves = s_lifetime_saves;
+  portEXIT_CRITICAL(&s_stats_lock);
+
+  json_begin_object(&w, "elements");
+  for (int i = 0; i < METRICS_ELEMENT_COUNT; i++) {
+    json_begin_object(&w, s_element_names[i]);
+    json_write_fields(&w, s_element_schema, &elements[i]);
+    json_end_object(&w);
+  }
+  json_end_object(&w);
+  // NVS writes of the lifetime figures since boot
+  json_write_uint(&w, "lifetime_saves", lifetime_saves);
+  json_begin_object(&w, "flash");
+  json_write_fields(&w, flash_ops_metrics_schema, &flash);
+  json_end_object(&w);
+  json_begin_object(&w, "pm");
+  json_write_fields(&w, pm_metrics_schema, &pm);
+  json_end_object(&w);
+  json_begin_object(&w, "supervisor");
+  json_write_fields(&w, supervisor_metrics_schema, &supervisor);
+  json_end_object(&w);
+  json_begin_object(&w, "boot");
+  json_write_fields(&w, boot_metrics_schema, &boot);
+  json_end_object(&w);
+
+  json_begin_object(&w, "stats");
+  for (int i = 0; i < STAT_COUNT; i++) {
+    json_begin_object(&w, s_stat_names[i]);
+    json_write_fields(&w, stats_summary_schema, &summaries[i]);
+    json_end_object(&w);
+  }
+  json_end_object(&w);
+  json_end_object(&w);
+  json_end_object(&w);
+  size_t len = json_writer_finish(&w);
 
   _last_report_time = report_id;
   ESP_LOGI(TAG, "%.*s\n", len, buffer);
@@ -126,11 +356,226 @@ void app_metrics_send(char *buffer, size_t max_len) {
 
 }
 
+/* A flight record as an array, time and type then the tick's fields or the event's value and argument */
+static void _write_flight_record(json_writer_t *w, const flight_record_t &record) {
+  json_begin_array(w, nullptr);
+  json_write_uint(w, nullptr, record.time_ms);
+  json_write_str(w, nullptr, flight_recorder_type_name(record.type));
+  if (record.type == FLIGHT_RECORD_TICK) {
+    const flight_tick_t &tick = record.tick;
+    json_write_uint(w, nullptr, record.flags);
+    json_write_uint(w, nullptr, tick.input_duty);
+    json_write_uint(w, nullptr, tick.output_duty);
+    json_write_uint(w, nullptr, tick.fan_duty);
+    json_write_uint(w, nullptr, tick.tc_status);
+    json_write_float(w, nullptr, tick.tc_temp == INT16_MIN ? NAN : tick.tc_temp / 10.0, 1);
+    json_write_float(w, nullptr, tick.junction_temp == INT16_MIN ? NAN : tick.junction_temp / 10.0, 1);
+  } else {
+    json_write_uint(w, nullptr, record.event.value);
+    json_write_int(w, nullptr, (int32_t) record.event.arg);
+  }
+  json_end_array(w);
+}
+
+/* Where the previous boot crashed, from the core dump it left in flash, null when it did not */
+static void _write_coredump(json_writer_t *w) {
+#if CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH && CONFIG_ESP_COREDUMP_DATA_FORMAT_ELF
+  size_t addr, size;
+  esp_core_dump_summary_t summary;
+  // Only a crash leaves a fresh one, any other is from an earlier boot and was reported then
+  if (s_crashed && esp_core_dump_image_get(&addr, &size) == ESP_OK &&
+      esp_core_dump_get_summary(&summary) == ESP_OK) {
+    char task[sizeof(summary.exc_task) + 1] = {};
+    char elf_sha256[sizeof(summary.app_elf_sha256) + 1] = {};
+    memcpy(task, summary.exc_task, sizeof(summary.exc_task));
+    memcpy(elf_sha256, summary.app_elf_sha256, sizeof(summary.app_elf_sha256));
+    uint32_t depth = std::min<uint32_t>(summary.exc_bt_info.depth,
+                                        sizeof(summary.exc_bt_info.bt) / sizeof(summary.exc_bt_info.bt[0]));
+
+    json_begin_object(w, "coredump");
+    json_write_uint(w, "size", size);
+    json_write_str(w, "task", task);
+    json_write_uint(w, "pc", summary.exc_pc);
+    json_write_uint(w, "cause", summary.ex_info.exc_cause);
+    json_write_uint(w, "vaddr", summary.ex_info.exc_vaddr);
+    json_begin_array(w, "backtrace");
+    for (uint32_t i = 0; i < depth; i++) {
+      json_write_uint(w, nullptr, summary.exc_bt_info.bt[i]);
+    }
+    json_end_array(w);
+    json_write_bool(w, "backtrace_corrupted", summary.exc_bt_info.corrupted);
+    json_write_str(w, "elf_sha256", elf_sha256);
+    json_end_object(w);
+    return;
+  }
+#endif
+  json_write_null(w, "coredump");
+}
+
+bool app_metrics_postmortem_pending() {
+  return s_postmortem_pending;
+}
+
+void app_metrics_postmortem_send(char *buffer, size_t max_len) {
+  const flight_recorder_previous_t &previous = flight_recorder_previous();
+
+  json_writer_t w;
+  json_writer_init(&w, buffer, max_len);
+  json_begin_object(&w, nullptr);
+  json_begin_object(&w, "postmortem");
+  json_write_uint(&w, "timestamp", (uint32_t) time(nullptr));
+  json_write_uint(&w, "boot_count", s_device_metrics.boot_count);
+  json_write_uint(&w, "reset_reason", s_reset_reason);
+  json_write_bool(&w, "crashed", s_crashed);
+  json_begin_object(&w, "recorder");
+  json_write_bool(&w, "valid", previous.valid);
+  json_write_uint(&w, "records", previous.count);
+  json_write_uint(&w, "corrupt", previous.corrupt);
+  json_end_object(&w);
+  json_begin_array(&w, "records");
+  for (int i = 0; i < previous.count; i++) {
+    _write_flight_record(&w, previous.records[i]);
+  }
+  json_end_array(&w);
+  _write_coredump(&w);
+  json_end_object(&w);
+  json_end_object(&w);
+  size_t len = json_writer_finish(&w);
+
+  // Once only, a document that does not fit would not the next time either
+  s_postmortem_pending = false;
+  if (len == 0) {
+    ESP_LOGE(TAG, "Post-mortem does not fit in %d bytes", max_len);
+    return;
+  }
+  ESP_LOGI(TAG, "%.*s\n", len, buffer);
+
+  MQTTPublishInfo_t publishInfo = {
+      .qos = MQTTQoS_t::MQTTQoS1,
+      .retain = false,
+      .dup = false,
+      .pTopicName = postmortem_topic,
+      .topicNameLength = (uint16_t) strlen(postmortem_topic),
+      .pPayload = buffer,
+      .payloadLength = len,
+  };
+  mqtt_client_publish(&publishInfo, CONFIG_MQTT_ACK_TIMEOUT_MS);
+  // The core dump summary is read on the telemetry task's stack, which is sized from this
+  ESP_LOGI(TAG, "Post-mortem sent, stack high water %u bytes free", uxTaskGetStackHighWaterMark(nullptr));
+}
+
+/* Copies one raw sample for the telemetry task, control task only */
+static void _push_sample(uint8_t stat, float value) {
+  uint32_t head = s_sample_head.load(std::memory_order_relaxed);
+  if (head - s_sample_tail.load(std::memory_order_acquire) >= SAMPLE_SLOTS) {
+    s_samples_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  s_samples[head % SAMPLE_SLOTS] = {.stat = stat, .value = value};
+  s_sample_head.store(head + 1, std::memory_order_release);
+}
+
+void app_metrics_record_tick(const control_state_t &state, float loop_latency_us, float wake_latency_us,
+                             float duty_error) {
+  _push_sample(STAT_LOOP_LATENCY, loop_latency_us);
+  _push_sample(STAT_WAKE_LATENCY, wake_latency_us);
+  // Temperatures hold their last good value on a fault, only sample fresh readings
+  if (state.tc_status == 0) {
+    _push_sample(STAT_TC_TEMP, state.tc_temp);
+    _push_sample(STAT_JUNCTION_TEMP, state.junction_temp);
+  }
+  _push_sample(STAT_BALANCE, (float) state.balance);
+  _push_sample(STAT_DUTY_ERROR, duty_error);
+}
+
+void app_metrics_record_command(float latency_us) {
+  _push_sample(STAT_COMMAND_LATENCY, latency_us);
+}
+
+void app_metrics_take_samples() {
+  uint32_t tail = s_sample_tail.load(std::memory_order_relaxed);
+  uint32_t head = s_sample_head.load(std::memory_order_acquire);
+  for (; tail != head; tail++) {
+    const stat_sample_t &sample = s_samples[tail % SAMPLE_SLOTS];
+    stream_stats_add(&s_stats[sample.stat], sample.value);
+  }
+  s_sample_tail.store(tail, std::memory_order_release);
+
+  // Sampled here rather than each tick, the WiFi driver's lock is not taken from the control task
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+    stream_stats_add(&s_stats[STAT_RSSI], ap_info.rssi);
+  }
+}
+
+void app_metrics_record_element(metrics_element_t element, const ssr_ctrl_counters_t &delta, float on_s,
+                                uint16_t watts) {
+  double energy_wh = (double) on_s * watts / 3600;
+  if (delta.on_half_cycles) {
+    s_last_on_us = esp_timer_get_time();
+  }
+  s_unsaved_on_s += on_s;
+
+  portENTER_CRITICAL(&s_stats_lock);
+  ssr_ctrl_counters_t &c = s_interval[element].counters;
+  c.half_cycles += delta.half_cycles;
+  c.on_half_cycles += delta.on_half_cycles;
+  c.commanded += delta.commanded;
+  c.switch_count += delta.switch_count;
+  c.late += delta.late;
+  c.missed += delta.missed;
+  c.max_late_us = delta.max_late_us;
+  s_interval[element].energy_wh += energy_wh;
+  s_lifetime[element].on_s += on_s;
+  s_lifetime[element].energy_wh += energy_wh;
+  s_lifetime[element].switch_count += delta.switch_count;
+  portEXIT_CRITICAL(&s_stats_lock);
+}
+
+bool app_metrics_lifetime_save_required() {
+  if (s_unsaved_on_s <= 0) {
+    return false;
+  }
+  return s_unsaved_on_s >= LIFETIME_SAVE_ON_S ||
+         esp_timer_get_time() - s_last_on_us >= (int64_t) LIFETIME_IDLE_SAVE_S * 1000 * 1000;
+}
+
+static void _lifetime_saved(esp_err_t err) {
+  if (err != ESP_OK) {
+    return;
+  }
+  portENTER_CRITICAL(&s_stats_lock);
+  s_lifetime_saves++;
+  portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void app_metrics_lifetime_save() {
+  element_lifetime_t lifetime[METRICS_ELEMENT_COUNT];
+  portENTER_CRITICAL(&s_stats_lock);
+  memcpy(lifetime, s_lifetime, sizeof(lifetime));
+  portEXIT_CRITICAL(&s_stats_lock);
+
+  esp_err_t err = flash_ops_write_blob(NVS_STATS_NAMESPACE, NVS_LIFETIME_KEY, lifetime, sizeof(lifetime),
+                                       _lifetime_saved);
+  // Either way the figures stay in RAM, a failed save is caught up by the next one rather than retried every tick
+  s_unsaved_on_s = 0;
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to queue element lifetime: %s", esp_err_to_name(err));
+    return;
+  }
+  ESP_LOGI(TAG, "Element lifetime queued, main %.2fh %" PRIu64 " switches, secondary %.2fh %" PRIu64 " switches",
+           lifetime[0].on_s / 3600, lifetime[0].switch_count, lifetime[1].on_s / 3600, lifetime[1].switch_count);
+}
+
 bool app_metrics_update_required(int interval_sec) {
   return (time(nullptr) - _last_report_time) > (interval_sec);
 }
 
 static void _event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+  if (event_id == CORE_MQTT_CONNECTED_EVENT || event_id == CORE_MQTT_DISCONNECTED_EVENT ||
+      event_id == CORE_MQTT_OTA_STARTED_EVENT || event_id == CORE_MQTT_OTA_STOPPED_EVENT) {
+    flight_recorder_event(FLIGHT_RECORD_NETWORK, event_id);
+  }
   if (event_id == CORE_MQTT_CONNECTED_EVENT && !mqtt_provisioning_active()) {
     // Refresh metrics on new connection
     _last_report_time = 0;
@@ -139,11 +584,20 @@ static void _event_handler(void *arg, esp_event_base_t event_base, int32_t event
 
 void app_metrics_init() {
   _record_metrics();
+  _load_lifetime();
+  // Nothing survives a power on, otherwise what the recorder kept or at least the crash
+  s_postmortem_pending = s_reset_reason != ESP_RST_POWERON && (flight_recorder_previous().count > 0 || s_crashed);
+  for (auto &stats: s_stats) {
+    stream_stats_reset(&stats);
+  }
+  ESP_LOGI(TAG, " >>>>>>>>>>>>>>>>>> Boot count: %" PRIu32 "\n", s_device_metrics.boot_count);
+}
 
+void app_metrics_start() {
   // Regular telemetry
   sprintf(metrics_topic, "%s/%s/telemetry/metrics", CMAKE_THING_TYPE, identity_thing_id());
+  // What the previous boot was doing when it reset, see flight_recorder.h
+  sprintf(postmortem_topic, "%s/%s/telemetry/postmortem", CMAKE_THING_TYPE, identity_thing_id());
   // Register connect events so we can send shadow on connect
   ESP_ERROR_CHECK(esp_event_handler_register(CORE_MQTT_EVENT, ESP_EVENT_ANY_ID, &_event_handler, nullptr));
-
-  ESP_LOGI(TAG, " >>>>>>>>>>>>>>>>>> Boot count: %" PRIu32 "\n", s_device_metrics.boot_count);
 }
\ No newline at end of file
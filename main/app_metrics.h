@@ -1,11 +1,82 @@
 #pragma once
 
 #include <cstdint>
+#include "control_loop.h"
+#include "ssr_ctrl.h"
+
+enum metrics_element_t : uint8_t {
+  METRICS_ELEMENT_MAIN = 0,
+  METRICS_ELEMENT_SECONDARY = 1,
+  METRICS_ELEMENT_COUNT = 2,
+};
 
 
 void app_metrics_send(char* buffer, size_t max_len);
 
 bool app_metrics_update_required(int interval_sec);
 
+/**
+ * True until the post-mortem of the previous boot was sent, when it ended in anything but a power on.
+ */
+bool app_metrics_postmortem_pending();
+
+/**
+ * Sends the post-mortem of the previous boot, once: its reset reason, the flight recorder's last records and the
+ * summary of the core dump a crash left. Telemetry task only.
+ */
+void app_metrics_postmortem_send(char *buffer, size_t max_len);
+
+/**
+ * Copies one control tick's raw values for the statistics reported, then reset, with each metrics document.
+ * Control task only, app_metrics_take_samples() feeds them into the statistics.
+ * @param state Controller state at the end of the tick
+ * @param loop_latency_us Time from the timer alarm to the outputs being set
+ * @param wake_latency_us Time from the tick being due to the timer alarm, waking from light sleep included
+ * @param duty_error Requested minus applied secondary duty, NaN when the element was not running
+ */
+void app_metrics_record_tick(const control_state_t &state, float loop_latency_us, float wake_latency_us,
+                             float duty_error);
+
+/**
+ * Copies the time from a command being received to the SSR duties it set, see control_loop_command().
+ * Control task only.
+ */
+void app_metrics_record_command(float latency_us);
+
+/**
+ * Feeds the samples the control task recorded into the statistics, and samples the WiFi RSSI. Telemetry task
+ * only, once each of its loops, samples that do not fit meanwhile are dropped and counted.
+ */
+void app_metrics_take_samples();
+
+/**
+ * Feeds what an element's SSR delivered over one control tick: into the interval's energy, commanded and delivered
+ * duty and switching, and into the element's lifetime on time, energy and switching cycles. Control task only.
+ * @param delta SSR counters since the previous tick, see ssr_ctrl_get_counters()
+ * @param on_s Seconds the SSR conducted over them
+ * @param watts Element power the energy is counted at
+ */
+void app_metrics_record_element(metrics_element_t element, const ssr_ctrl_counters_t &delta, float on_s,
+                                uint16_t watts);
+
+/**
+ * True when the lifetime figures are due to be written to NVS: once the elements have stayed off for a minute
+ * after heating, so after every roast, or after every 6 minutes of element on time during one. They only move by
+ * the hour, writing them more often would only wear the flash.
+ */
+bool app_metrics_lifetime_save_required();
+
+/**
+ * Writes the lifetime figures to NVS, a single blob for both elements. Control task only.
+ */
+void app_metrics_lifetime_save();
+
+/**
+ * Counts the boot and loads the lifetime figures, on the control task before its first tick.
+ */
 void app_metrics_init();
 
+/**
+ * Topics and MQTT events, once the network is up, see telemetry_init().
+ */
+void app_metrics_start();
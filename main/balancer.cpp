@@ -29,11 +29,10 @@ double balance_read_mv() {
   return level_voltage / num_readings;
 }
 
-double balance_read_percent() {
-  double balance = balance_read_mv();
+double balance_percent_from_mv(double mv) {
   static double max_value = 2400;
   static double min_value = 150;
-  balance = ((balance - min_value) / (max_value - min_value)) * 100;
+  double balance = ((mv - min_value) / (max_value - min_value)) * 100;
   if (balance < 0) {
     balance = 0;
   } else if (balance > 100) {
@@ -42,6 +41,10 @@ double balance_read_percent() {
   return balance;
 }
 
+double balance_read_percent() {
+  return balance_percent_from_mv(balance_read_mv());
+}
+
 static bool _adc_calibration_init(adc_unit_t unit, adc_atten_t atten, adc_cali_handle_t *out_handle) {
   adc_cali_handle_t handle = NULL;
   esp_err_t ret = ESP_FAIL;
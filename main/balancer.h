@@ -4,4 +4,9 @@ double balance_read_mv();
 
 double balance_read_percent();
 
+/**
+ * Converts a wiper voltage to the balance percentage, as balance_read_percent() does.
+ */
+double balance_percent_from_mv(double mv);
+
 void balancer_init();
@@ -0,0 +1,589 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <esp_log.h>
+#include "bench.h"
+#include "board.h"
+#include "control_loop.h"
+#include "balancer.h"
+#include "ssr_ctrl.h"
+#include "schema.h"
+#include "json_reader.h"
+#include "pid.h"
+#include "thermal_model.h"
+#include "profile.h"
+// The ESP-IDF json component, the host build has it when it finds one, see sim/CMakeLists.txt
+#if defined(ESP_PLATFORM) || defined(BENCH_CJSON)
+#define BENCH_HAS_CJSON 1
+#include <cJSON.h>
+#endif
+
+#define TAG "bench"
+
+// SSR2 output, the level shifter keeps it from the relay until control_loop_run() enables it
+#define BENCH_SSR_GPIO      BOARD.ssr2
+#define BENCH_WARMUP_CALLS  10
+#define BENCH_LINE_SIZE     256
+
+struct bench_case_t {
+  const char *name;
+  uint32_t calls;
+  void (*call)(uint32_t i);
+};
+
+struct bench_result_t {
+  const bench_case_t *bench;
+  bench_counters_t start;
+  bench_counters_t end;
+  uint32_t min;
+  uint32_t max;
+  size_t stack;
+  // Document length of the formatting cases, 0 for the others
+  size_t bytes;
+};
+
+// Results are folded in here so the calls cannot be optimised away
+static volatile uint32_t s_sink;
+
+static ssr_ctrl_handle_t s_ssr = nullptr;
+static control_cfg_t s_cfg;
+static control_state_t s_state;
+static schema_hash_t s_cfg_hash;
+static thermal_model_t s_model;
+static profile_t s_profile;
+static char s_doc[1024];
+// Fields of the status document as it was written with snprintf, and the length of the last document written
+static uint32_t s_status_mask;
+static size_t s_bytes;
+
+#define BENCH_READINGS  4
+static max31850_data_t s_readings[BENCH_READINGS];
+static control_inputs_t s_inputs[BENCH_READINGS];
+
+// A desired control section as the shadow service sends it
+static const char s_delta[] =
+    "{\"version\":1842,\"timestamp\":1700000000,\"state\":{\"control\":{\"max_heat_ratio\":0.65,"
+    "\"max_tc_temp\":260}},\"metadata\":{\"control\":{\"max_heat_ratio\":{\"timestamp\":1700000000},"
+    "\"max_tc_temp\":{\"timestamp\":1700000000}}}}";
+
+static void _nop(uint32_t) {}
+
+static void _ssr_half_cycle(uint32_t) {
+  ssr_ctrl_half_cycle(s_ssr);
+}
+
+static void _check_tc(uint32_t i) {
+  s_sink = s_sink + control_check_tc(s_readings[i % BENCH_READINGS], s_state);
+}
+
+static void _control_decide(uint32_t i) {
+  control_decide(s_inputs[i % BENCH_READINGS], s_cfg, s_state);
+}
+
+static void _pid_step(uint32_t i) {
+  static pid_ctrl_t pid = {};
+  static const pid_gains_t gains = pid_gains(13.2f, 0.1f, 434.0f);
+  s_sink = s_sink + pid_step(&pid, gains, 22000, 21950 + (int32_t) (i % 100), 40 * PID_ONE, 56 * PID_ONE);
+}
+
+static void _thermal_model_update(uint32_t i) {
+  thermal_model_update(&s_model, true, 220.0f + (float) (i % 8) * 0.25f, 80, (uint8_t) (i % 56), 30);
+  s_sink = s_sink + s_model.updates;
+}
+
+static void _profile_value(uint32_t i) {
+  s_sink = s_sink + (uint32_t) profile_value(s_profile, (float) (i % 1000));
+}
+
+static void _balance_read_percent(uint32_t) {
+  s_sink = s_sink + (uint32_t) balance_read_percent();
+}
+
+static void _control_tick(uint32_t) {
+  control_loop_tick();
+}
+
+static void _status_format(uint32_t i) {
+  s_bytes = control_state_format(s_doc, sizeof(s_doc), s_state, 1700000000 + i);
+  s_sink = s_sink + s_bytes;
+}
+
+/* The same fields as the snprintf template below, for bytes, cycles and stack against it */
+static void _status_schema(uint32_t i) {
+  json_writer_t w;
+  json_writer_init(&w, s_doc, sizeof(s_doc));
+  json_begin_object(&w, nullptr);
+  json_write_uint(&w, "timestamp", 1700000000 + i);
+  json_write_fields(&w, control_state_schema, &s_state, s_status_mask);
+  json_end_object(&w);
+  s_bytes = json_writer_finish(&w);
+  s_sink = s_sink + s_bytes;
+}
+
+/* The status document as telemetry wrote it before the schema, template and all */
+static void _status_snprintf(uint32_t i) {
+  static const char *format = R"({
+    "timestamp": %)" PRIu32 R"(,
+    "loop_count": %)" PRIu32 R"(,
+    "tc_temp": %f,
+    "junction_temp": %f,
+    "tc_status": %)" PRIu8 R"(,
+    "tc_error_count": %)" PRIu32 R"(,
+    "motor_on": %)" PRIu8 R"(,
+    "fan_duty": %)" PRIu8 R"(,
+    "balance": %f,
+    "input_duty": %)" PRIu8 R"(,
+    "output_duty": %)" PRIu8 R"(
+  })";
+  int len = snprintf(s_doc, sizeof(s_doc), format, 1700000000 + i, s_state.loop_count, s_state.tc_temp,
+                     s_state.junction_temp, s_state.tc_status, s_state.tc_error_count, s_state.motor_on,
+                     s_state.fan_duty, s_state.balance, s_state.input_duty, s_state.output_duty);
+  s_bytes = len > 0 ? len : 0;
+  s_sink = s_sink + s_bytes;
+}
+
+/* The parsing half of the shadow delta handler, applying the result would write the configuration to NVS */
+static void _shadow_delta_parse(uint32_t) {
+  json_reader_t reader;
+  json_token_t key, value;
+  control_cfg_t cfg = s_cfg;
+  uint32_t touched = 0;
+
+  if (!json_validate(s_delta, sizeof(s_delta) - 1)) {
+    return;
+  }
+  json_reader_init(&reader, s_delta, sizeof(s_delta) - 1);
+  json_next(&reader, &value);
+  while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+    json_next(&reader, &value);
+    if (value.type != JSON_TOKEN_OBJECT_START || !json_token_is(&key, "state")) {
+      json_skip(&reader, &value);
+      continue;
+    }
+    while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+      json_next(&reader, &value);
+      if (value.type == JSON_TOKEN_OBJECT_START && json_token_is(&key, "control")) {
+        schema_json_read(control_cfg_schema, s_cfg_hash, &reader, &cfg, &touched);
+      } else {
+        json_skip(&reader, &value);
+      }
+    }
+  }
+  s_sink = s_sink + touched;
+}
+
+#ifdef BENCH_HAS_CJSON
+/* The same delta through cJSON, as the shadow handler parsed it before json_reader */
+static void _delta_cjson(uint32_t) {
+  control_cfg_t cfg = s_cfg;
+  uint32_t touched = 0;
+  cJSON *item, *field;
+  cJSON *root = cJSON_ParseWithLength(s_delta, sizeof(s_delta) - 1);
+  cJSON *state = cJSON_GetObjectItem(root, "state");
+  cJSON_ArrayForEach(item, state) {
+    if (strcmp(item->string, "control") != 0) {
+      continue;
+    }
+    if ((field = cJSON_GetObjectItem(item, "max_heat_ratio"))) {
+      cfg.max_heat_ratio = (float) field->valuedouble;
+      touched++;
+    }
+    if ((field = cJSON_GetObjectItem(item, "max_tc_temp"))) {
+      cfg.max_tc_temp = field->valueint;
+      touched++;
+    }
+    if ((field = cJSON_GetObjectItem(item, "max_board_temp"))) {
+      cfg.max_board_temp = field->valueint;
+      touched++;
+    }
+    if ((field = cJSON_GetObjectItem(item, "mains_hz"))) {
+      cfg.mains_hz = field->valueint;
+      touched++;
+    }
+  }
+  cJSON_Delete(root);
+  s_sink = s_sink + touched + cfg.max_tc_temp;
+}
+#endif
+
+/*
+ * The empty case comes first, its stack use is the baseline taken off the others. The control tick reads the
+ * thermocouple over 1-Wire on the device, hence so few calls.
+ */
+static const bench_case_t s_cases[] = {
+    {"empty", 10000, _nop},
+    {"ssr_half_cycle", 10000, _ssr_half_cycle},
+    {"check_tc", 10000, _check_tc},
+    {"control_decide", 10000, _control_decide},
+    {"pid_step", 10000, _pid_step},
+    {"thermal_model_update", 10000, _thermal_model_update},
+    {"profile_value", 10000, _profile_value},
+    {"balance_read_percent", 1000, _balance_read_percent},
+    {"status_format", 1000, _status_format},
+    {"status_schema", 1000, _status_schema},
+    {"status_snprintf", 1000, _status_snprintf},
+    {"shadow_delta_parse", 1000, _shadow_delta_parse},
+#ifdef BENCH_HAS_CJSON
+    {"delta_cjson", 1000, _delta_cjson},
+#endif
+    {"control_tick", 20, _control_tick},
+};
+
+static max31850_data_t _reading(float tc_temp, float junction_temp) {
+  max31850_data_t reading = {};
+  reading.is_valid = true;
+  reading.thermocouple_status = MAX31850_TC_STATUS_OK;
+  reading.tc_temp = tc_temp;
+  reading.junction_temp = junction_temp;
+  return reading;
+}
+
+/* Healthy readings through a roast, faults would be dominated by their error logs */
+static void _setup() {
+  s_cfg = controller_get_cfg();
+  s_state = controller_get_state();
+  ESP_ERROR_CHECK(schema_hash_build(control_cfg_schema, &s_cfg_hash));
+  static const char *status_fields[] = {"loop_count", "tc_temp", "junction_temp", "tc_status", "tc_error_count",
+                                        "motor_on", "fan_duty", "balance", "input_duty", "output_duty"};
+  s_status_mask = 0;
+  for (int i = 0; i < control_state_schema.count; i++) {
+    for (const char *name: status_fields) {
+      s_status_mask |= strcmp(control_state_schema.fields[i].name, name) == 0 ? 1UL << i : 0;
+    }
+  }
+
+  s_readings[0] = _reading(24.75f, 31.0625f);
+  s_readings[1] = _reading(168.5f, 42.25f);
+  s_readings[2] = _reading(203.25f, 47.5f);
+  s_readings[3] = _reading(s_cfg.max_tc_temp + 2.0f, 52.125f);
+  for (int i = 0; i < BENCH_READINGS; i++) {
+    s_inputs[i] = {.heat_ok = true, .heat_duty = (uint8_t) (25 * i), .fan_ok = true, .fan_duty = 30,
+                   .balance_mv = (uint16_t) (800 + 400 * i), .motor_on = i > 0, .tc = s_readings[i]};
+  }
+
+  // Past the longest candidate delay, so every estimator of the bank is updated as for the rest of a roast
+  thermal_model_reset(&s_model);
+  for (int i = 0; i < THERMAL_MODEL_HISTORY; i++) {
+    thermal_model_update(&s_model, true, 220.0f, 80, 40, 30);
+  }
+
+  // A full profile over a long roast, every lookup takes the most steps of the binary search
+  s_profile = {.index = PROFILE_INDEX_TIME, .target = PROFILE_TARGET_SETPOINT, .count = PROFILE_MAX_POINTS};
+  for (int i = 0; i < PROFILE_MAX_POINTS; i++) {
+    s_profile.points[i] = {(uint16_t) (i * 30), (uint16_t) (150 + i * 2)};
+  }
+
+  ESP_ERROR_CHECK(ssr_ctrl_new({.gpio = BENCH_SSR_GPIO, .mains_hz = (main_hertz_t) s_cfg.mains_hz}, &s_ssr));
+  ssr_ctrl_set_duty(s_ssr, 37);
+}
+
+static void _teardown() {
+  ssr_ctrl_force_off(s_ssr);
+  ssr_ctrl_half_cycle(s_ssr);
+  ssr_ctrl_del(s_ssr);
+  s_ssr = nullptr;
+}
+
+static void _run_case(void *arg) {
+  auto result = (bench_result_t *) arg;
+  const bench_case_t &bench = *result->bench;
+  s_bytes = 0;
+
+  for (uint32_t i = 0; i < BENCH_WARMUP_CALLS; i++) {
+    bench.call(i);
+  }
+
+  bench_counters_read(&result->start);
+  for (uint32_t i = 0; i < bench.calls; i++) {
+    bench.call(i);
+  }
+  bench_counters_read(&result->end);
+
+  // Single calls are timed in a second pass, so the stamps do not weigh on the averages
+  result->min = UINT32_MAX;
+  result->max = 0;
+  for (uint32_t i = 0; i < bench.calls; i++) {
+    uint32_t start = bench_stamp();
+    bench.call(i);
+    uint32_t elapsed = bench_stamp() - start;
+    result->min = elapsed < result->min ? elapsed : result->min;
+    result->max = elapsed > result->max ? elapsed : result->max;
+  }
+  result->bytes = s_bytes;
+}
+
+static void _print(const bench_result_t &result, size_t stack_baseline) {
+  char line[BENCH_LINE_SIZE];
+  double calls = result.bench->calls;
+  json_writer_t w;
+  json_writer_init(&w, line, sizeof(line));
+  json_begin_object(&w, nullptr);
+  json_write_str(&w, "bench", result.bench->name);
+  json_write_str(&w, "platform", bench_platform);
+  json_write_uint(&w, "calls", result.bench->calls);
+  if (result.end.cycles) {
+    json_write_float(&w, "cycles", (result.end.cycles - result.start.cycles) / calls, 1);
+  }
+  if (result.end.instructions) {
+    json_write_float(&w, "instructions", (result.end.instructions - result.start.instructions) / calls, 1);
+  }
+  json_write_float(&w, "ns", (result.end.ns - result.start.ns) / calls, 1);
+  json_write_uint(&w, "min", result.min);
+  json_write_uint(&w, "max", result.max);
+  json_write_str(&w, "unit", bench_stamp_unit);
+  json_write_uint(&w, "stack", result.stack > stack_baseline ? result.stack - stack_baseline : 0);
+  if (result.bytes) {
+    json_write_uint(&w, "bytes", result.bytes);
+  }
+  json_end_object(&w);
+  if (json_writer_finish(&w)) {
+    printf("%s\n", line);
+  }
+}
+
+void bench_run(const char *filter) {
+  _setup();
+  // Pays for one-time setup of the platform, which would otherwise land on the baseline
+  bench_result_t discarded = {.bench = s_cases};
+  bench_on_fresh_stack(_run_case, &discarded);
+
+  size_t stack_baseline = 0;
+  for (const auto &bench: s_cases) {
+    bool baseline = &bench == s_cases;
+    if (!baseline && filter && !strstr(bench.name, filter)) {
+      continue;
+    }
+    bench_result_t result = {.bench = &bench};
+    result.stack = bench_on_fresh_stack(_run_case, &result);
+    if (baseline) {
+      stack_baseline = result.stack;
+    }
+    _print(result, stack_baseline);
+  }
+  _teardown();
+}
+
+#ifdef ESP_PLATFORM
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <lwip/sockets.h>
+#include <mbedtls/sha256.h>
+#include <cerrno>
+#include <cstdlib>
+#include "task_plan.h"
+
+#define JITTER_PERIOD_US    1000
+#define JITTER_SAMPLES      10000
+// 1us buckets, the last one takes anything later
+#define JITTER_BUCKETS      1000
+#define LOAD_PORT           3999
+#define LOAD_PAYLOAD_SIZE   1024
+
+struct bench_task_t {
+  void (*fn)(void *);
+  void *arg;
+  TaskHandle_t parent;
+  size_t free;
+};
+
+const char *const bench_platform = CONFIG_IDF_TARGET;
+const char *const bench_stamp_unit = "cycles";
+
+void bench_counters_read(bench_counters_t *counters) {
+  // Extends the 32 bit cycle count, which wraps every 17s at 240MHz, no batch runs anywhere near as long
+  static uint32_t last = 0;
+  static uint64_t high = 0;
+  uint32_t now = esp_cpu_get_cycle_count();
+  if (now < last) {
+    high += 1ULL << 32;
+  }
+  last = now;
+  *counters = {.cycles = high | now, .instructions = 0, .ns = (uint64_t) esp_timer_get_time() * 1000};
+}
+
+uint32_t bench_stamp() {
+  return esp_cpu_get_cycle_count();
+}
+
+static void _bench_task(void *arg) {
+  auto task = (bench_task_t *) arg;
+  task->fn(task->arg);
+  task->free = uxTaskGetStackHighWaterMark(nullptr);
+  xTaskNotifyGive(task->parent);
+  vTaskDelete(nullptr);
+}
+
+size_t bench_on_fresh_stack(void (*fn)(void *), void *arg) {
+  bench_task_t task = {.fn = fn, .arg = arg, .parent = xTaskGetCurrentTaskHandle(), .free = 0};
+  if (task_plan_create(TASK_BENCH, _bench_task, &task) != ESP_OK) {
+    return 0;
+  }
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  return task_plan(TASK_BENCH).stack_size - task.free;
+}
+
+/* ---- Control jitter under network load ---- */
+
+struct jitter_run_t {
+  const char *name;
+  bool isolated;
+  TaskHandle_t parent;
+  SemaphoreHandle_t alarm;
+  int64_t due_us;
+  uint32_t histogram[JITTER_BUCKETS];
+  uint64_t sum_us;
+  uint32_t min_us;
+  uint32_t max_us;
+  volatile bool load;
+  volatile uint32_t sent;
+};
+
+static jitter_run_t s_jitter;
+
+static IRAM_ATTR void _on_jitter_alarm(void *) {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(s_jitter.alarm, &woken);
+  if (woken) {
+    esp_timer_isr_dispatch_need_yield();
+  }
+}
+
+/* Wakes on each alarm as the control task does on its tick, and takes how late it is against when it was due */
+static void _jitter_probe(void *) {
+  for (uint32_t i = 0; i < JITTER_SAMPLES; i++) {
+    xSemaphoreTake(s_jitter.alarm, portMAX_DELAY);
+    s_jitter.due_us += JITTER_PERIOD_US;
+    auto late = (uint32_t) std::max((int64_t) 0, esp_timer_get_time() - s_jitter.due_us);
+    s_jitter.histogram[std::min(late, (uint32_t) JITTER_BUCKETS - 1)]++;
+    s_jitter.sum_us += late;
+    s_jitter.min_us = std::min(s_jitter.min_us, late);
+    s_jitter.max_us = std::max(s_jitter.max_us, late);
+  }
+  xTaskNotifyGive(s_jitter.parent);
+  vTaskDelete(nullptr);
+}
+
+/* Sends datagrams to the receiver over loopback, hashing each as TLS would */
+static void _load_sender(void *) {
+  static uint8_t payload[LOAD_PAYLOAD_SIZE];
+  uint8_t digest[32];
+  sockaddr_in to = {.sin_len = sizeof(to), .sin_family = AF_INET, .sin_port = htons(LOAD_PORT),
+                    .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}};
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  while (sock >= 0 && s_jitter.load) {
+    payload[0] = (uint8_t) s_jitter.sent;
+    mbedtls_sha256(payload, sizeof(payload), digest, 0);
+    memcpy(payload + 1, digest, sizeof(digest));
+    if (sendto(sock, payload, sizeof(payload), 0, (sockaddr *) &to, sizeof(to)) > 0) {
+      s_jitter.sent = s_jitter.sent + 1;
+    } else {
+      // Out of buffers, let the receiver catch up
+      vTaskDelay(1);
+    }
+  }
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Unable to create the load socket: %d", errno);
+  } else {
+    close(sock);
+  }
+  xTaskNotifyGive(s_jitter.parent);
+  vTaskDelete(nullptr);
+}
+
+static void _load_receiver(void *) {
+  static uint8_t payload[LOAD_PAYLOAD_SIZE];
+  sockaddr_in addr = {.sin_len = sizeof(addr), .sin_family = AF_INET, .sin_port = htons(LOAD_PORT),
+                      .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)}};
+  timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock >= 0) {
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    bind(sock, (sockaddr *) &addr, sizeof(addr));
+  }
+  while (sock >= 0 && s_jitter.load) {
+    recv(sock, payload, sizeof(payload), 0);
+  }
+  if (sock >= 0) {
+    close(sock);
+  }
+  xTaskNotifyGive(s_jitter.parent);
+  vTaskDelete(nullptr);
+}
+
+static void _jitter_create(task_id_t task, TaskFunction_t fn) {
+  const task_plan_t &plan = task_plan(task);
+  BaseType_t core = s_jitter.isolated ? plan.core : tskNO_AFFINITY;
+  if (xTaskCreatePinnedToCore(fn, plan.name, plan.stack_size, nullptr, plan.priority, nullptr, core) != pdPASS) {
+    ESP_LOGE(TAG, "Unable to create task %s", plan.name);
+    abort();
+  }
+}
+
+static void _jitter_print() {
+  uint32_t p99 = 0, count = 0;
+  while (p99 < JITTER_BUCKETS - 1 && (count += s_jitter.histogram[p99]) < JITTER_SAMPLES * 99 / 100) {
+    p99++;
+  }
+
+  char line[BENCH_LINE_SIZE];
+  json_writer_t w;
+  json_writer_init(&w, line, sizeof(line));
+  json_begin_object(&w, nullptr);
+  json_write_str(&w, "bench", s_jitter.name);
+  json_write_str(&w, "platform", bench_platform);
+  json_write_uint(&w, "calls", JITTER_SAMPLES);
+  json_write_float(&w, "ns", 1000.0 * (double) s_jitter.sum_us / JITTER_SAMPLES, 1);
+  json_write_uint(&w, "min", s_jitter.min_us);
+  json_write_uint(&w, "max", s_jitter.max_us);
+  json_write_str(&w, "unit", "us");
+  json_write_uint(&w, "p99", p99);
+  json_write_uint(&w, "load", s_jitter.sent);
+  json_end_object(&w);
+  if (json_writer_finish(&w)) {
+    printf("%s\n", line);
+  }
+}
+
+static void _jitter_run(const char *name, bool isolated) {
+  s_jitter = {.name = name, .isolated = isolated, .parent = xTaskGetCurrentTaskHandle(),
+              .alarm = xSemaphoreCreateBinary(), .min_us = UINT32_MAX, .load = true};
+  _jitter_create(TASK_NET_LOAD, _load_receiver);
+  _jitter_create(TASK_NET_LOAD, _load_sender);
+  _jitter_create(TASK_CONTROL, _jitter_probe);
+
+  esp_timer_handle_t timer;
+  esp_timer_create_args_t timer_args = {
+      .callback = _on_jitter_alarm,
+      .arg = nullptr,
+      .dispatch_method = ESP_TIMER_ISR,
+      .name = "jitter",
+      .skip_unhandled_events = false,
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+  s_jitter.due_us = esp_timer_get_time();
+  ESP_ERROR_CHECK(esp_timer_start_periodic(timer, JITTER_PERIOD_US));
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  esp_timer_stop(timer);
+  esp_timer_delete(timer);
+
+  s_jitter.load = false;
+  // One notification each from the sender and the receiver, they may both be in before the first is taken
+  for (int i = 0; i < 2; i++) {
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+  }
+  vSemaphoreDelete(s_jitter.alarm);
+  _jitter_print();
+}
+
+void bench_jitter() {
+  _jitter_run("jitter_isolated", true);
+  _jitter_run("jitter_shared", false);
+}
+
+#endif
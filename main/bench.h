@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Microbenchmarks of the hot paths: the SSR half-cycle alarm, a full control tick, the decision and its
+ * thermocouple check, the setpoint mode PID step, the thermal model update, the profile lookup, the balance read,
+ * status formatting and shadow delta parsing.
+ *
+ * A firmware built with -DBENCHMARK=1 runs them at boot instead of the control loop, and sim/roaster_bench runs
+ * the same cases on the host. Every case prints one JSON line so runs of two builds can be diffed:
+ *
+ *   {"bench":"control_decide","platform":"esp32s3","calls":10000,"cycles":812.4,"ns":3385.0,
+ *    "min":790,"max":1405,"unit":"cycles","stack":208}
+ *
+ * cycles, instructions and ns are per call averages, whichever the platform can count. min and max are single
+ * calls timed in `unit`, cycles on the device and ns on the host. stack is the deepest stack use of the case
+ * above that of an empty one, in bytes.
+ */
+
+/**
+ * Counters read before and after a batch of calls, zero where the platform does not provide them.
+ */
+struct bench_counters_t {
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t ns;
+};
+
+/* ---- Provided by the platform, below for the device and in sim/bench.cpp for the host ---- */
+
+extern const char *const bench_platform;
+
+/**
+ * Unit of bench_stamp(), "cycles" or "ns".
+ */
+extern const char *const bench_stamp_unit;
+
+void bench_counters_read(bench_counters_t *counters);
+
+/**
+ * Cheap timestamp for timing single calls, only differences are meaningful.
+ */
+uint32_t bench_stamp();
+
+/**
+ * Runs `fn` on a freshly allocated stack.
+ * @return Bytes of that stack `fn` used.
+ */
+size_t bench_on_fresh_stack(void (*fn)(void *), void *arg);
+
+/**
+ * Runs the cases whose name contains `filter`, all of them when nullptr, printing a line for each.
+ * control_loop_init() must have run, control_loop_run() must not be running.
+ */
+void bench_run(const char *filter);
+
+/**
+ * Device only. Times a 1ms esp_timer waking a task at the control task's priority, as the control tick does, under a
+ * synthetic network load of UDP over loopback and SHA-256 of the payloads, at the priority of the MQTT agent. Runs
+ * once as task_plan.h pins them, control and network apart, then with both free to run on either core:
+ *
+ *   {"bench":"jitter_isolated","platform":"esp32s3","calls":10000,"ns":14250.0,"min":11,"max":38,"unit":"us",
+ *    "p99":21,"load":18342}
+ *
+ * ns is the mean wake latency, min, max and p99 single ones, load the datagrams sent during the run.
+ */
+void bench_jitter();
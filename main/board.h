@@ -0,0 +1,54 @@
+#pragma once
+
+#include <hal/gpio_types.h>
+#include <cstdint>
+
+/**
+ * Pins of the controller board, one descriptor per hardware revision picked at compile time by
+ * CMAKE_HARDWARE_REVISION_MAJOR, so a board respin is a new descriptor rather than defines spread over modules.
+ * Outputs written from interrupts, the SSRs and the level shifter enable, are checked to be in the first GPIO bank,
+ * which is all the direct register writes of the SSR alarm and level_shifter_enable() handle.
+ */
+struct board_t {
+  // Panel signals from the roaster's own controller, and the thermocouple amplifier bus
+  gpio_num_t heat_signal;
+  gpio_num_t drum_motor_signal;
+  gpio_num_t fan_signal;
+  gpio_num_t onewire;
+  gpio_num_t reset_button;
+
+  // SSRs of the main and secondary elements, driven through the level shifter while it is enabled
+  gpio_num_t ssr1;
+  gpio_num_t ssr2;
+  gpio_num_t level_shifter_en;
+};
+
+#if CMAKE_HARDWARE_REVISION_MAJOR == 1
+constexpr board_t BOARD = {
+    .heat_signal = GPIO_NUM_6,
+    .drum_motor_signal = GPIO_NUM_7,
+    .fan_signal = GPIO_NUM_9,
+    .onewire = GPIO_NUM_2,
+    .reset_button = GPIO_NUM_4,
+    .ssr1 = GPIO_NUM_10,
+    .ssr2 = GPIO_NUM_11,
+    .level_shifter_en = GPIO_NUM_5,
+};
+#else
+#error "No board descriptor for this CMAKE_HARDWARE_REVISION_MAJOR"
+#endif
+
+/**
+ * Bit of `pin` in the set and clear registers of its bank, GPIO.out_w1ts and out_w1tc for pins 0 to 31, a single
+ * store sets or clears it without touching the other pins.
+ */
+constexpr uint32_t board_gpio_mask(gpio_num_t pin) {
+  return 1u << (pin % 32);
+}
+
+constexpr uint32_t BOARD_LEVEL_SHIFTER_MASK = board_gpio_mask(BOARD.level_shifter_en);
+
+static_assert(BOARD.ssr1 < 32 && BOARD.ssr2 < 32 && BOARD.level_shifter_en < 32,
+              "Outputs written from interrupts must be in the first GPIO bank");
+static_assert(BOARD.ssr1 != BOARD.ssr2 && BOARD.ssr1 != BOARD.level_shifter_en &&
+              BOARD.ssr2 != BOARD.level_shifter_en, "SSR and level shifter pins must differ");
@@ -0,0 +1,101 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <cmath>
+#include "boot_profile.h"
+
+#define TAG "boot"
+
+static const schema_field_t s_metrics_fields[] = {
+    SCHEMA_FIELD_P(boot_metrics_t, safe_ms, "safe_ms", 1),
+    SCHEMA_FIELD_P(boot_metrics_t, control_ms, "control_ms", 1),
+    SCHEMA_FIELD_P(boot_metrics_t, network_ms, "network_ms", 1),
+    SCHEMA_FIELD_P(boot_metrics_t, first_tick_ms, "first_tick_ms", 1),
+    SCHEMA_FIELD(boot_metrics_t, first_tick_target_ms),
+};
+const schema_t boot_metrics_schema = SCHEMA_DEFINE(s_metrics_fields);
+
+static const char *s_stage_names[BOOT_STAGE_COUNT] = {
+    "safe",
+    "control",
+    "network",
+};
+
+// Stages run on both cores at once
+static int64_t s_begin_us[BOOT_STAGE_COUNT] = {};
+static int64_t s_end_us[BOOT_STAGE_COUNT] = {};
+static bool s_ended[BOOT_STAGE_COUNT] = {};
+static int64_t s_paused_us[BOOT_STAGE_COUNT] = {};
+static int64_t s_pause_us[BOOT_STAGE_COUNT] = {};
+static int64_t s_first_tick_us = 0;
+static bool s_ticked = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static float _ms(int64_t us) {
+  return (float) us / 1000;
+}
+
+void boot_profile_begin(boot_stage_t stage) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_begin_us[stage] = now;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void boot_profile_end(boot_stage_t stage) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_end_us[stage] = now;
+  s_ended[stage] = true;
+  int64_t begin_us = s_begin_us[stage];
+  int64_t paused_us = s_paused_us[stage];
+  portEXIT_CRITICAL(&s_lock);
+  ESP_LOGI(TAG, "Stage %s took %.1fms, from %.1fms to %.1fms paused %.1fms", s_stage_names[stage],
+           _ms(now - begin_us - paused_us), _ms(begin_us), _ms(now), _ms(paused_us));
+}
+
+void boot_profile_pause(boot_stage_t stage) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_pause_us[stage] = now;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void boot_profile_resume(boot_stage_t stage) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_paused_us[stage] += now - s_pause_us[stage];
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void boot_profile_first_tick() {
+  boot_profile_end(BOOT_STAGE_CONTROL);
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_first_tick_us = now;
+  s_ticked = true;
+  portEXIT_CRITICAL(&s_lock);
+  if (now > BOOT_FIRST_TICK_TARGET_MS * 1000LL) {
+    ESP_LOGW(TAG, "First control tick at %.1fms, past its %dms target", _ms(now), BOOT_FIRST_TICK_TARGET_MS);
+  } else {
+    ESP_LOGI(TAG, "First control tick at %.1fms", _ms(now));
+  }
+}
+
+boot_metrics_t boot_profile_get_metrics() {
+  float stage_ms[BOOT_STAGE_COUNT];
+  portENTER_CRITICAL(&s_lock);
+  for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+    stage_ms[i] = s_ended[i] ? _ms(s_end_us[i] - s_begin_us[i] - s_paused_us[i]) : NAN;
+  }
+  float first_tick_ms = s_ticked ? _ms(s_first_tick_us) : NAN;
+  portEXIT_CRITICAL(&s_lock);
+
+  return {
+      .safe_ms = stage_ms[BOOT_STAGE_SAFE],
+      .control_ms = stage_ms[BOOT_STAGE_CONTROL],
+      .network_ms = stage_ms[BOOT_STAGE_NETWORK],
+      .first_tick_ms = first_tick_ms,
+      .first_tick_target_ms = BOOT_FIRST_TICK_TARGET_MS,
+  };
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include "schema.h"
+
+/**
+ * Boot in stages, timed from esp_timer's start:
+ *
+ *   safe       SSR outputs driven low and the level shifter isolating them, first thing in app_main
+ *   control    SSRs, the thermocouple, inputs and the control loop, on the control task up to its first tick with
+ *              the panel's inputs read
+ *   network    WiFi, provisioning and MQTT on the network core while control comes up, then telemetry and the
+ *              shadows once it has, the time waiting for it left out
+ *
+ * Each stage is logged as it ends, and the time to the first control tick is reported in the metrics against
+ * BOOT_FIRST_TICK_TARGET_MS.
+ */
+
+// The heat signal's duty is known a whole 2.1s period after its reader starts, then the next tick takes it
+#define BOOT_FIRST_TICK_TARGET_MS   3500
+
+enum boot_stage_t : uint8_t {
+  BOOT_STAGE_SAFE = 0,
+  BOOT_STAGE_CONTROL = 1,
+  BOOT_STAGE_NETWORK = 2,
+  BOOT_STAGE_COUNT = 3,
+};
+
+struct boot_metrics_t {
+  // Time each stage took, less its pauses, NaN until it ended
+  float safe_ms;
+  float control_ms;
+  float network_ms;
+  // Since esp_timer's start, NaN until the first tick ran
+  float first_tick_ms;
+  uint32_t first_tick_target_ms;
+};
+
+extern const schema_t boot_metrics_schema;
+
+void boot_profile_begin(boot_stage_t stage);
+
+void boot_profile_end(boot_stage_t stage);
+
+/**
+ * Leaves the time up to boot_profile_resume() out of the stage, waiting on another stage.
+ */
+void boot_profile_pause(boot_stage_t stage);
+
+void boot_profile_resume(boot_stage_t stage);
+
+/**
+ * Control task, once its first tick with the panel's inputs read is done, which ends the control stage.
+ */
+void boot_profile_first_tick();
+
+boot_metrics_t boot_profile_get_metrics();
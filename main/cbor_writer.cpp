@@ -0,0 +1,110 @@
+#include <cstring>
+#include "cbor_writer.h"
+
+// Major types, in the top three bits of the initial byte
+#define CBOR_UINT     0x00
+#define CBOR_NEGINT   0x20
+#define CBOR_TEXT     0x60
+#define CBOR_ARRAY    0x80
+#define CBOR_MAP      0xa0
+#define CBOR_SIMPLE   0xe0
+
+#define CBOR_FALSE    (CBOR_SIMPLE | 20)
+#define CBOR_TRUE     (CBOR_SIMPLE | 21)
+#define CBOR_NULL     (CBOR_SIMPLE | 22)
+#define CBOR_FLOAT32  (CBOR_SIMPLE | 26)
+#define CBOR_FLOAT64  (CBOR_SIMPLE | 27)
+
+static void _append(cbor_writer_t *w, const void *data, size_t len) {
+  if (w->overflow || len > w->size - w->len) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+}
+
+/* Initial byte and `bytes` of big endian argument after it */
+static void _head_bytes(cbor_writer_t *w, uint8_t initial, uint64_t value, int bytes) {
+  uint8_t head[9];
+  head[0] = initial;
+  for (int i = 0; i < bytes; i++) {
+    head[bytes - i] = (uint8_t) (value >> (8 * i));
+  }
+  _append(w, head, 1 + bytes);
+}
+
+/* Head of an item of `major` type, the argument in the fewest bytes it fits */
+static void _head(cbor_writer_t *w, uint8_t major, uint64_t value) {
+  if (value < 24) {
+    _head_bytes(w, major | value, 0, 0);
+  } else if (value <= UINT8_MAX) {
+    _head_bytes(w, major | 24, value, 1);
+  } else if (value <= UINT16_MAX) {
+    _head_bytes(w, major | 25, value, 2);
+  } else if (value <= UINT32_MAX) {
+    _head_bytes(w, major | 26, value, 4);
+  } else {
+    _head_bytes(w, major | 27, value, 8);
+  }
+}
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size) {
+  *w = {.buf = buf, .size = size, .len = 0, .overflow = false};
+}
+
+size_t cbor_writer_finish(const cbor_writer_t *w) {
+  return w->overflow ? 0 : w->len;
+}
+
+void cbor_begin_map(cbor_writer_t *w, size_t count) {
+  _head(w, CBOR_MAP, count);
+}
+
+void cbor_begin_array(cbor_writer_t *w, size_t count) {
+  _head(w, CBOR_ARRAY, count);
+}
+
+void cbor_write_null(cbor_writer_t *w) {
+  _head_bytes(w, CBOR_NULL, 0, 0);
+}
+
+void cbor_write_bool(cbor_writer_t *w, bool value) {
+  _head_bytes(w, value ? CBOR_TRUE : CBOR_FALSE, 0, 0);
+}
+
+void cbor_write_uint(cbor_writer_t *w, uint64_t value) {
+  _head(w, CBOR_UINT, value);
+}
+
+void cbor_write_int(cbor_writer_t *w, int64_t value) {
+  if (value >= 0) {
+    _head(w, CBOR_UINT, value);
+  } else {
+    // -1 - n, without overflowing on INT64_MIN
+    _head(w, CBOR_NEGINT, ~(uint64_t) value);
+  }
+}
+
+void cbor_write_float(cbor_writer_t *w, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  _head_bytes(w, CBOR_FLOAT32, bits, sizeof(bits));
+}
+
+void cbor_write_double(cbor_writer_t *w, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  _head_bytes(w, CBOR_FLOAT64, bits, sizeof(bits));
+}
+
+void cbor_write_text(cbor_writer_t *w, const char *value, size_t len) {
+  _head(w, CBOR_TEXT, len);
+  if (len) {
+    _append(w, value, len);
+  }
+}
+
+void cbor_write_str(cbor_writer_t *w, const char *value) {
+  cbor_write_text(w, value, value ? strlen(value) : 0);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded CBOR (RFC 8949) encoder over a caller supplied buffer, nothing is allocated.
+ *
+ * Only what our documents need: definite length maps and arrays, integers, booleans, null, text strings and
+ * single and double precision floats. Map keys and values are written as consecutive items. Like json_writer_t,
+ * a write that would not fit marks the writer as overflowed and the final length is reported as zero.
+ */
+struct cbor_writer_t {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+  bool overflow;
+};
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size);
+
+/**
+ * @return Length of the document, or 0 if it did not fit in the buffer.
+ */
+size_t cbor_writer_finish(const cbor_writer_t *w);
+
+/**
+ * Opens a map of `count` pairs, its keys and values follow it.
+ */
+void cbor_begin_map(cbor_writer_t *w, size_t count);
+
+/**
+ * Opens an array of `count` items, which follow it.
+ */
+void cbor_begin_array(cbor_writer_t *w, size_t count);
+
+void cbor_write_null(cbor_writer_t *w);
+
+void cbor_write_bool(cbor_writer_t *w, bool value);
+
+void cbor_write_uint(cbor_writer_t *w, uint64_t value);
+
+void cbor_write_int(cbor_writer_t *w, int64_t value);
+
+void cbor_write_float(cbor_writer_t *w, float value);
+
+void cbor_write_double(cbor_writer_t *w, double value);
+
+/**
+ * Writes `len` bytes of UTF-8 as a text string.
+ */
+void cbor_write_text(cbor_writer_t *w, const char *value, size_t len);
+
+/**
+ * Writes a NUL terminated text string, nullptr as an empty one.
+ */
+void cbor_write_str(cbor_writer_t *w, const char *value);
@@ -0,0 +1,112 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "command_topic.h"
+#include "control_loop.h"
+#include "schema.h"
+#include "json_reader.h"
+#include "mqtt/mqtt_client.h"
+#include "common/identity.h"
+
+#define TAG "command"
+#define TOPIC_MAX_SIZE 128
+
+/* The command section of a delta, as it reads off the wire */
+struct command_delta_t {
+  uint8_t type;
+  uint16_t seq;
+  uint16_t ratio_permille;
+  uint16_t ttl_s;
+};
+
+static const schema_field_t s_command_fields[] = {
+    SCHEMA_FIELD(command_delta_t, type),
+    SCHEMA_FIELD(command_delta_t, seq),
+    SCHEMA_FIELD(command_delta_t, ratio_permille),
+    SCHEMA_FIELD(command_delta_t, ttl_s),
+};
+static const schema_t s_command_schema = SCHEMA_DEFINE(s_command_fields);
+static schema_hash_t s_command_hash;
+
+static char s_ack_topic[TOPIC_MAX_SIZE];
+// Only the MQTT task applies deltas, nothing else touches these
+static bool s_taken = false;
+static uint16_t s_last_seq = 0;
+
+static uint8_t *_put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static void _ack(uint8_t type, uint16_t seq, command_status_t status) {
+  control_state_t state = controller_get_state();
+  uint8_t payload[COMMAND_ACK_SIZE];
+  uint8_t *p = payload;
+  *p++ = COMMAND_VERSION;
+  *p++ = type;
+  p = _put_u16(p, seq);
+  *p++ = status;
+  *p++ = state.heat_off;
+  p = _put_u16(p, std::isnan(state.ratio_override) ? COMMAND_NO_OVERRIDE :
+                  (uint16_t) lroundf(state.ratio_override * 1000));
+  p = _put_u16(p, state.command_latency_us & 0xffff);
+  _put_u16(p, state.command_latency_us >> 16);
+
+  MQTTPublishInfo_t publishInfo = {
+      .qos = MQTTQoS_t::MQTTQoS0,
+      .retain = false,
+      .dup = false,
+      .pTopicName = s_ack_topic,
+      .topicNameLength = (uint16_t) strlen(s_ack_topic),
+      .pPayload = payload,
+      .payloadLength = sizeof(payload),
+  };
+
+  // We are on the MQTT task, never wait on it for an ack of our own
+  mqtt_client_publish(&publishInfo, 0);
+}
+
+esp_err_t command_topic_apply(json_reader_t *reader) {
+  int64_t received_us = esp_timer_get_time();
+  command_delta_t delta = {};
+  esp_err_t ret = schema_json_read(s_command_schema, s_command_hash, reader, &delta);
+  if (ret == ESP_FAIL) {
+    return ESP_FAIL;
+  }
+  if (s_taken && delta.seq == s_last_seq) {
+    ESP_LOGD(TAG, "Command seq %d already taken", delta.seq);
+    return ESP_OK;
+  }
+  s_taken = true;
+  s_last_seq = delta.seq;
+
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Invalid command seq %d", delta.seq);
+    _ack(delta.type, delta.seq, COMMAND_STATUS_INVALID);
+    return ret;
+  }
+  if (delta.type == COMMAND_TYPE_PING) {
+    _ack(delta.type, delta.seq, COMMAND_STATUS_QUEUED);
+    return ESP_OK;
+  }
+
+  control_command_t command = {
+      .type = delta.type,
+      .ratio_permille = delta.ratio_permille,
+      .ttl_s = delta.ttl_s,
+      .received_us = received_us,
+  };
+  esp_err_t err = control_loop_command(command);
+  ESP_LOGI(TAG, "Command %d seq %d: %s", delta.type, delta.seq, esp_err_to_name(err));
+  _ack(delta.type, delta.seq, err == ESP_OK ? COMMAND_STATUS_QUEUED :
+                              err == ESP_ERR_NO_MEM ? COMMAND_STATUS_BUSY : COMMAND_STATUS_INVALID);
+  return err == ESP_ERR_INVALID_ARG ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+void command_topic_init() {
+  ESP_ERROR_CHECK(schema_hash_build(s_command_schema, &s_command_hash));
+  sprintf(s_ack_topic, "%s/%s/command/ack", CMAKE_THING_TYPE, identity_thing_id());
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <esp_err.h>
+
+/**
+ * Commands to cut the heat or override the ratio from the cloud. They come through the "command" section of the
+ * config shadow's desired state, the connector subscribing to nothing else, and are taken straight to the control
+ * loop without any NVS write:
+ *
+ *   {"state": {"desired": {"command": {"type": 1, "seq": 7, "ratio_permille": 450, "ttl_s": 60}}}}
+ *
+ * Types 1 to 3 are the control_command_type_t, heat off, resume and ratio override for ttl_s seconds, and 4 is a
+ * ping that only acks. The desired section is cleared once taken. Until then it comes back with every delta, so a
+ * command with the same seq as the last one taken is a repeat and skipped; give each new command a new seq.
+ *
+ * Each command taken is acked once queued on <thing type>/<thing>/command/ack, fixed size and little endian:
+ *
+ *   version:u8 type:u8 seq:u16 status:u8 heat_off:u8 ratio_override_permille:u16 command_latency_us:u32
+ *
+ * with seq echoed and the heat off and override in force before it is applied. command_latency_us is the time from
+ * the previous command being received to the SSR duties it set, so a ping after a command reads that command's
+ * latency. ratio_override_permille is COMMAND_NO_OVERRIDE when there is none.
+ */
+
+#define COMMAND_VERSION         1
+#define COMMAND_ACK_SIZE        12
+#define COMMAND_TYPE_PING       4
+#define COMMAND_NO_OVERRIDE     0xffff
+
+enum command_status_t : uint8_t {
+  COMMAND_STATUS_QUEUED = 0,
+  // Unknown type, a value out of range or a ratio above 1000
+  COMMAND_STATUS_INVALID = 1,
+  // The control task has not taken the previous commands yet
+  COMMAND_STATUS_BUSY = 2,
+};
+
+/**
+ * Sets up the ack topic, before the config shadow is.
+ */
+void command_topic_init();
+
+/**
+ * Takes the "command" section of a config shadow delta, `reader` positioned just after its opening brace, and acks
+ * it unless it repeats the last one taken. The whole object is consumed.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an invalid command, which is acked as such, or ESP_FAIL when malformed.
+ */
+esp_err_t command_topic_apply(struct json_reader_t *reader);
@@ -1,13 +1,20 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <driver/gptimer.h>
 #include <esp_log.h>
 #include <esp_task_wdt.h>
 #include <freertos/semphr.h>
 #include <esp_event.h>
 #include <esp_check.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <driver/gpio.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <ctime>
 #include <nvs.h>
 #include "control_loop.h"
+#include "board.h"
 #include "ssr_ctrl.h"
 #include "max31850.h"
 #include "level_shifter.h"
@@ -15,143 +22,735 @@
 #include "balancer.h"
 #include "input_pwm_duty.h"
 #include "digital_input.h"
-#include "reset_button.h"
 #include "pm_control.h"
 #include "events.h"
 #include "telemetry.h"
 #include "app_metrics.h"
 #include "app_config.h"
 #include "utils.h"
+#include "flash_ops.h"
+#include "supervisor.h"
+#include "flight_recorder.h"
+#include "control_record.h"
+#include "thermal_model.h"
+#include "profile.h"
+#include "roast_session.h"
+#include "local_server.h"
+#include "boot_profile.h"
 
 // Interval in MHz
 #define INTERVAL 1000000
 #define TAG "control"
 
-#define ONEWIRE_PIN                 GPIO_NUM_2
-#define HEAT_SIGNAL_PIN             GPIO_NUM_6
-#define DRUM_MOTOR_SIGNAL_PIN       GPIO_NUM_7
-#define FAN_SIGNAL_PIN              GPIO_NUM_9
-#define SSR1_PIN                    GPIO_NUM_10
-#define SSR2_PIN                    GPIO_NUM_11
+// Control tick period, also the spacing of the rate of rise samples
+#define TICK_PERIOD_S               (INTERVAL / 1e6f)
 
 #define DEFAULT_MAX_SECONDARY_HEAT_RATIO    0.7f
 #define DEFAULT_TEMPERATURE_TC_MAX          280
 #define DEFAULT_TEMPERATURE_BOARD_MAX       75
 #define DEFAULT_MAINS_HZ                    MAINS_50_HZ
+// Tuned on the simulator's runaway scenario, see sim/README.md
+#define DEFAULT_CUTOFF_HORIZON_S            15
+#define DEFAULT_CUTOFF_TAPER_C              5
+#define DEFAULT_MODE                        CONTROL_MODE_RATIO
+#define DEFAULT_SETPOINT_C                  220
+// From an autotune on the simulator at the default setpoint, see sim/README.md
+#define DEFAULT_KP                          13.2f
+#define DEFAULT_KI                          0.1f
+#define DEFAULT_KD                          434.0f
+#define DEFAULT_MAIN_WATTS                  1300
+#define DEFAULT_SECONDARY_WATTS             1300
+#define DEFAULT_POWER_PROFILE               PM_PROFILE_BALANCED
+#define MAX_ELEMENT_WATTS                   5000
+#define MAX_GAIN                            1000
+
+// Commands waiting for the control task, a power of two
+#define COMMAND_SLOTS                       8
+
+// Drum motor is a logic line from the panel, the reset button a contact held down to restart
+#define DRUM_MOTOR_DEBOUNCE_US              2000
+#define RESET_BUTTON_DEBOUNCE_US            20000
+#define RESET_BUTTON_HOLD_US                3000000
 
 static SemaphoreHandle_t semaphoreHandle;
-static gptimer_handle_t gptimer;
+static esp_timer_handle_t s_tick_timer;
 static bool _go = false;
 
 static input_pwm_handle_t s_heat_pwm_in;
 static input_pwm_handle_t s_fan_pwm_in;
 static ssr_ctrl_handle_t s_ssr1 = nullptr;
 static ssr_ctrl_handle_t s_ssr2 = nullptr;
+// Mains frequency the SSRs were created with, and their counters as read at the previous tick
+static uint8_t s_ssr_mains_hz = DEFAULT_MAINS_HZ;
+static ssr_ctrl_counters_t s_ssr_counters[2] = {};
 static uint64_t s_max31850_addr = 0;
 
+// Time of the last timer alarm, loop latency is measured from here to the outputs being set
+static volatile int64_t s_tick_time = 0;
+// When the next alarm is due, and how late the last one ran, waking from light sleep included
+static int64_t s_tick_due_us = 0;
+static volatile int64_t s_wake_latency_us = 0;
+// Set by the timer alarm, the semaphore is also given by commands between ticks
+static volatile bool s_tick_due = false;
+// SSRs powered, only while the roaster is in use
+static bool s_ssr_powered = false;
+// A tick decided from the panel's inputs ran, control task only
+static bool s_controlling = false;
+
 // State object that will record internal variables
 static control_state_t s_state = {};
 
+// Chamber model identified from the ticks, kept apart from the state as it is large
+static thermal_model_t s_model;
+
+// Profile played from charge, and the configuration in force once it has replaced its targets
+static profile_player_t s_player;
+static control_cfg_t s_applied_cfg = {};
+
+// Roast under way, summarised tick by tick and handed to telemetry when it ends
+static roast_session_t s_session;
+
+/*
+ * Mailbox of commands for the control task, a bounded lock-free ring with any number of producers and the control
+ * task as its only consumer. A cell's sequence says whose turn it is at ring position p: its producer may write it
+ * when it reads p and the consumer may take it when it reads p + 1. Sequences are kept less the cell index, so the
+ * zeroed ring is empty and commands can be queued before init.
+ */
+struct command_cell_t {
+  std::atomic<uint32_t> seq;
+  control_command_t command;
+};
+static command_cell_t s_command_cells[COMMAND_SLOTS];
+static std::atomic<uint32_t> s_command_head{0};
+static uint32_t s_command_tail = 0;
+
+// The heat off commands latch, the ratio override in force until a loop count, and when the last command arrived
+static bool s_heat_off = false;
+static float s_ratio_override = NAN;
+static uint32_t s_override_until = 0;
+static int64_t s_command_received_us = 0;
+
+// Bumped whenever the configuration in force changes, so recorded ticks can be matched to it
+static uint16_t s_cfg_version = 0;
+
 // Configuration object
 static control_cfg_t s_cfg = {
     .max_heat_ratio  = DEFAULT_MAX_SECONDARY_HEAT_RATIO,
     .max_tc_temp = DEFAULT_TEMPERATURE_TC_MAX,
     .max_board_temp = DEFAULT_TEMPERATURE_BOARD_MAX,
     .mains_hz = DEFAULT_MAINS_HZ,
+    .cutoff_horizon_s = DEFAULT_CUTOFF_HORIZON_S,
+    .cutoff_taper_c = DEFAULT_CUTOFF_TAPER_C,
+    .mode = DEFAULT_MODE,
+    .setpoint_c = DEFAULT_SETPOINT_C,
+    .kp = DEFAULT_KP,
+    .ki = DEFAULT_KI,
+    .kd = DEFAULT_KD,
+    .autotune = false,
+    .profile = 0,
+    .main_watts = DEFAULT_MAIN_WATTS,
+    .secondary_watts = DEFAULT_SECONDARY_WATTS,
+    .power_profile = DEFAULT_POWER_PROFILE,
+};
+
+static const schema_field_t s_state_fields[] = {
+    SCHEMA_FIELD(control_state_t, loop_count),
+    SCHEMA_FIELD(control_state_t, tc_temp),
+    SCHEMA_FIELD(control_state_t, junction_temp),
+    SCHEMA_FIELD(control_state_t, tc_status),
+    SCHEMA_FIELD(control_state_t, tc_error_count),
+    SCHEMA_FIELD(control_state_t, motor_on),
+    SCHEMA_FIELD(control_state_t, fan_duty),
+    SCHEMA_FIELD(control_state_t, balance),
+    SCHEMA_FIELD(control_state_t, input_duty),
+    SCHEMA_FIELD(control_state_t, output_duty),
+    SCHEMA_FIELD_P(control_state_t, ror, "ror", 1),
+    SCHEMA_FIELD_P(control_state_t, secondary_taper, "secondary_taper", 2),
+    SCHEMA_FIELD(control_state_t, autotune_phase),
+    SCHEMA_FIELD_P(control_state_t, model_gain_main, "model_gain_main", 1),
+    SCHEMA_FIELD_P(control_state_t, model_gain_secondary, "model_gain_secondary", 1),
+    SCHEMA_FIELD_P(control_state_t, model_gain_fan, "model_gain_fan", 1),
+    SCHEMA_FIELD_P(control_state_t, model_tau_s, "model_tau_s", 0),
+    SCHEMA_FIELD_P(control_state_t, model_dead_time_s, "model_dead_time_s", 0),
+    SCHEMA_FIELD_P(control_state_t, model_rmse, "model_rmse", 3),
+    SCHEMA_FIELD(control_state_t, profile),
+    SCHEMA_FIELD(control_state_t, profile_phase),
+    SCHEMA_FIELD(control_state_t, profile_elapsed_s),
+    SCHEMA_FIELD_P(control_state_t, profile_progress, "profile_progress", 0),
+    SCHEMA_FIELD_P(control_state_t, profile_target, "profile_target", 2),
+    SCHEMA_FIELD(control_state_t, heat_off),
+    SCHEMA_FIELD_P(control_state_t, ratio_override, "ratio_override", 3),
+    SCHEMA_FIELD(control_state_t, command_latency_us),
+    SCHEMA_FIELD(control_state_t, roast_phase),
+};
+const schema_t control_state_schema = SCHEMA_DEFINE(s_state_fields);
+
+static const schema_field_t s_cfg_fields[] = {
+    SCHEMA_FIELD_P(control_cfg_t, max_heat_ratio, "max_heat_ratio", 3),
+    SCHEMA_FIELD(control_cfg_t, max_tc_temp),
+    SCHEMA_FIELD(control_cfg_t, max_board_temp),
+    SCHEMA_FIELD(control_cfg_t, mains_hz),
+    SCHEMA_FIELD(control_cfg_t, cutoff_horizon_s),
+    SCHEMA_FIELD(control_cfg_t, cutoff_taper_c),
+    SCHEMA_FIELD(control_cfg_t, mode),
+    SCHEMA_FIELD(control_cfg_t, setpoint_c),
+    SCHEMA_FIELD_P(control_cfg_t, kp, "kp", 4),
+    SCHEMA_FIELD_P(control_cfg_t, ki, "ki", 4),
+    SCHEMA_FIELD_P(control_cfg_t, kd, "kd", 4),
+    SCHEMA_FIELD(control_cfg_t, autotune),
+    SCHEMA_FIELD(control_cfg_t, profile),
+    SCHEMA_FIELD(control_cfg_t, main_watts),
+    SCHEMA_FIELD(control_cfg_t, secondary_watts),
+    SCHEMA_FIELD(control_cfg_t, power_profile),
 };
+const schema_t control_cfg_schema = SCHEMA_DEFINE(s_cfg_fields);
 
 /*
- * Checks that the TC and environmental temperatures are within acceptable range
+ * Configurations saved untagged by firmware before fields were added at the end, by their size and the bytes of
+ * fields each held. The profile slot and then the power profile went into trailing padding, which is saved as
+ * zero: a 32 byte blob reads without a profile and a 36 byte one on power profile 0. A tagged configuration is
+ * larger than any of them.
  */
-static bool _check_tc(max31850_data_t elm_temp) {
+static const utils_legacy_blob_t s_cfg_legacy[] = {
+    {.size = 8, .used = 8},
+    {.size = 12, .used = 10},
+    {.size = 32, .used = 30},
+    {.size = 36, .used = 35},
+};
+
+bool control_check_tc(const max31850_data_t &elm_temp, control_state_t &state) {
   bool is_ok = false;
 
   // Get TC value
   if (elm_temp.is_valid) {
     if (elm_temp.thermocouple_status == MAX31850_TC_STATUS_OK) {
       ESP_LOGI(TAG, "Thermocouple=%.2fC, Board=%.2fC", elm_temp.tc_temp, elm_temp.junction_temp);
-      s_state.tc_status = 0;
-      s_state.tc_temp = elm_temp.tc_temp;
-      s_state.junction_temp = elm_temp.junction_temp;
+      state.tc_status = 0;
+      state.tc_temp = elm_temp.tc_temp;
+      state.junction_temp = elm_temp.junction_temp;
+      is_ok = true;
     } else {
       if (elm_temp.thermocouple_status & MAX31850_TC_STATUS_OPEN_CIRCUIT) {
         ESP_LOGE(TAG, "Unable to run, thermocouple fault OPEN CIRCUIT");
-        s_state.tc_error_count++;
-        s_state.tc_status = MAX31850_TC_STATUS_OPEN_CIRCUIT;
+        state.tc_error_count++;
+        state.tc_status = MAX31850_TC_STATUS_OPEN_CIRCUIT;
       } else if (elm_temp.thermocouple_status & MAX31850_TC_STATUS_SHORT_GND) {
         ESP_LOGE(TAG, "Unable to run, thermocouple fault SHORT TO GROUND");
-        s_state.tc_error_count++;
-        s_state.tc_status = MAX31850_TC_STATUS_SHORT_GND;
+        state.tc_error_count++;
+        state.tc_status = MAX31850_TC_STATUS_SHORT_GND;
       } else if (elm_temp.thermocouple_status & MAX31850_TC_STATUS_SHORT_VCC) {
         ESP_LOGE(TAG, "Unable to run, thermocouple fault SHORT TO VCC");
-        s_state.tc_error_count++;
-        s_state.tc_status = MAX31850_TC_STATUS_SHORT_VCC;
+        state.tc_error_count++;
+        state.tc_status = MAX31850_TC_STATUS_SHORT_VCC;
       }
     }
   } else {
     ESP_LOGE(TAG, "Unable to run, error reading thermocouple data.");
-    s_state.tc_error_count++;
-    s_state.tc_status = 255;
+    state.tc_error_count++;
+    state.tc_status = 255;
   }
 
   return is_ok;
 }
 
+/*
+ * Fraction of the secondary duty allowed from where the thermocouple is heading, rather than where it is
+ */
+static float _predictive_taper(const control_state_t &state, const control_cfg_t &cfg) {
+  if (cfg.cutoff_horizon_s == 0 || !ror_ready(&state.ror_window)) {
+    return 1;
+  }
 
-static IRAM_ATTR bool _on_alarm_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx) {
-  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-  xSemaphoreGiveFromISR(semaphoreHandle, &xHigherPriorityTaskWoken);
-  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-  return true;
+  float projected = state.tc_temp + state.ror / 60 * cfg.cutoff_horizon_s;
+  float cut = cfg.max_tc_temp;
+  float start = cut - cfg.cutoff_taper_c;
+  if (projected >= cut) {
+    return 0;
+  } else if (projected <= start) {
+    return 1;
+  }
+  return (cut - projected) / (cut - start);
 }
 
-/* Do it, one loop iteration */
-static esp_err_t _control() {
-  max31850_data_t elm_temp{};
-  esp_err_t ret = ESP_OK;
+/*
+ * Secondary duty in setpoint mode, from the PID or the autotune relay while one runs. The ratio duty is the
+ * feed-forward, so the loop only trims what the main element is already asking for.
+ */
+static float _closed_loop(const control_cfg_t &cfg, control_state_t &state, float ratio_duty) {
+  auto measured = (int32_t) lroundf(state.tc_temp * 100);
+  int32_t setpoint = cfg.setpoint_c * 100;
+  auto out_max = (int32_t) lroundf(state.input_duty * cfg.max_heat_ratio * state.secondary_taper * PID_ONE);
+  int32_t out;
+
+  if (cfg.autotune && state.autotune.phase == AUTOTUNE_IDLE) {
+    ESP_LOGI(TAG, "Autotune started at %dC", cfg.setpoint_c);
+    autotune_start(&state.autotune);
+  }
+  if (state.autotune.phase == AUTOTUNE_RUNNING) {
+    out = autotune_step(&state.autotune, setpoint, measured, out_max);
+    pid_reset(&state.pid);
+  } else {
+    pid_gains_t gains = pid_gains(cfg.kp, cfg.ki * TICK_PERIOD_S, cfg.kd / TICK_PERIOD_S);
+    out = pid_step(&state.pid, gains, setpoint, measured, (int32_t) lroundf(ratio_duty * PID_ONE), out_max);
+  }
+  return (float) out / PID_ONE;
+}
+
+/*
+ * Tick alarm, dispatched from the esp_timer interrupt on the control core rather than through the esp_timer task,
+ * which runs WiFi's timers on the network core. Unlike a gptimer clocked from APB, which holds the chip awake for as
+ * long as it is enabled, an esp_timer wakes it from light sleep.
+ */
+static IRAM_ATTR void _on_tick(void *) {
+  s_tick_time = esp_timer_get_time();
+  s_wake_latency_us = s_tick_time - s_tick_due_us;
+  s_tick_due_us += INTERVAL;
+  s_tick_due = true;
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(semaphoreHandle, &woken);
+  if (woken) {
+    esp_timer_isr_dispatch_need_yield();
+  }
+}
+
+float control_decide(const control_inputs_t &in, const control_cfg_t &cfg, control_state_t &state) {
   bool tc_ok;
-  s_state.loop_count++;
-
-  // Read our peripherals to figure out what to do
-  ESP_GOTO_ON_ERROR(
-      input_pwm_get_duty(s_heat_pwm_in, s_state.input_duty), heat_off, TAG, "Can't read input duty");
-  ESP_GOTO_ON_ERROR(
-      input_pwm_get_duty(s_fan_pwm_in, s_state.fan_duty), heat_off, TAG, "Can't read fan duty");
-  s_state.balance = balance_read_percent();
-  s_state.motor_on = digital_input_is_on(DRUM_MOTOR_SIGNAL_PIN);
-  s_state.input_duty = (s_state.motor_on) ? s_state.input_duty : 0;
-
-  // Grab temperatures and decide if it is safe to operate
-  elm_temp = max31850_read(ONEWIRE_PIN, s_max31850_addr);
-  tc_ok = _check_tc(elm_temp);
-  if (!elm_temp.is_valid) {
+  // Fractional duty lost to the integer SSR duty, when the secondary element is running
+  float duty_error = NAN;
+  state.loop_count++;
+
+  if (!in.heat_ok || !in.fan_ok) {
+    ESP_LOGE(TAG, "Can't read input or fan duty");
+    goto heat_off;
+  }
+  state.input_duty = in.heat_duty;
+  state.fan_duty = in.fan_duty;
+  state.balance = balance_percent_from_mv(in.balance_mv);
+  state.motor_on = in.motor_on;
+  state.input_duty = (state.motor_on) ? state.input_duty : 0;
+
+  // Decide from the temperatures if it is safe to operate
+  tc_ok = control_check_tc(in.tc, state);
+  if (tc_ok) {
+    ror_add(&state.ror_window, in.tc.tc_temp);
+  } else {
+    ror_reset(&state.ror_window);
+  }
+  state.ror = ror_slope(&state.ror_window) * 60 / TICK_PERIOD_S;
+  state.secondary_taper = _predictive_taper(state, cfg);
+  if (!cfg.autotune) {
+    state.autotune.phase = AUTOTUNE_IDLE;
+  }
+
+  state.heat_off = in.heat_off;
+  if (in.heat_off) {
+    ESP_LOGW(TAG, "Heat held off by command");
+    goto heat_off;
+  } else if (!in.tc.is_valid) {
     goto heat_off;
-  } else if (elm_temp.is_valid && elm_temp.junction_temp > s_cfg.max_board_temp) {
-    ESP_LOGW(TAG, "Board temperature exceeded: Board=%.2f, Max=%d", elm_temp.junction_temp, s_cfg.max_board_temp);
+  } else if (in.tc.is_valid && in.tc.junction_temp > cfg.max_board_temp) {
+    ESP_LOGW(TAG, "Board temperature exceeded: Board=%.2f, Max=%d", in.tc.junction_temp, cfg.max_board_temp);
     goto heat_off;
-  } else if (tc_ok && elm_temp.tc_temp < s_cfg.max_tc_temp) {
-    s_state.output_duty = (uint8_t) (s_state.input_duty * s_state.balance / 100.0 * s_cfg.max_heat_ratio);
+  } else if (tc_ok && in.tc.tc_temp < cfg.max_tc_temp) {
+    if (state.secondary_taper < 1) {
+      ESP_LOGW(TAG, "Projected TC=%.1f in %ds, secondary at %.0f%%",
+               state.tc_temp + state.ror / 60 * cfg.cutoff_horizon_s, cfg.cutoff_horizon_s,
+               state.secondary_taper * 100);
+    }
+    double requested = state.input_duty * state.balance / 100.0 * cfg.max_heat_ratio * state.secondary_taper;
+    if (cfg.mode == CONTROL_MODE_SETPOINT) {
+      requested = _closed_loop(cfg, state, (float) requested);
+    }
+    state.output_duty = (uint8_t) requested;
+    duty_error = (float) (requested - state.output_duty);
   } else {
     ESP_LOGW(TAG, "Safety not met, turning off secondary element");
+    state.output_duty = 0;
+    goto loop_off;
+  }
+  state.autotune_phase = state.autotune.phase;
+  return duty_error;
+
+  heat_off:
+  ESP_LOGE(TAG, "Shutting off heaters due to safety");
+  state.input_duty = 0;
+  state.output_duty = 0;
+
+  loop_off:
+  // The loop starts over once it is safe again, an autotune cannot carry on from readings it missed
+  pid_reset(&state.pid);
+  if (state.autotune.phase == AUTOTUNE_RUNNING) {
+    ESP_LOGW(TAG, "Autotune interrupted by a safety cut");
+    state.autotune.phase = AUTOTUNE_FAILED;
+  }
+  state.autotune_phase = state.autotune.phase;
+  return duty_error;
+}
+
+/* Reads everything the decision depends on */
+static void _read_inputs(control_inputs_t &in) {
+  // Temperatures first, the supervisor checks them while the rest is read and decided
+  in.tc = max31850_read(BOARD.onewire, s_max31850_addr);
+  supervisor_publish(in.tc);
+  in.heat_ok = input_pwm_get_duty(s_heat_pwm_in, in.heat_duty) == ESP_OK;
+  in.fan_ok = input_pwm_get_duty(s_fan_pwm_in, in.fan_duty) == ESP_OK;
+  // Calibrated readings are whole millivolts, keep them as recorded so replay sees the same value
+  in.balance_mv = (uint16_t) lround(balance_read_mv());
+  in.motor_on = digital_input_is_on(BOARD.drum_motor_signal);
+}
+
+/*
+ * Duties take effect once the SSR finishes its current on and off pattern, up to two seconds, while an element
+ * cut must not wait for it
+ */
+static void _set_duty(ssr_ctrl_handle_t ssr, uint8_t duty) {
+  if (duty == 0) {
+    ssr_ctrl_force_off(ssr);
+  } else {
+    ssr_ctrl_set_duty(ssr, duty);
+  }
+}
+
+/*
+ * Powers the SSRs while the roaster is in use, the drum turning or an element on, and keeps the chip out of light
+ * sleep for as long as they run. Idle, their alarms stop and the chip can sleep between ticks.
+ */
+static void _ssr_window(const control_inputs_t &in) {
+  bool active = in.motor_on || s_state.input_duty > 0 || s_state.output_duty > 0;
+  if (!_go || active == s_ssr_powered) {
+    return;
+  }
+  if (active) {
+    pm_control_hold(PM_WINDOW_SSR, true);
+    ssr_ctrl_power_on(s_ssr1);
+    ssr_ctrl_power_on(s_ssr2);
+  } else {
+    ssr_ctrl_power_off(s_ssr1);
+    ssr_ctrl_power_off(s_ssr2);
+    pm_control_hold(PM_WINDOW_SSR, false);
+  }
+  s_ssr_powered = active;
+  supervisor_set_active(active);
+  flight_recorder_event(FLIGHT_RECORD_SSR, active);
+}
+
+/* Takes the oldest command from the mailbox, control task only */
+static bool _command_pop(control_command_t *command) {
+  uint32_t index = s_command_tail % COMMAND_SLOTS;
+  command_cell_t &cell = s_command_cells[index];
+  if (cell.seq.load(std::memory_order_acquire) + index != s_command_tail + 1) {
+    return false;
+  }
+  *command = cell.command;
+  // Free for the producer of the same cell one lap on
+  cell.seq.store(s_command_tail + COMMAND_SLOTS - index, std::memory_order_release);
+  s_command_tail++;
+  return true;
+}
+
+/* Applies the commands queued since they were last taken */
+static void _take_commands() {
+  control_command_t command;
+  while (_command_pop(&command)) {
+    switch (command.type) {
+      case CONTROL_COMMAND_HEAT_OFF:
+        s_heat_off = true;
+        break;
+      case CONTROL_COMMAND_RESUME:
+        s_heat_off = false;
+        s_ratio_override = NAN;
+        break;
+      case CONTROL_COMMAND_RATIO:
+        s_ratio_override = command.ttl_s ? command.ratio_permille / 1000.0f : NAN;
+        s_override_until = s_state.loop_count + (uint32_t) lroundf(command.ttl_s / TICK_PERIOD_S);
+        break;
+      default:
+        break;
+    }
+    ESP_LOGI(TAG, "Command %d, heat off=%d, ratio override=%.3f for %ds", command.type, s_heat_off,
+             s_ratio_override, command.ttl_s);
+    flight_recorder_event(FLIGHT_RECORD_COMMAND, command.type, command.ttl_s);
+    s_command_received_us = std::max(s_command_received_us, command.received_us);
+  }
+}
+
+/* Records the time from the last command being received to the duties just set */
+static void _command_actuated() {
+  if (s_command_received_us) {
+    s_state.command_latency_us = (uint32_t) (esp_timer_get_time() - s_command_received_us);
+    s_command_received_us = 0;
+    app_metrics_record_command(s_state.command_latency_us);
+  }
+}
+
+/*
+ * Woken by a command between ticks. A heat off cuts both elements now, the SSRs turn off from the next
+ * half-cycle mid pattern, anything else takes effect with the next tick.
+ */
+static void _on_command() {
+  _take_commands();
+  if (s_heat_off && !s_state.heat_off) {
+    ssr_ctrl_force_off(s_ssr1);
+    ssr_ctrl_force_off(s_ssr2);
+    s_state.heat_off = true;
+    s_state.input_duty = 0;
     s_state.output_duty = 0;
+    _command_actuated();
+    ESP_LOGW(TAG, "Heat off by command");
+  }
+}
+
+/* Wakes the control task for input changes as it does for a tick, they wait in the queue until it runs */
+static IRAM_ATTR void _on_input(void *) {
+  if (!semaphoreHandle) {
+    return;
+  }
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(semaphoreHandle, &woken);
+  if (woken) {
+    esp_timer_isr_dispatch_need_yield();
+  }
+}
+
+/*
+ * Input changes queued since they were last taken. The drum stopping cuts both elements now as a heat off command
+ * does, the tick that follows keeps them off, and the reset button held down restarts.
+ */
+static void _take_inputs() {
+  digital_input_event_t event;
+  while (digital_input_take(&event)) {
+    flight_recorder_event(FLIGHT_RECORD_INPUT, event.gpio, event.type);
+    if (event.gpio == BOARD.reset_button && event.type == DIGITAL_INPUT_LONG_PRESS) {
+      ESP_LOGW(TAG, "Reset button held, restarting");
+      flight_recorder_event(FLIGHT_RECORD_RESTART, 0);
+      esp_restart();
+    }
+    if (event.gpio == BOARD.drum_motor_signal && event.type == DIGITAL_INPUT_OFF && s_state.motor_on) {
+      ssr_ctrl_force_off(s_ssr1);
+      ssr_ctrl_force_off(s_ssr2);
+      s_state.motor_on = false;
+      s_state.input_duty = 0;
+      s_state.output_duty = 0;
+      ESP_LOGW(TAG, "Drum stopped, heat off");
+    }
+  }
+}
+
+/* Identifies the chamber model from the reading the tick started with and the duties it applied */
+static void _identify(const control_inputs_t &in) {
+  bool temp_valid = in.tc.is_valid && in.tc.thermocouple_status == MAX31850_TC_STATUS_OK;
+  uint8_t fan_duty = in.fan_ok ? in.fan_duty : s_state.fan_duty;
+  thermal_model_update(&s_model, temp_valid, in.tc.tc_temp, s_state.input_duty, s_state.output_duty, fan_duty);
+
+  thermal_model_estimate_t estimate = thermal_model_estimate(&s_model, TICK_PERIOD_S);
+  s_state.model_gain_main = estimate.gain_main;
+  s_state.model_gain_secondary = estimate.gain_secondary;
+  s_state.model_gain_fan = estimate.gain_fan;
+  s_state.model_tau_s = estimate.tau_s;
+  s_state.model_dead_time_s = estimate.dead_time_s;
+  s_state.model_rmse = estimate.rmse;
+}
+
+/*
+ * Reads what each SSR delivered since the previous tick into the state, and hands it to the metrics for energy,
+ * duty realization and element wear
+ */
+static void _account(const control_cfg_t &cfg) {
+  ssr_ctrl_handle_t ssrs[] = {s_ssr1, s_ssr2};
+  float *on_s[] = {&s_state.input_on_s, &s_state.output_on_s};
+  uint16_t watts[] = {cfg.main_watts, cfg.secondary_watts};
+  for (int i = 0; i < 2; i++) {
+    ssr_ctrl_counters_t now;
+    ssr_ctrl_get_counters(ssrs[i], now);
+    ssr_ctrl_counters_t delta = {
+        .half_cycles = now.half_cycles - s_ssr_counters[i].half_cycles,
+        .on_half_cycles = now.on_half_cycles - s_ssr_counters[i].on_half_cycles,
+        .commanded = now.commanded - s_ssr_counters[i].commanded,
+        .switch_count = now.switch_count - s_ssr_counters[i].switch_count,
+        .late = now.late - s_ssr_counters[i].late,
+        .missed = now.missed - s_ssr_counters[i].missed,
+        .max_late_us = now.max_late_us,
+    };
+    s_ssr_counters[i] = now;
+    *on_s[i] = (float) delta.on_half_cycles / (2.0f * s_ssr_mains_hz);
+    app_metrics_record_element((metrics_element_t) i, delta, *on_s[i], watts[i]);
   }
+}
 
-  ssr_ctrl_set_duty(s_ssr1, s_state.input_duty);
-  ssr_ctrl_set_duty(s_ssr2, s_state.output_duty);
+/* The stack is sized from its high water mark, logged after what goes deepest into it */
+static void _log_stack(const char *after) {
+  ESP_LOGI(TAG, "Stack high water after %s, %u bytes free", after, uxTaskGetStackHighWaterMark(nullptr));
+}
 
-  ESP_LOGI(TAG, "Input=%d, Output=%d, Fan=%d, Balance=%f, TC=%.2f, Board=%.2f, TC Status=%d, TC Errors=%lu",
-           s_state.input_duty, s_state.output_duty, s_state.fan_duty, s_state.balance, s_state.tc_temp,
+/* Follows the roast session through the tick just decided, a summary is published once when it ends */
+static void _roast(const control_inputs_t &in, const control_cfg_t &cfg) {
+  roast_summary_t summary;
+  if (roast_session_update(&s_session, in, s_state, cfg, (uint32_t) time(nullptr), TICK_PERIOD_S, &summary)) {
+    telemetry_roast_done(summary);
+    _log_stack("a roast");
+  }
+  s_state.roast_phase = s_session.phase;
+}
+
+/*
+ * Advances the selected profile, returning the configuration with the target it sets in force, and then any
+ * ratio override on top. Ratios are applied in whole percent and setpoints in whole degrees, a ramp then only
+ * changes the configuration, and adds a config record, every few ticks.
+ */
+static control_cfg_t _playback(const control_inputs_t &in) {
+  control_cfg_t cfg = s_cfg;
+  bool heat_on = in.heat_ok && in.heat_duty > 0;
+  bool tc_ok = in.tc.is_valid && in.tc.thermocouple_status == MAX31850_TC_STATUS_OK;
+  float target = profile_player_step(&s_player, cfg.profile, in.motor_on, heat_on, tc_ok, in.tc.tc_temp,
+                                     TICK_PERIOD_S);
+
+  s_state.profile = s_player.slot;
+  s_state.profile_phase = s_player.phase;
+  s_state.profile_elapsed_s = (uint16_t) std::min<uint32_t>(UINT16_MAX, s_player.ticks * TICK_PERIOD_S);
+  s_state.profile_progress = profile_player_progress(&s_player) * 100;
+  if (std::isnan(target)) {
+    s_state.profile_target = NAN;
+  } else if (s_player.profile.target == PROFILE_TARGET_RATIO) {
+    cfg.max_heat_ratio = lroundf(target / 10) / 100.0f;
+    s_state.profile_target = cfg.max_heat_ratio;
+  } else {
+    cfg.mode = CONTROL_MODE_SETPOINT;
+    cfg.setpoint_c = (uint16_t) std::min<long>(lroundf(target), cfg.max_tc_temp);
+    s_state.profile_target = cfg.setpoint_c;
+  }
+
+  if (!std::isnan(s_ratio_override) && s_state.loop_count >= s_override_until) {
+    ESP_LOGI(TAG, "Ratio override expired");
+    s_ratio_override = NAN;
+  }
+  if (!std::isnan(s_ratio_override)) {
+    cfg.max_heat_ratio = s_ratio_override;
+  }
+  s_state.ratio_override = s_ratio_override;
+  return cfg;
+}
+
+/* Ends the autotune the decision finished or gave up on, keeping the gains it found */
+static void _autotune_apply() {
+  const autotune_t &tune = s_state.autotune;
+  control_cfg_t cfg = s_cfg;
+  cfg.autotune = false;
+  if (tune.phase == AUTOTUNE_DONE) {
+    cfg.kp = tune.kp;
+    cfg.ki = tune.ki / TICK_PERIOD_S;
+    cfg.kd = tune.kd * TICK_PERIOD_S;
+    ESP_LOGI(TAG, "Autotune done in %ds, kp=%.4f ki=%.4f kd=%.4f", tune.ticks, cfg.kp, cfg.ki, cfg.kd);
+  } else {
+    ESP_LOGW(TAG, "Autotune failed after %ds, keeping the previous gains", tune.ticks);
+  }
+
+  if (controller_set_cfg(cfg) != ESP_OK) {
+    ESP_LOGW(TAG, "Autotune gains out of range, keeping the previous gains");
+    cfg = s_cfg;
+    cfg.autotune = false;
+    controller_set_cfg(cfg);
+  }
+  // The request is done, it must not come back as a delta once the shadow sees it reported false
+  app_config_clear_desired_control();
+}
+
+/* Do it, one loop iteration */
+static esp_err_t _control() {
+  control_inputs_t in{};
+  _read_inputs(in);
+  _take_commands();
+  in.heat_off = s_heat_off;
+  control_cfg_t cfg = _playback(in);
+  if (schema_diff(control_cfg_schema, &cfg, &s_applied_cfg)) {
+    s_applied_cfg = cfg;
+    s_cfg_version++;
+    flight_recorder_event(FLIGHT_RECORD_CONFIG, s_cfg_version);
+  }
+  float duty_error = control_decide(in, cfg, s_state);
+
+  _ssr_window(in);
+  _set_duty(s_ssr1, s_state.input_duty);
+  _set_duty(s_ssr2, s_state.output_duty);
+  _command_actuated();
+  control_record_tick(in, s_state, s_cfg_version, cfg);
+  flight_recorder_tick(s_state, s_ssr_powered);
+  _identify(in);
+  _account(cfg);
+  _roast(in, cfg);
+  // Boot is timed to the first tick deciding from the panel's inputs, the ones before only kept the heat off
+  if (!s_controlling && in.heat_ok && in.fan_ok) {
+    s_controlling = true;
+    boot_profile_first_tick();
+  }
+  if (s_state.autotune.phase == AUTOTUNE_DONE || s_state.autotune.phase == AUTOTUNE_FAILED) {
+    _autotune_apply();
+  }
+
+  ESP_LOGI(TAG, "Input=%d, Output=%d, Fan=%d, Balance=%f, TC=%.2f, RoR=%.1f, Board=%.2f, TC Status=%d, TC Errors=%lu",
+           s_state.input_duty, s_state.output_duty, s_state.fan_duty, s_state.balance, s_state.tc_temp, s_state.ror,
            s_state.junction_temp, s_state.tc_status, s_state.tc_error_count);
+  local_server_notify(s_state);
   ESP_LOGI(TAG, "Memory heap: %lu, min: %lu\n.\n", esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
-  return ret;
+  app_metrics_record_tick(s_state, (float) (esp_timer_get_time() - s_tick_time), (float) s_wake_latency_us,
+                          duty_error);
+  // Rarely due, once the elements go idle after use or every few minutes of heating
+  if (app_metrics_lifetime_save_required()) {
+    app_metrics_lifetime_save();
+  }
+  // The rest of the tick period is idle, the one window where the flash cache going off delays nothing
+  if (flash_ops_run()) {
+    _log_stack("a flash write");
+  }
+  return ESP_OK;
+}
 
-  heat_off:
-  ESP_LOGE(TAG, "Shutting off heaters due to safety");
-  s_state.input_duty = 0;
-  s_state.output_duty = 0;
-  ssr_ctrl_set_duty(s_ssr1, s_state.input_duty);
-  ssr_ctrl_set_duty(s_ssr2, s_state.output_duty);
-  return ret;
+esp_err_t control_loop_tick() {
+  s_tick_time = esp_timer_get_time();
+  return _control();
+}
+
+size_t control_state_format(char *buf, size_t size, const control_state_t &state, uint32_t timestamp) {
+  json_writer_t w;
+  json_writer_init(&w, buf, size);
+  json_begin_object(&w, nullptr);
+  json_write_uint(&w, "timestamp", timestamp);
+  json_write_fields(&w, control_state_schema, &state);
+  json_end_object(&w);
+  return json_writer_finish(&w);
+}
+
+esp_err_t control_loop_command(const control_command_t &command) {
+  ESP_RETURN_ON_FALSE(command.type >= CONTROL_COMMAND_HEAT_OFF && command.type <= CONTROL_COMMAND_RATIO,
+                      ESP_ERR_INVALID_ARG, TAG, "Unknown command %d", command.type);
+  ESP_RETURN_ON_FALSE(command.ratio_permille <= 1000, ESP_ERR_INVALID_ARG, TAG, "Invalid ratio %d",
+                      command.ratio_permille);
+
+  // Claim a position, then publish the command in its cell
+  uint32_t pos = s_command_head.load(std::memory_order_relaxed);
+  command_cell_t *cell;
+  while (true) {
+    uint32_t index = pos % COMMAND_SLOTS;
+    cell = &s_command_cells[index];
+    auto lag = (int32_t) (cell->seq.load(std::memory_order_acquire) + index - pos);
+    if (lag == 0) {
+      if (s_command_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (lag < 0) {
+      // Not taken yet from the previous lap
+      return ESP_ERR_NO_MEM;
+    } else {
+      pos = s_command_head.load(std::memory_order_relaxed);
+    }
+  }
+  cell->command = command;
+  cell->seq.store(pos + 1 - pos % COMMAND_SLOTS, std::memory_order_release);
+
+  // Wake the control task now rather than at the next tick
+  if (semaphoreHandle) {
+    xSemaphoreGive(semaphoreHandle);
+  }
+  return ESP_OK;
 }
 
 control_state_t controller_get_state() {
@@ -162,31 +761,94 @@ control_cfg_t controller_get_cfg() {
   return s_cfg;
 }
 
-esp_err_t controller_set_cfg(control_cfg_t cfg) {
+/* Checks every field, for a configuration set and one loaded as well */
+static bool _cfg_valid(const control_cfg_t &cfg) {
   if (cfg.max_board_temp < 50 or cfg.max_board_temp > 85) {
     ESP_LOGE(TAG, "Max board temperature invalid: %d : [%d, %d]", cfg.max_board_temp, 50, 85);
-    goto error;
+    return false;
   }
 
   if (cfg.max_tc_temp > 300 or cfg.max_tc_temp < 200) {
     ESP_LOGE(TAG, "Invalid max TC temperature: %d, expected [200, 300]", cfg.max_tc_temp);
-    goto error;
+    return false;
   }
 
   if (cfg.max_heat_ratio > 1.0 or cfg.max_heat_ratio < 0.0) {
     ESP_LOGE(TAG, "Invalid heat ratio too high: %f, expected [0, 1]", cfg.max_heat_ratio);
-    goto error;
+    return false;
   }
 
   if (cfg.mains_hz != MAINS_50_HZ and cfg.mains_hz != MAINS_60_HZ) {
     ESP_LOGW(TAG, "Invalid mains frequency: %dHz, expected 50Hz or 60Hz]", cfg.mains_hz);
+    return false;
+  }
+
+  if (cfg.cutoff_horizon_s > 120 or cfg.cutoff_taper_c > 50) {
+    ESP_LOGE(TAG, "Invalid predictive cutoff: horizon %ds, taper %dC, expected [0, 120] and [0, 50]",
+             cfg.cutoff_horizon_s, cfg.cutoff_taper_c);
+    return false;
+  }
+
+  if (cfg.mode != CONTROL_MODE_RATIO and cfg.mode != CONTROL_MODE_SETPOINT) {
+    ESP_LOGE(TAG, "Invalid mode: %d, expected %d or %d", cfg.mode, CONTROL_MODE_RATIO, CONTROL_MODE_SETPOINT);
+    return false;
+  }
+
+  if (cfg.setpoint_c > cfg.max_tc_temp) {
+    ESP_LOGE(TAG, "Invalid setpoint: %dC, expected at most max TC %dC", cfg.setpoint_c, cfg.max_tc_temp);
+    return false;
+  }
+
+  if (!(cfg.kp >= 0 and cfg.kp <= MAX_GAIN and cfg.ki >= 0 and cfg.ki <= MAX_GAIN and
+        cfg.kd >= 0 and cfg.kd <= MAX_GAIN)) {
+    ESP_LOGE(TAG, "Invalid gains: kp=%f ki=%f kd=%f, expected [0, %d]", cfg.kp, cfg.ki, cfg.kd, MAX_GAIN);
+    return false;
+  }
+
+  if (cfg.autotune and cfg.mode != CONTROL_MODE_SETPOINT) {
+    ESP_LOGE(TAG, "Autotune needs setpoint mode");
+    return false;
+  }
+
+  if (cfg.profile > PROFILE_SLOTS) {
+    ESP_LOGE(TAG, "Invalid profile slot: %d, expected [0, %d]", cfg.profile, PROFILE_SLOTS);
+    return false;
+  }
+
+  if (cfg.autotune and cfg.profile) {
+    ESP_LOGE(TAG, "Autotune needs a fixed setpoint, no profile");
+    return false;
+  }
+
+  if (cfg.main_watts > MAX_ELEMENT_WATTS or cfg.secondary_watts > MAX_ELEMENT_WATTS) {
+    ESP_LOGE(TAG, "Invalid element power: main %dW, secondary %dW, expected [0, %d]", cfg.main_watts,
+             cfg.secondary_watts, MAX_ELEMENT_WATTS);
+    return false;
+  }
+
+  if (cfg.power_profile >= PM_PROFILE_COUNT) {
+    ESP_LOGE(TAG, "Invalid power profile: %d, expected [0, %d]", cfg.power_profile, PM_PROFILE_COUNT - 1);
+    return false;
+  }
+
+  return true;
+}
+
+esp_err_t controller_set_cfg(control_cfg_t cfg) {
+  if (!_cfg_valid(cfg)) {
     goto error;
   }
 
   s_cfg = cfg;
-  utils_save_to_nvs("controller", "cfg", &s_cfg, sizeof(control_cfg_t));
-  ESP_LOGI(TAG, "New configuration set max_board_temp=%d, max_tc_temp=%d, max_heat_ratio=%f, mains_hz=%d",
-           s_cfg.max_board_temp, s_cfg.max_tc_temp, s_cfg.max_heat_ratio, s_cfg.mains_hz);
+  utils_save_tagged_to_nvs("controller", "cfg", &s_cfg, schema_struct_end(control_cfg_schema));
+  pm_control_set_profile(s_cfg.power_profile);
+  supervisor_set_limits(s_cfg.max_tc_temp, s_cfg.max_board_temp);
+  ESP_LOGI(TAG, "New configuration set max_board_temp=%d, max_tc_temp=%d, max_heat_ratio=%f, mains_hz=%d, "
+                "cutoff_horizon_s=%d, cutoff_taper_c=%d, mode=%d, setpoint_c=%d, kp=%.4f, ki=%.4f, kd=%.4f, "
+                "autotune=%d, profile=%d, main_watts=%d, secondary_watts=%d, power_profile=%d",
+           s_cfg.max_board_temp, s_cfg.max_tc_temp, s_cfg.max_heat_ratio, s_cfg.mains_hz, s_cfg.cutoff_horizon_s,
+           s_cfg.cutoff_taper_c, s_cfg.mode, s_cfg.setpoint_c, s_cfg.kp, s_cfg.ki, s_cfg.kd, s_cfg.autotune,
+           s_cfg.profile, s_cfg.main_watts, s_cfg.secondary_watts, s_cfg.power_profile);
   return ESP_OK;
 
   error:
@@ -196,39 +858,49 @@ esp_err_t controller_set_cfg(control_cfg_t cfg) {
 
 void control_loop_run() {
   semaphoreHandle = xSemaphoreCreateBinary();
+  // Runs on the control task, its core and priority are in task_plan.h
   TaskHandle_t xTaskToNotify = xTaskGetCurrentTaskHandle();
-  // As this is a control loop, we want it to be very high priority
-  vTaskPrioritySet(xTaskToNotify, 7);
 
-  ESP_ERROR_CHECK(gptimer_start(gptimer));
+  s_tick_due_us = esp_timer_get_time() + INTERVAL;
+  ESP_ERROR_CHECK(esp_timer_start_periodic(s_tick_timer, INTERVAL));
   _go = true;
+  // Flash writes wait for the end of a tick from here on
+  flash_ops_start();
 
   // Add this task to the watch dog timer
   ESP_ERROR_CHECK(esp_task_wdt_add(xTaskToNotify));
 
-  // We are good to go
+  // We are good to go, the SSRs are powered by the first tick the roaster is in use
   level_shifter_enable(true);
-
-  ssr_ctrl_power_on(s_ssr1);
-  ssr_ctrl_power_on(s_ssr2);
+  supervisor_start(s_ssr1, s_ssr2);
 
   // Go to go
   esp_event_post(MAIN_APP_EVENT, APP_READY, NULL, 0, portMAX_DELAY);
 
   do {
     if (xSemaphoreTake(semaphoreHandle, pdMS_TO_TICKS(1000)) == pdPASS) {
-      // Restart if we are asked to
-      if (reset_button_is_triggered()) {
-        esp_restart();
+      pm_control_hold(PM_WINDOW_TICK, true);
+      _take_inputs();
+      if (!s_tick_due) {
+        _on_command();
+      } else {
+        s_tick_due = false;
+        ESP_ERROR_CHECK(esp_task_wdt_reset());
+        digital_input_resync();
+        _control();
       }
-
-      ESP_ERROR_CHECK(esp_task_wdt_reset());
-      _control();
+      pm_control_hold(PM_WINDOW_TICK, false);
     }
   } while (_go);
 
-  ssr_ctrl_power_off(s_ssr1);
-  ssr_ctrl_power_off(s_ssr2);
+  supervisor_stop();
+  flash_ops_stop();
+  if (s_ssr_powered) {
+    ssr_ctrl_power_off(s_ssr1);
+    ssr_ctrl_power_off(s_ssr2);
+    pm_control_hold(PM_WINDOW_SSR, false);
+    s_ssr_powered = false;
+  }
   level_shifter_enable(false);
   ssr_ctrl_del(s_ssr1);
   ssr_ctrl_del(s_ssr2);
@@ -237,57 +909,88 @@ void control_loop_run() {
 }
 
 void control_loop_stop() {
-  ESP_ERROR_CHECK(gptimer_stop(gptimer));
+  ESP_ERROR_CHECK(esp_timer_stop(s_tick_timer));
   _go = false;
 }
 
-void control_loop_init(EventGroupHandle_t net_group) {
-  utils_load_from_nvs("controller", "cfg", &s_cfg, sizeof(control_cfg_t));
-  pm_control_init();
-  reset_button_init(GPIO_NUM_4);
+void control_loop_safe_state() {
+  gpio_set_level(BOARD.ssr1, 0);
+  gpio_set_level(BOARD.ssr2, 0);
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.mode = GPIO_MODE_OUTPUT;
+  io_conf.pin_bit_mask = (1ULL << BOARD.ssr1) | (1ULL << BOARD.ssr2);
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+  gpio_config(&io_conf);
   level_shifter_init();
-  panel_inputs_init();
-  balancer_init();
-  digital_input_init(DRUM_MOTOR_SIGNAL_PIN);
-  telemetry_init(net_group);
-  app_config_init();
-
-  // Thermocouple amplifier
-  max3185_devices_t found_devices = max31850_list(ONEWIRE_PIN);
-  ESP_ERROR_CHECK(found_devices.devices_address_length == 1 ? ESP_OK : ESP_FAIL);
-  s_max31850_addr = found_devices.devices_address[0];
+}
 
-  // Init reading inbound PWMs, noting heat is 2s period on later hottop models
-  input_pwm_new({.gpio=HEAT_SIGNAL_PIN, .edge_type=PWM_INPUT_DOWN_EDGE_ON, .period_us=2100000}, &s_heat_pwm_in);
-  input_pwm_new({.gpio=FAN_SIGNAL_PIN, .edge_type=PWM_INPUT_DOWN_EDGE_ON, .period_us=100000}, &s_fan_pwm_in);
+/*
+ * Loads the configuration over the defaults. One an earlier firmware saved keeps the fields it had, the safety
+ * limits and mains frequency with them, and is saved back with the fields added since at their defaults.
+ */
+static void _load_cfg() {
+  control_cfg_t cfg = s_cfg;
+  bool upgraded;
+  if (utils_load_tagged_from_nvs("controller", "cfg", &cfg, schema_struct_end(control_cfg_schema), s_cfg_legacy,
+                                 sizeof(s_cfg_legacy) / sizeof(s_cfg_legacy[0]), &upgraded) != ESP_OK) {
+    return;
+  }
+  if (!_cfg_valid(cfg)) {
+    ESP_LOGE(TAG, "Configuration loaded is invalid, keeping the defaults");
+    return;
+  }
+  s_cfg = cfg;
+  if (upgraded) {
+    utils_save_tagged_to_nvs("controller", "cfg", &s_cfg, schema_struct_end(control_cfg_schema));
+  }
+}
 
-  // Init SSRs
-  ssr_ctrl_new({.gpio = SSR1_PIN, .mains_hz = (main_hertz_t) s_cfg.mains_hz}, &s_ssr1);
-  ssr_ctrl_new({.gpio = SSR2_PIN, .mains_hz = (main_hertz_t) s_cfg.mains_hz}, &s_ssr2);
+void control_loop_init() {
+  _load_cfg();
 
-  // Turn off heat
+  // SSRs first, off until control_loop_run() powers them on by the first tick the roaster is in use
+  s_ssr_mains_hz = s_cfg.mains_hz;
+  ssr_ctrl_new({.gpio = BOARD.ssr1, .mains_hz = (main_hertz_t) s_cfg.mains_hz}, &s_ssr1);
+  ssr_ctrl_new({.gpio = BOARD.ssr2, .mains_hz = (main_hertz_t) s_cfg.mains_hz}, &s_ssr2);
   ssr_ctrl_set_duty(s_ssr1, 0);
   ssr_ctrl_set_duty(s_ssr2, 0);
 
-  // Set up timer now
-  gptimer_config_t timer_config = {
-      .clk_src = GPTIMER_CLK_SRC_DEFAULT,
-      .direction = GPTIMER_COUNT_UP,
-      .resolution_hz = 1 * 1000 * 1000, // 1MHz, 1 tick = 1us
-      .flags = {.intr_shared = 1}
-  };
-  ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &gptimer));
+  pm_control_init(s_cfg.power_profile);
+  supervisor_set_limits(s_cfg.max_tc_temp, s_cfg.max_board_temp);
+  supervisor_init();
+  panel_inputs_init();
+  balancer_init();
+  // Drum motor logic line, and the reset button pulled up on the board
+  digital_input_add({.gpio = BOARD.drum_motor_signal, .active_low = true, .pull_up = true,
+                     .debounce_us = DRUM_MOTOR_DEBOUNCE_US});
+  digital_input_add({.gpio = BOARD.reset_button, .active_low = true, .pull_up = false,
+                     .debounce_us = RESET_BUTTON_DEBOUNCE_US, .long_press_us = RESET_BUTTON_HOLD_US});
+  digital_input_set_notify(_on_input, nullptr);
+  control_record_init();
+  thermal_model_reset(&s_model);
+  roast_session_reset(&s_session);
+  profile_init();
+  // Counters the control task adds to from its first tick, published once telemetry is up
+  app_metrics_init();
 
-  gptimer_alarm_config_t alarm_config = {
-      .alarm_count = INTERVAL,
-      .reload_count = 0,
-      .flags = {.auto_reload_on_alarm = true},
-  };
-  ESP_ERROR_CHECK(gptimer_set_alarm_action(gptimer, &alarm_config));
+  // Thermocouple amplifier
+  max3185_devices_t found_devices = max31850_list(BOARD.onewire);
+  ESP_ERROR_CHECK(found_devices.devices_address_length == 1 ? ESP_OK : ESP_FAIL);
+  s_max31850_addr = found_devices.devices_address[0];
 
-  gptimer_event_callbacks_t cbs = {
-      .on_alarm = _on_alarm_cb,
+  // Init reading inbound PWMs, noting heat is 2s period on later hottop models
+  input_pwm_new({.gpio=BOARD.heat_signal, .edge_type=PWM_INPUT_DOWN_EDGE_ON, .period_us=2100000}, &s_heat_pwm_in);
+  input_pwm_new({.gpio=BOARD.fan_signal, .edge_type=PWM_INPUT_DOWN_EDGE_ON, .period_us=100000}, &s_fan_pwm_in);
+
+  // Set up timer now, started by control_loop_run()
+  esp_timer_create_args_t timer_args = {
+      .callback = _on_tick,
+      .arg = nullptr,
+      .dispatch_method = ESP_TIMER_ISR,
+      .name = "control",
+      .skip_unhandled_events = false,
   };
-  ESP_ERROR_CHECK(gptimer_register_event_callbacks(gptimer, &cbs, nullptr));
-  ESP_ERROR_CHECK(gptimer_enable(gptimer));
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_tick_timer));
 }
\ No newline at end of file
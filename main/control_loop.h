@@ -2,6 +2,20 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include "schema.h"
+#include "max31850.h"
+#include "ror.h"
+#include "pid.h"
+
+/**
+ * How the secondary element duty is decided.
+ */
+enum control_mode_t : uint8_t {
+  // A share of the main element duty, set by the balance and max_heat_ratio
+  CONTROL_MODE_RATIO = 0,
+  // Closed loop on the thermocouple towards setpoint_c, with the ratio duty as feed-forward
+  CONTROL_MODE_SETPOINT = 1,
+};
 
 struct control_state_t {
   // loop count
@@ -33,6 +47,51 @@ struct control_state_t {
 
   // Output duty
   uint8_t output_duty;
+
+  // Rate of rise of the thermocouple, C/min
+  float ror;
+
+  // Fraction of the secondary duty let through by the predictive cutoff
+  float secondary_taper;
+
+  // Recent thermocouple readings the rate of rise is estimated from
+  ror_t ror_window;
+
+  // Autotune progress, an autotune_phase_t
+  uint8_t autotune_phase;
+
+  // Identified thermal model, see thermal_model.h, NaN until identified
+  float model_gain_main;
+  float model_gain_secondary;
+  float model_gain_fan;
+  float model_tau_s;
+  float model_dead_time_s;
+  float model_rmse;
+
+  // Profile playback, see profile.h: slot selected, a profile_phase_t, seconds since charge, percent of the
+  // profile covered and the target it sets, NaN while not playing
+  uint8_t profile;
+  uint8_t profile_phase;
+  uint16_t profile_elapsed_s;
+  float profile_progress;
+  float profile_target;
+
+  // Commands, see control_loop_command(): both elements held off, the max_heat_ratio override in force or NaN,
+  // and the time from the last command being received to the SSR duties it set
+  bool heat_off;
+  float ratio_override;
+  uint32_t command_latency_us;
+
+  // Roast session under way, a roast_session_phase_t, see roast_session.h
+  uint8_t roast_phase;
+
+  // Seconds each SSR actually conducted since the previous tick, from its half-cycle counters
+  float input_on_s;
+  float output_on_s;
+
+  // Secondary element loop in setpoint mode, and its relay autotune
+  pid_ctrl_t pid;
+  autotune_t autotune;
 };
 
 struct control_cfg_t {
@@ -58,14 +117,148 @@ struct control_cfg_t {
    * 50Hz or 60Hz mains frequency
    */
   uint8_t mains_hz;
+
+  /**
+   * How far ahead, in seconds, the thermocouple is projected from its rate of rise. The secondary element is
+   * tapered as the projection nears max_tc_temp and cut once it reaches it, so the chamber does not overshoot
+   * the limit on the heat still stored in the element. 0 only cuts at the limit itself.
+   */
+  uint8_t cutoff_horizon_s;
+
+  /**
+   * Degrees below max_tc_temp at which the projected temperature starts tapering the secondary element.
+   */
+  uint8_t cutoff_taper_c;
+
+  /**
+   * A control_mode_t.
+   */
+  uint8_t mode;
+
+  /**
+   * Chamber temperature the secondary element holds in setpoint mode. It never gets more than input*ratio, so
+   * the main element still bounds it and a setpoint out of its reach ends up in ratio mode at full balance.
+   */
+  uint16_t setpoint_c;
+
+  /**
+   * PID gains of setpoint mode: duty percent per degree of error, per degree and second of accumulated error,
+   * and per degree per second of change of the thermocouple.
+   */
+  float kp;
+  float ki;
+  float kd;
+
+  /**
+   * Set to run a relay autotune at setpoint_c. The gains found are stored here and the flag cleared when done.
+   */
+  bool autotune;
+
+  /**
+   * Profile slot played from charge, 0 for none. It replaces max_heat_ratio or setpoint_c as it plays.
+   */
+  uint8_t profile;
+
+  /**
+   * Rated power of the main and secondary elements in watts, the energy reported is their on time at this power.
+   */
+  uint16_t main_watts;
+  uint16_t secondary_watts;
+  /**
+   * Power profile, a pm_profile_t: what the chip saves between ticks against how late it wakes for them, see
+   * pm_control.h.
+   */
+  uint8_t power_profile;
 };
 
+/**
+ * Raw inputs of one control tick, everything a decision depends on besides the configuration. Recorded by
+ * control_record so that ticks can be replayed off the device.
+ */
+struct control_inputs_t {
+  // Panel PWM duties, only meaningful when their read succeeded
+  bool heat_ok;
+  uint8_t heat_duty;
+  bool fan_ok;
+  uint8_t fan_duty;
+
+  // Balance potentiometer wiper, calibrated mV
+  uint16_t balance_mv;
+
+  // Drum motor signal
+  bool motor_on;
+
+  // Thermocouple amplifier reading as returned by the driver
+  max31850_data_t tc;
+
+  // Both elements held off by a command
+  bool heat_off;
+};
+
+enum control_command_type_t : uint8_t {
+  // Both elements off until resumed, whatever the panel asks for
+  CONTROL_COMMAND_HEAT_OFF = 1,
+  // Ends a heat off and any ratio override
+  CONTROL_COMMAND_RESUME = 2,
+  // Replaces max_heat_ratio, a profile's included, for ttl_s seconds, 0 ends the override
+  CONTROL_COMMAND_RATIO = 3,
+};
+
+struct control_command_t {
+  // A control_command_type_t
+  uint8_t type;
+  // Ratio in thousandths
+  uint16_t ratio_permille;
+  uint16_t ttl_s;
+  // esp_timer time the command arrived, command_latency_us is measured from here
+  int64_t received_us;
+};
+
+/**
+ * Wire schemas for the status document and the control section of the config shadow.
+ */
+extern const schema_t control_state_schema;
+extern const schema_t control_cfg_schema;
+
 void control_loop_run();
 
+/**
+ * Runs one control iteration now, as the timer alarm would. Used by benchmarks before the loop is started, the
+ * SSRs are only driven once control_loop_run() powers them on.
+ */
+esp_err_t control_loop_tick();
+
 void control_loop_stop();
 
 control_state_t controller_get_state();
 
+/**
+ * Checks a thermocouple amplifier reading, recording its temperatures or fault in `state`.
+ * @return true when the reading is valid and the thermocouple reports no fault.
+ */
+bool control_check_tc(const max31850_data_t &elm_temp, control_state_t &state);
+
+/**
+ * Queues a command for the control task from any task, without blocking, and wakes it. Commands are applied in
+ * order, a heat off at once and the others with the next tick. They are never persisted, a reboot drops them.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an unknown type or a ratio above 1, or ESP_ERR_NO_MEM when the queue
+ * is full.
+ */
+esp_err_t control_loop_command(const control_command_t &command);
+
+/**
+ * Formats the status document published on telemetry/status.
+ * @return Document length, 0 when it does not fit in `size`.
+ */
+size_t control_state_format(char *buf, size_t size, const control_state_t &state, uint32_t timestamp);
+
+/**
+ * Decides the element duties for one tick from its inputs, updating `state`. Nothing else is touched, so
+ * recorded inputs replay to the same outputs.
+ * @return Fractional secondary duty lost to the integer SSR duty, NaN when the element is not running.
+ */
+float control_decide(const control_inputs_t &in, const control_cfg_t &cfg, control_state_t &state);
+
 /**
  * Retrieves the current configuration.
  * @return
@@ -79,4 +272,14 @@ control_cfg_t controller_get_cfg();
  */
 esp_err_t controller_set_cfg(control_cfg_t cfg);
 
-void control_loop_init(EventGroupHandle_t net_group);
\ No newline at end of file
+/**
+ * Drives the SSR outputs low and has the level shifter isolate them, first thing at boot, a reset leaves them
+ * floating until then.
+ */
+void control_loop_safe_state();
+
+/**
+ * Loads the configuration and sets up the SSRs, off, then the inputs and the thermocouple, on the control task.
+ * Telemetry and the shadows are left to the network stage of the boot, see boot_profile.h.
+ */
+void control_loop_init();
\ No newline at end of file
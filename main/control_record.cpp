@@ -0,0 +1,292 @@
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include "control_record.h"
+
+#define TAG "record"
+
+#define TICK_FLAG_HEAT_OK   (1 << 0)
+#define TICK_FLAG_FAN_OK    (1 << 1)
+#define TICK_FLAG_MOTOR_ON  (1 << 2)
+#define TICK_FLAG_TC_VALID  (1 << 3)
+#define TICK_FLAG_HEAT_OFF  (1 << 4)
+
+struct record_slot_t {
+  uint32_t loop_count;
+  uint8_t len;
+  uint8_t bytes[CONTROL_RECORD_MAX_SIZE];
+};
+
+// Ring of encoded records, written by the control task and drained by the telemetry task
+static record_slot_t s_slots[CONTROL_RECORD_SLOTS];
+static uint16_t s_tail = 0;
+static uint16_t s_count = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Config record in force for the oldest pending tick, every chunk opens with it
+static uint8_t s_tail_cfg[CONTROL_RECORD_CONFIG_SIZE];
+static bool s_cfg_recorded = false;
+static uint16_t s_cfg_version = 0;
+static uint32_t s_dropped = 0;
+
+static uint8_t *_put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *_put_u32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (v >> (8 * i)) & 0xff;
+  }
+  return p + 4;
+}
+
+static uint8_t *_put_f32(uint8_t *p, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return _put_u32(p, bits);
+}
+
+static uint16_t _get_u16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t _get_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static float _get_f32(const uint8_t *p) {
+  uint32_t bits = _get_u32(p);
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+static void _encode_config(record_slot_t &slot, uint16_t version, const control_cfg_t &cfg) {
+  uint8_t *p = slot.bytes;
+  *p++ = CONTROL_RECORD_CONFIG;
+  p = _put_u16(p, version);
+  p = _put_f32(p, cfg.max_heat_ratio);
+  p = _put_u16(p, cfg.max_tc_temp);
+  *p++ = cfg.max_board_temp;
+  *p++ = cfg.mains_hz;
+  *p++ = cfg.cutoff_horizon_s;
+  *p++ = cfg.cutoff_taper_c;
+  *p++ = cfg.mode;
+  p = _put_u16(p, cfg.setpoint_c);
+  p = _put_f32(p, cfg.kp);
+  p = _put_f32(p, cfg.ki);
+  p = _put_f32(p, cfg.kd);
+  *p++ = cfg.autotune;
+  slot.len = p - slot.bytes;
+  slot.loop_count = 0;
+}
+
+static void _encode_tick(record_slot_t &slot, const control_inputs_t &in, const control_state_t &state) {
+  uint8_t *p = slot.bytes;
+  *p++ = CONTROL_RECORD_TICK;
+  *p++ = (in.heat_ok ? TICK_FLAG_HEAT_OK : 0) | (in.fan_ok ? TICK_FLAG_FAN_OK : 0) |
+         (in.motor_on ? TICK_FLAG_MOTOR_ON : 0) | (in.tc.is_valid ? TICK_FLAG_TC_VALID : 0) |
+         (in.heat_off ? TICK_FLAG_HEAT_OFF : 0);
+  *p++ = in.heat_duty;
+  *p++ = in.fan_duty;
+  p = _put_u16(p, in.balance_mv);
+  *p++ = in.tc.thermocouple_status;
+  p = _put_f32(p, in.tc.tc_temp);
+  p = _put_f32(p, in.tc.junction_temp);
+  *p++ = state.input_duty;
+  *p++ = state.output_duty;
+  slot.len = p - slot.bytes;
+  slot.loop_count = state.loop_count;
+}
+
+/* Removes the oldest record, must hold the lock */
+static void _pop(record_slot_t &slot) {
+  slot = s_slots[s_tail];
+  s_tail = (s_tail + 1) % CONTROL_RECORD_SLOTS;
+  s_count--;
+  if (slot.bytes[0] == CONTROL_RECORD_CONFIG) {
+    memcpy(s_tail_cfg, slot.bytes, CONTROL_RECORD_CONFIG_SIZE);
+  }
+}
+
+/* Appends a record, overwriting the oldest when full, must hold the lock */
+static void _push(const record_slot_t &slot) {
+  if (s_count == CONTROL_RECORD_SLOTS) {
+    record_slot_t oldest;
+    _pop(oldest);
+    s_dropped += oldest.bytes[0] == CONTROL_RECORD_TICK ? 1 : 0;
+  }
+  s_slots[(s_tail + s_count) % CONTROL_RECORD_SLOTS] = slot;
+  s_count++;
+}
+
+void control_record_tick(const control_inputs_t &in, const control_state_t &state, uint16_t cfg_version,
+                         const control_cfg_t &cfg) {
+  record_slot_t cfg_slot, tick_slot;
+  bool cfg_changed = !s_cfg_recorded || cfg_version != s_cfg_version;
+  if (cfg_changed) {
+    _encode_config(cfg_slot, cfg_version, cfg);
+    s_cfg_version = cfg_version;
+  }
+  _encode_tick(tick_slot, in, state);
+
+  portENTER_CRITICAL(&s_lock);
+  if (!s_cfg_recorded) {
+    memcpy(s_tail_cfg, cfg_slot.bytes, CONTROL_RECORD_CONFIG_SIZE);
+    s_cfg_recorded = true;
+  } else if (cfg_changed) {
+    _push(cfg_slot);
+  }
+  _push(tick_slot);
+  portEXIT_CRITICAL(&s_lock);
+}
+
+size_t control_record_drain(uint8_t *buf, size_t size) {
+  if (size < CONTROL_RECORD_HEADER_SIZE + CONTROL_RECORD_CONFIG_SIZE + CONTROL_RECORD_TICK_SIZE) {
+    return 0;
+  }
+  uint8_t *p = buf + CONTROL_RECORD_HEADER_SIZE;
+  uint8_t *end = buf + size;
+  uint32_t first_loop_count = 0;
+  uint16_t records = 1;
+  uint16_t ticks = 0;
+
+  // One record at a time, so the lock is never held for long
+  portENTER_CRITICAL(&s_lock);
+  memcpy(p, s_tail_cfg, CONTROL_RECORD_CONFIG_SIZE);
+  portEXIT_CRITICAL(&s_lock);
+  p += CONTROL_RECORD_CONFIG_SIZE;
+
+  while (true) {
+    record_slot_t slot;
+    portENTER_CRITICAL(&s_lock);
+    bool have = s_count > 0 && p + s_slots[s_tail].len <= end;
+    if (have) {
+      _pop(slot);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!have) {
+      break;
+    }
+
+    if (slot.bytes[0] == CONTROL_RECORD_CONFIG && ticks == 0) {
+      // Supersedes the opening config record before any tick used it
+      memcpy(buf + CONTROL_RECORD_HEADER_SIZE, slot.bytes, CONTROL_RECORD_CONFIG_SIZE);
+      continue;
+    }
+    if (slot.bytes[0] == CONTROL_RECORD_TICK && ticks++ == 0) {
+      first_loop_count = slot.loop_count;
+    }
+    memcpy(p, slot.bytes, slot.len);
+    p += slot.len;
+    records++;
+  }
+
+  if (ticks == 0) {
+    return 0;
+  }
+  memcpy(buf, CONTROL_RECORD_MAGIC, 4);
+  _put_u32(buf + 4, first_loop_count);
+  _put_u16(buf + 8, records);
+  return p - buf;
+}
+
+uint32_t control_record_dropped() {
+  return s_dropped;
+}
+
+void control_record_init() {
+  portENTER_CRITICAL(&s_lock);
+  s_tail = 0;
+  s_count = 0;
+  s_cfg_recorded = false;
+  portEXIT_CRITICAL(&s_lock);
+  ESP_LOGI(TAG, "Recording control ticks, %d records of buffer", CONTROL_RECORD_SLOTS);
+}
+
+void control_record_reader_init(control_record_reader_t *r, const uint8_t *buf, size_t len) {
+  *r = {};
+  r->pos = buf;
+  r->end = buf + len;
+}
+
+esp_err_t control_record_next(control_record_reader_t *r, control_record_t *record) {
+  while (r->remaining == 0) {
+    if (r->pos == r->end) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    if (r->end - r->pos < CONTROL_RECORD_HEADER_SIZE) {
+      return ESP_ERR_INVALID_RESPONSE;
+    } else if (memcmp(r->pos, CONTROL_RECORD_MAGIC, 4) == 0) {
+      r->config_size = CONTROL_RECORD_CONFIG_SIZE;
+    } else if (memcmp(r->pos, CONTROL_RECORD_MAGIC_V2, 4) == 0) {
+      r->config_size = CONTROL_RECORD_CONFIG_V2_SIZE;
+    } else if (memcmp(r->pos, CONTROL_RECORD_MAGIC_V1, 4) == 0) {
+      r->config_size = CONTROL_RECORD_CONFIG_V1_SIZE;
+    } else {
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    r->loop_count = _get_u32(r->pos + 4);
+    r->remaining = _get_u16(r->pos + 8);
+    r->pos += CONTROL_RECORD_HEADER_SIZE;
+  }
+
+  *record = {};
+  const uint8_t *p = r->pos;
+  size_t available = r->end - p;
+  switch (p[0]) {
+    case CONTROL_RECORD_TICK: {
+      if (available < CONTROL_RECORD_TICK_SIZE) {
+        return ESP_ERR_INVALID_RESPONSE;
+      }
+      control_inputs_t &in = record->inputs;
+      record->type = CONTROL_RECORD_TICK;
+      record->loop_count = r->loop_count++;
+      in.heat_ok = p[1] & TICK_FLAG_HEAT_OK;
+      in.fan_ok = p[1] & TICK_FLAG_FAN_OK;
+      in.motor_on = p[1] & TICK_FLAG_MOTOR_ON;
+      in.tc.is_valid = p[1] & TICK_FLAG_TC_VALID;
+      in.heat_off = p[1] & TICK_FLAG_HEAT_OFF;
+      in.heat_duty = p[2];
+      in.fan_duty = p[3];
+      in.balance_mv = _get_u16(p + 4);
+      in.tc.thermocouple_status = p[6];
+      in.tc.tc_temp = _get_f32(p + 7);
+      in.tc.junction_temp = _get_f32(p + 11);
+      record->input_duty = p[15];
+      record->output_duty = p[16];
+      r->pos += CONTROL_RECORD_TICK_SIZE;
+      break;
+    }
+    case CONTROL_RECORD_CONFIG:
+      if (available < r->config_size) {
+        return ESP_ERR_INVALID_RESPONSE;
+      }
+      record->type = CONTROL_RECORD_CONFIG;
+      record->cfg_version = _get_u16(p + 1);
+      record->cfg.max_heat_ratio = _get_f32(p + 3);
+      record->cfg.max_tc_temp = _get_u16(p + 7);
+      record->cfg.max_board_temp = p[9];
+      record->cfg.mains_hz = p[10];
+      if (r->config_size >= CONTROL_RECORD_CONFIG_V2_SIZE) {
+        record->cfg.cutoff_horizon_s = p[11];
+        record->cfg.cutoff_taper_c = p[12];
+      }
+      if (r->config_size >= CONTROL_RECORD_CONFIG_SIZE) {
+        record->cfg.mode = p[13];
+        record->cfg.setpoint_c = _get_u16(p + 14);
+        record->cfg.kp = _get_f32(p + 16);
+        record->cfg.ki = _get_f32(p + 20);
+        record->cfg.kd = _get_f32(p + 24);
+        record->cfg.autotune = p[28];
+      }
+      r->pos += r->config_size;
+      break;
+    default:
+      return ESP_ERR_INVALID_RESPONSE;
+  }
+  r->remaining--;
+  return ESP_OK;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+#include "control_loop.h"
+
+/**
+ * Compact binary recording of every control tick, inputs and outputs, for replay off the device.
+ *
+ * The control task appends a record per tick to a RAM ring, overwriting the oldest when full, and the telemetry
+ * task drains it as self contained chunks. All values are little endian.
+ *
+ *   chunk   := "RCR3" first_loop_count:u32 record_count:u16 config record*
+ *   config  := 0x02 version:u16 max_heat_ratio:f32 max_tc_temp:u16 max_board_temp:u8 mains_hz:u8
+ *              cutoff_horizon_s:u8 cutoff_taper_c:u8 mode:u8 setpoint_c:u16 kp:f32 ki:f32 kd:f32 autotune:u8
+ *   tick    := 0x01 flags:u8 heat_duty:u8 fan_duty:u8 balance_mv:u16 tc_status:u8 tc_temp:f32
+ *              junction_temp:f32 input_duty:u8 output_duty:u8
+ *
+ * Tick flags are bit 0 heat read ok, bit 1 fan read ok, bit 2 motor on, bit 3 thermocouple reading valid and
+ * bit 4 heat held off by a command. Config records hold the configuration in force, with the target of a
+ * playing profile or a ratio override in place of the one configured, so neither need be recorded.
+ * Every chunk opens with the configuration in force for its first tick, and ticks are numbered from
+ * first_loop_count without gaps, a jump between chunks means records were overwritten before being sent.
+ *
+ * Chunks of earlier builds are still read, their config records stop short and the missing fields decode as
+ * zero, which is how those builds behaved: "RCR1" ends at mains_hz, from before the predictive cutoff, and
+ * "RCR2" at cutoff_taper_c, from before setpoint mode.
+ *
+ * Ticks in setpoint mode also depend on the PID and autotune state, which is not recorded. They replay exactly
+ * from a recording that starts in ratio mode or with the chamber well away from the setpoint.
+ */
+
+#define CONTROL_RECORD_MAGIC          "RCR3"
+#define CONTROL_RECORD_MAGIC_V2       "RCR2"
+#define CONTROL_RECORD_MAGIC_V1       "RCR1"
+#define CONTROL_RECORD_HEADER_SIZE    10
+#define CONTROL_RECORD_TICK_SIZE      17
+#define CONTROL_RECORD_CONFIG_SIZE    29
+#define CONTROL_RECORD_CONFIG_V2_SIZE 13
+#define CONTROL_RECORD_CONFIG_V1_SIZE 11
+#define CONTROL_RECORD_MAX_SIZE       CONTROL_RECORD_CONFIG_SIZE
+
+// Ring capacity in records, at one tick a second this is over 8 minutes
+#define CONTROL_RECORD_SLOTS          512
+
+enum control_record_type_t : uint8_t {
+  CONTROL_RECORD_TICK = 0x01,
+  CONTROL_RECORD_CONFIG = 0x02,
+};
+
+/**
+ * One decoded record.
+ */
+struct control_record_t {
+  control_record_type_t type;
+
+  // Tick records
+  uint32_t loop_count;
+  control_inputs_t inputs;
+  uint8_t input_duty;
+  uint8_t output_duty;
+
+  // Config records
+  uint16_t cfg_version;
+  control_cfg_t cfg;
+};
+
+void control_record_init();
+
+/**
+ * Appends a tick, preceded by a config record when `cfg_version` changed. Called from the control task only.
+ */
+void control_record_tick(const control_inputs_t &in, const control_state_t &state, uint16_t cfg_version,
+                         const control_cfg_t &cfg);
+
+/**
+ * Moves as many pending records as fit into a chunk.
+ * @return Chunk length, or 0 when nothing is pending or `size` cannot hold a single tick.
+ */
+size_t control_record_drain(uint8_t *buf, size_t size);
+
+/**
+ * Number of records overwritten before they could be drained since boot.
+ */
+uint32_t control_record_dropped();
+
+/**
+ * Pull decoder over one or more concatenated chunks.
+ */
+struct control_record_reader_t {
+  const uint8_t *pos;
+  const uint8_t *end;
+  uint16_t remaining;
+  uint32_t loop_count;
+  size_t config_size;
+};
+
+void control_record_reader_init(control_record_reader_t *r, const uint8_t *buf, size_t len);
+
+/**
+ * Decodes the next record.
+ * @return ESP_OK, ESP_ERR_NOT_FOUND at the end of the input, or ESP_ERR_INVALID_RESPONSE when it is malformed.
+ */
+esp_err_t control_record_next(control_record_reader_t *r, control_record_t *record);
@@ -5,32 +5,57 @@
 #include "device_info.h"
 #include "shadow/shadow_handler.h"
 #include "common/identity.h"
+#include "schema.h"
+#include "fmt.h"
 
 #define TAG "device_info"
 #define NVS_STATS_NAMESPACE "stats"
 
+struct device_info_t {
+  const char *thing_type;
+  const char *fw_version;
+  const char *build_date;
+  const char *build_type;
+};
+
+static const schema_field_t s_info_fields[] = {
+    SCHEMA_FIELD(device_info_t, thing_type),
+    SCHEMA_FIELD(device_info_t, fw_version),
+    SCHEMA_FIELD(device_info_t, build_date),
+    SCHEMA_FIELD(device_info_t, build_type),
+};
+static const schema_t s_info_schema = SCHEMA_DEFINE(s_info_fields);
+
 static device_shadow_handle_t shadow_handle {};
 static  bool _update_required = false;
 
 void device_info_send(char* buffer, size_t max_len) {
-  static const char* metrics_format =
-    R"({
-      "state": {
-        "reported": {
-          "thing_type:": "%s",
-          "hw_version": %)" PRIu8 R"(.%)" PRIu8 R"(,
-          "fw_version": "%s",
-          "build_date": "%s",
-          "build_type": "%s"
-          }
-        }
-      })";
   auto identity = identity_get();
-  size_t len = snprintf(buffer, max_len, metrics_format,
-          CMAKE_THING_TYPE,
-          identity->hardware_major, identity->hardware_minor,
-          esp_app_get_description()->version,
-          __DATE__, CMAKE_BUILD_TYPE);
+  device_info_t info = {
+      .thing_type = CMAKE_THING_TYPE,
+      .fw_version = esp_app_get_description()->version,
+      .build_date = __DATE__,
+      .build_type = CMAKE_BUILD_TYPE,
+  };
+
+  // Hardware version is reported as a number, e.g. 1.2
+  char hw_version[8];
+  size_t n = fmt_u32(hw_version, sizeof(hw_version) - 1, identity->hardware_major);
+  hw_version[n++] = '.';
+  n += fmt_u32(hw_version + n, sizeof(hw_version) - n - 1, identity->hardware_minor);
+  hw_version[n] = '\0';
+
+  json_writer_t w;
+  json_writer_init(&w, buffer, max_len);
+  json_begin_object(&w, nullptr);
+  json_begin_object(&w, "state");
+  json_begin_object(&w, "reported");
+  json_write_fields(&w, s_info_schema, &info);
+  json_write_raw(&w, "hw_version", hw_version);
+  json_end_object(&w);
+  json_end_object(&w);
+  json_end_object(&w);
+  size_t len = json_writer_finish(&w);
 
   printf("%s\n", buffer);
   shadow_handler_update(shadow_handle, buffer, len);
@@ -1,21 +1,185 @@
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <atomic>
 #include "digital_input.h"
 
-#include <driver/gpio.h>
+#define TAG "digital_input"
 
-bool digital_input_is_on(gpio_num_t gpio) {
-  return gpio_get_level(gpio) == 0;
+enum input_phase_t : uint8_t {
+  INPUT_IDLE = 0,
+  // An edge came, the level is taken once it held for the debounce time
+  INPUT_SETTLING = 1,
+  // On, waiting out the long press time
+  INPUT_HOLDING = 2,
+};
+
+struct input_t {
+  digital_input_cfg_t cfg;
+  esp_timer_handle_t timer;
+  volatile bool on;
+  uint8_t phase;
+  // First edge of the change settling, and the edge the input went on with
+  int64_t edge_us;
+  int64_t on_us;
+  bool long_pressed;
+};
+
+// Inputs are added at init, their state after under the lock from the GPIO and esp_timer interrupts
+static input_t s_inputs[DIGITAL_INPUT_MAX];
+static int s_count = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Single producer, the esp_timer interrupt, and single consumer ring
+static digital_input_event_t s_events[DIGITAL_INPUT_QUEUE_SLOTS];
+static std::atomic<uint32_t> s_head{0};
+static std::atomic<uint32_t> s_tail{0};
+static uint32_t s_dropped = 0;
+
+static digital_input_notify_t s_notify = nullptr;
+static void *s_notify_arg = nullptr;
+
+static IRAM_ATTR bool _push(gpio_num_t gpio, digital_input_event_type_t type, int64_t time_us) {
+  uint32_t head = s_head.load(std::memory_order_relaxed);
+  if (head - s_tail.load(std::memory_order_acquire) >= DIGITAL_INPUT_QUEUE_SLOTS) {
+    s_dropped++;
+    return false;
+  }
+  s_events[head % DIGITAL_INPUT_QUEUE_SLOTS] = {.gpio = gpio, .type = type, .time_us = time_us};
+  s_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+static IRAM_ATTR bool _level_on(const input_t &input) {
+  return (gpio_get_level(input.cfg.gpio) == 0) == input.cfg.active_low;
+}
+
+/* Any edge restarts the debounce time, a bouncing contact settles once, called under the lock */
+static IRAM_ATTR void _settle(input_t *input, int64_t now) {
+  if (input->phase != INPUT_SETTLING) {
+    input->edge_us = now;
+    input->phase = INPUT_SETTLING;
+  }
+  esp_timer_stop(input->timer);
+  esp_timer_start_once(input->timer, input->cfg.debounce_us);
+}
+
+static IRAM_ATTR void _on_edge(void *arg) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&s_lock);
+  _settle((input_t *) arg, now);
+  portEXIT_CRITICAL_ISR(&s_lock);
+}
+
+static IRAM_ATTR void _on_timer(void *arg) {
+  auto input = (input_t *) arg;
+  int64_t now = esp_timer_get_time();
+  bool queued = false;
+  portENTER_CRITICAL_ISR(&s_lock);
+  if (input->phase == INPUT_SETTLING) {
+    bool on = _level_on(*input);
+    input->phase = INPUT_IDLE;
+    if (on != input->on) {
+      input->on = on;
+      queued = _push(input->cfg.gpio, on ? DIGITAL_INPUT_ON : DIGITAL_INPUT_OFF, input->edge_us);
+      if (on) {
+        input->on_us = input->edge_us;
+        input->long_pressed = false;
+      }
+    }
+    // Counted from the edge it went on with, a bounce while held does not start it again
+    if (input->on && input->cfg.long_press_us && !input->long_pressed) {
+      int64_t remaining = input->on_us + input->cfg.long_press_us - now;
+      input->phase = INPUT_HOLDING;
+      esp_timer_start_once(input->timer, remaining > 0 ? remaining : 1);
+    }
+  } else if (input->phase == INPUT_HOLDING) {
+    input->phase = INPUT_IDLE;
+    input->long_pressed = true;
+    queued = _push(input->cfg.gpio, DIGITAL_INPUT_LONG_PRESS, now);
+  }
+  portEXIT_CRITICAL_ISR(&s_lock);
+
+  if (queued && s_notify) {
+    s_notify(s_notify_arg);
+  }
 }
 
-void digital_input_init(gpio_num_t gpio) {
+esp_err_t digital_input_add(const digital_input_cfg_t &cfg) {
+  if (s_count >= DIGITAL_INPUT_MAX) {
+    ESP_LOGE(TAG, "No room for GPIO %d, %d inputs at most", cfg.gpio, DIGITAL_INPUT_MAX);
+    return ESP_ERR_NO_MEM;
+  }
+  input_t *input = &s_inputs[s_count];
+  *input = {.cfg = cfg};
+
+  esp_timer_create_args_t timer_args = {
+      .callback = _on_timer,
+      .arg = input,
+      .dispatch_method = ESP_TIMER_ISR,
+      .name = "digital_input",
+      .skip_unhandled_events = false,
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &input->timer));
+
   gpio_config_t io_conf;
-  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.intr_type = GPIO_INTR_ANYEDGE;
   io_conf.mode = GPIO_MODE_INPUT;
-  io_conf.pin_bit_mask = (
-      (1ULL << gpio)
-  );
-
-  // Pull-up high is disable by default, safety state
+  io_conf.pin_bit_mask = (1ULL << cfg.gpio);
   io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-  io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+  io_conf.pull_up_en = cfg.pull_up ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE;
   gpio_config(&io_conf);
+
+  input->on = _level_on(*input);
+  s_count++;
+  ESP_ERROR_CHECK(gpio_isr_handler_add(cfg.gpio, _on_edge, input));
+  return ESP_OK;
+}
+
+bool digital_input_is_on(gpio_num_t gpio) {
+  for (int i = 0; i < s_count; i++) {
+    if (s_inputs[i].cfg.gpio == gpio) {
+      return s_inputs[i].on;
+    }
+  }
+  return false;
+}
+
+void digital_input_resync() {
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < s_count; i++) {
+    input_t *input = &s_inputs[i];
+    bool on = _level_on(*input);
+    portENTER_CRITICAL(&s_lock);
+    bool missed = on != input->on && input->phase != INPUT_SETTLING;
+    if (missed) {
+      _settle(input, now);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (missed) {
+      ESP_LOGD(TAG, "Missed an edge on GPIO %d", input->cfg.gpio);
+    }
+  }
+}
+
+bool digital_input_take(digital_input_event_t *event) {
+  uint32_t tail = s_tail.load(std::memory_order_relaxed);
+  if (tail == s_head.load(std::memory_order_acquire)) {
+    return false;
+  }
+  *event = s_events[tail % DIGITAL_INPUT_QUEUE_SLOTS];
+  s_tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+uint32_t digital_input_dropped() {
+  return s_dropped;
+}
+
+void digital_input_set_notify(digital_input_notify_t notify, void *arg) {
+  portENTER_CRITICAL(&s_lock);
+  s_notify = notify;
+  s_notify_arg = arg;
+  portEXIT_CRITICAL(&s_lock);
 }
@@ -1,17 +1,78 @@
 #pragma once
 
+#include <cstdint>
+#include <esp_err.h>
 #include <driver/gpio.h>
 
+/**
+ * Digital inputs of the board behind one service. Each input interrupts on both edges and a change is taken once
+ * the level has held for the input's debounce time, so a bouncing contact is one change and a held one no longer
+ * interrupts at all. Changes are queued as events stamped with the edge that started them, and an input held on
+ * for its long press time queues a long press as well.
+ *
+ * Events are queued from the esp_timer interrupt only, its one producer, into a lock-free ring taken by a single
+ * consumer task, which the notify callback wakes straight away.
+ */
+
+#define DIGITAL_INPUT_MAX           4
+// Events waiting to be taken, a power of two
+#define DIGITAL_INPUT_QUEUE_SLOTS   16
+
+enum digital_input_event_type_t : uint8_t {
+  DIGITAL_INPUT_ON = 1,
+  DIGITAL_INPUT_OFF = 2,
+  DIGITAL_INPUT_LONG_PRESS = 3,
+};
+
+struct digital_input_cfg_t {
+  gpio_num_t gpio;
+  // On while the pin is low
+  bool active_low;
+  // Internal pull up enabled, otherwise the pin floats and the board pulls it
+  bool pull_up;
+  uint32_t debounce_us;
+  // Time on from the edge to a long press, 0 for none
+  uint32_t long_press_us;
+};
+
+struct digital_input_event_t {
+  gpio_num_t gpio;
+  digital_input_event_type_t type;
+  // First edge of the change, or when the long press time was reached
+  int64_t time_us;
+};
+
+/**
+ * Called from the esp_timer interrupt once events were queued, must be in IRAM.
+ */
+typedef void (*digital_input_notify_t)(void *arg);
 
 /**
- * Returns true if enabled
+ * Configures the pin and starts watching it, its level now is the initial state and queues nothing.
+ * @return ESP_ERR_NO_MEM with DIGITAL_INPUT_MAX inputs added already
+ */
+esp_err_t digital_input_add(const digital_input_cfg_t &cfg);
+
+/**
+ * Debounced state, false for a pin not added.
  */
 bool digital_input_is_on(gpio_num_t gpio);
 
+/**
+ * Settles again any input whose level differs from its state, an edge lost while the chip was in light sleep.
+ * Called by the consumer task now and then, once a tick.
+ */
+void digital_input_resync();
+
+/**
+ * Takes the oldest event, consumer task only.
+ * @return false when none is waiting
+ */
+bool digital_input_take(digital_input_event_t *event);
 
 /**
- * Associated digital input pin
- * @param gpio
+ * Events dropped with the queue full since boot.
  */
-void digital_input_init(gpio_num_t gpio);
+uint32_t digital_input_dropped();
 
+void digital_input_set_notify(digital_input_notify_t notify, void *arg);
@@ -0,0 +1,203 @@
+#include <nvs.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <algorithm>
+#include <cstring>
+#include "flash_ops.h"
+#include "flight_recorder.h"
+
+#define TAG "flash_ops"
+
+enum flash_op_type_t : uint8_t {
+  FLASH_OP_BLOB = 0,
+  FLASH_OP_U32 = 1,
+};
+
+enum flash_op_state_t : uint8_t {
+  FLASH_OP_FREE = 0,
+  FLASH_OP_PENDING = 1,
+  // Taken by flash_ops_run(), a newer value of the key goes in another slot
+  FLASH_OP_WRITING = 2,
+};
+
+struct flash_op_t {
+  uint8_t state;
+  uint8_t type;
+  // Queue order
+  uint32_t seq;
+  char ns[NVS_KEY_NAME_MAX_SIZE];
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  size_t size;
+  uint8_t value[FLASH_OPS_MAX_SIZE];
+  flash_op_done_t done;
+  int64_t queued_us;
+};
+
+static const schema_field_t s_metrics_fields[] = {
+    SCHEMA_FIELD(flash_ops_metrics_t, writes),
+    SCHEMA_FIELD(flash_ops_metrics_t, failures),
+    SCHEMA_FIELD(flash_ops_metrics_t, coalesced),
+    SCHEMA_FIELD(flash_ops_metrics_t, rejected),
+    SCHEMA_FIELD(flash_ops_metrics_t, pending),
+    SCHEMA_FIELD(flash_ops_metrics_t, max_write_us),
+    SCHEMA_FIELD(flash_ops_metrics_t, max_wait_us),
+};
+const schema_t flash_ops_metrics_schema = SCHEMA_DEFINE(s_metrics_fields);
+
+// Slots and metrics, under the lock. A value is copied in or out of its slot under it, they are small.
+static flash_op_t s_ops[FLASH_OPS_SLOTS];
+static uint32_t s_seq = 0;
+static flash_ops_metrics_t s_metrics = {};
+static bool s_started = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_err_t _write(const flash_op_t &op) {
+  nvs_handle_t nvs_handle;
+  esp_err_t err = nvs_open(op.ns, NVS_READWRITE, &nvs_handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (op.type == FLASH_OP_U32) {
+    uint32_t value;
+    memcpy(&value, op.value, sizeof(value));
+    err = nvs_set_u32(nvs_handle, op.key, value);
+  } else {
+    err = nvs_set_blob(nvs_handle, op.key, op.value, op.size);
+  }
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_handle);
+  }
+  nvs_close(nvs_handle);
+  return err;
+}
+
+/* Writes a taken op and frees its slot, outside the lock */
+static esp_err_t _run(flash_op_t *op) {
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = _write(*op);
+  int64_t end = esp_timer_get_time();
+  flash_op_done_t done = op->done;
+  flight_recorder_event(FLIGHT_RECORD_FLASH, (uint32_t) (end - start), err);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write key %s in ns %s: %s", op->key, op->ns, esp_err_to_name(err));
+  }
+
+  portENTER_CRITICAL(&s_lock);
+  s_metrics.writes++;
+  s_metrics.failures += err != ESP_OK;
+  s_metrics.max_write_us = std::max(s_metrics.max_write_us, (uint32_t) (end - start));
+  s_metrics.max_wait_us = std::max(s_metrics.max_wait_us, (uint32_t) (start - op->queued_us));
+  op->state = FLASH_OP_FREE;
+  portEXIT_CRITICAL(&s_lock);
+
+  if (done) {
+    done(err);
+  }
+  return err;
+}
+
+static esp_err_t _queue(flash_op_type_t type, const char *ns, const char *key, const void *value, size_t size,
+                        flash_op_done_t done) {
+  if (size > FLASH_OPS_MAX_SIZE || strlen(ns) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+    ESP_LOGE(TAG, "Cannot write key %s in ns %s, %d bytes", key, ns, size);
+    portENTER_CRITICAL(&s_lock);
+    s_metrics.rejected++;
+    portEXIT_CRITICAL(&s_lock);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  flash_op_t *op = nullptr;
+  bool replaced = false, now = false;
+  portENTER_CRITICAL(&s_lock);
+  for (auto &slot: s_ops) {
+    if (slot.state == FLASH_OP_PENDING && strcmp(slot.ns, ns) == 0 && strcmp(slot.key, key) == 0) {
+      // Keeps its place in the queue
+      op = &slot;
+      replaced = true;
+      break;
+    }
+    if (!op && slot.state == FLASH_OP_FREE) {
+      op = &slot;
+    }
+  }
+  if (op) {
+    if (!replaced) {
+      op->seq = s_seq++;
+      op->queued_us = esp_timer_get_time();
+      strcpy(op->ns, ns);
+      strcpy(op->key, key);
+    }
+    // Taken straight away when not started, nothing else touches it then
+    now = !s_started;
+    op->state = now ? FLASH_OP_WRITING : FLASH_OP_PENDING;
+    op->type = type;
+    op->size = size;
+    memcpy(op->value, value, size);
+    op->done = done;
+  }
+  s_metrics.coalesced += replaced;
+  s_metrics.rejected += !op;
+  portEXIT_CRITICAL(&s_lock);
+
+  if (!op) {
+    ESP_LOGE(TAG, "Queue full, dropped key %s in ns %s", key, ns);
+    return ESP_ERR_NO_MEM;
+  }
+  return now ? _run(op) : ESP_OK;
+}
+
+esp_err_t flash_ops_write_blob(const char *ns, const char *key, const void *value, size_t size,
+                               flash_op_done_t done) {
+  return _queue(FLASH_OP_BLOB, ns, key, value, size, done);
+}
+
+esp_err_t flash_ops_write_u32(const char *ns, const char *key, uint32_t value) {
+  return _queue(FLASH_OP_U32, ns, key, &value, sizeof(value), nullptr);
+}
+
+bool flash_ops_run() {
+  flash_op_t *op = nullptr;
+  portENTER_CRITICAL(&s_lock);
+  for (auto &slot: s_ops) {
+    if (slot.state == FLASH_OP_PENDING && (!op || (int32_t) (slot.seq - op->seq) < 0)) {
+      op = &slot;
+    }
+  }
+  if (op) {
+    op->state = FLASH_OP_WRITING;
+  }
+  portEXIT_CRITICAL(&s_lock);
+
+  if (op) {
+    _run(op);
+  }
+  return op != nullptr;
+}
+
+void flash_ops_start() {
+  portENTER_CRITICAL(&s_lock);
+  s_started = true;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void flash_ops_stop() {
+  portENTER_CRITICAL(&s_lock);
+  s_started = false;
+  portEXIT_CRITICAL(&s_lock);
+  // Nothing is queued any more, drain what was
+  for (int i = 0; i < FLASH_OPS_SLOTS; i++) {
+    flash_ops_run();
+  }
+}
+
+flash_ops_metrics_t flash_ops_get_metrics() {
+  portENTER_CRITICAL(&s_lock);
+  flash_ops_metrics_t metrics = s_metrics;
+  metrics.pending = 0;
+  for (auto &slot: s_ops) {
+    metrics.pending += slot.state == FLASH_OP_PENDING;
+  }
+  portEXIT_CRITICAL(&s_lock);
+  return metrics;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+#include "schema.h"
+
+/**
+ * NVS writes queued from any task and run by the control task just after its tick, one key and its commit at a
+ * time, so the flash cache is only ever disabled in the idle part of the tick period. Writing a key still waiting
+ * replaces its value, settings saved in bursts are written once.
+ *
+ * Until flash_ops_start(), at boot or in a benchmark build where no SSR is powered, writes run in the calling
+ * task straight away.
+ */
+
+#define FLASH_OPS_SLOTS     8
+// Largest value, a stored profile
+#define FLASH_OPS_MAX_SIZE  160
+
+/**
+ * Called on the control task once a queued write is done, with its result.
+ */
+typedef void (*flash_op_done_t)(esp_err_t err);
+
+struct flash_ops_metrics_t {
+  // Writes done since boot, and those that failed
+  uint32_t writes;
+  uint32_t failures;
+  // Writes replaced by a newer value of the key before they ran, and those refused with the queue full
+  uint32_t coalesced;
+  uint32_t rejected;
+  uint32_t pending;
+  // Longest write since boot, which bounds the flash cache being disabled by it, and longest wait in the queue
+  uint32_t max_write_us;
+  uint32_t max_wait_us;
+};
+
+extern const schema_t flash_ops_metrics_schema;
+
+/**
+ * Queues a blob write, the value is copied.
+ * @param done Optional, called once it was written
+ * @return ESP_ERR_INVALID_SIZE above FLASH_OPS_MAX_SIZE, ESP_ERR_NO_MEM with the queue full, otherwise the result
+ * of the write when it ran straight away
+ */
+esp_err_t flash_ops_write_blob(const char *ns, const char *key, const void *value, size_t size,
+                               flash_op_done_t done = nullptr);
+
+/**
+ * Queues a 32 bit integer write, as flash_ops_write_blob().
+ */
+esp_err_t flash_ops_write_u32(const char *ns, const char *key, uint32_t value);
+
+/**
+ * Runs the oldest queued write, if any. Control task only, right after its tick.
+ * @return true when a write ran
+ */
+bool flash_ops_run();
+
+/**
+ * From here on writes wait for flash_ops_run().
+ */
+void flash_ops_start();
+
+/**
+ * Runs what is still queued, and writes go back to running straight away.
+ */
+void flash_ops_stop();
+
+flash_ops_metrics_t flash_ops_get_metrics();
@@ -0,0 +1,134 @@
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include "flight_recorder.h"
+
+#define TAG "flight_recorder"
+
+#define FLIGHT_RECORDER_MAGIC   0x46524331  // "FRC1"
+
+struct flight_header_t {
+  uint32_t magic;
+  // Slot the next record goes in, and records held
+  uint16_t head;
+  uint16_t count;
+  uint16_t crc;
+};
+
+struct flight_ring_t {
+  flight_header_t header;
+  flight_record_t records[FLIGHT_RECORDER_SLOTS];
+};
+
+static_assert(sizeof(flight_record_t) == 16, "flight records are 16 bytes");
+
+static const char *s_type_names[FLIGHT_RECORD_TYPE_COUNT] = {
+    "unknown",
+    "tick",
+    "ssr",
+    "command",
+    "config",
+    "trip",
+    "flash",
+    "network",
+    "restart",
+    "input",
+};
+
+// Left alone by every reset but a power on, appended to under the lock
+static RTC_NOINIT_ATTR flight_ring_t s_ring;
+static bool s_ready = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static flight_recorder_previous_t s_previous = {};
+
+static uint16_t _header_crc(const flight_header_t &header) {
+  return esp_rom_crc16_le(0, (const uint8_t *) &header, offsetof(flight_header_t, crc));
+}
+
+/* Over the record with its own CRC left out */
+static uint16_t _record_crc(const flight_record_t &record) {
+  uint16_t crc = esp_rom_crc16_le(0, (const uint8_t *) &record, offsetof(flight_record_t, crc));
+  return esp_rom_crc16_le(crc, (const uint8_t *) &record.tick, sizeof(record) - offsetof(flight_record_t, tick));
+}
+
+/* The record then the header, a reset in between loses the record and nothing else */
+static void _append(flight_record_t &record) {
+  record.time_ms = (uint32_t) (esp_timer_get_time() / 1000);
+  record.crc = _record_crc(record);
+  portENTER_CRITICAL(&s_lock);
+  if (s_ready) {
+    flight_header_t &header = s_ring.header;
+    s_ring.records[header.head] = record;
+    header.head = (header.head + 1) % FLIGHT_RECORDER_SLOTS;
+    header.count = std::min<uint16_t>(header.count + 1, FLIGHT_RECORDER_SLOTS);
+    header.crc = _header_crc(header);
+  }
+  portEXIT_CRITICAL(&s_lock);
+}
+
+static int16_t _decidegrees(float temp) {
+  return std::isfinite(temp) ? (int16_t) std::lround(std::clamp(temp * 10, -32768.0f, 32767.0f)) : INT16_MIN;
+}
+
+void flight_recorder_tick(const control_state_t &state, bool ssr_powered) {
+  flight_record_t record = {.type = FLIGHT_RECORD_TICK};
+  record.flags = (state.motor_on ? FLIGHT_TICK_MOTOR_ON : 0) | (state.heat_off ? FLIGHT_TICK_HEAT_OFF : 0) |
+                 (ssr_powered ? FLIGHT_TICK_SSR_POWERED : 0);
+  record.tick = {
+      .input_duty = state.input_duty,
+      .output_duty = state.output_duty,
+      .fan_duty = state.fan_duty,
+      .tc_status = state.tc_status,
+      .tc_temp = _decidegrees(state.tc_temp),
+      .junction_temp = _decidegrees(state.junction_temp),
+  };
+  _append(record);
+}
+
+void flight_recorder_event(flight_record_type_t type, uint32_t value, uint32_t arg) {
+  flight_record_t record = {.type = type};
+  record.event = {.value = value, .arg = arg};
+  _append(record);
+}
+
+const char *flight_recorder_type_name(uint8_t type) {
+  return type < FLIGHT_RECORD_TYPE_COUNT ? s_type_names[type] : s_type_names[0];
+}
+
+const flight_recorder_previous_t &flight_recorder_previous() {
+  return s_previous;
+}
+
+void flight_recorder_init() {
+  const flight_header_t &header = s_ring.header;
+  s_previous = {};
+  s_previous.valid = header.magic == FLIGHT_RECORDER_MAGIC && header.crc == _header_crc(header) &&
+                     header.head < FLIGHT_RECORDER_SLOTS && header.count <= FLIGHT_RECORDER_SLOTS;
+  if (s_previous.valid) {
+    // Oldest first, from where the ring would next be written
+    for (int i = 0; i < header.count; i++) {
+      const flight_record_t &record =
+          s_ring.records[(header.head + FLIGHT_RECORDER_SLOTS - header.count + i) % FLIGHT_RECORDER_SLOTS];
+      if (record.crc == _record_crc(record)) {
+        s_previous.records[s_previous.count++] = record;
+      } else {
+        s_previous.corrupt++;
+      }
+    }
+    ESP_LOGI(TAG, "Kept %d records of the previous boot, %d corrupt", s_previous.count, s_previous.corrupt);
+  }
+
+  portENTER_CRITICAL(&s_lock);
+  memset(&s_ring, 0, sizeof(s_ring));
+  s_ring.header.magic = FLIGHT_RECORDER_MAGIC;
+  s_ring.header.crc = _header_crc(s_ring.header);
+  s_ready = true;
+  portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include "control_loop.h"
+
+/**
+ * Flight recorder of the last minute or so before a reset, kept in RTC slow memory which a software, panic or
+ * watchdog reset leaves alone. The control task snapshots every tick into a ring, and any task adds trace events
+ * between them, each record checked by its own CRC and the ring by its header's.
+ *
+ * On the next boot flight_recorder_init() keeps what the previous boot recorded, records failing their CRC
+ * dropped, then starts a fresh ring. A power on leaves RTC memory random, it then has nothing to keep.
+ */
+
+// Ring capacity in records, a minute of ticks with events in between, a post-mortem document holds them all
+#define FLIGHT_RECORDER_SLOTS   64
+
+enum flight_record_type_t : uint8_t {
+  // Controller state at the end of a tick, see flight_tick_t
+  FLIGHT_RECORD_TICK = 1,
+  // SSRs powered on or off, value 1 or 0
+  FLIGHT_RECORD_SSR = 2,
+  // Command taken by the control task, value its control_command_type_t
+  FLIGHT_RECORD_COMMAND = 3,
+  // Configuration in force changed, value its version as in the control record
+  FLIGHT_RECORD_CONFIG = 4,
+  // Supervisor tripped, value its supervisor_trip_t, 0 once cleared
+  FLIGHT_RECORD_TRIP = 5,
+  // NVS write run, value its duration in us and arg its esp_err_t
+  FLIGHT_RECORD_FLASH = 6,
+  // MQTT connection or OTA update, value the CORE_MQTT_EVENT id
+  FLIGHT_RECORD_NETWORK = 7,
+  // Restart asked for by the reset button
+  FLIGHT_RECORD_RESTART = 8,
+  // Digital input change, value its GPIO and arg its digital_input_event_type_t
+  FLIGHT_RECORD_INPUT = 9,
+  FLIGHT_RECORD_TYPE_COUNT = 10,
+};
+
+enum flight_tick_flags_t : uint8_t {
+  FLIGHT_TICK_MOTOR_ON = 1 << 0,
+  FLIGHT_TICK_HEAT_OFF = 1 << 1,
+  FLIGHT_TICK_SSR_POWERED = 1 << 2,
+};
+
+struct flight_tick_t {
+  uint8_t input_duty;
+  uint8_t output_duty;
+  uint8_t fan_duty;
+  uint8_t tc_status;
+  // Tenths of a degree
+  int16_t tc_temp;
+  int16_t junction_temp;
+};
+
+struct flight_event_t {
+  uint32_t value;
+  uint32_t arg;
+};
+
+/**
+ * One record, 16 bytes.
+ */
+struct flight_record_t {
+  // Since boot, from esp_timer
+  uint32_t time_ms;
+  uint8_t type;
+  // flight_tick_flags_t of a tick
+  uint8_t flags;
+  uint16_t crc;
+  union {
+    flight_tick_t tick;
+    flight_event_t event;
+  };
+};
+
+/**
+ * What the previous boot recorded, oldest first.
+ */
+struct flight_recorder_previous_t {
+  // Whether RTC memory held a ring at all, false after a power on
+  bool valid;
+  uint16_t count;
+  // Records dropped for failing their CRC, torn by the reset or corrupted
+  uint16_t corrupt;
+  flight_record_t records[FLIGHT_RECORDER_SLOTS];
+};
+
+/**
+ * Snapshots the state at the end of a tick, control task only.
+ */
+void flight_recorder_tick(const control_state_t &state, bool ssr_powered);
+
+/**
+ * Adds a trace event, from any task.
+ */
+void flight_recorder_event(flight_record_type_t type, uint32_t value, uint32_t arg = 0);
+
+/**
+ * Name of a record type on the wire.
+ */
+const char *flight_recorder_type_name(uint8_t type);
+
+/**
+ * The previous boot's records as kept by flight_recorder_init().
+ */
+const flight_recorder_previous_t &flight_recorder_previous();
+
+/**
+ * Keeps the previous boot's records and starts a fresh ring, first thing at boot before anything records.
+ */
+void flight_recorder_init();
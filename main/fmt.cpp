@@ -0,0 +1,111 @@
+#include <cmath>
+#include <cstring>
+#include "fmt.h"
+
+static const char s_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t s_pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+/* Writes digits right to left into the end of `tmp`, returns the first digit. 32-bit division is
+ * native on the target, so only drop to 64-bit division while the value needs it. */
+static char *_digits(char *end, uint64_t value) {
+  char *p = end;
+  while (value > UINT32_MAX) {
+    auto rem = (uint32_t) (value % 100);
+    value /= 100;
+    p -= 2;
+    memcpy(p, &s_digit_pairs[rem * 2], 2);
+  }
+
+  auto v = (uint32_t) value;
+  while (v >= 100) {
+    uint32_t rem = v % 100;
+    v /= 100;
+    p -= 2;
+    memcpy(p, &s_digit_pairs[rem * 2], 2);
+  }
+  if (v >= 10) {
+    p -= 2;
+    memcpy(p, &s_digit_pairs[v * 2], 2);
+  } else {
+    *--p = (char) ('0' + v);
+  }
+  return p;
+}
+
+static size_t _emit(char *buf, size_t size, bool negative, const char *digits, size_t len) {
+  size_t total = len + (negative ? 1 : 0);
+  if (total > size) {
+    return 0;
+  }
+  if (negative) {
+    *buf++ = '-';
+  }
+  memcpy(buf, digits, len);
+  return total;
+}
+
+size_t fmt_u32(char *buf, size_t size, uint32_t value) {
+  return fmt_u64(buf, size, value);
+}
+
+size_t fmt_u64(char *buf, size_t size, uint64_t value) {
+  char tmp[FMT_INT_MAX_LEN];
+  char *end = tmp + sizeof(tmp);
+  char *start = _digits(end, value);
+  return _emit(buf, size, false, start, end - start);
+}
+
+size_t fmt_i64(char *buf, size_t size, int64_t value) {
+  char tmp[FMT_INT_MAX_LEN];
+  char *end = tmp + sizeof(tmp);
+  // Negate in unsigned space so INT64_MIN is handled
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+  char *start = _digits(end, magnitude);
+  return _emit(buf, size, value < 0, start, end - start);
+}
+
+size_t fmt_fixed(char *buf, size_t size, double value, uint8_t decimals) {
+  if (!std::isfinite(value)) {
+    return 0;
+  }
+  if (decimals > FMT_MAX_DECIMALS) {
+    decimals = FMT_MAX_DECIMALS;
+  }
+
+  // Single scale and round, everything after this is integer arithmetic
+  bool negative = std::signbit(value);
+  double scaled = std::fabs(value) * s_pow10[decimals] + 0.5;
+  if (scaled >= 18446744073709551615.0) {
+    return 0;
+  }
+  auto units = (uint64_t) scaled;
+  uint64_t whole = units / s_pow10[decimals];
+  auto frac = (uint32_t) (units - whole * s_pow10[decimals]);
+
+  // Don't print -0.00
+  negative = negative && units != 0;
+
+  char tmp[FMT_INT_MAX_LEN + FMT_MAX_DECIMALS + 1];
+  char *end = tmp + sizeof(tmp);
+  char *p = end;
+  if (decimals) {
+    for (int i = 0; i < decimals; i++) {
+      *--p = (char) ('0' + frac % 10);
+      frac /= 10;
+    }
+    *--p = '.';
+  }
+  char *start = _digits(p, whole);
+  return _emit(buf, size, negative, start, end - start);
+}
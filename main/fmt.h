@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Locale free number formatting into caller supplied buffers.
+ *
+ * These replace printf style formatting on the telemetry path, where newlib's vfprintf is both the largest
+ * stack consumer and the largest CPU cost. None of the functions NUL terminate, they return the number of
+ * characters written, or 0 when the result does not fit in `size`.
+ */
+
+// Largest number of decimals supported by fmt_fixed()
+#define FMT_MAX_DECIMALS    6
+
+// Enough room for any 64-bit integer, sign included
+#define FMT_INT_MAX_LEN     20
+
+size_t fmt_u32(char *buf, size_t size, uint32_t value);
+
+size_t fmt_u64(char *buf, size_t size, uint64_t value);
+
+size_t fmt_i64(char *buf, size_t size, int64_t value);
+
+/**
+ * Writes `value` rounded half away from zero to `decimals` places, e.g. fmt_fixed(buf, 16, 3.14159, 2) -> "3.14".
+ *
+ * Trailing zeros are kept so the output width is stable. Values that are not finite, or whose scaled
+ * magnitude exceeds 64 bits, are not representable and return 0.
+ */
+size_t fmt_fixed(char *buf, size_t size, double value, uint8_t decimals);
@@ -0,0 +1,349 @@
+#include <cstring>
+#include "json_reader.h"
+
+enum {
+  EXPECT_VALUE,
+  EXPECT_VALUE_OR_END,
+  EXPECT_KEY,
+  EXPECT_KEY_OR_END,
+  EXPECT_COLON,
+  EXPECT_COMMA_OR_END,
+  EXPECT_DONE,
+  EXPECT_FAILED,
+};
+
+// Exact powers of ten representable in a double, larger exponents are built by repeated scaling
+static const double s_pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+                                 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool _is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static json_token_type_t _fail(json_reader_t *r) {
+  r->expect = EXPECT_FAILED;
+  return JSON_TOKEN_ERROR;
+}
+
+static void _skip_ws(json_reader_t *r) {
+  while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\n' || *r->pos == '\r')) {
+    r->pos++;
+  }
+}
+
+/* Marks a value as complete, we then either expect a separator or the document is done */
+static void _value_done(json_reader_t *r) {
+  r->expect = r->depth == 0 ? EXPECT_DONE : EXPECT_COMMA_OR_END;
+}
+
+static bool _push(json_reader_t *r, bool object) {
+  if (r->depth >= JSON_READER_MAX_DEPTH) {
+    return false;
+  }
+  r->in_object[r->depth++] = object;
+  r->expect = object ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+  return true;
+}
+
+static void _pop(json_reader_t *r) {
+  r->depth--;
+  _value_done(r);
+}
+
+static bool _read_string(json_reader_t *r, json_token_t *token) {
+  const char *p = r->pos + 1;
+  token->str = p;
+  while (p < r->end) {
+    auto c = (unsigned char) *p;
+    if (c == '"') {
+      token->len = p - token->str;
+      r->pos = p + 1;
+      return true;
+    } else if (c < 0x20) {
+      return false;
+    } else if (c == '\\') {
+      if (++p >= r->end) {
+        return false;
+      }
+      if (*p == 'u') {
+        for (int i = 0; i < 4; i++) {
+          if (++p >= r->end) {
+            return false;
+          }
+          char h = *p;
+          if (!_is_digit(h) && !(h >= 'a' && h <= 'f') && !(h >= 'A' && h <= 'F')) {
+            return false;
+          }
+        }
+      } else if (!strchr("\"\\/bfnrt", *p) || *p == '\0') {
+        return false;
+      }
+    }
+    p++;
+  }
+  return false;
+}
+
+static bool _read_number(json_reader_t *r, json_token_t *token) {
+  const char *p = r->pos;
+  bool negative = false;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+
+  if (*p == '-') {
+    negative = true;
+    p++;
+  }
+  if (p >= r->end || !_is_digit(*p)) {
+    return false;
+  }
+
+  // No leading zeros
+  if (*p == '0') {
+    p++;
+  } else {
+    for (; p < r->end && _is_digit(*p); p++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa ? 1 : 0;
+      } else {
+        exponent++;
+      }
+    }
+  }
+
+  if (p < r->end && *p == '.') {
+    p++;
+    if (p >= r->end || !_is_digit(*p)) {
+      return false;
+    }
+    for (; p < r->end && _is_digit(*p); p++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa ? 1 : 0;
+        exponent--;
+      }
+    }
+  }
+
+  if (p < r->end && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool exp_negative = false;
+    int exp_value = 0;
+    if (p < r->end && (*p == '+' || *p == '-')) {
+      exp_negative = *p == '-';
+      p++;
+    }
+    if (p >= r->end || !_is_digit(*p)) {
+      return false;
+    }
+    for (; p < r->end && _is_digit(*p); p++) {
+      if (exp_value < 10000) {
+        exp_value = exp_value * 10 + (*p - '0');
+      }
+    }
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  double value = (double) mantissa;
+  if (mantissa != 0) {
+    // Anything beyond this is not a number any of our fields could hold
+    if (exponent > 308) {
+      return false;
+    }
+    // Below the smallest denormal whatever the 19 digits of mantissa, it reads as zero as strtod() has it
+    if (exponent < -324 - 19) {
+      exponent = 0;
+      value = 0;
+    }
+    while (exponent > 22) {
+      value *= 1e22;
+      exponent -= 22;
+    }
+    while (exponent < -22) {
+      value /= 1e22;
+      exponent += 22;
+    }
+    value = exponent >= 0 ? value * s_pow10[exponent] : value / s_pow10[-exponent];
+  }
+
+  token->number = negative ? -value : value;
+  r->pos = p;
+  return true;
+}
+
+static bool _read_literal(json_reader_t *r, const char *literal) {
+  size_t len = strlen(literal);
+  if ((size_t) (r->end - r->pos) < len || memcmp(r->pos, literal, len) != 0) {
+    return false;
+  }
+  r->pos += len;
+  return true;
+}
+
+static json_token_type_t _read_value(json_reader_t *r, json_token_t *token) {
+  switch (*r->pos) {
+    case '{':
+      r->pos++;
+      return _push(r, true) ? JSON_TOKEN_OBJECT_START : _fail(r);
+    case '[':
+      r->pos++;
+      return _push(r, false) ? JSON_TOKEN_ARRAY_START : _fail(r);
+    case '"':
+      if (!_read_string(r, token)) {
+        return _fail(r);
+      }
+      _value_done(r);
+      return JSON_TOKEN_STRING;
+    case 't':
+      if (!_read_literal(r, "true")) {
+        return _fail(r);
+      }
+      _value_done(r);
+      return JSON_TOKEN_TRUE;
+    case 'f':
+      if (!_read_literal(r, "false")) {
+        return _fail(r);
+      }
+      _value_done(r);
+      return JSON_TOKEN_FALSE;
+    case 'n':
+      if (!_read_literal(r, "null")) {
+        return _fail(r);
+      }
+      _value_done(r);
+      return JSON_TOKEN_NULL;
+    default:
+      if (!_read_number(r, token)) {
+        return _fail(r);
+      }
+      _value_done(r);
+      return JSON_TOKEN_NUMBER;
+  }
+}
+
+void json_reader_init(json_reader_t *r, const char *buf, size_t len, uint16_t max_tokens) {
+  *r = {};
+  r->pos = buf;
+  r->end = buf + len;
+  r->max_tokens = max_tokens;
+  r->expect = EXPECT_VALUE;
+}
+
+json_token_type_t json_next(json_reader_t *r, json_token_t *token) {
+  token->type = JSON_TOKEN_ERROR;
+  token->str = nullptr;
+  token->len = 0;
+  token->number = 0;
+
+  if (r->expect == EXPECT_FAILED) {
+    return JSON_TOKEN_ERROR;
+  }
+  if (++r->tokens > r->max_tokens) {
+    return _fail(r);
+  }
+
+  while (true) {
+    _skip_ws(r);
+    if (r->expect == EXPECT_DONE) {
+      // Only whitespace may follow the root value
+      return token->type = r->pos == r->end ? JSON_TOKEN_END : _fail(r);
+    }
+    if (r->pos >= r->end) {
+      return _fail(r);
+    }
+
+    char c = *r->pos;
+    switch (r->expect) {
+      case EXPECT_VALUE_OR_END:
+        if (c == ']') {
+          r->pos++;
+          _pop(r);
+          return token->type = JSON_TOKEN_ARRAY_END;
+        }
+        // fall through
+      case EXPECT_VALUE:
+        return token->type = _read_value(r, token);
+
+      case EXPECT_KEY_OR_END:
+        if (c == '}') {
+          r->pos++;
+          _pop(r);
+          return token->type = JSON_TOKEN_OBJECT_END;
+        }
+        // fall through
+      case EXPECT_KEY:
+        if (c != '"' || !_read_string(r, token)) {
+          return _fail(r);
+        }
+        r->expect = EXPECT_COLON;
+        return token->type = JSON_TOKEN_KEY;
+
+      case EXPECT_COLON:
+        if (c != ':') {
+          return _fail(r);
+        }
+        r->pos++;
+        r->expect = EXPECT_VALUE;
+        break;
+
+      case EXPECT_COMMA_OR_END: {
+        bool in_object = r->in_object[r->depth - 1];
+        r->pos++;
+        if (c == ',') {
+          r->expect = in_object ? EXPECT_KEY : EXPECT_VALUE;
+        } else if ((c == '}' && in_object) || (c == ']' && !in_object)) {
+          _pop(r);
+          return token->type = in_object ? JSON_TOKEN_OBJECT_END : JSON_TOKEN_ARRAY_END;
+        } else {
+          return _fail(r);
+        }
+        break;
+      }
+
+      default:
+        return _fail(r);
+    }
+  }
+}
+
+bool json_skip(json_reader_t *r, const json_token_t *first) {
+  if (first->type != JSON_TOKEN_OBJECT_START && first->type != JSON_TOKEN_ARRAY_START) {
+    return first->type != JSON_TOKEN_ERROR && first->type != JSON_TOKEN_END;
+  }
+
+  uint8_t target = r->depth - 1;
+  json_token_t token;
+  do {
+    switch (json_next(r, &token)) {
+      case JSON_TOKEN_ERROR:
+      case JSON_TOKEN_END:
+        return false;
+      default:
+        break;
+    }
+  } while (r->depth > target);
+  return true;
+}
+
+bool json_token_is(const json_token_t *token, const char *str) {
+  return (token->type == JSON_TOKEN_KEY || token->type == JSON_TOKEN_STRING) &&
+         strncmp(token->str, str, token->len) == 0 && str[token->len] == '\0';
+}
+
+bool json_validate(const char *buf, size_t len, uint16_t max_tokens) {
+  json_reader_t r;
+  json_token_t token;
+  json_reader_init(&r, buf, len, max_tokens);
+  while (true) {
+    switch (json_next(&r, &token)) {
+      case JSON_TOKEN_END:
+        return true;
+      case JSON_TOKEN_ERROR:
+        return false;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Pull tokenizer for JSON documents, used to parse shadow deltas without building a DOM.
+ *
+ * The reader walks the caller's buffer in place, strings are returned as slices into it and nothing is
+ * allocated. Nesting depth and the number of tokens are bounded, anything malformed or over budget puts the
+ * reader in a sticky error state.
+ */
+
+#define JSON_READER_MAX_DEPTH   8
+// Default token budget, a document known to be larger is read with its own
+#define JSON_READER_MAX_TOKENS  256
+
+enum json_token_type_t : uint8_t {
+  JSON_TOKEN_ERROR,
+  JSON_TOKEN_END,
+  JSON_TOKEN_OBJECT_START,
+  JSON_TOKEN_OBJECT_END,
+  JSON_TOKEN_ARRAY_START,
+  JSON_TOKEN_ARRAY_END,
+  JSON_TOKEN_KEY,
+  JSON_TOKEN_STRING,
+  JSON_TOKEN_NUMBER,
+  JSON_TOKEN_TRUE,
+  JSON_TOKEN_FALSE,
+  JSON_TOKEN_NULL,
+};
+
+struct json_token_t {
+  json_token_type_t type;
+  // Raw contents of keys and strings, escapes are validated but not decoded
+  const char *str;
+  size_t len;
+  double number;
+};
+
+struct json_reader_t {
+  const char *pos;
+  const char *end;
+  uint16_t tokens;
+  uint16_t max_tokens;
+  uint8_t depth;
+  uint8_t expect;
+  bool in_object[JSON_READER_MAX_DEPTH];
+};
+
+void json_reader_init(json_reader_t *r, const char *buf, size_t len, uint16_t max_tokens = JSON_READER_MAX_TOKENS);
+
+/**
+ * Reads the next token.
+ * @return Token type, JSON_TOKEN_END once the root value is complete or JSON_TOKEN_ERROR on malformed input.
+ */
+json_token_type_t json_next(json_reader_t *r, json_token_t *token);
+
+/**
+ * Skips the remainder of a value given its first token, e.g. a whole object after JSON_TOKEN_OBJECT_START.
+ * @return false on malformed input.
+ */
+bool json_skip(json_reader_t *r, const json_token_t *first);
+
+/**
+ * True when the token is a key or string equal to `str`.
+ */
+bool json_token_is(const json_token_t *token, const char *str);
+
+/**
+ * Checks the whole document is well formed and within the reader budget.
+ */
+bool json_validate(const char *buf, size_t len, uint16_t max_tokens = JSON_READER_MAX_TOKENS);
@@ -1,11 +1,17 @@
 #include <hal/gpio_types.h>
 #include <driver/gpio.h>
+#include <esp_attr.h>
+#include <soc/gpio_struct.h>
+#include "board.h"
 #include "level_shifter.h"
 
-#define LS_PIN_EN GPIO_NUM_5
-
-void level_shifter_enable(bool enable) {
-  gpio_set_level(LS_PIN_EN, !enable ? 0 : 1);
+IRAM_ATTR void level_shifter_enable(bool enable) {
+  // A single register store, so the SSRs can be isolated from an interrupt or with the flash cache disabled
+  if (enable) {
+    GPIO.out_w1ts = BOARD_LEVEL_SHIFTER_MASK;
+  } else {
+    GPIO.out_w1tc = BOARD_LEVEL_SHIFTER_MASK;
+  }
 }
 
 void level_shifter_init() {
@@ -14,7 +20,7 @@ void level_shifter_init() {
   io_conf.intr_type = GPIO_INTR_DISABLE;
   io_conf.mode = GPIO_MODE_OUTPUT;
   io_conf.pin_bit_mask = (
-      (1ULL << LS_PIN_EN)
+      (1ULL << BOARD.level_shifter_en)
   );
 
   io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
@@ -1,5 +1,8 @@
 #pragma once
 
+/**
+ * Connects the SSR outputs to the SSRs, or isolates them. Safe to call from an ISR.
+ */
 void level_shifter_enable(bool enable);
 
 void level_shifter_init();
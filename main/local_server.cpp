@@ -0,0 +1,484 @@
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <esp_check.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
+#include <freertos/FreeRTOS.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "local_server.h"
+#include "json_reader.h"
+#include "utils.h"
+#include "task_plan.h"
+
+#define TAG "local_server"
+
+#define NONCE_SIZE          8
+#define MAC_SIZE            32
+#define REQUEST_MAX_SIZE    256
+#define REPLY_MAX_SIZE      512
+#define STATUS_MAX_SIZE     2048
+
+#define SNAPSHOT_VERSION            1
+#define SNAPSHOT_FLAG_MOTOR_ON      (1 << 0)
+#define SNAPSHOT_FLAG_TC_OK         (1 << 1)
+#define SNAPSHOT_FLAG_HEAT_OFF      (1 << 2)
+
+struct client_t {
+  // Socket, -1 when the slot is free
+  int fd;
+  bool subscribed;
+  bool binary;
+  // Last command sequence number accepted, and the nonce commands are authenticated against
+  uint32_t seq;
+  char nonce[2 * NONCE_SIZE + 1];
+};
+
+struct request_t {
+  char command[16];
+  bool has_id;
+  uint32_t id;
+  char format[8];
+  uint32_t value;
+  uint32_t ttl;
+  uint32_t seq;
+  char mac[2 * MAC_SIZE + 1];
+};
+
+static httpd_handle_t s_server = nullptr;
+static std::atomic<bool> s_running{false};
+
+static local_server_cfg_t s_cfg = {
+    .enabled = false,
+    .port = LOCAL_SERVER_DEFAULT_PORT,
+    .key = "",
+};
+
+static const schema_field_t s_cfg_fields[] = {
+    SCHEMA_FIELD(local_server_cfg_t, enabled),
+    SCHEMA_FIELD(local_server_cfg_t, port),
+    SCHEMA_FIELD(local_server_cfg_t, key),
+};
+const schema_t local_server_cfg_schema = SCHEMA_DEFINE(s_cfg_fields);
+
+// Connections, only touched from the server task
+static client_t s_clients[LOCAL_SERVER_MAX_CLIENTS];
+static std::atomic<uint8_t> s_subscribers{0};
+
+// State of the last tick, written by the control task, and whether a send of it is queued on the server task
+static local_snapshot_t s_snapshot = {};
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<bool> s_send_queued{false};
+
+static char s_status[STATUS_MAX_SIZE];
+
+static local_snapshot_t _get_snapshot() {
+  portENTER_CRITICAL(&s_lock);
+  local_snapshot_t snapshot = s_snapshot;
+  portEXIT_CRITICAL(&s_lock);
+  return snapshot;
+}
+
+static client_t *_client(int fd) {
+  for (auto &client: s_clients) {
+    if (client.fd == fd) {
+      return &client;
+    }
+  }
+  return nullptr;
+}
+
+static void _write_data(json_writer_t *w, const local_snapshot_t &s) {
+  bool tc_ok = s.flags & SNAPSHOT_FLAG_TC_OK;
+  json_begin_object(w, "data");
+  json_write_uint(w, "loop_count", s.loop_count);
+  json_write_float(w, "ET", tc_ok ? s.tc_temp : NAN, 2);
+  json_write_float(w, "board", s.junction_temp, 2);
+  json_write_float(w, "ror", s.ror, 1);
+  json_write_uint(w, "heat", s.input_duty);
+  json_write_uint(w, "secondary", s.output_duty);
+  json_write_uint(w, "fan", s.fan_duty);
+  json_write_uint(w, "balance", s.balance);
+  json_write_bool(w, "motor_on", s.flags & SNAPSHOT_FLAG_MOTOR_ON);
+  json_write_bool(w, "heat_off", s.flags & SNAPSHOT_FLAG_HEAT_OFF);
+  json_write_float(w, "ratio_override", s.ratio_override, 3);
+  json_write_uint(w, "command_latency_us", s.command_latency_us);
+  json_end_object(w);
+}
+
+static esp_err_t _send_text(int fd, const char *text, size_t len) {
+  httpd_ws_frame_t frame = {};
+  frame.type = HTTPD_WS_TYPE_TEXT;
+  frame.payload = (uint8_t *) text;
+  frame.len = len;
+  return httpd_ws_send_frame_async(s_server, fd, &frame);
+}
+
+/* Sends the snapshot of the last tick to every subscriber, on the server task */
+static void _broadcast(void *) {
+  s_send_queued = false;
+  local_snapshot_t snapshot = _get_snapshot();
+  char json[REPLY_MAX_SIZE];
+  size_t json_len = 0;
+
+  for (auto &client: s_clients) {
+    if (client.fd < 0 || !client.subscribed) {
+      continue;
+    }
+    esp_err_t err;
+    if (client.binary) {
+      httpd_ws_frame_t frame = {};
+      frame.type = HTTPD_WS_TYPE_BINARY;
+      frame.payload = (uint8_t *) &snapshot;
+      frame.len = sizeof(snapshot);
+      err = httpd_ws_send_frame_async(s_server, client.fd, &frame);
+    } else {
+      if (json_len == 0) {
+        json_writer_t w;
+        json_writer_init(&w, json, sizeof(json));
+        json_begin_object(&w, nullptr);
+        json_write_str(&w, "pushMessage", "data");
+        _write_data(&w, snapshot);
+        json_end_object(&w);
+        json_len = json_writer_finish(&w);
+      }
+      err = _send_text(client.fd, json, json_len);
+    }
+    // A slow or gone client is closed by the server, its slot freed in _on_close()
+    if (err != ESP_OK) {
+      ESP_LOGD(TAG, "Send to %d failed: %s", client.fd, esp_err_to_name(err));
+    }
+  }
+}
+
+static bool _hex_decode(const char *hex, uint8_t *out, size_t size) {
+  if (strlen(hex) != 2 * size) {
+    return false;
+  }
+  for (size_t i = 0; i < size; i++) {
+    unsigned int byte;
+    if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+      return false;
+    }
+    out[i] = (uint8_t) byte;
+  }
+  return true;
+}
+
+/* Checks the request was signed with the key for this connection, and is not a replay of an earlier one */
+static bool _authentic(client_t *client, const request_t &req) {
+  size_t key_len = strlen(s_cfg.key);
+  uint8_t given[MAC_SIZE], expected[MAC_SIZE];
+  if (key_len < LOCAL_SERVER_KEY_MIN_LEN || req.seq <= client->seq || !_hex_decode(req.mac, given, MAC_SIZE)) {
+    return false;
+  }
+
+  char message[96];
+  int len = snprintf(message, sizeof(message), "%s:%lu:%s:%lu:%lu", client->nonce, req.seq, req.command,
+                     req.value, req.ttl);
+  if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t *) s_cfg.key, key_len,
+                      (const uint8_t *) message, len, expected) != 0) {
+    return false;
+  }
+
+  // Constant time, so the MAC cannot be guessed a byte at a time
+  uint8_t diff = 0;
+  for (size_t i = 0; i < MAC_SIZE; i++) {
+    diff |= given[i] ^ expected[i];
+  }
+  if (diff != 0) {
+    return false;
+  }
+  client->seq = req.seq;
+  return true;
+}
+
+static bool _copy_str(const json_token_t &token, char *dst, size_t size) {
+  if (token.type != JSON_TOKEN_STRING || token.len >= size) {
+    return false;
+  }
+  memcpy(dst, token.str, token.len);
+  dst[token.len] = '\0';
+  return true;
+}
+
+static bool _read_uint(const json_token_t &token, uint32_t max, uint32_t *dst) {
+  if (token.type != JSON_TOKEN_NUMBER || token.number != std::floor(token.number) || token.number < 0 ||
+      token.number > max) {
+    return false;
+  }
+  *dst = (uint32_t) token.number;
+  return true;
+}
+
+/* Parses a request, nullptr when it is well formed, or what is wrong with it */
+static const char *_parse(const char *buf, size_t len, request_t *req) {
+  json_reader_t reader;
+  json_token_t key, value;
+  if (!json_validate(buf, len)) {
+    return "malformed";
+  }
+  json_reader_init(&reader, buf, len);
+  if (json_next(&reader, &value) != JSON_TOKEN_OBJECT_START) {
+    return "expected an object";
+  }
+
+  const char *error = nullptr;
+  while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+    json_next(&reader, &value);
+    bool ok = true;
+    if (json_token_is(&key, "command")) {
+      ok = _copy_str(value, req->command, sizeof(req->command));
+    } else if (json_token_is(&key, "id")) {
+      ok = req->has_id = _read_uint(value, UINT32_MAX, &req->id);
+    } else if (json_token_is(&key, "format")) {
+      ok = _copy_str(value, req->format, sizeof(req->format));
+    } else if (json_token_is(&key, "value")) {
+      ok = _read_uint(value, 1000, &req->value);
+    } else if (json_token_is(&key, "ttl")) {
+      ok = _read_uint(value, UINT16_MAX, &req->ttl);
+    } else if (json_token_is(&key, "seq")) {
+      ok = _read_uint(value, UINT32_MAX, &req->seq);
+    } else if (json_token_is(&key, "mac")) {
+      ok = _copy_str(value, req->mac, sizeof(req->mac));
+    } else if (!json_skip(&reader, &value)) {
+      return "malformed";
+    }
+    if (!ok && !error) {
+      error = "invalid value";
+      json_skip(&reader, &value);
+    }
+  }
+  return error;
+}
+
+static void _subscribe(client_t *client, bool on, bool binary) {
+  if (on != client->subscribed) {
+    s_subscribers += on ? 1 : -1;
+  }
+  client->subscribed = on;
+  client->binary = binary;
+}
+
+/* Runs a request, writing the members of its reply */
+static void _handle(client_t *client, const char *buf, size_t len, int64_t received_us, json_writer_t *w) {
+  request_t req = {};
+  const char *error = _parse(buf, len, &req);
+  if (req.has_id) {
+    json_write_uint(w, "id", req.id);
+  }
+  if (error) {
+    json_write_str(w, "error", error);
+    return;
+  }
+
+  control_command_t command = {.type = 0, .ratio_permille = 0, .ttl_s = 0, .received_us = received_us};
+  if (strcmp(req.command, "getData") == 0) {
+    _write_data(w, _get_snapshot());
+    return;
+  } else if (strcmp(req.command, "subscribe") == 0) {
+    _subscribe(client, true, strcmp(req.format, "binary") == 0);
+  } else if (strcmp(req.command, "unsubscribe") == 0) {
+    _subscribe(client, false, false);
+  } else if (strcmp(req.command, "heat_off") == 0) {
+    command.type = CONTROL_COMMAND_HEAT_OFF;
+  } else if (strcmp(req.command, "resume") == 0) {
+    command.type = CONTROL_COMMAND_RESUME;
+  } else if (strcmp(req.command, "ratio") == 0) {
+    command.type = CONTROL_COMMAND_RATIO;
+    command.ratio_permille = req.value;
+    command.ttl_s = req.ttl;
+  } else {
+    json_write_str(w, "error", "unknown command");
+    return;
+  }
+
+  if (command.type != 0) {
+    if (!_authentic(client, req)) {
+      ESP_LOGW(TAG, "Refused %s from %d, not authenticated", req.command, client->fd);
+      json_write_str(w, "error", "not authenticated");
+      return;
+    }
+    esp_err_t err = control_loop_command(command);
+    if (err != ESP_OK) {
+      json_write_str(w, "error", esp_err_to_name(err));
+      return;
+    }
+  }
+  json_write_str(w, "result", "ok");
+}
+
+static esp_err_t _ws_handler(httpd_req_t *req) {
+  int fd = httpd_req_to_sockfd(req);
+  if (req->method == HTTP_GET) {
+    // Handshake done, take a slot and greet the client with the nonce its commands are signed against
+    client_t *client = _client(-1);
+    ESP_RETURN_ON_FALSE(client, ESP_FAIL, TAG, "No slot for connection %d", fd);
+    uint8_t nonce[NONCE_SIZE];
+    esp_fill_random(nonce, sizeof(nonce));
+    *client = {.fd = fd, .subscribed = false, .binary = false, .seq = 0, .nonce = ""};
+    for (int i = 0; i < NONCE_SIZE; i++) {
+      sprintf(client->nonce + 2 * i, "%02x", nonce[i]);
+    }
+
+    char hello[64];
+    int len = snprintf(hello, sizeof(hello), "{\"pushMessage\":\"hello\",\"nonce\":\"%s\"}", client->nonce);
+    ESP_LOGI(TAG, "Client %d connected", fd);
+    return _send_text(fd, hello, len);
+  }
+
+  int64_t received_us = esp_timer_get_time();
+  uint8_t buf[REQUEST_MAX_SIZE];
+  httpd_ws_frame_t frame = {};
+  ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(req, &frame, 0), TAG, "Failed to read frame length");
+  ESP_RETURN_ON_FALSE(frame.len < sizeof(buf), ESP_FAIL, TAG, "Frame of %d bytes too long", frame.len);
+  frame.payload = buf;
+  ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(req, &frame, sizeof(buf)), TAG, "Failed to read frame");
+  client_t *client = _client(fd);
+  if (frame.type != HTTPD_WS_TYPE_TEXT || !client) {
+    return ESP_OK;
+  }
+
+  char reply[REPLY_MAX_SIZE];
+  json_writer_t w;
+  json_writer_init(&w, reply, sizeof(reply));
+  json_begin_object(&w, nullptr);
+  _handle(client, (const char *) buf, frame.len, received_us, &w);
+  json_end_object(&w);
+  size_t len = json_writer_finish(&w);
+  return len ? _send_text(fd, reply, len) : ESP_OK;
+}
+
+static esp_err_t _status_handler(httpd_req_t *req) {
+  size_t len = control_state_format(s_status, sizeof(s_status), controller_get_state(), (uint32_t) time(nullptr));
+  if (len == 0) {
+    ESP_LOGE(TAG, "Status does not fit in %d bytes", sizeof(s_status));
+    return httpd_resp_send_500(req);
+  }
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, s_status, len);
+}
+
+static void _on_close(httpd_handle_t, int fd) {
+  client_t *client = _client(fd);
+  if (client) {
+    ESP_LOGI(TAG, "Client %d disconnected", fd);
+    _subscribe(client, false, false);
+    client->fd = -1;
+  }
+  close(fd);
+}
+
+static esp_err_t _start() {
+  for (auto &client: s_clients) {
+    client.fd = -1;
+  }
+
+  const task_plan_t &plan = task_plan(TASK_LOCAL_SERVER);
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = s_cfg.port;
+  config.task_priority = plan.priority;
+  config.stack_size = plan.stack_size;
+  config.core_id = plan.core;
+  config.lru_purge_enable = true;
+  config.close_fn = _on_close;
+  ESP_RETURN_ON_ERROR(httpd_start(&s_server, &config), TAG, "Failed to start on port %d", s_cfg.port);
+
+  httpd_uri_t status = {.uri = "/", .method = HTTP_GET, .handler = _status_handler, .user_ctx = nullptr};
+  httpd_uri_t ws = {.uri = "/ws", .method = HTTP_GET, .handler = _ws_handler, .user_ctx = nullptr,
+                    .is_websocket = true};
+  httpd_register_uri_handler(s_server, &status);
+  httpd_register_uri_handler(s_server, &ws);
+  s_running = true;
+  ESP_LOGI(TAG, "Listening on port %d, commands %s", s_cfg.port, s_cfg.key[0] ? "enabled" : "refused, no key");
+  return ESP_OK;
+}
+
+static void _stop() {
+  if (s_server) {
+    s_running = false;
+    httpd_stop(s_server);
+    s_server = nullptr;
+    s_subscribers = 0;
+  }
+}
+
+void local_server_notify(const control_state_t &state) {
+  if (!s_running) {
+    return;
+  }
+
+  local_snapshot_t snapshot = {
+      .version = SNAPSHOT_VERSION,
+      .flags = (uint8_t) ((state.motor_on ? SNAPSHOT_FLAG_MOTOR_ON : 0) |
+                          (state.tc_status == 0 ? SNAPSHOT_FLAG_TC_OK : 0) |
+                          (state.heat_off ? SNAPSHOT_FLAG_HEAT_OFF : 0)),
+      .loop_count = state.loop_count,
+      .tc_temp = state.tc_temp,
+      .junction_temp = state.junction_temp,
+      .ror = state.ror,
+      .input_duty = state.input_duty,
+      .output_duty = state.output_duty,
+      .fan_duty = state.fan_duty,
+      .balance = (uint8_t) lround(state.balance),
+      .ratio_override = state.ratio_override,
+      .command_latency_us = state.command_latency_us,
+  };
+  portENTER_CRITICAL(&s_lock);
+  s_snapshot = snapshot;
+  portEXIT_CRITICAL(&s_lock);
+
+  // One send queued at a time, a server task that fell behind sends the latest tick only
+  bool expected = false;
+  if (s_subscribers > 0 && s_send_queued.compare_exchange_strong(expected, true) &&
+      httpd_queue_work(s_server, _broadcast, nullptr) != ESP_OK) {
+    s_send_queued = false;
+  }
+}
+
+local_server_cfg_t local_server_get_cfg() {
+  return s_cfg;
+}
+
+esp_err_t local_server_set_cfg(const local_server_cfg_t &cfg) {
+  size_t key_len = strnlen(cfg.key, sizeof(cfg.key));
+  if (cfg.port == 0) {
+    ESP_LOGE(TAG, "Invalid port: %d", cfg.port);
+    goto error;
+  }
+
+  if (key_len == sizeof(cfg.key) or (key_len > 0 and key_len < LOCAL_SERVER_KEY_MIN_LEN)) {
+    ESP_LOGE(TAG, "Invalid key: %d characters, expected none or [%d, %d]", key_len, LOCAL_SERVER_KEY_MIN_LEN,
+             LOCAL_SERVER_KEY_SIZE - 1);
+    goto error;
+  }
+
+  if (schema_diff(local_server_cfg_schema, &cfg, &s_cfg)) {
+    // Stopped first, the server task reads the key
+    _stop();
+    s_cfg = cfg;
+    utils_save_to_nvs("local", "cfg", &s_cfg, sizeof(local_server_cfg_t));
+    ESP_LOGI(TAG, "Set local server config: enabled=%d, port=%d, key %s", s_cfg.enabled, s_cfg.port,
+             s_cfg.key[0] ? "set" : "empty");
+    if (s_cfg.enabled) {
+      return _start();
+    }
+  }
+  return ESP_OK;
+
+  error:
+  ESP_LOGE(TAG, "Failed to set local server config");
+  return ESP_FAIL;
+}
+
+void local_server_init() {
+  utils_load_from_nvs("local", "cfg", &s_cfg, sizeof(local_server_cfg_t));
+  if (s_cfg.enabled) {
+    _start();
+  }
+}
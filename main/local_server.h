@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <esp_err.h>
+#include "schema.h"
+#include "control_loop.h"
+
+/**
+ * Server on the local network streaming the controller state at the loop rate, and taking commands without a
+ * round trip through the cloud, for Artisan and other roast loggers on the same network.
+ *
+ *   GET /     status document, as published on telemetry/status
+ *   GET /ws   WebSocket
+ *
+ * Text frames carry one JSON object each. Requests follow Artisan's WebSocket defaults, a "command" node and a
+ * message "id" echoed in the reply, with the readings under "data":
+ *
+ *   {"command": "getData", "id": 1}
+ *     -> {"id": 1, "data": {"ET": 201.5, "board": 41.2, "ror": 9.8, "heat": 80, "secondary": 40, ...}}
+ *   {"command": "subscribe", "id": 2, "format": "json" | "binary"}
+ *     -> {"id": 2, "result": "ok"}, then after every control tick {"pushMessage": "data", "data": {...}} or a
+ *        local_snapshot_t binary frame
+ *   {"command": "unsubscribe", "id": 3}
+ *
+ * The thermocouple is the chamber temperature, ET to Artisan, the board has no bean probe to give BT.
+ *
+ * Commands that move the heat must be authenticated. On connect the server pushes
+ * {"pushMessage": "hello", "nonce": "<16 hex digits>"}, and each command carries a sequence number above the
+ * previous one on the connection and the HMAC-SHA256 under the configured key, in lowercase hex, of
+ * "<nonce>:<seq>:<command>:<value>:<ttl>" with absent numbers as 0:
+ *
+ *   {"command": "heat_off", "id": 4, "seq": 1, "mac": "..."}
+ *   {"command": "resume", "id": 5, "seq": 2, "mac": "..."}
+ *   {"command": "ratio", "id": 6, "value": 450, "ttl": 60, "seq": 3, "mac": "..."}   value in thousandths
+ *     -> {"id": 6, "result": "ok"} or {"id": 6, "error": "<reason>"}
+ *
+ * See control_loop_command() for what they do. bin/local_client.py is a client measuring command latency.
+ */
+
+#define LOCAL_SERVER_DEFAULT_PORT   80
+#define LOCAL_SERVER_MAX_CLIENTS    4
+// Key length, shorter keys are refused so commands cannot be forged by a search
+#define LOCAL_SERVER_KEY_MIN_LEN    16
+#define LOCAL_SERVER_KEY_SIZE       65
+
+// Fields of local_server_cfg_schema never reported back to the shadow, the key
+#define LOCAL_SERVER_SECRET_FIELDS  (1UL << 2)
+
+struct local_server_cfg_t {
+  /**
+   * Whether the server runs.
+   */
+  bool enabled;
+
+  /**
+   * TCP port the server listens on.
+   */
+  uint16_t port;
+
+  /**
+   * Shared secret commands are authenticated with, empty to refuse all commands.
+   */
+  char key[LOCAL_SERVER_KEY_SIZE];
+};
+
+/**
+ * Binary snapshot frame, little endian and packed. Version 1.
+ */
+struct __attribute__((packed)) local_snapshot_t {
+  uint8_t version;
+  // Bit 0 motor on, bit 1 thermocouple ok, bit 2 heat held off by a command
+  uint8_t flags;
+  uint32_t loop_count;
+  float tc_temp;
+  float junction_temp;
+  float ror;
+  uint8_t input_duty;
+  uint8_t output_duty;
+  uint8_t fan_duty;
+  uint8_t balance;
+  // NaN when none
+  float ratio_override;
+  uint32_t command_latency_us;
+};
+
+/**
+ * Wire schema for the local section of the config shadow, see LOCAL_SERVER_SECRET_FIELDS.
+ */
+extern const schema_t local_server_cfg_schema;
+
+local_server_cfg_t local_server_get_cfg();
+
+/**
+ * Sets the configuration, starting, restarting or stopping the server as needed.
+ * @return ESP_OK, or ESP_FAIL when a value is out of range.
+ */
+esp_err_t local_server_set_cfg(const local_server_cfg_t &cfg);
+
+/**
+ * Publishes the state of the tick just run to subscribers. Called from the control task, only copies the state
+ * and leaves the sending to the server task.
+ */
+void local_server_notify(const control_state_t &state);
+
+void local_server_init();
@@ -3,6 +3,8 @@
 #include <esp_event.h>
 #include <cstring>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <nvs_flash.h>
 #include "control_loop.h"
 #include "square_wave_gen.h"
 #include "esp_pm.h"
@@ -10,11 +12,19 @@
 #include "ota.h"
 #include "aws_connector.h"
 #include "events.h"
+#include "bench.h"
+#include "task_plan.h"
+#include "flight_recorder.h"
+#include "boot_profile.h"
+#include "telemetry.h"
+#include "app_config.h"
 
 #define TAG  "main"
 
 ESP_EVENT_DEFINE_BASE(MAIN_APP_EVENT);
 static EventGroupHandle_t xNetworkEventGroup;
+// Notified by the control task once the controller is set up
+static TaskHandle_t s_main_task;
 
 static square_wave_handle_t wave_handle;
 /**
@@ -33,19 +43,67 @@ static void _generate_zero_signal() {
 }
 
 
+/*
+ * Sets up the control loop and runs it, on the control core so the interrupts of its GPIOs, timers and SSRs are
+ * allocated there too.
+ */
+static void _control_task(void *) {
+  gpio_install_isr_service(0);
+  control_loop_init();
+  xTaskNotifyGive(s_main_task);
+
+#ifdef CMAKE_BENCHMARK
+  // Quiet logs, so the console time is not what gets measured, and never power the elements
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  bench_run(nullptr);
+  bench_jitter();
+  vTaskSuspend(nullptr);
+#endif
+
+  // We are good to go, run.
+  control_loop_run();
+  vTaskDelete(nullptr);
+}
+
+/* Both boot stages read NVS, it is ready before either starts */
+static void _nvs_init() {
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    err = nvs_flash_init();
+  }
+  ESP_ERROR_CHECK(err);
+}
+
+/* Boot stages, see boot_profile.h */
 extern "C" void app_main() {
+  // Heaters safe before anything else
+  boot_profile_begin(BOOT_STAGE_SAFE);
+  control_loop_safe_state();
+  boot_profile_end(BOOT_STAGE_SAFE);
+
+  // Before anything records, what the previous boot left is kept for its post-mortem
+  flight_recorder_init();
   //_generate_zero_signal();
   esp_log_level_set("coreMQTT", ESP_LOG_ERROR);
 
   ESP_ERROR_CHECK(esp_event_loop_create_default());
+  _nvs_init();
 
-  gpio_install_isr_service(0);
   xNetworkEventGroup = xEventGroupCreate();
+  s_main_task = xTaskGetCurrentTaskHandle();
 
-  aws_connector_init(xNetworkEventGroup);
-  control_loop_init(xNetworkEventGroup);
+  // Control comes up on its own core while the network tasks are created from here, on the network core
+  boot_profile_begin(BOOT_STAGE_CONTROL);
+  ESP_ERROR_CHECK(task_plan_create(TASK_CONTROL, _control_task, nullptr));
 
-  // We are good to go, run.
-  control_loop_run();
+  boot_profile_begin(BOOT_STAGE_NETWORK);
+  aws_connector_init(xNetworkEventGroup);
+  // Telemetry and the shadows read and change the controller's configuration, it is loaded first
+  boot_profile_pause(BOOT_STAGE_NETWORK);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  boot_profile_resume(BOOT_STAGE_NETWORK);
+  telemetry_init(xNetworkEventGroup);
+  app_config_init();
+  boot_profile_end(BOOT_STAGE_NETWORK);
 }
-
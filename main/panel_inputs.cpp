@@ -1,18 +1,17 @@
 #include <hal/gpio_types.h>
 #include <driver/gpio.h>
+#include "board.h"
 #include "panel_inputs.h"
 
 
 void panel_inputs_init() {
-  // --- Configure input switch that drives the pump
+  // --- Configure the heat and fan PWM lines from the panel, the drum motor is a digital input
   gpio_config_t io_conf;
   io_conf.intr_type = GPIO_INTR_DISABLE;
   io_conf.mode = GPIO_MODE_INPUT;
   io_conf.pin_bit_mask = (
-      (1ULL << GPIO_NUM_6) |
-      (1ULL << GPIO_NUM_7) |
-      (1ULL << GPIO_NUM_8) |
-      (1ULL << GPIO_NUM_9)
+      (1ULL << BOARD.heat_signal) |
+      (1ULL << BOARD.fan_signal)
   );
 
   io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
@@ -0,0 +1,108 @@
+#include <cmath>
+#include "pid.h"
+
+static int32_t _clamp(int64_t v, int32_t lo, int32_t hi) {
+  return v < lo ? lo : v > hi ? hi : (int32_t) v;
+}
+
+pid_gains_t pid_gains(float kp, float ki, float kd) {
+  return {
+      .kp = (int32_t) lroundf(kp * PID_ONE),
+      .ki = (int32_t) lroundf(ki * PID_ONE),
+      .kd = (int32_t) lroundf(kd * PID_ONE),
+  };
+}
+
+void pid_reset(pid_ctrl_t *pid) {
+  *pid = {};
+}
+
+int32_t pid_step(pid_ctrl_t *pid, const pid_gains_t &gains, int32_t setpoint_cdeg, int32_t measured_cdeg,
+                 int32_t feed_forward, int32_t out_max) {
+  if (!pid->primed) {
+    pid->last_cdeg = measured_cdeg;
+    pid->slope_cdeg = 0;
+    pid->primed = true;
+  }
+
+  // Change per tick through a first order filter of a quarter, thermocouple steps would otherwise kick the output
+  pid->slope_cdeg += (measured_cdeg - pid->last_cdeg - pid->slope_cdeg) >> 2;
+  pid->last_cdeg = measured_cdeg;
+
+  int32_t error = setpoint_cdeg - measured_cdeg;
+  int64_t proportional = (int64_t) gains.kp * error / 100;
+  int64_t derivative = (int64_t) gains.kd * pid->slope_cdeg / 100;
+  int64_t integral = pid->integral + (int64_t) gains.ki * error / 100;
+
+  // Conditional integration, the integral is held while the output is pinned and the error would push it further
+  int64_t output = feed_forward + proportional + integral - derivative;
+  if ((output > out_max && error > 0) || (output < 0 && error < 0)) {
+    integral = pid->integral;
+    output = feed_forward + proportional + integral - derivative;
+  }
+  pid->integral = _clamp(integral, -out_max, out_max);
+  return _clamp(output, 0, out_max);
+}
+
+void autotune_start(autotune_t *tune) {
+  *tune = {};
+  tune->phase = AUTOTUNE_RUNNING;
+  tune->relay_on = true;
+  tune->max_cdeg = INT32_MIN;
+  tune->min_cdeg = INT32_MAX;
+}
+
+/*
+ * Ziegler-Nichols from the averaged oscillations. Tyreus-Luyben was tried for less overshoot, but its integral is
+ * too slow to hold the chamber against the main element's own drift.
+ */
+static void _autotune_finish(autotune_t *tune) {
+  float period = (float) tune->period_sum / AUTOTUNE_CYCLES;
+  float amplitude = (float) tune->amplitude_sum_cdeg / AUTOTUNE_CYCLES / 100;
+  float relay = (float) tune->relay_sum / AUTOTUNE_CYCLES / PID_ONE / 2;
+  if (amplitude <= 0 || period <= 0 || relay <= 0) {
+    tune->phase = AUTOTUNE_FAILED;
+    return;
+  }
+
+  float ku = 4 * relay / ((float) M_PI * amplitude);
+  float ti = period / 2;
+  float td = period / 8;
+  tune->kp = 0.6f * ku;
+  tune->ki = tune->kp / ti;
+  tune->kd = tune->kp * td;
+  tune->phase = AUTOTUNE_DONE;
+}
+
+int32_t autotune_step(autotune_t *tune, int32_t setpoint_cdeg, int32_t measured_cdeg, int32_t out_max) {
+  if (tune->phase != AUTOTUNE_RUNNING) {
+    return 0;
+  }
+  if (++tune->ticks > AUTOTUNE_MAX_TICKS) {
+    tune->phase = AUTOTUNE_FAILED;
+    return 0;
+  }
+
+  tune->max_cdeg = measured_cdeg > tune->max_cdeg ? measured_cdeg : tune->max_cdeg;
+  tune->min_cdeg = measured_cdeg < tune->min_cdeg ? measured_cdeg : tune->min_cdeg;
+
+  if (tune->relay_on && measured_cdeg > setpoint_cdeg + AUTOTUNE_HYSTERESIS_CDEG) {
+    tune->relay_on = false;
+  } else if (!tune->relay_on && measured_cdeg < setpoint_cdeg - AUTOTUNE_HYSTERESIS_CDEG) {
+    // A full oscillation ends each time the relay switches back on
+    tune->relay_on = true;
+    if (tune->cycle_start != 0 && tune->cycles++ > 0) {
+      tune->period_sum += tune->ticks - tune->cycle_start;
+      tune->amplitude_sum_cdeg += (tune->max_cdeg - tune->min_cdeg) / 2;
+      tune->relay_sum += out_max;
+    }
+    tune->cycle_start = tune->ticks;
+    tune->max_cdeg = measured_cdeg;
+    tune->min_cdeg = measured_cdeg;
+    if (tune->cycles > AUTOTUNE_CYCLES) {
+      _autotune_finish(tune);
+      return 0;
+    }
+  }
+  return tune->relay_on ? out_max : 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Fixed point PID for the secondary element, and a relay feedback autotune for its gains.
+ *
+ * Temperatures are integer hundredths of a degree and duties are Q16.16 percent, one call per control tick. The
+ * step is straight line integer code, no loops and no floating point, so its cost is the same every tick.
+ */
+
+#define PID_Q               16
+#define PID_ONE             (1 << PID_Q)
+
+/**
+ * Gains in Q16.16: duty percent per degree, per degree and tick, and per degree per tick.
+ */
+struct pid_gains_t {
+  int32_t kp;
+  int32_t ki;
+  int32_t kd;
+};
+
+struct pid_ctrl_t {
+  // Integral term, Q16.16 percent
+  int32_t integral;
+  // Previous measurement and filtered change per tick, hundredths of a degree
+  int32_t last_cdeg;
+  int32_t slope_cdeg;
+  bool primed;
+};
+
+pid_gains_t pid_gains(float kp, float ki, float kd);
+
+void pid_reset(pid_ctrl_t *pid);
+
+/**
+ * One step towards `setpoint_cdeg`. The derivative acts on the measurement so setpoint changes do not kick, and
+ * the integral only grows while the output is not pinned against a limit in the same direction.
+ * @param feed_forward Q16.16 percent the output is built on, what the element would get open loop
+ * @param out_max Q16.16 percent upper limit of the output, the lower limit is 0
+ * @return Q16.16 duty percent in [0, out_max]
+ */
+int32_t pid_step(pid_ctrl_t *pid, const pid_gains_t &gains, int32_t setpoint_cdeg, int32_t measured_cdeg,
+                 int32_t feed_forward, int32_t out_max);
+
+/* ---- Relay autotune ---- */
+
+// Relay switches this far either side of the setpoint, two steps of the thermocouple amplifier
+#define AUTOTUNE_HYSTERESIS_CDEG  50
+
+// Full oscillations measured after the first, which only settles the relay
+#define AUTOTUNE_CYCLES           3
+
+// Gives up when the oscillation has not settled in this many ticks
+#define AUTOTUNE_MAX_TICKS        5400
+
+enum autotune_phase_t : uint8_t {
+  AUTOTUNE_IDLE,
+  AUTOTUNE_RUNNING,
+  AUTOTUNE_DONE,
+  AUTOTUNE_FAILED,
+};
+
+struct autotune_t {
+  autotune_phase_t phase;
+  bool relay_on;
+  uint8_t cycles;
+  uint16_t ticks;
+  // Tick of the last off to on switch, 0 before the first
+  uint16_t cycle_start;
+  int32_t max_cdeg;
+  int32_t min_cdeg;
+  uint32_t period_sum;
+  int32_t amplitude_sum_cdeg;
+  // Relay high output, Q16.16 percent, it follows the cap on the element so it is averaged too
+  int32_t relay_sum;
+  // Ziegler-Nichols gains from the ultimate gain and period, per tick
+  float kp;
+  float ki;
+  float kd;
+};
+
+void autotune_start(autotune_t *tune);
+
+/**
+ * Runs the relay one tick, switching the element between 0 and `out_max` around the setpoint.
+ * @return Q16.16 duty percent to apply
+ */
+int32_t autotune_step(autotune_t *tune, int32_t setpoint_cdeg, int32_t measured_cdeg, int32_t out_max);
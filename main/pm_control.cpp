@@ -2,37 +2,177 @@
 #include <esp_pm.h>
 #include <esp_wifi_types.h>
 #include <esp_wifi.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <cmath>
 #include "pm_control.h"
 #include "common/events_common.h"
 
-static void _event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-  if (event_id == CORE_MQTT_CONNECTED_EVENT || event_id == CORE_MQTT_OTA_STOPPED_EVENT) {
-
-    // Enable power management and light sleep
-    esp_pm_config_esp32s3_t pm_config = {
-        .max_freq_mhz = 160,
-        .min_freq_mhz = 80,
-        .light_sleep_enable = true
-    };
-    ESP_ERROR_CHECK( esp_pm_configure(&pm_config) );
-
-    esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
-  } else if(event_id == CORE_MQTT_DISCONNECTED_EVENT || event_id == CORE_MQTT_OTA_STARTED_EVENT) {
-
-    // Enable power management and light sleep
-    esp_pm_config_esp32s3_t pm_config = {
-        .max_freq_mhz = 160,
-        .min_freq_mhz = 80,
-        .light_sleep_enable = false
-    };
-    ESP_ERROR_CHECK( esp_pm_configure(&pm_config) );
-
-    esp_wifi_set_ps(WIFI_PS_NONE);
+#define TAG "pm"
+
+#define MAX_FREQ_MHZ  160
+
+struct pm_profile_cfg_t {
+  int min_freq_mhz;
+  bool light_sleep;
+  wifi_ps_type_t wifi_ps;
+};
+
+static const pm_profile_cfg_t s_profiles[PM_PROFILE_COUNT] = {
+    {.min_freq_mhz = MAX_FREQ_MHZ, .light_sleep = false, .wifi_ps = WIFI_PS_NONE},
+    {.min_freq_mhz = 80, .light_sleep = true, .wifi_ps = WIFI_PS_MIN_MODEM},
+    {.min_freq_mhz = 40, .light_sleep = true, .wifi_ps = WIFI_PS_MAX_MODEM},
+};
+
+static const esp_pm_lock_type_t s_window_types[PM_WINDOW_COUNT] = {
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_NO_LIGHT_SLEEP,
+    ESP_PM_NO_LIGHT_SLEEP,
+};
+
+static const char *s_window_names[PM_WINDOW_COUNT] = {
+    "tick",
+    "ssr",
+    "network",
+};
+
+static const schema_field_t s_metrics_fields[] = {
+    SCHEMA_FIELD(pm_metrics_t, profile),
+    SCHEMA_FIELD(pm_metrics_t, light_sleep_count),
+    SCHEMA_FIELD_P(pm_metrics_t, light_sleep_ms, "light_sleep_ms", 0),
+    SCHEMA_FIELD_P(pm_metrics_t, light_sleep_pct, "light_sleep_pct", 1),
+};
+const schema_t pm_metrics_schema = SCHEMA_DEFINE(s_metrics_fields);
+
+static esp_pm_lock_handle_t s_locks[PM_WINDOW_COUNT] = {};
+static bool s_held[PM_WINDOW_COUNT] = {};
+static uint8_t s_profile = PM_PROFILE_BALANCED;
+// Network busy until MQTT connects, and while an OTA update runs
+static bool s_connected = false;
+static bool s_ota = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Light sleep since the interval started, added to by the idle task as the chip wakes
+static uint32_t s_sleep_count = 0;
+static int64_t s_sleep_us = 0;
+static int64_t s_interval_start_us = 0;
+static portMUX_TYPE s_sleep_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void pm_control_hold(pm_window_t window, bool hold) {
+  if (!s_locks[window]) {
+    return;
   }
+  // Under the lock, so a window opened and closed from two tasks cannot release before it acquires
+  portENTER_CRITICAL(&s_lock);
+  if (s_held[window] != hold) {
+    s_held[window] = hold;
+    ESP_ERROR_CHECK(hold ? esp_pm_lock_acquire(s_locks[window]) : esp_pm_lock_release(s_locks[window]));
+  }
+  portEXIT_CRITICAL(&s_lock);
 }
 
+/* Clocks, light sleep and the modem for the profile, the modem stays awake while the network is busy */
+static void _apply() {
+  portENTER_CRITICAL(&s_lock);
+  const pm_profile_cfg_t &profile = s_profiles[s_profile];
+  bool busy = !s_connected || s_ota;
+  portEXIT_CRITICAL(&s_lock);
 
-void pm_control_init() {
-  esp_event_handler_register(CORE_MQTT_EVENT, ESP_EVENT_ANY_ID, &_event_handler, nullptr);
+  esp_pm_config_esp32s3_t pm_config = {
+      .max_freq_mhz = MAX_FREQ_MHZ,
+      .min_freq_mhz = profile.min_freq_mhz,
+      .light_sleep_enable = profile.light_sleep,
+  };
+  ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+  pm_control_hold(PM_WINDOW_NETWORK, busy);
+  // Fails until WiFi is started, it is applied again on connecting
+  esp_wifi_set_ps(busy ? WIFI_PS_NONE : profile.wifi_ps);
+}
 
-}
\ No newline at end of file
+esp_err_t pm_control_set_profile(uint8_t profile) {
+  if (profile >= PM_PROFILE_COUNT) {
+    ESP_LOGE(TAG, "Invalid power profile: %d, expected [0, %d]", profile, PM_PROFILE_COUNT - 1);
+    return ESP_ERR_INVALID_ARG;
+  }
+  portENTER_CRITICAL(&s_lock);
+  bool change = s_profile != profile;
+  s_profile = profile;
+  portEXIT_CRITICAL(&s_lock);
+  if (change && s_locks[0]) {
+    ESP_LOGI(TAG, "Power profile %d", profile);
+    _apply();
+  }
+  return ESP_OK;
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+static IRAM_ATTR esp_err_t _on_sleep_exit(int64_t sleep_time_us, void *) {
+  portENTER_CRITICAL_SAFE(&s_sleep_lock);
+  s_sleep_count++;
+  s_sleep_us += sleep_time_us;
+  portEXIT_CRITICAL_SAFE(&s_sleep_lock);
+  return ESP_OK;
+}
+#endif
+
+pm_metrics_t pm_control_get_metrics() {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_sleep_lock);
+  uint32_t count = s_sleep_count;
+  int64_t sleep_us = s_sleep_us;
+  s_sleep_count = 0;
+  s_sleep_us = 0;
+  portEXIT_CRITICAL(&s_sleep_lock);
+  int64_t interval_us = now - s_interval_start_us;
+  s_interval_start_us = now;
+
+  pm_metrics_t metrics = {
+      .profile = s_profile,
+      .light_sleep_count = count,
+      .light_sleep_ms = (float) sleep_us / 1000,
+      .light_sleep_pct = interval_us > 0 ? 100.0f * (float) sleep_us / (float) interval_us : NAN,
+  };
+#if !CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+  // Not counted
+  metrics.light_sleep_ms = NAN;
+  metrics.light_sleep_pct = NAN;
+#endif
+  return metrics;
+}
+
+static void _event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+  portENTER_CRITICAL(&s_lock);
+  if (event_id == CORE_MQTT_CONNECTED_EVENT) {
+    s_connected = true;
+  } else if (event_id == CORE_MQTT_DISCONNECTED_EVENT) {
+    s_connected = false;
+  } else if (event_id == CORE_MQTT_OTA_STARTED_EVENT) {
+    s_ota = true;
+  } else if (event_id == CORE_MQTT_OTA_STOPPED_EVENT) {
+    s_ota = false;
+  } else {
+    portEXIT_CRITICAL(&s_lock);
+    return;
+  }
+  portEXIT_CRITICAL(&s_lock);
+  _apply();
+}
+
+void pm_control_init(uint8_t profile) {
+  for (int i = 0; i < PM_WINDOW_COUNT; i++) {
+    ESP_ERROR_CHECK(esp_pm_lock_create(s_window_types[i], 0, s_window_names[i], &s_locks[i]));
+  }
+  s_profile = profile < PM_PROFILE_COUNT ? profile : PM_PROFILE_BALANCED;
+  s_interval_start_us = esp_timer_get_time();
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+  esp_pm_sleep_cbs_register_config_t cbs = {
+      .exit_cb = _on_sleep_exit,
+  };
+  ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&cbs));
+#endif
+  _apply();
+  esp_event_handler_register(CORE_MQTT_EVENT, ESP_EVENT_ANY_ID, &_event_handler, nullptr);
+  ESP_LOGI(TAG, "Power profile %d", s_profile);
+}
@@ -1,3 +1,58 @@
 #pragma once
 
-void pm_control_init();
+#include <cstdint>
+#include <esp_err.h>
+#include "schema.h"
+
+/**
+ * Power management policy. Outside the windows below the chip scales its clocks down and, with the profile
+ * allowing it, light sleeps, woken by the control tick's esp_timer. Each window holds its lock only while open:
+ *
+ *   PM_WINDOW_TICK     APB at its maximum, from the control task waking for a tick or command to it being done
+ *   PM_WINDOW_SSR      no light sleep while the SSRs are powered, their alarms run from a timer light sleep stops
+ *   PM_WINDOW_NETWORK  no light sleep while MQTT connects or an OTA update runs
+ */
+
+enum pm_profile_t : uint8_t {
+  // No clock scaling or light sleep, modem always on: the lowest wake and command latency
+  PM_PROFILE_PERFORMANCE = 0,
+  // Clocks scaled down to 80MHz and light sleep between ticks, modem waking every beacon
+  PM_PROFILE_BALANCED = 1,
+  // Down to 40MHz and light sleep, modem waking every listen interval, commands may wait for it
+  PM_PROFILE_LOW_POWER = 2,
+  PM_PROFILE_COUNT = 3,
+};
+
+enum pm_window_t : uint8_t {
+  PM_WINDOW_TICK = 0,
+  PM_WINDOW_SSR = 1,
+  PM_WINDOW_NETWORK = 2,
+  PM_WINDOW_COUNT = 3,
+};
+
+struct pm_metrics_t {
+  uint8_t profile;
+  // Light sleeps and their time since the previous report, 0 and null without CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+  uint32_t light_sleep_count;
+  float light_sleep_ms;
+  float light_sleep_pct;
+};
+
+extern const schema_t pm_metrics_schema;
+
+/**
+ * Opens or closes a window, idempotent.
+ */
+void pm_control_hold(pm_window_t window, bool hold);
+
+/**
+ * Applies a pm_profile_t, from any task.
+ */
+esp_err_t pm_control_set_profile(uint8_t profile);
+
+/**
+ * Figures since the previous call, which starts a new interval. Telemetry task only.
+ */
+pm_metrics_t pm_control_get_metrics();
+
+void pm_control_init(uint8_t profile);
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include "profile.h"
+#include "json_reader.h"
+#include "schema.h"
+#include "flash_ops.h"
+
+#define TAG "profile"
+
+#define NVS_NAMESPACE       "profiles"
+
+// Bounds of the breakpoints accepted, the setpoint is further capped at max_tc_temp when played
+#define MAX_TIME_S          3600
+#define MAX_TEMP_C          300
+#define MAX_RATIO           1000
+
+// Stored slots, written from the shadow handler and copied by the control task at charge
+static profile_t s_profiles[PROFILE_SLOTS];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static_assert(sizeof(profile_t) <= FLASH_OPS_MAX_SIZE, "A full profile must fit a flash write");
+
+/* Length of the blob holding a profile, the header and the breakpoints in use */
+static size_t _stored_size(uint8_t count) {
+  return offsetof(profile_t, points) + count * sizeof(profile_point_t);
+}
+
+static void _key(char *key, size_t size, uint8_t slot) {
+  snprintf(key, size, "slot%u", slot);
+}
+
+static bool _valid(const profile_t &profile) {
+  if (profile.index > PROFILE_INDEX_TEMP || profile.target > PROFILE_TARGET_SETPOINT ||
+      profile.count > PROFILE_MAX_POINTS) {
+    return false;
+  }
+  uint16_t max_x = profile.index == PROFILE_INDEX_TIME ? MAX_TIME_S : MAX_TEMP_C;
+  uint16_t max_y = profile.target == PROFILE_TARGET_RATIO ? MAX_RATIO : MAX_TEMP_C;
+  for (int i = 0; i < profile.count; i++) {
+    const profile_point_t &p = profile.points[i];
+    if (p.x > max_x || p.y > max_y || (i > 0 && p.x <= profile.points[i - 1].x)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void profile_init() {
+  nvs_handle_t nvs_handle;
+  ESP_ERROR_CHECK(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle));
+  for (uint8_t slot = 1; slot <= PROFILE_SLOTS; slot++) {
+    char key[8];
+    _key(key, sizeof(key), slot);
+    profile_t profile = {};
+    size_t size = sizeof(profile);
+    if (nvs_get_blob(nvs_handle, key, &profile, &size) != ESP_OK) {
+      continue;
+    }
+    if (size < _stored_size(0) || size != _stored_size(profile.count) || !_valid(profile)) {
+      ESP_LOGE(TAG, "Discarding corrupt profile in slot %u, %d bytes", slot, size);
+      continue;
+    }
+    s_profiles[slot - 1] = profile;
+    ESP_LOGI(TAG, "Loaded profile in slot %u, %u breakpoints", slot, profile.count);
+  }
+  nvs_close(nvs_handle);
+}
+
+esp_err_t profile_store(uint8_t slot, const profile_t &profile) {
+  if (slot < 1 || slot > PROFILE_SLOTS || !_valid(profile)) {
+    ESP_LOGE(TAG, "Invalid profile for slot %u", slot);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  profile_t stored = {};
+  memcpy(&stored, &profile, _stored_size(profile.count));
+  portENTER_CRITICAL(&s_lock);
+  s_profiles[slot - 1] = stored;
+  portEXIT_CRITICAL(&s_lock);
+
+  char key[8];
+  _key(key, sizeof(key), slot);
+  esp_err_t err = flash_ops_write_blob(NVS_NAMESPACE, key, &stored, _stored_size(stored.count));
+  ESP_LOGI(TAG, "Stored profile in slot %u, %u breakpoints", slot, stored.count);
+  return err;
+}
+
+profile_t profile_get(uint8_t slot) {
+  profile_t profile = {};
+  if (slot >= 1 && slot <= PROFILE_SLOTS) {
+    portENTER_CRITICAL(&s_lock);
+    profile = s_profiles[slot - 1];
+    portEXIT_CRITICAL(&s_lock);
+  }
+  return profile;
+}
+
+/* Reads the [[x, y], ...] breakpoints as given, y is only scaled once the target is known */
+static esp_err_t _read_points(json_reader_t *reader, profile_t *profile, double *y) {
+  esp_err_t ret = ESP_OK;
+  json_token_t token, px, py;
+  profile->count = 0;
+
+  while (json_next(reader, &token) == JSON_TOKEN_ARRAY_START) {
+    if (json_next(reader, &px) != JSON_TOKEN_NUMBER || json_next(reader, &py) != JSON_TOKEN_NUMBER ||
+        json_next(reader, &token) != JSON_TOKEN_ARRAY_END) {
+      return ESP_FAIL;
+    }
+    if (profile->count == PROFILE_MAX_POINTS || !(px.number >= 0 && px.number <= UINT16_MAX)) {
+      ret = ESP_ERR_INVALID_ARG;
+      continue;
+    }
+    profile->points[profile->count].x = (uint16_t) lround(px.number);
+    y[profile->count++] = py.number;
+  }
+  return token.type == JSON_TOKEN_ARRAY_END ? ret : ESP_FAIL;
+}
+
+esp_err_t profile_json_read(json_reader_t *reader, profile_t *profile) {
+  esp_err_t ret = ESP_OK;
+  json_token_t key, value;
+  double y[PROFILE_MAX_POINTS];
+  *profile = {};
+
+  while (json_next(reader, &key) == JSON_TOKEN_KEY) {
+    json_next(reader, &value);
+    bool known = json_token_is(&key, "index") || json_token_is(&key, "target") || json_token_is(&key, "points");
+    if (json_token_is(&key, "index") && value.type == JSON_TOKEN_STRING) {
+      if (json_token_is(&value, "time")) {
+        profile->index = PROFILE_INDEX_TIME;
+      } else if (json_token_is(&value, "temperature")) {
+        profile->index = PROFILE_INDEX_TEMP;
+      } else {
+        ret = ESP_ERR_INVALID_ARG;
+      }
+    } else if (json_token_is(&key, "target") && value.type == JSON_TOKEN_STRING) {
+      if (json_token_is(&value, "ratio")) {
+        profile->target = PROFILE_TARGET_RATIO;
+      } else if (json_token_is(&value, "setpoint")) {
+        profile->target = PROFILE_TARGET_SETPOINT;
+      } else {
+        ret = ESP_ERR_INVALID_ARG;
+      }
+    } else if (json_token_is(&key, "points") && value.type == JSON_TOKEN_ARRAY_START) {
+      esp_err_t err = _read_points(reader, profile, y);
+      if (err == ESP_FAIL) {
+        return ESP_FAIL;
+      }
+      ret = ret == ESP_OK ? err : ret;
+    } else if (!json_skip(reader, &value)) {
+      return ESP_FAIL;
+    } else if (known) {
+      ret = ESP_ERR_INVALID_ARG;
+    }
+  }
+  if (key.type != JSON_TOKEN_OBJECT_END) {
+    return ESP_FAIL;
+  }
+
+  double scale = profile->target == PROFILE_TARGET_RATIO ? MAX_RATIO : 1;
+  for (int i = 0; i < profile->count; i++) {
+    double scaled = y[i] * scale;
+    if (!(scaled >= 0 && scaled <= UINT16_MAX)) {
+      ret = ESP_ERR_INVALID_ARG;
+      break;
+    }
+    profile->points[i].y = (uint16_t) lround(scaled);
+  }
+  if (ret == ESP_OK && !_valid(*profile)) {
+    ret = ESP_ERR_INVALID_ARG;
+  }
+  return ret;
+}
+
+void profile_json_write_summary(json_writer_t *w, const char *key, uint8_t slot) {
+  profile_t profile = profile_get(slot);
+  if (profile.count == 0) {
+    json_write_null(w, key);
+    return;
+  }
+  json_begin_object(w, key);
+  json_write_str(w, "index", profile.index == PROFILE_INDEX_TIME ? "time" : "temperature");
+  json_write_str(w, "target", profile.target == PROFILE_TARGET_RATIO ? "ratio" : "setpoint");
+  json_write_uint(w, "points", profile.count);
+  json_write_uint(w, "end", profile.points[profile.count - 1].x);
+  json_end_object(w);
+}
+
+float profile_value(const profile_t &profile, float x) {
+  if (profile.count == 0) {
+    return NAN;
+  }
+  const profile_point_t *p = profile.points;
+  if (x <= p[0].x) {
+    return p[0].y;
+  } else if (x >= p[profile.count - 1].x) {
+    return p[profile.count - 1].y;
+  }
+
+  // First breakpoint past x, there is one as x is below the last
+  uint8_t lo = 1, hi = profile.count - 1;
+  while (lo < hi) {
+    uint8_t mid = (lo + hi) / 2;
+    if (p[mid].x > x) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  const profile_point_t &a = p[lo - 1], &b = p[lo];
+  return a.y + ((float) b.y - a.y) * (x - a.x) / (b.x - a.x);
+}
+
+int32_t profile_charge_step(float *history, uint32_t *readings, float tc_c) {
+  const uint32_t n = 2 * PROFILE_CHARGE_WINDOW;
+  float oldest = history[*readings % n];
+  float middle = history[(*readings + PROFILE_CHARGE_WINDOW) % n];
+  history[*readings % n] = tc_c;
+  if (++*readings <= n) {
+    return -1;
+  }
+
+  float rise = middle - oldest;
+  float shortfall = middle + rise - tc_c;
+  if (shortfall < PROFILE_CHARGE_DROP_C) {
+    return -1;
+  }
+  // The chamber roughly stalls at charge, so the shortfall grew at the rate of the rise it interrupted
+  float per_tick = rise / PROFILE_CHARGE_WINDOW;
+  return per_tick > 0 ? std::min<int32_t>(PROFILE_CHARGE_WINDOW, lroundf(shortfall / per_tick)) : 0;
+}
+
+float profile_player_step(profile_player_t *player, uint8_t slot, bool motor_on, bool heat_on, bool tc_ok,
+                          float tc_c, float tick_period_s) {
+  if (slot != player->slot) {
+    *player = {};
+    player->slot = slot;
+    player->phase = slot ? PROFILE_ARMED : PROFILE_IDLE;
+  }
+
+  switch (player->phase) {
+    case PROFILE_IDLE:
+      return NAN;
+
+    case PROFILE_ARMED: {
+      if (!motor_on || !heat_on || !tc_ok) {
+        player->ticks = 0;
+        return NAN;
+      }
+      int32_t since = profile_charge_step(player->history, &player->ticks, tc_c);
+      if (since < 0) {
+        return NAN;
+      }
+      player->profile = profile_get(slot);
+      player->ticks = 0;
+      if (player->profile.count == 0) {
+        ESP_LOGW(TAG, "Charge detected but slot %u is empty", slot);
+        return NAN;
+      }
+      ESP_LOGI(TAG, "Charge detected at %.1fC about %lds ago, playing slot %u", tc_c, since, slot);
+      player->phase = PROFILE_PLAYING;
+      player->ticks = since;
+      player->x = player->profile.index == PROFILE_INDEX_TIME ? since * tick_period_s : tc_c;
+      break;
+    }
+
+    default:
+      if (!motor_on) {
+        ESP_LOGI(TAG, "Drum stopped after %lus, slot %u armed for the next roast", player->ticks, slot);
+        player->phase = PROFILE_ARMED;
+        player->ticks = 0;
+        return NAN;
+      }
+      player->ticks++;
+      if (player->profile.index == PROFILE_INDEX_TIME) {
+        player->x = player->ticks * tick_period_s;
+      } else if (tc_ok) {
+        player->x = std::max(player->x, tc_c);
+      }
+      break;
+  }
+
+  if (player->phase == PROFILE_PLAYING && player->x >= player->profile.points[player->profile.count - 1].x) {
+    ESP_LOGI(TAG, "Profile in slot %u done after %lus", slot, player->ticks);
+    player->phase = PROFILE_DONE;
+  }
+  return profile_value(player->profile, player->x);
+}
+
+float profile_player_progress(const profile_player_t *player) {
+  const profile_t &profile = player->profile;
+  if (player->phase < PROFILE_PLAYING || profile.count == 0) {
+    return 0;
+  }
+  float first = profile.points[0].x;
+  float last = profile.points[profile.count - 1].x;
+  if (last <= first) {
+    return 1;
+  }
+  return std::min(1.0f, std::max(0.0f, (player->x - first) / (last - first)));
+}
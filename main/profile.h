@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+
+/**
+ * Roast profiles: breakpoints driving the secondary heat ratio or the setpoint through a roast, indexed by the
+ * time since charge or by the thermocouple temperature. Between breakpoints the target is interpolated
+ * linearly, before the first and past the last it holds their value.
+ *
+ * Profiles are uploaded through the "profiles" section of the config shadow and kept in NVS, one blob per slot
+ * holding only the breakpoints in use. The control configuration selects the slot that plays, it arms on
+ * selection and starts at charge.
+ *
+ * Charge is seen with the heat and drum on, as the thermocouple falling short of where its rise was taking it.
+ * The cold beans pull the chamber down or at least stall it, while the operator moving the heat or fan only
+ * bends the rise slowly through the chamber's time constant.
+ */
+
+#define PROFILE_SLOTS           4
+#define PROFILE_MAX_POINTS      32
+// Tokens a full slot takes in a shadow delta: each [x, y] point is 4, and the metadata mirrors it with a
+// {"timestamp": t} object for either value, 10 more. The slot's own keys and objects take the rest.
+#define PROFILE_DELTA_SLOT_TOKENS   (PROFILE_MAX_POINTS * 14 + 32)
+
+// The rise over one window is projected over the next, a reading this far short of it is taken as charge
+#define PROFILE_CHARGE_WINDOW   30
+#define PROFILE_CHARGE_DROP_C   5
+
+enum profile_index_t : uint8_t {
+  // Seconds since charge
+  PROFILE_INDEX_TIME = 0,
+  // Thermocouple degrees, the highest reached so far so the target never steps back on a dip
+  PROFILE_INDEX_TEMP = 1,
+};
+
+enum profile_target_t : uint8_t {
+  // Replaces max_heat_ratio
+  PROFILE_TARGET_RATIO = 0,
+  // Replaces setpoint_c, in setpoint mode whatever the configured mode
+  PROFILE_TARGET_SETPOINT = 1,
+};
+
+enum profile_phase_t : uint8_t {
+  // No profile selected, or the slot is empty
+  PROFILE_IDLE = 0,
+  // Waiting for charge
+  PROFILE_ARMED = 1,
+  PROFILE_PLAYING = 2,
+  // Past the last breakpoint, holding its value until the drum stops
+  PROFILE_DONE = 3,
+};
+
+struct profile_point_t {
+  // Seconds or degrees, strictly increasing
+  uint16_t x;
+  // Secondary heat ratio in thousandths, or setpoint degrees
+  uint16_t y;
+};
+
+struct profile_t {
+  // A profile_index_t and a profile_target_t
+  uint8_t index;
+  uint8_t target;
+  // Breakpoints in use, 0 for an empty slot
+  uint8_t count;
+  profile_point_t points[PROFILE_MAX_POINTS];
+};
+
+struct profile_player_t {
+  // Copy of the slot taken at charge, an upload mid roast plays from the next one
+  profile_t profile;
+  uint8_t slot;
+  // A profile_phase_t
+  uint8_t phase;
+  // Thermocouple readings of the last two charge windows while armed, oldest at `ticks` modulo their count
+  float history[2 * PROFILE_CHARGE_WINDOW];
+  // Readings taken while armed, ticks since charge once playing
+  uint32_t ticks;
+  // Position in the profile's index, seconds or degrees
+  float x;
+};
+
+/**
+ * Loads the stored profiles.
+ */
+void profile_init();
+
+/**
+ * Checks and stores a profile in `slot`, 1 to PROFILE_SLOTS, an empty one clears the slot.
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG when the slot or the breakpoints are out of range.
+ */
+esp_err_t profile_store(uint8_t slot, const profile_t &profile);
+
+/**
+ * Copies the profile in `slot`, an empty one when the slot is out of range or was never stored.
+ */
+profile_t profile_get(uint8_t slot);
+
+/**
+ * Reads a profile object from `reader`, positioned just after its opening brace:
+ *
+ *   {"index": "time" | "temperature", "target": "ratio" | "setpoint", "points": [[x, y], ...]}
+ *
+ * Ratios are given as fractions like max_heat_ratio. The whole object is consumed.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for unknown names or values out of range, ESP_FAIL when malformed.
+ */
+esp_err_t profile_json_read(struct json_reader_t *reader, profile_t *profile);
+
+/**
+ * Writes a one line description of the profile in `slot` as a member of the current object, null when empty.
+ */
+void profile_json_write_summary(struct json_writer_t *w, const char *key, uint8_t slot);
+
+/**
+ * Target at `x`, interpolated between the breakpoints either side found by binary search.
+ * @return Target in the units of the breakpoints, NaN for an empty profile.
+ */
+float profile_value(const profile_t &profile, float x);
+
+/**
+ * Looks for charge in one more thermocouple reading, taken with the heat and drum on.
+ * @param history The last 2 * PROFILE_CHARGE_WINDOW readings, oldest at `readings` modulo their count.
+ * @param readings Readings taken so far, 0 to start over.
+ * @return Ticks since charge, estimated from how far the reading fell short of the projection at the rate it had
+ * been rising, or -1 until then.
+ */
+int32_t profile_charge_step(float *history, uint32_t *readings, float tc_c);
+
+/**
+ * Advances playback by one control tick.
+ * @param slot Slot selected, 0 for none. A change re-arms the player.
+ * @param motor_on Drum running, playback ends when it stops.
+ * @param heat_on Main element asked for heat, charge is only looked for while it is.
+ * @param tc_ok Whether `tc_c` is a valid reading.
+ * @return Target in force in the units of the breakpoints, NaN while not playing.
+ */
+float profile_player_step(profile_player_t *player, uint8_t slot, bool motor_on, bool heat_on, bool tc_ok,
+                          float tc_c, float tick_period_s);
+
+/**
+ * Share of the profile's index range covered, 0 to 1.
+ */
+float profile_player_progress(const profile_player_t *player);
@@ -1,4 +0,0 @@
-#pragma once
-
-bool reset_button_is_triggered();
-void reset_button_init(gpio_num_t gpio);
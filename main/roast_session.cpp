@@ -0,0 +1,161 @@
+#include <esp_log.h>
+#include <algorithm>
+#include <cmath>
+#include "roast_session.h"
+
+#define TAG "roast"
+
+static const schema_field_t s_summary_fields[] = {
+    SCHEMA_FIELD(roast_summary_t, start_time),
+    SCHEMA_FIELD(roast_summary_t, start_loop),
+    SCHEMA_FIELD_P(roast_summary_t, duration_s, "duration_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, charge_s, "charge_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, charge_temp, "charge_temp", 1),
+    SCHEMA_FIELD_P(roast_summary_t, drop_temp, "drop_temp", 1),
+    SCHEMA_FIELD_P(roast_summary_t, peak_tc, "peak_tc", 1),
+    SCHEMA_FIELD_P(roast_summary_t, peak_board, "peak_board", 1),
+    SCHEMA_FIELD_P(roast_summary_t, max_ror, "max_ror", 1),
+    SCHEMA_FIELD_P(roast_summary_t, above_150_s, "above_150_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, above_200_s, "above_200_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, near_limit_s, "near_limit_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, main_full_s, "main_full_s", 1),
+    SCHEMA_FIELD_P(roast_summary_t, secondary_full_s, "secondary_full_s", 1),
+    SCHEMA_FIELD_P(roast_summary_t, main_wh, "main_wh", 1),
+    SCHEMA_FIELD_P(roast_summary_t, secondary_wh, "secondary_wh", 1),
+    SCHEMA_FIELD(roast_summary_t, cutoff_count),
+    SCHEMA_FIELD_P(roast_summary_t, cutoff_s, "cutoff_s", 0),
+    SCHEMA_FIELD_P(roast_summary_t, taper_s, "taper_s", 0),
+    SCHEMA_FIELD(roast_summary_t, tc_errors),
+    SCHEMA_FIELD(roast_summary_t, profile),
+    SCHEMA_FIELD(roast_summary_t, end),
+};
+const schema_t roast_summary_schema = SCHEMA_DEFINE(s_summary_fields);
+
+void roast_session_reset(roast_session_t *session) {
+  *session = {};
+}
+
+static void _start(roast_session_t *session, const control_state_t &state, const control_cfg_t &cfg,
+                   uint32_t timestamp) {
+  *session = {};
+  session->phase = ROAST_PREHEAT;
+  session->tc_errors_at_start = state.tc_error_count;
+  roast_summary_t &s = session->summary;
+  s.start_time = timestamp;
+  s.start_loop = state.loop_count;
+  s.charge_s = NAN;
+  s.charge_temp = NAN;
+  s.drop_temp = NAN;
+  s.peak_tc = NAN;
+  s.peak_board = NAN;
+  s.max_ror = NAN;
+  s.profile = cfg.profile;
+  ESP_LOGI(TAG, "Roast started at tick %lu", state.loop_count);
+}
+
+/* Adds one tick to the summary */
+static void _accumulate(roast_session_t *session, const control_state_t &state, const control_cfg_t &cfg,
+                        bool tc_ok, float tick_period_s) {
+  roast_summary_t &s = session->summary;
+  s.duration_s = session->ticks * tick_period_s;
+  if (tc_ok) {
+    s.peak_tc = std::isnan(s.peak_tc) ? state.tc_temp : std::max(s.peak_tc, state.tc_temp);
+    s.peak_board = std::isnan(s.peak_board) ? state.junction_temp : std::max(s.peak_board, state.junction_temp);
+    s.above_150_s += state.tc_temp > 150 ? tick_period_s : 0;
+    s.above_200_s += state.tc_temp > 200 ? tick_period_s : 0;
+    s.near_limit_s += state.tc_temp > cfg.max_tc_temp - cfg.cutoff_taper_c ? tick_period_s : 0;
+    if (session->phase == ROAST_CHARGED && ror_ready(&state.ror_window)) {
+      s.max_ror = std::isnan(s.max_ror) ? state.ror : std::max(s.max_ror, state.ror);
+    }
+  }
+  s.main_full_s += state.input_duty / 100.0f * tick_period_s;
+  s.secondary_full_s += state.output_duty / 100.0f * tick_period_s;
+  s.main_wh += state.input_on_s * cfg.main_watts / 3600.0f;
+  s.secondary_wh += state.output_on_s * cfg.secondary_watts / 3600.0f;
+  s.taper_s += state.secondary_taper < 1 ? tick_period_s : 0;
+
+  // As control_decide() cuts the secondary, the thermocouple temperature holds its last good value on a fault
+  bool cut = state.tc_status != 0 || state.junction_temp > cfg.max_board_temp || state.tc_temp >= cfg.max_tc_temp;
+  if (cut && !session->cut) {
+    s.cutoff_count++;
+  }
+  s.cutoff_s += cut ? tick_period_s : 0;
+  session->cut = cut;
+  s.tc_errors = state.tc_error_count - session->tc_errors_at_start;
+}
+
+/* Closes the session on `summary`, reported unless it was too short to be a roast */
+static bool _end(roast_session_t *session, const roast_summary_t &final, roast_end_t end, roast_summary_t *summary) {
+  *summary = final;
+  summary->end = end;
+  session->phase = ROAST_IDLE;
+  bool report = summary->duration_s >= ROAST_MIN_S;
+  ESP_LOGI(TAG, "Roast %s after %.0fs, charge %.1fC drop %.1fC peak %.1fC%s", end == ROAST_END_DROP ? "dropped" :
+           "ended by the drum stopping", summary->duration_s, summary->charge_temp, summary->drop_temp,
+           summary->peak_tc, report ? "" : ", too short to report");
+  return report;
+}
+
+bool roast_session_update(roast_session_t *session, const control_inputs_t &in, const control_state_t &state,
+                          const control_cfg_t &cfg, uint32_t timestamp, float tick_period_s,
+                          roast_summary_t *summary) {
+  // What the panel asks for, the state has the heat zeroed by safety cuts which must not look like drop
+  bool heat_on = in.motor_on && in.heat_ok && in.heat_duty > 0;
+  bool tc_ok = state.tc_status == 0;
+
+  if (session->phase == ROAST_IDLE) {
+    if (!heat_on) {
+      return false;
+    }
+    _start(session, state, cfg, timestamp);
+  } else if (!in.motor_on) {
+    // A heat off run the drum stopped in was drop all the same
+    if (session->heat_off_ticks) {
+      return _end(session, session->at_drop, ROAST_END_MOTOR, summary);
+    }
+    return _end(session, session->summary, ROAST_END_MOTOR, summary);
+  }
+
+  if (heat_on) {
+    session->heat_off_ticks = 0;
+  } else if (session->heat_off_ticks++ == 0) {
+    session->at_drop = session->summary;
+    session->heat_off_temp = state.tc_temp;
+    if (session->phase == ROAST_CHARGED) {
+      session->at_drop.drop_temp = state.tc_temp;
+    }
+  } else if (session->heat_off_ticks * tick_period_s >= ROAST_DROP_S &&
+             (!tc_ok || state.tc_temp <= session->heat_off_temp - ROAST_DROP_FALL_C)) {
+    return _end(session, session->at_drop, ROAST_END_DROP, summary);
+  }
+
+  if (session->phase == ROAST_PREHEAT) {
+    if (heat_on && tc_ok) {
+      int32_t since = profile_charge_step(session->history, &session->readings, state.tc_temp);
+      if (since >= 0) {
+        const uint32_t n = 2 * PROFILE_CHARGE_WINDOW;
+        session->phase = ROAST_CHARGED;
+        session->summary.charge_s = (float) (session->ticks - std::min<uint32_t>(since, session->ticks)) *
+                                    tick_period_s;
+        session->summary.charge_temp = session->history[(session->readings - 1 - since) % n];
+        ESP_LOGI(TAG, "Charge at %.1fC, %.0fs into the session", session->summary.charge_temp,
+                 session->summary.charge_s);
+      }
+    } else {
+      session->readings = 0;
+    }
+  }
+
+  session->ticks++;
+  _accumulate(session, state, cfg, tc_ok, tick_period_s);
+  return false;
+}
+
+size_t roast_summary_format(char *buf, size_t size, const roast_summary_t &summary) {
+  json_writer_t w;
+  json_writer_init(&w, buf, size);
+  json_begin_object(&w, nullptr);
+  json_write_fields(&w, roast_summary_schema, &summary);
+  json_end_object(&w);
+  return json_writer_finish(&w);
+}
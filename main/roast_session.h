@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "control_loop.h"
+#include "profile.h"
+
+/**
+ * Roast sessions told apart from the control ticks, and summarised as they go so nothing of the curve is kept.
+ *
+ * A session starts with the drum turning and the main element asked for heat. Charge is seen in it the way a
+ * profile starts, from the thermocouple falling short of its rise, see profile.h. It ends with the drum stopping,
+ * or with the heat staying off for ROAST_DROP_S while the chamber cools by ROAST_DROP_FALL_C, which is taken as
+ * drop at the tick the heat went off. Sessions shorter than ROAST_MIN_S, a drum test or a knob nudged, are
+ * dropped.
+ */
+
+#define ROAST_DROP_S        30
+#define ROAST_DROP_FALL_C   5
+#define ROAST_MIN_S         120
+
+enum roast_session_phase_t : uint8_t {
+  ROAST_IDLE = 0,
+  // Heating, charge not seen yet
+  ROAST_PREHEAT = 1,
+  ROAST_CHARGED = 2,
+};
+
+enum roast_end_t : uint8_t {
+  ROAST_END_DROP = 0,
+  ROAST_END_MOTOR = 1,
+};
+
+struct roast_summary_t {
+  // Unix time and loop count the session started at
+  uint32_t start_time;
+  uint32_t start_loop;
+  // Seconds from the start to drop, and to charge
+  float duration_s;
+  float charge_s;
+  // Thermocouple at charge and at drop, NaN when charge was not seen
+  float charge_temp;
+  float drop_temp;
+  // Highest readings of the session, and the highest rate of rise after charge in C/min
+  float peak_tc;
+  float peak_board;
+  float max_ror;
+  // Seconds the thermocouple spent above 150C, 200C, and within cutoff_taper_c of max_tc_temp
+  float above_150_s;
+  float above_200_s;
+  float near_limit_s;
+  // Energy asked of each element as seconds at full power, times the element power for joules
+  float main_full_s;
+  float secondary_full_s;
+  // Energy each element's SSR actually delivered in Wh, its on time at the configured element power
+  float main_wh;
+  float secondary_wh;
+  // Secondary cut by the thermocouple or board limit or a thermocouple fault: times and seconds held, then
+  // seconds tapered by the predictive cutoff and thermocouple read errors
+  uint16_t cutoff_count;
+  float cutoff_s;
+  float taper_s;
+  uint32_t tc_errors;
+  // Profile slot selected at the start, a roast_end_t
+  uint8_t profile;
+  uint8_t end;
+};
+
+struct roast_session_t {
+  // A roast_session_phase_t
+  uint8_t phase;
+  uint32_t ticks;
+  // Consecutive ticks the heat was off, the summary and thermocouple as they stood at the first are kept in case
+  // it was drop
+  uint32_t heat_off_ticks;
+  roast_summary_t at_drop;
+  float heat_off_temp;
+  // Charge detector readings, see profile_charge_step()
+  float history[2 * PROFILE_CHARGE_WINDOW];
+  uint32_t readings;
+  uint32_t tc_errors_at_start;
+  bool cut;
+  roast_summary_t summary;
+};
+
+/**
+ * Wire schema of the summary published on telemetry/roast.
+ */
+extern const schema_t roast_summary_schema;
+
+void roast_session_reset(roast_session_t *session);
+
+/**
+ * Feeds one control tick: its inputs, the state control_decide() left and the configuration it ran with.
+ * @param timestamp Unix time, only kept when a session starts.
+ * @return true when a session worth reporting just ended, its summary is then in `summary`.
+ */
+bool roast_session_update(roast_session_t *session, const control_inputs_t &in, const control_state_t &state,
+                          const control_cfg_t &cfg, uint32_t timestamp, float tick_period_s,
+                          roast_summary_t *summary);
+
+/**
+ * Formats the summary document.
+ * @return Document length, 0 when it does not fit in `size`.
+ */
+size_t roast_summary_format(char *buf, size_t size, const roast_summary_t &summary);
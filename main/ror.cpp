@@ -0,0 +1,42 @@
+#include <cmath>
+#include "ror.h"
+
+void ror_reset(ror_t *ror) {
+  *ror = {};
+}
+
+void ror_add(ror_t *ror, float temp_c) {
+  auto sample = (int32_t) lroundf(temp_c * 100);
+
+  if (ror->count == ROR_WINDOW_SAMPLES) {
+    // Drop the oldest, every remaining sample moves one position closer to the start
+    int32_t oldest = ror->samples[ror->head];
+    ror->sum -= oldest;
+    ror->weighted_sum -= ror->sum;
+    ror->count--;
+    ror->head = (ror->head + 1) % ROR_WINDOW_SAMPLES;
+  }
+
+  ror->samples[(ror->head + ror->count) % ROR_WINDOW_SAMPLES] = sample;
+  ror->weighted_sum += (int64_t) ror->count * sample;
+  ror->sum += sample;
+  ror->count++;
+}
+
+bool ror_ready(const ror_t *ror) {
+  return ror->count >= ROR_MIN_SAMPLES;
+}
+
+float ror_slope(const ror_t *ror) {
+  if (!ror_ready(ror)) {
+    return 0;
+  }
+
+  // Positions are 0..n-1, so their sum and sum of squares only depend on n
+  int64_t n = ror->count;
+  int64_t sum_x = n * (n - 1) / 2;
+  int64_t sum_xx = (n - 1) * n * (2 * n - 1) / 6;
+  int64_t numerator = n * ror->weighted_sum - sum_x * ror->sum;
+  int64_t denominator = n * sum_xx - sum_x * sum_x;
+  return (float) numerator / (float) denominator / 100.0f;
+}
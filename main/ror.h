@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Rate of rise of a temperature, as the least squares slope over a sliding window of evenly spaced samples.
+ *
+ * Samples are kept in hundredths of a degree and the running sums are integers, so each update is O(1) and the
+ * estimate never drifts from what a full regression over the window would give, however long it runs.
+ */
+
+// 30s at one sample per control tick, long enough to average out the 0.25C steps of the thermocouple amplifier
+#define ROR_WINDOW_SAMPLES  30
+
+// Samples needed before the slope is reported
+#define ROR_MIN_SAMPLES     5
+
+struct ror_t {
+  int32_t samples[ROR_WINDOW_SAMPLES];
+  uint8_t head;
+  uint8_t count;
+  // Sum of the samples, and of each sample times its position in the window, oldest at 0
+  int64_t sum;
+  int64_t weighted_sum;
+};
+
+void ror_reset(ror_t *ror);
+
+void ror_add(ror_t *ror, float temp_c);
+
+bool ror_ready(const ror_t *ror);
+
+/**
+ * Slope of the samples in the window.
+ * @return Degrees per sample period, 0 until ROR_MIN_SAMPLES were added.
+ */
+float ror_slope(const ror_t *ror);
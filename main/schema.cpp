@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include "schema.h"
+#include "fmt.h"
+#include "json_reader.h"
+#include "cbor_writer.h"
+
+static void _append(json_writer_t *w, const char *data, size_t len) {
+  if (w->overflow || w->len + len >= w->size) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+}
+
+static void _append_char(json_writer_t *w, char c) {
+  _append(w, &c, 1);
+}
+
+static void _append_escaped(json_writer_t *w, const char *str) {
+  _append_char(w, '"');
+  for (const char *p = str; p && *p; p++) {
+    auto c = (unsigned char) *p;
+    if (c == '"' || c == '\\') {
+      _append_char(w, '\\');
+      _append_char(w, (char) c);
+    } else if (c < 0x20) {
+      static const char hex[] = "0123456789abcdef";
+      char esc[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+      _append(w, esc, sizeof(esc));
+    } else {
+      _append_char(w, (char) c);
+    }
+  }
+  _append_char(w, '"');
+}
+
+static void _key(json_writer_t *w, const char *key) {
+  if (w->need_comma) {
+    _append_char(w, ',');
+  }
+  if (key) {
+    _append_escaped(w, key);
+    _append_char(w, ':');
+  }
+  w->need_comma = true;
+}
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size) {
+  *w = {.buf = buf, .size = size, .len = 0, .overflow = size == 0, .need_comma = false};
+}
+
+size_t json_writer_finish(json_writer_t *w) {
+  if (w->overflow) {
+    if (w->size) {
+      w->buf[0] = '\0';
+    }
+    return 0;
+  }
+  w->buf[w->len] = '\0';
+  return w->len;
+}
+
+void json_begin_object(json_writer_t *w, const char *key) {
+  _key(w, key);
+  _append_char(w, '{');
+  w->need_comma = false;
+}
+
+void json_end_object(json_writer_t *w) {
+  _append_char(w, '}');
+  w->need_comma = true;
+}
+
+void json_begin_array(json_writer_t *w, const char *key) {
+  _key(w, key);
+  _append_char(w, '[');
+  w->need_comma = false;
+}
+
+void json_end_array(json_writer_t *w) {
+  _append_char(w, ']');
+  w->need_comma = true;
+}
+
+void json_write_null(json_writer_t *w, const char *key) {
+  json_write_raw(w, key, "null");
+}
+
+void json_write_bool(json_writer_t *w, const char *key, bool value) {
+  json_write_raw(w, key, value ? "true" : "false");
+}
+
+void json_write_uint(json_writer_t *w, const char *key, uint64_t value) {
+  char num[FMT_INT_MAX_LEN];
+  size_t n = fmt_u64(num, sizeof(num), value);
+  _key(w, key);
+  _append(w, num, n);
+}
+
+void json_write_int(json_writer_t *w, const char *key, int64_t value) {
+  char num[FMT_INT_MAX_LEN];
+  size_t n = fmt_i64(num, sizeof(num), value);
+  _key(w, key);
+  _append(w, num, n);
+}
+
+void json_write_float(json_writer_t *w, const char *key, double value, uint8_t precision) {
+  char num[FMT_INT_MAX_LEN + FMT_MAX_DECIMALS + 2];
+  size_t n = fmt_fixed(num, sizeof(num), value, precision);
+
+  // JSON has no representation for NaN or infinity
+  if (n == 0) {
+    json_write_null(w, key);
+    return;
+  }
+
+  _key(w, key);
+  _append(w, num, n);
+}
+
+void json_write_str(json_writer_t *w, const char *key, const char *value) {
+  _key(w, key);
+  _append_escaped(w, value);
+}
+
+void json_write_raw(json_writer_t *w, const char *key, const char *value) {
+  _key(w, key);
+  _append(w, value, strlen(value));
+}
+
+static void _write_field(json_writer_t *w, const schema_field_t &f, const uint8_t *p) {
+  switch (f.type) {
+    case SCHEMA_BOOL:
+      json_write_bool(w, f.name, *(const bool *) p);
+      break;
+    case SCHEMA_U8:
+      json_write_uint(w, f.name, *(const uint8_t *) p);
+      break;
+    case SCHEMA_U16:
+      json_write_uint(w, f.name, *(const uint16_t *) p);
+      break;
+    case SCHEMA_U32:
+      json_write_uint(w, f.name, *(const uint32_t *) p);
+      break;
+    case SCHEMA_U64:
+      json_write_uint(w, f.name, *(const uint64_t *) p);
+      break;
+    case SCHEMA_I8:
+      json_write_int(w, f.name, *(const int8_t *) p);
+      break;
+    case SCHEMA_I16:
+      json_write_int(w, f.name, *(const int16_t *) p);
+      break;
+    case SCHEMA_I32:
+      json_write_int(w, f.name, *(const int32_t *) p);
+      break;
+    case SCHEMA_I64:
+      json_write_int(w, f.name, *(const int64_t *) p);
+      break;
+    case SCHEMA_FLOAT:
+      json_write_float(w, f.name, *(const float *) p, f.precision);
+      break;
+    case SCHEMA_DOUBLE:
+      json_write_float(w, f.name, *(const double *) p, f.precision);
+      break;
+    case SCHEMA_CHARS:
+      json_write_str(w, f.name, (const char *) p);
+      break;
+    case SCHEMA_CSTR:
+      json_write_str(w, f.name, *(const char *const *) p);
+      break;
+  }
+}
+
+void json_write_fields(json_writer_t *w, const schema_t &schema, const void *obj, uint32_t mask) {
+  auto base = (const uint8_t *) obj;
+  for (int i = 0; i < schema.count; i++) {
+    if (mask & (1UL << i)) {
+      _write_field(w, schema.fields[i], base + schema.fields[i].offset);
+    }
+  }
+}
+
+static void _cbor_field(cbor_writer_t *w, const schema_field_t &f, const uint8_t *p) {
+  cbor_write_str(w, f.name);
+  switch (f.type) {
+    case SCHEMA_BOOL:
+      cbor_write_bool(w, *(const bool *) p);
+      break;
+    case SCHEMA_U8:
+      cbor_write_uint(w, *(const uint8_t *) p);
+      break;
+    case SCHEMA_U16:
+      cbor_write_uint(w, *(const uint16_t *) p);
+      break;
+    case SCHEMA_U32:
+      cbor_write_uint(w, *(const uint32_t *) p);
+      break;
+    case SCHEMA_U64:
+      cbor_write_uint(w, *(const uint64_t *) p);
+      break;
+    case SCHEMA_I8:
+      cbor_write_int(w, *(const int8_t *) p);
+      break;
+    case SCHEMA_I16:
+      cbor_write_int(w, *(const int16_t *) p);
+      break;
+    case SCHEMA_I32:
+      cbor_write_int(w, *(const int32_t *) p);
+      break;
+    case SCHEMA_I64:
+      cbor_write_int(w, *(const int64_t *) p);
+      break;
+    case SCHEMA_FLOAT:
+      cbor_write_float(w, *(const float *) p);
+      break;
+    case SCHEMA_DOUBLE:
+      cbor_write_double(w, *(const double *) p);
+      break;
+    case SCHEMA_CHARS:
+      cbor_write_text(w, (const char *) p, strnlen((const char *) p, f.size));
+      break;
+    case SCHEMA_CSTR:
+      cbor_write_str(w, *(const char *const *) p);
+      break;
+  }
+}
+
+size_t schema_cbor_write(uint8_t *buf, size_t size, const schema_t &schema, const void *obj, uint32_t mask) {
+  auto base = (const uint8_t *) obj;
+  size_t count = 0;
+  for (int i = 0; i < schema.count; i++) {
+    count += (mask & (1UL << i)) ? 1 : 0;
+  }
+
+  cbor_writer_t w;
+  cbor_writer_init(&w, buf, size);
+  cbor_begin_map(&w, count);
+  for (int i = 0; i < schema.count; i++) {
+    if (mask & (1UL << i)) {
+      _cbor_field(&w, schema.fields[i], base + schema.fields[i].offset);
+    }
+  }
+  return cbor_writer_finish(&w);
+}
+
+static inline uint32_t _hash(uint32_t seed, const char *key, size_t len) {
+  // FNV-1a, seeded
+  uint32_t h = 2166136261UL ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t) key[i];
+    h *= 16777619UL;
+  }
+  return h ^ (h >> 15);
+}
+
+esp_err_t schema_hash_build(const schema_t &schema, schema_hash_t *hash) {
+  // Start at twice the field count and grow the table if no seed gives a perfect hash
+  size_t table = 1;
+  while (table < 2U * schema.count) {
+    table <<= 1;
+  }
+
+  for (; table <= SCHEMA_HASH_MAX_SLOTS; table <<= 1) {
+    for (uint32_t seed = 0; seed < 4096; seed++) {
+      bool collision = false;
+      memset(hash->slots, 0, sizeof(hash->slots));
+      for (int i = 0; i < schema.count && !collision; i++) {
+        const char *name = schema.fields[i].name;
+        uint32_t slot = _hash(seed, name, strlen(name)) & (table - 1);
+        collision = hash->slots[slot] != 0;
+        hash->slots[slot] = i + 1;
+      }
+
+      if (!collision) {
+        hash->seed = seed;
+        hash->mask = table - 1;
+        return ESP_OK;
+      }
+    }
+  }
+
+  return ESP_ERR_NOT_FOUND;
+}
+
+int schema_find(const schema_t &schema, const schema_hash_t &hash, const char *key, size_t key_len) {
+  uint8_t slot = hash.slots[_hash(hash.seed, key, key_len) & hash.mask];
+  if (slot == 0) {
+    return -1;
+  }
+
+  const char *name = schema.fields[slot - 1].name;
+  return (strncmp(name, key, key_len) == 0 && name[key_len] == '\0') ? slot - 1 : -1;
+}
+
+template<typename T>
+static esp_err_t _assign(void *dst, double value) {
+  if (std::is_integral<T>::value) {
+    if (value != std::floor(value) || value < (double) std::numeric_limits<T>::min() ||
+        value > (double) std::numeric_limits<T>::max()) {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  *(T *) dst = (T) value;
+  return ESP_OK;
+}
+
+esp_err_t schema_set_number(const schema_t &schema, int index, void *obj, double value) {
+  const schema_field_t &f = schema.fields[index];
+  void *dst = (uint8_t *) obj + f.offset;
+  switch (f.type) {
+    case SCHEMA_BOOL:
+      return _assign<bool>(dst, value);
+    case SCHEMA_U8:
+      return _assign<uint8_t>(dst, value);
+    case SCHEMA_U16:
+      return _assign<uint16_t>(dst, value);
+    case SCHEMA_U32:
+      return _assign<uint32_t>(dst, value);
+    case SCHEMA_U64:
+      return _assign<uint64_t>(dst, value);
+    case SCHEMA_I8:
+      return _assign<int8_t>(dst, value);
+    case SCHEMA_I16:
+      return _assign<int16_t>(dst, value);
+    case SCHEMA_I32:
+      return _assign<int32_t>(dst, value);
+    case SCHEMA_I64:
+      return _assign<int64_t>(dst, value);
+    case SCHEMA_FLOAT:
+      return _assign<float>(dst, value);
+    case SCHEMA_DOUBLE:
+      return _assign<double>(dst, value);
+    default:
+      return ESP_ERR_INVALID_ARG;
+  }
+}
+
+/* Copies a string into an embedded char array, escapes are not decoded so they are refused */
+static esp_err_t _set_chars(const schema_field_t &f, void *obj, const json_token_t &value) {
+  if (f.type != SCHEMA_CHARS || value.len >= f.size || memchr(value.str, '\\', value.len)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *dst = (char *) obj + f.offset;
+  memcpy(dst, value.str, value.len);
+  dst[value.len] = '\0';
+  return ESP_OK;
+}
+
+esp_err_t schema_json_read(const schema_t &schema, const schema_hash_t &hash, json_reader_t *reader, void *obj,
+                           uint32_t *touched) {
+  esp_err_t ret = ESP_OK;
+  json_token_t key, value;
+
+  while (json_next(reader, &key) == JSON_TOKEN_KEY) {
+    int index = schema_find(schema, hash, key.str, key.len);
+    if (index >= 0 && touched) {
+      *touched |= 1UL << index;
+    }
+    switch (json_next(reader, &value)) {
+      case JSON_TOKEN_NUMBER:
+        if (index >= 0 && schema_set_number(schema, index, obj, value.number) != ESP_OK) {
+          ret = ESP_ERR_INVALID_ARG;
+        }
+        break;
+      case JSON_TOKEN_TRUE:
+      case JSON_TOKEN_FALSE:
+        if (index >= 0 && schema_set_number(schema, index, obj, value.type == JSON_TOKEN_TRUE) != ESP_OK) {
+          ret = ESP_ERR_INVALID_ARG;
+        }
+        break;
+      case JSON_TOKEN_STRING:
+        if (index >= 0 && _set_chars(schema.fields[index], obj, value) != ESP_OK) {
+          ret = ESP_ERR_INVALID_ARG;
+        }
+        break;
+      default:
+        if (!json_skip(reader, &value)) {
+          return ESP_FAIL;
+        }
+        if (index >= 0) {
+          ret = ESP_ERR_INVALID_ARG;
+        }
+        break;
+    }
+  }
+
+  // We only get here on the closing brace, or on malformed input
+  return key.type == JSON_TOKEN_OBJECT_END ? ret : ESP_FAIL;
+}
+
+size_t schema_struct_end(const schema_t &schema) {
+  size_t end = 0;
+  for (int i = 0; i < schema.count; i++) {
+    end = std::max<size_t>(end, schema.fields[i].offset + schema.fields[i].size);
+  }
+  return end;
+}
+
+uint32_t schema_diff(const schema_t &schema, const void *a, const void *b) {
+  uint32_t mask = 0;
+  for (int i = 0; i < schema.count; i++) {
+    const schema_field_t &f = schema.fields[i];
+    if (memcmp((const uint8_t *) a + f.offset, (const uint8_t *) b + f.offset, f.size) != 0) {
+      mask |= 1UL << i;
+    }
+  }
+  return mask;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <esp_err.h>
+
+/**
+ * Compile-time field descriptors used to serialise our telemetry and shadow documents.
+ *
+ * Each struct that ends up on the wire declares its fields once with SCHEMA_FIELD(), the JSON and CBOR writers
+ * and the shadow delta parser are all driven from that single table. Types and offsets are deduced by the
+ * compiler, so there is no format string to keep in sync with an argument list.
+ */
+
+enum schema_type_t : uint8_t {
+  SCHEMA_BOOL,
+  SCHEMA_U8,
+  SCHEMA_U16,
+  SCHEMA_U32,
+  SCHEMA_U64,
+  SCHEMA_I8,
+  SCHEMA_I16,
+  SCHEMA_I32,
+  SCHEMA_I64,
+  SCHEMA_FLOAT,
+  SCHEMA_DOUBLE,
+  // NUL terminated char array embedded in the struct
+  SCHEMA_CHARS,
+  // Pointer to a NUL terminated string
+  SCHEMA_CSTR,
+};
+
+struct schema_field_t {
+  // Key used on the wire
+  const char *name;
+  schema_type_t type;
+  uint16_t offset;
+  uint16_t size;
+  // Number of decimals for floating point values
+  uint8_t precision;
+};
+
+struct schema_t {
+  const schema_field_t *fields;
+  uint8_t count;
+};
+
+// Mask selecting every field of a schema
+#define SCHEMA_ALL_FIELDS   UINT32_MAX
+// Field masks are 32 bits, bit i for field i
+#define SCHEMA_MAX_FIELDS   32
+
+// Default number of decimals written for floating point fields
+#define SCHEMA_DEFAULT_PRECISION  2
+
+template<typename T>
+constexpr schema_type_t schema_type_of() {
+  static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_array<T>::value ||
+                std::is_pointer<T>::value, "Unsupported schema field type");
+  return std::is_same<T, bool>::value ? SCHEMA_BOOL :
+         std::is_floating_point<T>::value ? (sizeof(T) == sizeof(float) ? SCHEMA_FLOAT : SCHEMA_DOUBLE) :
+         std::is_array<T>::value ? SCHEMA_CHARS :
+         std::is_pointer<T>::value ? SCHEMA_CSTR :
+         std::is_signed<T>::value ?
+         (sizeof(T) == 1 ? SCHEMA_I8 : sizeof(T) == 2 ? SCHEMA_I16 : sizeof(T) == 4 ? SCHEMA_I32 : SCHEMA_I64) :
+         (sizeof(T) == 1 ? SCHEMA_U8 : sizeof(T) == 2 ? SCHEMA_U16 : sizeof(T) == 4 ? SCHEMA_U32 : SCHEMA_U64);
+}
+
+/**
+ * Declares a field of struct `type` written on the wire under `key`, with `precision` decimals for floats.
+ */
+#define SCHEMA_FIELD_P(type, member, key, precision) \
+  {key, schema_type_of<decltype(type::member)>(), offsetof(type, member), sizeof(type::member), precision}
+
+#define SCHEMA_FIELD_NAMED(type, member, key) SCHEMA_FIELD_P(type, member, key, SCHEMA_DEFAULT_PRECISION)
+
+#define SCHEMA_FIELD(type, member) SCHEMA_FIELD_NAMED(type, member, #member)
+
+template<size_t N>
+constexpr uint8_t schema_count_of(const schema_field_t (&)[N]) {
+  static_assert(N <= SCHEMA_MAX_FIELDS, "A schema has at most SCHEMA_MAX_FIELDS fields, one bit each in a mask");
+  return N;
+}
+
+#define SCHEMA_DEFINE(fields) {fields, schema_count_of(fields)}
+
+/**
+ * Bounded JSON writer over a caller supplied buffer, nothing is allocated.
+ *
+ * Any write that would not fit marks the writer as overflowed and subsequent writes are dropped, the final
+ * length is then reported as zero so a truncated document is never published.
+ */
+struct json_writer_t {
+  char *buf;
+  size_t size;
+  size_t len;
+  bool overflow;
+  bool need_comma;
+};
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size);
+
+/**
+ * NUL terminates the document.
+ * @return Length of the document, or 0 if it did not fit in the buffer.
+ */
+size_t json_writer_finish(json_writer_t *w);
+
+/**
+ * Opens an object, `key` is nullptr for the root or for array elements.
+ */
+void json_begin_object(json_writer_t *w, const char *key);
+
+void json_end_object(json_writer_t *w);
+
+/**
+ * Opens an array, its elements are written with a nullptr key.
+ */
+void json_begin_array(json_writer_t *w, const char *key);
+
+void json_end_array(json_writer_t *w);
+
+void json_write_null(json_writer_t *w, const char *key);
+
+void json_write_bool(json_writer_t *w, const char *key, bool value);
+
+void json_write_uint(json_writer_t *w, const char *key, uint64_t value);
+
+void json_write_int(json_writer_t *w, const char *key, int64_t value);
+
+/**
+ * Writes a fixed point number, values that cannot be represented (NaN, infinity) are written as null.
+ */
+void json_write_float(json_writer_t *w, const char *key, double value, uint8_t precision);
+
+void json_write_str(json_writer_t *w, const char *key, const char *value);
+
+/**
+ * Writes `value` verbatim, caller is responsible for it being a valid JSON value.
+ */
+void json_write_raw(json_writer_t *w, const char *key, const char *value);
+
+/**
+ * Writes the fields of `obj` selected by `mask` (bit i selects field i) as members of the current object.
+ */
+void json_write_fields(json_writer_t *w, const schema_t &schema, const void *obj, uint32_t mask = SCHEMA_ALL_FIELDS);
+
+/**
+ * Encodes the fields of `obj` selected by `mask` as a flat CBOR map, floats at full precision.
+ * @return Number of bytes written, or 0 if the buffer was too small.
+ */
+size_t schema_cbor_write(uint8_t *buf, size_t size, const schema_t &schema, const void *obj,
+                         uint32_t mask = SCHEMA_ALL_FIELDS);
+
+/**
+ * Collision free lookup table from wire name to field index, see schema_hash_build().
+ */
+#define SCHEMA_HASH_MAX_SLOTS   64
+
+struct schema_hash_t {
+  uint32_t seed;
+  uint8_t mask;
+  // Field index + 1 for each slot, 0 when empty
+  uint8_t slots[SCHEMA_HASH_MAX_SLOTS];
+};
+
+/**
+ * Searches for a hash seed under which every field name of `schema` lands in its own slot, so that a lookup is
+ * one hash and one string compare.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if no perfect hash was found for the schema.
+ */
+esp_err_t schema_hash_build(const schema_t &schema, schema_hash_t *hash);
+
+/**
+ * Looks up a field by its wire name.
+ * @return Field index or -1 when unknown.
+ */
+int schema_find(const schema_t &schema, const schema_hash_t &hash, const char *key, size_t key_len);
+
+/**
+ * Applies a single value to field `index` of `obj`, checking it fits the field type.
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG when the value is out of range for the field.
+ */
+esp_err_t schema_set_number(const schema_t &schema, int index, void *obj, double value);
+
+/**
+ * Reads a JSON object from `reader` onto `obj`, the reader must be positioned just after its opening brace.
+ *
+ * Keys not in the schema are skipped, strings are only accepted for char array fields and without escapes.
+ * The whole object is always consumed so the caller can carry on with the rest of the document. When `touched` is given, the bits of every known key present are set in it.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG when a known key had the wrong type or an out of range value, or
+ * ESP_FAIL when the document is malformed.
+ */
+esp_err_t schema_json_read(const schema_t &schema, const schema_hash_t &hash, struct json_reader_t *reader,
+                           void *obj, uint32_t *touched = nullptr);
+
+/**
+ * Bytes of a struct up to the end of its last field, leaving out the padding after it. Every field of the struct
+ * must be in the schema.
+ */
+size_t schema_struct_end(const schema_t &schema);
+
+/**
+ * Compares two instances of the same struct field by field.
+ * @return Mask of the fields that differ, bit i for field i.
+ */
+uint32_t schema_diff(const schema_t &schema, const void *a, const void *b);
@@ -0,0 +1,151 @@
+#include <cmath>
+#include <algorithm>
+#include "stats.h"
+
+static const schema_field_t s_summary_fields[] = {
+    SCHEMA_FIELD(stats_summary_t, count),
+    SCHEMA_FIELD(stats_summary_t, min),
+    SCHEMA_FIELD(stats_summary_t, max),
+    SCHEMA_FIELD(stats_summary_t, mean),
+    SCHEMA_FIELD(stats_summary_t, p50),
+    SCHEMA_FIELD(stats_summary_t, p95),
+    SCHEMA_FIELD(stats_summary_t, p99),
+};
+const schema_t stats_summary_schema = SCHEMA_DEFINE(s_summary_fields);
+
+void p2_init(p2_quantile_t *est, float p) {
+  *est = {};
+  est->p = p;
+  for (int i = 0; i < 5; i++) {
+    est->n[i] = i;
+  }
+  est->np[0] = 0;
+  est->np[1] = 2 * p;
+  est->np[2] = 4 * p;
+  est->np[3] = 2 + 2 * p;
+  est->np[4] = 4;
+  est->dn[0] = 0;
+  est->dn[1] = p / 2;
+  est->dn[2] = p;
+  est->dn[3] = (1 + p) / 2;
+  est->dn[4] = 1;
+}
+
+static float _parabolic(const p2_quantile_t *est, int i, int d) {
+  const float *q = est->q;
+  const int32_t *n = est->n;
+  return q[i] + (float) d / (float) (n[i + 1] - n[i - 1]) *
+                ((float) (n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (float) (n[i + 1] - n[i]) +
+                 (float) (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (float) (n[i] - n[i - 1]));
+}
+
+static float _linear(const p2_quantile_t *est, int i, int d) {
+  return est->q[i] + (float) d * (est->q[i + d] - est->q[i]) / (float) (est->n[i + d] - est->n[i]);
+}
+
+void p2_add(p2_quantile_t *est, float x) {
+  // Collect the first five samples as the initial markers
+  if (est->count < 5) {
+    est->q[est->count++] = x;
+    if (est->count == 5) {
+      std::sort(est->q, est->q + 5);
+    }
+    return;
+  }
+  est->count++;
+
+  // Find the cell x falls in, stretching the extremes if needed
+  int k;
+  if (x < est->q[0]) {
+    est->q[0] = x;
+    k = 0;
+  } else if (x >= est->q[4]) {
+    est->q[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= est->q[k + 1]) {
+      k++;
+    }
+  }
+
+  for (int i = k + 1; i < 5; i++) {
+    est->n[i]++;
+  }
+  for (int i = 0; i < 5; i++) {
+    est->np[i] += est->dn[i];
+  }
+
+  // Nudge the middle markers towards their desired positions
+  for (int i = 1; i < 4; i++) {
+    float d = est->np[i] - (float) est->n[i];
+    if ((d >= 1 && est->n[i + 1] - est->n[i] > 1) || (d <= -1 && est->n[i - 1] - est->n[i] < -1)) {
+      int ds = d > 0 ? 1 : -1;
+      float q = _parabolic(est, i, ds);
+      if (est->q[i - 1] < q && q < est->q[i + 1]) {
+        est->q[i] = q;
+      } else {
+        est->q[i] = _linear(est, i, ds);
+      }
+      est->n[i] += ds;
+    }
+  }
+}
+
+float p2_value(const p2_quantile_t *est) {
+  if (est->count == 0) {
+    return NAN;
+  }
+  if (est->count >= 5) {
+    return est->q[2];
+  }
+
+  // Too few samples for the markers, answer from the samples themselves
+  float sorted[5];
+  std::copy(est->q, est->q + est->count, sorted);
+  std::sort(sorted, sorted + est->count);
+  auto index = (uint32_t) lroundf(est->p * (float) (est->count - 1));
+  return sorted[index];
+}
+
+void stream_stats_reset(stream_stats_t *stats) {
+  stats->count = 0;
+  stats->min = NAN;
+  stats->max = NAN;
+  stats->mean = NAN;
+  p2_init(&stats->p50, 0.50f);
+  p2_init(&stats->p95, 0.95f);
+  p2_init(&stats->p99, 0.99f);
+}
+
+void stream_stats_add(stream_stats_t *stats, float x) {
+  if (!std::isfinite(x)) {
+    return;
+  }
+
+  stats->count++;
+  if (stats->count == 1) {
+    stats->min = x;
+    stats->max = x;
+    stats->mean = x;
+  } else {
+    stats->min = std::min(stats->min, x);
+    stats->max = std::max(stats->max, x);
+    stats->mean += (x - stats->mean) / (float) stats->count;
+  }
+  p2_add(&stats->p50, x);
+  p2_add(&stats->p95, x);
+  p2_add(&stats->p99, x);
+}
+
+stats_summary_t stream_stats_summary(const stream_stats_t *stats) {
+  return {
+      .count = stats->count,
+      .min = stats->min,
+      .max = stats->max,
+      .mean = stats->mean,
+      .p50 = p2_value(&stats->p50),
+      .p95 = p2_value(&stats->p95),
+      .p99 = p2_value(&stats->p99),
+  };
+}
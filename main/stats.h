@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "schema.h"
+
+/**
+ * Constant memory streaming statistics, updated once per control tick and reported per metrics interval.
+ */
+
+/**
+ * P² estimator of a single quantile (Jain & Chlamtac, 1985), five markers and no sample storage.
+ */
+struct p2_quantile_t {
+  float p;
+  uint32_t count;
+  // Marker heights, actual and desired positions, and desired position increments
+  float q[5];
+  int32_t n[5];
+  float np[5];
+  float dn[5];
+};
+
+void p2_init(p2_quantile_t *est, float p);
+
+void p2_add(p2_quantile_t *est, float x);
+
+/**
+ * Current estimate, exact while fewer than five samples were seen. NaN when empty.
+ */
+float p2_value(const p2_quantile_t *est);
+
+struct stream_stats_t {
+  uint32_t count;
+  float min;
+  float max;
+  float mean;
+  p2_quantile_t p50;
+  p2_quantile_t p95;
+  p2_quantile_t p99;
+};
+
+/**
+ * Reportable summary of a stream_stats_t.
+ */
+struct stats_summary_t {
+  uint32_t count;
+  float min;
+  float max;
+  float mean;
+  float p50;
+  float p95;
+  float p99;
+};
+
+extern const schema_t stats_summary_schema;
+
+void stream_stats_reset(stream_stats_t *stats);
+
+void stream_stats_add(stream_stats_t *stats, float x);
+
+stats_summary_t stream_stats_summary(const stream_stats_t *stats);
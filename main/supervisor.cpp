@@ -0,0 +1,208 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_task_wdt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <algorithm>
+#include "supervisor.h"
+#include "level_shifter.h"
+#include "task_plan.h"
+#include "flight_recorder.h"
+
+#define TAG "supervisor"
+
+static const schema_field_t s_metrics_fields[] = {
+    SCHEMA_FIELD(supervisor_metrics_t, checks),
+    SCHEMA_FIELD(supervisor_metrics_t, max_check_gap_us),
+    SCHEMA_FIELD(supervisor_metrics_t, trips),
+    SCHEMA_FIELD(supervisor_metrics_t, tc_temp_trips),
+    SCHEMA_FIELD(supervisor_metrics_t, tc_fault_trips),
+    SCHEMA_FIELD(supervisor_metrics_t, board_temp_trips),
+    SCHEMA_FIELD(supervisor_metrics_t, no_reading_trips),
+    SCHEMA_FIELD(supervisor_metrics_t, stale_trips),
+    SCHEMA_FIELD(supervisor_metrics_t, last_trip),
+    SCHEMA_FIELD(supervisor_metrics_t, last_reaction_us),
+    SCHEMA_FIELD(supervisor_metrics_t, max_reaction_us),
+};
+const schema_t supervisor_metrics_schema = SCHEMA_DEFINE(s_metrics_fields);
+
+static const char *s_trip_names[SUPERVISOR_TRIP_COUNT] = {
+    "none",
+    "thermocouple limit",
+    "thermocouple fault",
+    "board temperature",
+    "no reading",
+    "stale samples",
+};
+
+static TaskHandle_t s_task = nullptr;
+
+// Handed over by the control task and read by the supervisor, under the lock
+static max31850_data_t s_sample = {};
+static int64_t s_sample_us = 0;
+static uint16_t s_max_tc_temp = 0;
+static uint8_t s_max_board_temp = 0;
+static bool s_active = false;
+static bool s_armed = false;
+static ssr_ctrl_handle_t s_ssr1 = nullptr;
+static ssr_ctrl_handle_t s_ssr2 = nullptr;
+static supervisor_metrics_t s_metrics = {};
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Supervisor only
+static supervisor_trip_t s_trip = SUPERVISOR_TRIP_NONE;
+static bool s_cut_level_shifter = false;
+static int64_t s_last_check_us = 0;
+static bool s_was_active = false;
+
+void supervisor_publish(const max31850_data_t &sample) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_sample = sample;
+  s_sample_us = now;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void supervisor_set_limits(uint16_t max_tc_temp, uint8_t max_board_temp) {
+  portENTER_CRITICAL(&s_lock);
+  s_max_tc_temp = max_tc_temp;
+  s_max_board_temp = max_board_temp;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void supervisor_set_active(bool active) {
+  portENTER_CRITICAL(&s_lock);
+  bool wake = active && !s_active;
+  s_active = active;
+  portEXIT_CRITICAL(&s_lock);
+  // Checked straight away, not at the end of an idle period
+  if (wake && s_task) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
+/* The most severe limit the sample breaks, and since when */
+static supervisor_trip_t _evaluate(const max31850_data_t &sample, int64_t sample_us, uint16_t max_tc_temp,
+                                   uint8_t max_board_temp, int64_t now, int64_t *since) {
+  *since = sample_us;
+  if (now - sample_us >= SUPERVISOR_STALE_US) {
+    *since = sample_us + SUPERVISOR_STALE_US;
+    return SUPERVISOR_TRIP_STALE;
+  } else if (!sample.is_valid) {
+    return SUPERVISOR_TRIP_NO_READING;
+  } else if (sample.junction_temp > max_board_temp) {
+    return SUPERVISOR_TRIP_BOARD_TEMP;
+  } else if (sample.thermocouple_status != MAX31850_TC_STATUS_OK) {
+    return SUPERVISOR_TRIP_TC_FAULT;
+  } else if (sample.tc_temp >= max_tc_temp) {
+    return SUPERVISOR_TRIP_TC_TEMP;
+  }
+  return SUPERVISOR_TRIP_NONE;
+}
+
+void supervisor_check() {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  bool armed = s_armed;
+  max31850_data_t sample = s_sample;
+  int64_t sample_us = s_sample_us;
+  uint16_t max_tc_temp = s_max_tc_temp;
+  uint8_t max_board_temp = s_max_board_temp;
+  bool active = s_active;
+  portEXIT_CRITICAL(&s_lock);
+  if (!armed) {
+    return;
+  }
+
+  int64_t since;
+  supervisor_trip_t trip = _evaluate(sample, sample_us, max_tc_temp, max_board_temp, now, &since);
+  bool both = trip >= SUPERVISOR_TRIP_BOARD_TEMP;
+  if (trip != SUPERVISOR_TRIP_NONE) {
+    ssr_ctrl_force_off(s_ssr2);
+  }
+  if (both) {
+    ssr_ctrl_force_off(s_ssr1);
+    level_shifter_enable(false);
+    s_cut_level_shifter = true;
+  } else if (s_cut_level_shifter) {
+    level_shifter_enable(true);
+    s_cut_level_shifter = false;
+  }
+  int64_t reaction_us = esp_timer_get_time() - since;
+
+  bool tripped = trip != SUPERVISOR_TRIP_NONE && trip != s_trip;
+  portENTER_CRITICAL(&s_lock);
+  s_metrics.checks++;
+  if (active && s_was_active) {
+    s_metrics.max_check_gap_us = std::max(s_metrics.max_check_gap_us, (uint32_t) (now - s_last_check_us));
+  }
+  if (tripped) {
+    s_metrics.trips++;
+    s_metrics.tc_temp_trips += trip == SUPERVISOR_TRIP_TC_TEMP;
+    s_metrics.tc_fault_trips += trip == SUPERVISOR_TRIP_TC_FAULT;
+    s_metrics.board_temp_trips += trip == SUPERVISOR_TRIP_BOARD_TEMP;
+    s_metrics.no_reading_trips += trip == SUPERVISOR_TRIP_NO_READING;
+    s_metrics.stale_trips += trip == SUPERVISOR_TRIP_STALE;
+    s_metrics.last_trip = trip;
+    s_metrics.last_reaction_us = (uint32_t) reaction_us;
+    s_metrics.max_reaction_us = std::max(s_metrics.max_reaction_us, (uint32_t) reaction_us);
+  }
+  portEXIT_CRITICAL(&s_lock);
+
+  if (tripped) {
+    flight_recorder_event(FLIGHT_RECORD_TRIP, trip, (uint32_t) reaction_us);
+    ESP_LOGW(TAG, "Tripped on %s, %s off in %lldus", s_trip_names[trip], both ? "both elements" : "secondary",
+             reaction_us);
+  } else if (trip == SUPERVISOR_TRIP_NONE && s_trip != SUPERVISOR_TRIP_NONE) {
+    flight_recorder_event(FLIGHT_RECORD_TRIP, SUPERVISOR_TRIP_NONE);
+    ESP_LOGI(TAG, "Cleared %s", s_trip_names[s_trip]);
+  }
+  s_trip = trip;
+  s_last_check_us = now;
+  s_was_active = active;
+}
+
+void supervisor_start(ssr_ctrl_handle_t ssr1, ssr_ctrl_handle_t ssr2) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_lock);
+  s_ssr1 = ssr1;
+  s_ssr2 = ssr2;
+  // Nothing read yet, the first sample is due within a tick
+  s_sample = {};
+  s_sample.is_valid = true;
+  s_sample_us = now;
+  s_armed = true;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void supervisor_stop() {
+  portENTER_CRITICAL(&s_lock);
+  s_armed = false;
+  portEXIT_CRITICAL(&s_lock);
+}
+
+supervisor_metrics_t supervisor_get_metrics() {
+  portENTER_CRITICAL(&s_lock);
+  supervisor_metrics_t metrics = s_metrics;
+  portEXIT_CRITICAL(&s_lock);
+  return metrics;
+}
+
+static void _supervise(void *) {
+  // Its own subscription, a stalled control task does not hide a stalled supervisor and the other way round
+  ESP_ERROR_CHECK(esp_task_wdt_add(nullptr));
+  while (true) {
+    portENTER_CRITICAL(&s_lock);
+    uint32_t period_ms = s_active ? SUPERVISOR_PERIOD_MS : SUPERVISOR_IDLE_PERIOD_MS;
+    portEXIT_CRITICAL(&s_lock);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(period_ms));
+    ESP_ERROR_CHECK(esp_task_wdt_reset());
+    supervisor_check();
+  }
+}
+
+void supervisor_init() {
+  if (!s_task) {
+    ESP_ERROR_CHECK(task_plan_create(TASK_SUPERVISOR, _supervise, nullptr, &s_task));
+  }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include "max31850.h"
+#include "ssr_ctrl.h"
+#include "schema.h"
+
+/**
+ * Safety supervisor, a small task on the network core with its own watchdog subscription. It checks the latest
+ * thermocouple sample the control task published against the limits, every SUPERVISOR_PERIOD_MS while the SSRs are
+ * powered, and forces the SSRs off itself rather than waiting for the rest of the control tick:
+ *
+ *   thermocouple at max_tc_temp or faulted     secondary off, the main element follows the Hottop as the control
+ *                                              decision has it
+ *   board past max_board_temp, no reading, or  both off and the level shifter disabled, until a fresh sample in
+ *   no sample for SUPERVISOR_STALE_US          the limits comes in
+ *
+ * The control decision applies the same limits on the same sample, so the two never disagree, the supervisor
+ * only gets there first and still does when the control task stalls.
+ */
+
+#define SUPERVISOR_PERIOD_MS        50
+#define SUPERVISOR_IDLE_PERIOD_MS   1000
+// Two and a half control ticks
+#define SUPERVISOR_STALE_US         2500000
+
+enum supervisor_trip_t : uint8_t {
+  SUPERVISOR_TRIP_NONE = 0,
+  SUPERVISOR_TRIP_TC_TEMP = 1,
+  SUPERVISOR_TRIP_TC_FAULT = 2,
+  SUPERVISOR_TRIP_BOARD_TEMP = 3,
+  SUPERVISOR_TRIP_NO_READING = 4,
+  SUPERVISOR_TRIP_STALE = 5,
+  SUPERVISOR_TRIP_COUNT = 6,
+};
+
+struct supervisor_metrics_t {
+  // Checks since boot, and the longest time between two while the SSRs were powered
+  uint32_t checks;
+  uint32_t max_check_gap_us;
+  // Trips since boot, by reason, and the reason of the last one, a supervisor_trip_t
+  uint32_t trips;
+  uint32_t tc_temp_trips;
+  uint32_t tc_fault_trips;
+  uint32_t board_temp_trips;
+  uint32_t no_reading_trips;
+  uint32_t stale_trips;
+  uint8_t last_trip;
+  // From the sample that tripped it, or samples going stale, to the SSRs forced off
+  uint32_t last_reaction_us;
+  uint32_t max_reaction_us;
+};
+
+extern const schema_t supervisor_metrics_schema;
+
+/**
+ * Hands over a thermocouple sample as soon as it is read, control task only.
+ */
+void supervisor_publish(const max31850_data_t &sample);
+
+/**
+ * Limits from the controller configuration, from any task.
+ */
+void supervisor_set_limits(uint16_t max_tc_temp, uint8_t max_board_temp);
+
+/**
+ * Checks at SUPERVISOR_PERIOD_MS while the SSRs are powered, SUPERVISOR_IDLE_PERIOD_MS otherwise.
+ */
+void supervisor_set_active(bool active);
+
+/**
+ * One check, run by the supervisor task.
+ */
+void supervisor_check();
+
+/**
+ * Starts supervising the SSRs, samples are stale SUPERVISOR_STALE_US from here until the first one.
+ */
+void supervisor_start(ssr_ctrl_handle_t ssr1, ssr_ctrl_handle_t ssr2);
+
+/**
+ * Stops supervising, the control loop powers everything off after it.
+ */
+void supervisor_stop();
+
+supervisor_metrics_t supervisor_get_metrics();
+
+void supervisor_init();
@@ -0,0 +1,26 @@
+#include <esp_log.h>
+#include "task_plan.h"
+
+#define TAG "task_plan"
+
+static const task_plan_t s_plans[TASK_COUNT] = {
+    {.name = "control", .stack_size = 4096, .priority = 19, .core = TASK_CORE_CONTROL},
+    {.name = "supervisor", .stack_size = 2560, .priority = 20, .core = TASK_CORE_NETWORK},
+    {.name = "send_telemetry", .stack_size = 4096, .priority = 4, .core = TASK_CORE_NETWORK},
+    {.name = "httpd", .stack_size = 6144, .priority = 5, .core = TASK_CORE_NETWORK},
+    {.name = "bench", .stack_size = 8192, .priority = 19, .core = TASK_CORE_CONTROL},
+    {.name = "net_load", .stack_size = 4096, .priority = 5, .core = TASK_CORE_NETWORK},
+};
+
+const task_plan_t &task_plan(task_id_t task) {
+  return s_plans[task];
+}
+
+esp_err_t task_plan_create(task_id_t task, TaskFunction_t fn, void *arg, TaskHandle_t *handle) {
+  const task_plan_t &plan = s_plans[task];
+  if (xTaskCreatePinnedToCore(fn, plan.name, plan.stack_size, arg, plan.priority, handle, plan.core) != pdPASS) {
+    ESP_LOGE(TAG, "Unable to create task %s", plan.name);
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/**
+ * Where each task of the firmware runs and at what priority, in one table. The control task, its tick and the SSR
+ * alarms have core 1 to themselves, the safety supervisor, WiFi, lwIP, MQTT, telemetry and the local server run on
+ * core 0, see sdkconfig for the tasks ESP-IDF creates itself. An interrupt is allocated on the core of the task
+ * enabling it, which is why the control task sets up its own peripherals.
+ *
+ * A firmware built with -DNO_CORE_ISOLATION=1 leaves every task free to run on either core, for comparison.
+ */
+
+#ifdef CMAKE_NO_CORE_ISOLATION
+#define TASK_CORE_CONTROL   tskNO_AFFINITY
+#define TASK_CORE_NETWORK   tskNO_AFFINITY
+#else
+#define TASK_CORE_CONTROL   1
+#define TASK_CORE_NETWORK   0
+#endif
+
+enum task_id_t : uint8_t {
+  // Control loop, from init to its end, above lwIP so it is not held up by it even sharing a core
+  TASK_CONTROL = 0,
+  // Safety supervisor, on the other core from control so a stalled control task cannot hold it up, above lwIP
+  TASK_SUPERVISOR = 1,
+  TASK_TELEMETRY = 2,
+  // esp_http_server's task
+  TASK_LOCAL_SERVER = 3,
+  // Benchmark cases on a fresh stack, on the control core
+  TASK_BENCH = 4,
+  // Synthetic network load of the jitter benchmark, at the priority of the MQTT agent
+  TASK_NET_LOAD = 5,
+  TASK_COUNT = 6,
+};
+
+struct task_plan_t {
+  const char *name;
+  uint32_t stack_size;
+  UBaseType_t priority;
+  // Core pinned to, tskNO_AFFINITY for either
+  BaseType_t core;
+};
+
+const task_plan_t &task_plan(task_id_t task);
+
+/**
+ * Creates a task as planned.
+ * @return ESP_ERR_NO_MEM when it could not be created
+ */
+esp_err_t task_plan_create(task_id_t task, TaskFunction_t fn, void *arg, TaskHandle_t *handle = nullptr);
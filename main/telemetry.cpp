@@ -8,22 +8,28 @@
 #include "sntp/sntp_sync.h"
 #include "app_metrics.h"
 #include "device_info.h"
+#include "local_server.h"
+#include "command_topic.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <esp_cpu.h>
 #include <cstring>
 #include <ctime>
 #include <nvs.h>
 #include "control_loop.h"
 #include "app_config.h"
+#include "control_record.h"
 #include "utils.h"
+#include "task_plan.h"
 
 #define TAG "telemetry"
 #define DEFAULT_STATUS_INTERVAL_SEC (5)
 #define DEFAULT_METRICS_INTERVAL_SEC (60*30)
 
 #define TOPIC_MAX_SIZE (128)
-#define PAYLOAD_MAX_SIZE (1024)
+// The metrics document is the largest, within CONFIG_MQTT_NETWORK_BUFFER_SIZE
+#define PAYLOAD_MAX_SIZE (4096)
 
 static EventGroupHandle_t xNetworkEventGroup;
 static bool _go = false;
@@ -34,37 +40,33 @@ static telemetry_cfg_t s_cfg = {
     .metrics_interval_s = DEFAULT_METRICS_INTERVAL_SEC,
 };
 
+static const schema_field_t s_cfg_fields[] = {
+    SCHEMA_FIELD_NAMED(telemetry_cfg_t, status_interval_s, "status_interval"),
+    SCHEMA_FIELD_NAMED(telemetry_cfg_t, metrics_interval_s, "metrics_interval"),
+};
+const schema_t telemetry_cfg_schema = SCHEMA_DEFINE(s_cfg_fields);
 
 static char info_topic[TOPIC_MAX_SIZE];
+static char record_topic[TOPIC_MAX_SIZE];
+static char roast_topic[TOPIC_MAX_SIZE];
 static char payload[PAYLOAD_MAX_SIZE];
 
+// Summary of the last roast until it is published, handed over by the control task
+static roast_summary_t s_roast;
+static bool s_roast_pending = false;
+static portMUX_TYPE s_roast_lock = portMUX_INITIALIZER_UNLOCKED;
+
 
 static void _send_status() {
-  static const char* format = R"({
-    "timestamp": %)" PRIu32 R"(,
-    "loop_count": %)" PRIu32 R"(,
-    "tc_temp": %f,
-    "junction_temp": %f,
-    "tc_status": %)" PRIu8 R"(,
-    "tc_error_count": %)" PRIu32 R"(,
-    "motor_on": %)" PRIu8 R"(,
-    "fan_duty": %)" PRIu8 R"(,
-    "balance": %f,
-    "input_duty": %)" PRIu8 R"(,
-    "output_duty": %)" PRIu8 R"(
-  })";
   auto control_state = controller_get_state();
-  size_t len = sprintf(payload, format, (uint32_t)time(nullptr),
-          control_state.loop_count,
-          control_state.tc_temp,
-          control_state.junction_temp,
-          control_state.tc_status,
-          control_state.tc_error_count,
-          control_state.motor_on,
-          control_state.fan_duty,
-          control_state.balance,
-          control_state.input_duty,
-          control_state.output_duty);
+  uint32_t start_cycles = esp_cpu_get_cycle_count();
+  size_t len = control_state_format(payload, PAYLOAD_MAX_SIZE, control_state, (uint32_t) time(nullptr));
+  if (len == 0) {
+    ESP_LOGE(TAG, "Status payload does not fit in %d bytes", PAYLOAD_MAX_SIZE);
+    return;
+  }
+  ESP_LOGD(TAG, "Status document %d bytes in %" PRIu32 " cycles, stack free %u bytes", len,
+           esp_cpu_get_cycle_count() - start_cycles, uxTaskGetStackHighWaterMark(nullptr));
 
   MQTTPublishInfo_t publishInfo = {
       .qos = MQTTQoS_t::MQTTQoS1,
@@ -80,9 +82,65 @@ static void _send_status() {
   mqtt_client_publish(&publishInfo, CONFIG_MQTT_ACK_TIMEOUT_MS);
 }
 
+static void _send_record() {
+  size_t len = control_record_drain((uint8_t *) payload, PAYLOAD_MAX_SIZE);
+  if (len == 0) {
+    return;
+  }
+
+  MQTTPublishInfo_t publishInfo = {
+      .qos = MQTTQoS_t::MQTTQoS1,
+      .retain = false,
+      .dup = false,
+      .pTopicName = record_topic,
+      .topicNameLength = (uint16_t) strlen(record_topic),
+      .pPayload = payload,
+      .payloadLength = len,
+  };
+
+  ESP_LOGD(TAG, "Control record chunk %d bytes, %" PRIu32 " records dropped so far", len, control_record_dropped());
+  mqtt_client_publish(&publishInfo, CONFIG_MQTT_ACK_TIMEOUT_MS);
+}
+
+static void _send_roast() {
+  roast_summary_t summary;
+  portENTER_CRITICAL(&s_roast_lock);
+  bool pending = s_roast_pending;
+  summary = s_roast;
+  portEXIT_CRITICAL(&s_roast_lock);
+  if (!pending) {
+    return;
+  }
+
+  size_t len = roast_summary_format(payload, PAYLOAD_MAX_SIZE, summary);
+  if (len == 0) {
+    // Kept pending, it goes with the next loop should the document fit then
+    ESP_LOGE(TAG, "Roast summary does not fit in %d bytes", PAYLOAD_MAX_SIZE);
+    return;
+  }
+  MQTTPublishInfo_t publishInfo = {
+      .qos = MQTTQoS_t::MQTTQoS1,
+      .retain = false,
+      .dup = false,
+      .pTopicName = roast_topic,
+      .topicNameLength = (uint16_t) strlen(roast_topic),
+      .pPayload = payload,
+      .payloadLength = len,
+  };
+
+  ESP_LOGI(TAG, "%.*s\n", len, payload);
+  mqtt_client_publish(&publishInfo, CONFIG_MQTT_ACK_TIMEOUT_MS);
+
+  // Unless another roast ended meanwhile
+  portENTER_CRITICAL(&s_roast_lock);
+  s_roast_pending = s_roast.start_loop != summary.start_loop;
+  portEXIT_CRITICAL(&s_roast_lock);
+}
+
 static void _send_telemetry(void *) {
   do {
     uint64_t now = esp_timer_get_time();
+    app_metrics_take_samples();
 
     // Wait for MQTT and ensure we are not doing an OTA
     xEventGroupWaitBits(xNetworkEventGroup,
@@ -102,17 +160,22 @@ static void _send_telemetry(void *) {
       if(app_config_update_required()) {
         app_config_update_send(payload, PAYLOAD_MAX_SIZE);
       }
+      if (app_metrics_postmortem_pending()) {
+        app_metrics_postmortem_send(payload, PAYLOAD_MAX_SIZE);
+      }
       if (app_metrics_update_required(s_cfg.metrics_interval_s)) {
         app_metrics_send(payload, PAYLOAD_MAX_SIZE);
       }
 
       _send_status();
+      _send_record();
+      _send_roast();
     }
 
     uint64_t delta = esp_timer_get_time() - now;
-    auto interval = (uint64_t)(s_cfg.status_interval_s / 1e6);
+    uint64_t interval = (uint64_t) s_cfg.status_interval_s * 1000 * 1000;
     if (delta < interval) {
-      vTaskDelay(pdMS_TO_TICKS((interval - delta))/1000);
+      vTaskDelay(pdMS_TO_TICKS((interval - delta) / 1000));
     }
   } while (_go);
 }
@@ -145,6 +208,13 @@ esp_err_t telemetry_set_cfg(telemetry_cfg_t cfg) {
 
 
 
+void telemetry_roast_done(const roast_summary_t &summary) {
+  portENTER_CRITICAL(&s_roast_lock);
+  s_roast = summary;
+  s_roast_pending = true;
+  portEXIT_CRITICAL(&s_roast_lock);
+}
+
 void telemetry_init(EventGroupHandle_t net_group) {
   if (_go) {
     return;
@@ -153,11 +223,17 @@ void telemetry_init(EventGroupHandle_t net_group) {
   utils_load_from_nvs("telemetry", "cfg", &s_cfg, sizeof(telemetry_cfg_t));
   xNetworkEventGroup = net_group;
   device_info_init();
-  app_metrics_init();
+  app_metrics_start();
+  local_server_init();
+  command_topic_init();
 
   // Regular telemetry
   sprintf(info_topic, "%s/%s/telemetry/status", CMAKE_THING_TYPE, identity_thing_id());
+  // Raw control inputs and outputs, see control_record.h
+  sprintf(record_topic, "%s/%s/telemetry/record", CMAKE_THING_TYPE, identity_thing_id());
+  // One summary per roast, see roast_session.h
+  sprintf(roast_topic, "%s/%s/telemetry/roast", CMAKE_THING_TYPE, identity_thing_id());
 
   _go = true;
-  xTaskCreate(_send_telemetry, "send_telemetry", 3072, nullptr, 4, nullptr);
+  task_plan_create(TASK_TELEMETRY, _send_telemetry, nullptr);
 }
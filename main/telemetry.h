@@ -2,6 +2,8 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include "schema.h"
+#include "roast_session.h"
 
 struct telemetry_cfg_t {
   /**
@@ -15,8 +17,19 @@ struct telemetry_cfg_t {
   uint32_t metrics_interval_s;
 };
 
+/**
+ * Wire schema for the telemetry section of the config shadow.
+ */
+extern const schema_t telemetry_cfg_schema;
+
 telemetry_cfg_t telemetry_get_cfg();
 
 esp_err_t telemetry_set_cfg(telemetry_cfg_t cfg);
 
+/**
+ * Hands over the summary of a roast that just ended, published once on telemetry/roast. Only the latest is kept
+ * while it waits for a connection.
+ */
+void telemetry_roast_done(const roast_summary_t &summary);
+
 void telemetry_init(EventGroupHandle_t net_group);
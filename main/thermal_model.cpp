@@ -0,0 +1,142 @@
+#include <cmath>
+#include "thermal_model.h"
+
+// Initial covariance, large against parameters of order 1 so the first ticks move them freely
+#define INITIAL_COVARIANCE  100.0f
+
+// Forgetting is suspended while the covariance trace is above this, directions the data does not excite would
+// otherwise grow without bound, the main and secondary duties move together in ratio mode
+#define MAX_COVARIANCE_TRACE  1000.0f
+
+static const uint8_t s_delays[THERMAL_MODEL_DELAYS] = {0, 5, 10, 15, 20, 30, 45, 60};
+
+static_assert(THERMAL_MODEL_HISTORY > 60, "History shorter than the longest candidate delay");
+
+static void _rls_reset(thermal_model_rls_t *rls) {
+  *rls = {};
+  for (int i = 0; i < THERMAL_MODEL_PARAMS; i++) {
+    rls->p[i][i] = INITIAL_COVARIANCE;
+  }
+}
+
+/*
+ * One tick of the model run open loop on its own output. One tick ahead, quantisation noise swamps the
+ * difference between delays, the error of the free running model shows which one has the dynamics right.
+ */
+static void _simulate(thermal_model_rls_t *rls, const float *phi, float temp) {
+  if (!rls->simulating) {
+    rls->simulated = phi[0] * 100;
+    rls->simulating = true;
+  }
+
+  float sim_phi[THERMAL_MODEL_PARAMS] = {rls->simulated / 100, phi[1], phi[2], phi[3], phi[4]};
+  float step = 0;
+  for (int i = 0; i < THERMAL_MODEL_PARAMS; i++) {
+    step += rls->theta[i] * sim_phi[i];
+  }
+  rls->simulated += step;
+
+  float error = temp - rls->simulated;
+  rls->cost = THERMAL_MODEL_FORGETTING * rls->cost + error * error;
+}
+
+static void _rls_update(thermal_model_rls_t *rls, const float *phi, float y) {
+  float p_phi[THERMAL_MODEL_PARAMS];
+  float denominator = THERMAL_MODEL_FORGETTING;
+  float prediction = 0;
+  float trace = 0;
+
+  for (int i = 0; i < THERMAL_MODEL_PARAMS; i++) {
+    float sum = 0;
+    for (int j = 0; j < THERMAL_MODEL_PARAMS; j++) {
+      sum += (i <= j ? rls->p[i][j] : rls->p[j][i]) * phi[j];
+    }
+    p_phi[i] = sum;
+    denominator += phi[i] * sum;
+    prediction += rls->theta[i] * phi[i];
+  }
+
+  float error = y - prediction;
+  rls->residual = THERMAL_MODEL_FORGETTING * rls->residual + error * error;
+  for (int i = 0; i < THERMAL_MODEL_PARAMS; i++) {
+    rls->theta[i] += p_phi[i] / denominator * error;
+    trace += rls->p[i][i];
+  }
+
+  float forget = trace > MAX_COVARIANCE_TRACE ? 1 : THERMAL_MODEL_FORGETTING;
+  for (int i = 0; i < THERMAL_MODEL_PARAMS; i++) {
+    for (int j = i; j < THERMAL_MODEL_PARAMS; j++) {
+      rls->p[i][j] = (rls->p[i][j] - p_phi[i] * p_phi[j] / denominator) / forget;
+    }
+  }
+}
+
+void thermal_model_reset(thermal_model_t *model) {
+  *model = {};
+  for (auto &rls: model->rls) {
+    _rls_reset(&rls);
+  }
+}
+
+void thermal_model_update(thermal_model_t *model, bool temp_valid, float temp_c, uint8_t main_duty,
+                          uint8_t secondary_duty, uint8_t fan_duty) {
+  if (temp_valid && model->last_valid) {
+    float y = temp_c - model->last_temp;
+    for (int i = 0; i < THERMAL_MODEL_DELAYS; i++) {
+      if (s_delays[i] >= model->history) {
+        continue;
+      }
+      const uint8_t *u = model->duty[(model->head + THERMAL_MODEL_HISTORY - s_delays[i]) % THERMAL_MODEL_HISTORY];
+      float phi[THERMAL_MODEL_PARAMS] = {model->last_temp / 100, u[0] / 100.0f, u[1] / 100.0f, u[2] / 100.0f, 1};
+      _simulate(&model->rls[i], phi, temp_c);
+      _rls_update(&model->rls[i], phi, y);
+    }
+    model->updates++;
+  }
+
+  model->head = (model->head + 1) % THERMAL_MODEL_HISTORY;
+  model->duty[model->head][0] = main_duty;
+  model->duty[model->head][1] = secondary_duty;
+  model->duty[model->head][2] = fan_duty;
+  model->history += model->history < THERMAL_MODEL_HISTORY ? 1 : 0;
+  model->last_valid = temp_valid;
+  model->last_temp = temp_c;
+}
+
+/* Whether parameter `i` is known well enough, from its variance: covariance times the residual variance */
+static bool _identified(const thermal_model_rls_t *rls, int i) {
+  float variance = rls->p[i][i] * rls->residual * (1 - THERMAL_MODEL_FORGETTING);
+  float spread = THERMAL_MODEL_MAX_GAIN_SPREAD * rls->theta[i];
+  return variance < spread * spread;
+}
+
+thermal_model_estimate_t thermal_model_estimate(const thermal_model_t *model, float tick_period_s) {
+  thermal_model_estimate_t estimate = {NAN, NAN, NAN, NAN, NAN, NAN};
+  if (model->updates < THERMAL_MODEL_WARMUP) {
+    return estimate;
+  }
+
+  int best = 0;
+  for (int i = 1; i < THERMAL_MODEL_DELAYS; i++) {
+    best = model->rls[i].cost < model->rls[best].cost ? i : best;
+  }
+  const float *theta = model->rls[best].theta;
+
+  // theta[0] is (a - 1) * 100, a first order response needs 0 < a < 1
+  float a = 1 + theta[0] / 100;
+  if (a <= 0 || a >= 1) {
+    return estimate;
+  }
+  float scale = -100 / theta[0];
+  float gains[3];
+  for (int i = 0; i < 3; i++) {
+    gains[i] = _identified(&model->rls[best], i + 1) ? theta[i + 1] * scale : NAN;
+  }
+  estimate.gain_main = gains[0];
+  estimate.gain_secondary = gains[1];
+  estimate.gain_fan = gains[2];
+  estimate.tau_s = -tick_period_s / logf(a);
+  estimate.dead_time_s = s_delays[best] * tick_period_s;
+  estimate.rmse = sqrtf(model->rls[best].cost * (1 - THERMAL_MODEL_FORGETTING));
+  return estimate;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Online identification of a first order plus dead time model of the chamber thermocouple:
+ *
+ *   tau dT/dt = -(T - T0) + K_main u_main(t - L) + K_secondary u_secondary(t - L) + K_fan u_fan(t - L)
+ *
+ * Discretised at the control tick, T[k+1] - T[k] = (a - 1) T[k] + b . u[k - d] + c is fitted by recursive least
+ * squares with exponential forgetting. The dead time is not linear in the parameters, so a small bank of
+ * estimators runs one per candidate delay and the one whose model, run open loop, tracked the thermocouple best
+ * recently wins.
+ *
+ * Each tick costs the same fixed number of operations and nothing is allocated, the duties applied over the
+ * longest candidate delay are all that is kept.
+ */
+
+// Regressors: T[k] / 100, the three duties as fractions and a constant
+#define THERMAL_MODEL_PARAMS      5
+
+// Candidate dead times in ticks, and the duty history they need
+#define THERMAL_MODEL_DELAYS      8
+#define THERMAL_MODEL_HISTORY     64
+
+// Memory of about 1000 ticks, most of a roast
+#define THERMAL_MODEL_FORGETTING  0.999f
+
+// Ticks before estimates are reported, the initial covariance makes the first ones meaningless
+#define THERMAL_MODEL_WARMUP      300
+
+struct thermal_model_rls_t {
+  float theta[THERMAL_MODEL_PARAMS];
+  // Upper triangle is kept, the covariance is symmetric
+  float p[THERMAL_MODEL_PARAMS][THERMAL_MODEL_PARAMS];
+  // Exponentially weighted squared one tick prediction error, for the parameter variances
+  float residual;
+  // Model output run open loop from the duties, and its exponentially weighted squared error
+  float simulated;
+  bool simulating;
+  float cost;
+};
+
+struct thermal_model_t {
+  thermal_model_rls_t rls[THERMAL_MODEL_DELAYS];
+  // Duty percentages applied, main, secondary and fan, newest at head
+  uint8_t duty[THERMAL_MODEL_HISTORY][3];
+  uint8_t head;
+  uint8_t history;
+  bool last_valid;
+  float last_temp;
+  uint32_t updates;
+};
+
+// A gain is only reported once its standard deviation is below this fraction of it
+#define THERMAL_MODEL_MAX_GAIN_SPREAD  0.2f
+
+/**
+ * Identified model, NaN until enough ticks were seen or while the fit is not a stable first order response.
+ * Gains are also NaN while the duties did not move enough to tell them apart, in ratio mode the main and
+ * secondary duties only separate when the balance is turned.
+ */
+struct thermal_model_estimate_t {
+  // Steady state rise in degrees at 100% duty, the fan one is negative
+  float gain_main;
+  float gain_secondary;
+  float gain_fan;
+  float tau_s;
+  float dead_time_s;
+  // Root mean square error of the winning estimator run open loop, degrees
+  float rmse;
+};
+
+void thermal_model_reset(thermal_model_t *model);
+
+/**
+ * Feeds one tick: the thermocouple reading it started with and the duties then applied until the next tick.
+ * @param temp_valid false when the reading failed, the model then skips the step it would have ended
+ */
+void thermal_model_update(thermal_model_t *model, bool temp_valid, float temp_c, uint8_t main_duty,
+                          uint8_t secondary_duty, uint8_t fan_duty);
+
+thermal_model_estimate_t thermal_model_estimate(const thermal_model_t *model, float tick_period_s);
@@ -1,9 +1,15 @@
 #include <nvs.h>
 #include <esp_log.h>
+#include <algorithm>
+#include <cstring>
 #include "utils.h"
+#include "flash_ops.h"
 
 #define TAG "utils"
 
+// Bytes of fields a tagged blob holds, ahead of them
+typedef uint16_t blob_tag_t;
+
 esp_err_t utils_load_from_nvs(const char* ns, const char* key, void* ptr, size_t size_in) {
   nvs_handle_t nvs_handle;
   ESP_ERROR_CHECK(nvs_open(ns, NVS_READWRITE, &nvs_handle));
@@ -30,10 +36,65 @@ esp_err_t utils_load_from_nvs(const char* ns, const char* key, void* ptr, size_t
 }
 
 esp_err_t utils_save_to_nvs(const char* ns, const char* key, void* ptr, size_t size) {
+  // Written after the next control tick once the loop runs, see flash_ops.h
+  return flash_ops_write_blob(ns, key, ptr, size);
+}
+
+esp_err_t utils_save_tagged_to_nvs(const char *ns, const char *key, const void *ptr, size_t used) {
+  uint8_t blob[FLASH_OPS_MAX_SIZE];
+  if (sizeof(blob_tag_t) + used > sizeof(blob)) {
+    ESP_LOGE(TAG, "Key %s of ns %s does not fit in %d bytes tagged", key, ns, sizeof(blob));
+    return ESP_ERR_INVALID_SIZE;
+  }
+  auto tag = (blob_tag_t) used;
+  memcpy(blob, &tag, sizeof(tag));
+  memcpy(blob + sizeof(tag), ptr, used);
+  return flash_ops_write_blob(ns, key, blob, sizeof(tag) + used);
+}
+
+esp_err_t utils_load_tagged_from_nvs(const char *ns, const char *key, void *ptr, size_t used,
+                                     const utils_legacy_blob_t *legacy, size_t legacy_count, bool *upgraded) {
+  uint8_t blob[FLASH_OPS_MAX_SIZE];
+  size_t size = sizeof(blob);
   nvs_handle_t nvs_handle;
+  *upgraded = false;
   ESP_ERROR_CHECK(nvs_open(ns, NVS_READWRITE, &nvs_handle));
-  esp_err_t err = nvs_set_blob(nvs_handle, key, ptr, size);
-  ESP_ERROR_CHECK(nvs_commit(nvs_handle));
+  esp_err_t err = nvs_get_blob(nvs_handle, key, nullptr, &size);
+  if (err == ESP_OK && size <= sizeof(blob)) {
+    err = nvs_get_blob(nvs_handle, key, blob, &size);
+  } else if (err == ESP_OK) {
+    err = ESP_ERR_INVALID_SIZE;
+  }
   nvs_close(nvs_handle);
-  return err;
-}
\ No newline at end of file
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error loading key %s from NVS ns %s, Error: %s", key, ns, esp_err_to_name(err));
+    return err;
+  }
+
+  const uint8_t *fields = nullptr;
+  size_t held = 0;
+  for (size_t i = 0; i < legacy_count; i++) {
+    if (legacy[i].size == size) {
+      fields = blob;
+      held = legacy[i].used;
+    }
+  }
+  blob_tag_t tag;
+  if (!fields && size >= sizeof(tag)) {
+    memcpy(&tag, blob, sizeof(tag));
+    if (tag == size - sizeof(tag)) {
+      fields = blob + sizeof(tag);
+      held = tag;
+    }
+  }
+  if (!fields) {
+    ESP_LOGE(TAG, "Key %s of ns %s is neither tagged nor of an earlier firmware, %d bytes", key, ns, size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  memcpy(ptr, fields, std::min(held, used));
+  *upgraded = held < used;
+  ESP_LOGI(TAG, "Loaded key %s from NVS ns %s, %d of %d bytes of fields%s", key, ns, held, used,
+           fields == blob ? " untagged" : "");
+  return ESP_OK;
+}
@@ -1,4 +1,31 @@
 #pragma once
 
+#include <cstddef>
+#include <esp_err.h>
+
 esp_err_t utils_load_from_nvs(const char* ns, const char* key, void* ptr, size_t size_in);
-esp_err_t utils_save_to_nvs(const char* ns, const char* key, void* ptr, size_t size);
\ No newline at end of file
+esp_err_t utils_save_to_nvs(const char* ns, const char* key, void* ptr, size_t size);
+
+struct utils_legacy_blob_t {
+  // Size of an untagged blob an earlier firmware saved, and the bytes of fields it held
+  size_t size;
+  size_t used;
+};
+
+/**
+ * Saves the first `used` bytes of a struct, its fields without the padding after the last, tagged with their
+ * count. A firmware adding fields at the end of the struct can then upgrade the blob, see
+ * utils_load_tagged_from_nvs().
+ * @return ESP_ERR_INVALID_SIZE when the tagged blob is over FLASH_OPS_MAX_SIZE, otherwise as flash_ops_write_blob()
+ */
+esp_err_t utils_save_tagged_to_nvs(const char *ns, const char *key, const void *ptr, size_t used);
+
+/**
+ * Loads a struct saved by utils_save_tagged_to_nvs() over the defaults `ptr` holds. Fields a blob from an earlier
+ * firmware did not have keep their defaults, those of a later one are left out. Untagged blobs saved before the
+ * tag existed are recognised by their size in `legacy`, a tagged blob must not have any of these sizes.
+ * @param upgraded Set when the blob held fewer fields than `used`, so it is worth saving again
+ * @return ESP_ERR_INVALID_SIZE for a blob neither tagged nor legacy, which is left out
+ */
+esp_err_t utils_load_tagged_from_nvs(const char *ns, const char *key, void *ptr, size_t used,
+                                     const utils_legacy_blob_t *legacy, size_t legacy_count, bool *upgraded);
@@ -0,0 +1,10 @@
+#include "app_config.h"
+
+/*
+ * The config shadow only talks to the network, left out of the simulator. In a file of its own so roaster_fuzz
+ * can link the real main/app_config.cpp over the same firmware sources instead.
+ */
+
+void app_config_init() {}
+
+void app_config_clear_desired_control() {}
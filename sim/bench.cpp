@@ -0,0 +1,282 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "sim_platform.h"
+#include "control_loop.h"
+#include "json_reader.h"
+#include "bench.h"
+#include "board.h"
+#include "world.h"
+
+/*
+ * Host runner for the firmware microbenchmarks in main/bench.cpp, timed with std::chrono and, where the kernel
+ * allows it, perf counters for cycles and instructions. Also compares two runs, from the host or captured off
+ * the device console.
+ */
+
+#define DRUM_MOTOR_PIN      BOARD.drum_motor_signal
+#define BENCH_STACK_SIZE    (256 * 1024)
+#define BENCH_STACK_PAINT   0xa5
+
+const char *const bench_platform = "host";
+const char *const bench_stamp_unit = "ns";
+
+// Counters of the thread running a case, opened on first use as perf only counts the thread that opened it
+static thread_local int t_perf_cycles = -2;
+static thread_local int t_perf_instructions = -2;
+
+// Ticks are not observed, the control task only runs when a case calls it
+void sim_on_tick(const control_state_t &) {}
+
+void sim_on_roast(const roast_summary_t &) {}
+
+static int _perf_open(uint64_t config) {
+  perf_event_attr attr = {};
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t _perf_read(int fd) {
+  uint64_t value = 0;
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+
+static void _perf_close() {
+  for (int *fd: {&t_perf_cycles, &t_perf_instructions}) {
+    if (*fd >= 0) {
+      close(*fd);
+    }
+    *fd = -2;
+  }
+}
+
+void bench_counters_read(bench_counters_t *counters) {
+  if (t_perf_cycles == -2) {
+    t_perf_cycles = _perf_open(PERF_COUNT_HW_CPU_CYCLES);
+    t_perf_instructions = _perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+  }
+  counters->cycles = _perf_read(t_perf_cycles);
+  counters->instructions = _perf_read(t_perf_instructions);
+  counters->ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t bench_stamp() {
+  return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct fresh_stack_t {
+  void (*fn)(void *);
+  void *arg;
+};
+
+static void *_fresh_stack_thread(void *arg) {
+  auto call = (fresh_stack_t *) arg;
+  call->fn(call->arg);
+  _perf_close();
+  return nullptr;
+}
+
+size_t bench_on_fresh_stack(void (*fn)(void *), void *arg) {
+  // The stack is painted and the untouched bytes counted from its far end once the thread is done
+  void *stack = mmap(nullptr, BENCH_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stack == MAP_FAILED) {
+    perror("mmap");
+    exit(2);
+  }
+  memset(stack, BENCH_STACK_PAINT, BENCH_STACK_SIZE);
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  fresh_stack_t call = {fn, arg};
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+  if (pthread_create(&thread, &attr, _fresh_stack_thread, &call) != 0) {
+    perror("pthread_create");
+    exit(2);
+  }
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+
+  auto bytes = (const uint8_t *) stack;
+  size_t untouched = 0;
+  while (untouched < BENCH_STACK_SIZE && bytes[untouched] == BENCH_STACK_PAINT) {
+    untouched++;
+  }
+  munmap(stack, BENCH_STACK_SIZE);
+  return BENCH_STACK_SIZE - untouched;
+}
+
+/* ---- Comparing runs ---- */
+
+struct bench_line_t {
+  std::string name;
+  std::string platform;
+  double cycles;
+  double ns;
+  double stack;
+};
+
+static bool _number(json_reader_t *reader, double &out) {
+  json_token_t value;
+  if (json_next(reader, &value) == JSON_TOKEN_NUMBER) {
+    out = value.number;
+    return true;
+  }
+  return json_skip(reader, &value);
+}
+
+/* Lines that are not benchmark results, such as the rest of a device console, are skipped */
+static bool _parse_line(const char *line, size_t len, bench_line_t &out) {
+  json_reader_t reader;
+  json_token_t key, value;
+  out = {};
+  if (strncmp(line, "{\"bench\":", 9) != 0) {
+    return false;
+  }
+  json_reader_init(&reader, line, len);
+  if (json_next(&reader, &value) != JSON_TOKEN_OBJECT_START) {
+    return false;
+  }
+  while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+    bool ok;
+    if (json_token_is(&key, "bench") || json_token_is(&key, "platform")) {
+      ok = json_next(&reader, &value) == JSON_TOKEN_STRING;
+      (json_token_is(&key, "bench") ? out.name : out.platform).assign(value.str, value.len);
+    } else if (json_token_is(&key, "cycles")) {
+      ok = _number(&reader, out.cycles);
+    } else if (json_token_is(&key, "ns")) {
+      ok = _number(&reader, out.ns);
+    } else if (json_token_is(&key, "stack")) {
+      ok = _number(&reader, out.stack);
+    } else {
+      json_next(&reader, &value);
+      ok = json_skip(&reader, &value);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return key.type == JSON_TOKEN_OBJECT_END && !out.name.empty();
+}
+
+static bool _load(const char *path, std::vector<bench_line_t> &lines) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char buf[1024];
+  while (fgets(buf, sizeof(buf), f)) {
+    bench_line_t line;
+    if (_parse_line(buf, strcspn(buf, "\r\n"), line)) {
+      lines.push_back(line);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+/*
+ * Lists each case of `after` against `before`, on cycles when both runs counted them and on time otherwise.
+ * @return Whether any case got more than `threshold` percent slower.
+ */
+static bool _compare(const std::vector<bench_line_t> &before, const std::vector<bench_line_t> &after,
+                     double threshold) {
+  bool regressed = false;
+  printf("%-22s %-8s %12s %12s %8s %8s %8s\n", "bench", "metric", "before", "after", "change", "stack", "stack");
+  for (const auto &b: after) {
+    const bench_line_t *a = nullptr;
+    for (const auto &candidate: before) {
+      if (candidate.name == b.name && candidate.platform == b.platform) {
+        a = &candidate;
+      }
+    }
+    if (!a) {
+      printf("%-22s new\n", b.name.c_str());
+      continue;
+    }
+    bool by_cycles = a->cycles > 0 && b.cycles > 0;
+    double old_cost = by_cycles ? a->cycles : a->ns;
+    double new_cost = by_cycles ? b.cycles : b.ns;
+    double change = old_cost > 0 ? (new_cost - old_cost) / old_cost * 100 : 0;
+    bool slower = threshold > 0 && change > threshold;
+    regressed |= slower;
+    printf("%-22s %-8s %12.1f %12.1f %+7.1f%% %8.0f %8.0f%s\n", b.name.c_str(), by_cycles ? "cycles" : "ns",
+           old_cost, new_cost, change, a->stack, b.stack, slower ? "  REGRESSED" : "");
+  }
+  return regressed;
+}
+
+static void _usage(const char *argv0) {
+  printf("Usage: %s [options]\n"
+         "       %s --compare BEFORE AFTER [--threshold PCT]\n"
+         "  Runs the firmware microbenchmarks, one JSON line per case on stdout.\n"
+         "  -f, --filter NAME      Only print cases whose name contains NAME\n"
+         "      --compare A B      Compare two runs, device console captures are fine\n"
+         "      --threshold PCT    With --compare, fail when a case is PCT percent slower\n"
+         "  -v                     Firmware log verbosity, repeat for more\n", argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+  const char *filter = nullptr;
+  const char *compare[2] = {};
+  double threshold = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if ((!strcmp(arg, "-f") || !strcmp(arg, "--filter")) && value) {
+      filter = value;
+      i++;
+    } else if (!strcmp(arg, "--compare") && i + 2 < argc) {
+      compare[0] = argv[i + 1];
+      compare[1] = argv[i + 2];
+      i += 2;
+    } else if (!strcmp(arg, "--threshold") && value) {
+      threshold = strtod(value, nullptr);
+      i++;
+    } else if (!strncmp(arg, "-v", 2) && strspn(arg + 1, "v") == strlen(arg + 1)) {
+      sim_set_log_level((esp_log_level_t) std::min<int>(ESP_LOG_VERBOSE, ESP_LOG_ERROR + (int) strlen(arg + 1)));
+    } else {
+      _usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (compare[0]) {
+    std::vector<bench_line_t> before, after;
+    if (!_load(compare[0], before) || !_load(compare[1], after)) {
+      return 2;
+    }
+    return _compare(before, after, threshold) ? 1 : 0;
+  }
+
+  // A roaster at ambient with the drum turning and the balance mid way
+  plant_init(&sim_world.plant, plant_default_params());
+  sim_world.balance_mv = 1275;
+  sim_world.heat_duty = 60;
+  sim_world.fan_duty = 30;
+  control_loop_safe_state();
+  control_loop_init();
+  sim_gpio_set_input(DRUM_MOTOR_PIN, 0);
+
+  bench_run(filter);
+  return 0;
+}
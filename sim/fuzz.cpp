@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <sanitizer/common_interface_defs.h>
+#include "sim_platform.h"
+#include "shadow/shadow_handler.h"
+#include "app_config.h"
+#include "command_topic.h"
+#include "common/identity.h"
+#include "json_reader.h"
+#include "telemetry.h"
+#include "local_server.h"
+#include "world.h"
+
+/*
+ * Mutation fuzzer of the shadow delta parsing, json_validate() and app_config_apply_delta() built with
+ * AddressSanitizer and UndefinedBehaviorSanitizer. Starts from a corpus of deltas as the shadow service sends
+ * them, mutates them byte and token wise, and keeps the mutants that still validate as new seeds. Each input
+ * sits in a heap buffer of exactly its length, so reading a byte past it is caught.
+ */
+
+#define FUZZ_DEFAULT_ITERATIONS   200000
+#define FUZZ_MAX_CORPUS           512
+#define FUZZ_MAX_INPUT            4096
+#define FUZZ_MAX_MUTATIONS        4
+
+static const char *const s_seeds[] = {
+    R"({"version":1842,"timestamp":1700000000,"state":{"control":{"max_heat_ratio":0.65,"max_tc_temp":260}},)"
+    R"("metadata":{"control":{"max_heat_ratio":{"timestamp":1700000000},)"
+    R"("max_tc_temp":{"timestamp":1700000000}}}})",
+    R"({"state":{"control":{"mode":1,"setpoint_c":220,"kp":0.05,"ki":1E-4,"kd":2.5e+1,"autotune":true}}})",
+    R"({"state":{"telemetry":{"status_interval":5,"metrics_interval":60},)"
+    R"("local":{"enabled":true,"port":8080,"key":"0123456789abcdef"}}})",
+    R"({"state":{"profiles":{"1":{"index":"time","target":"ratio","points":[[0,0.3],[150,0.8],[300,0.6]]},)"
+    R"("2":null,"3":{"index":"temperature","target":"setpoint","points":[[100,180],[200,210]]}}}})",
+    R"({"state":{"control":{"max_heat_ratio":6.5e-1,"cutoff_horizon_s":15,"cutoff_taper_c":5e0,"kd":1e-400}},)"
+    R"("extra":[1,-0,0.0e+0,[2,[3,[]]],{"a":{"b":null}},true,false]})",
+    R"({"state":{"local":{"key":"A\\\"\/\b\f\n\r\t-long-enough"}},"other":"😀"})",
+    R"({"state":{"command":{"type":3,"seq":7,"ratio_permille":450,"ttl_s":60}},)"
+    R"("metadata":{"command":{"type":{"timestamp":1700000000},"seq":{"timestamp":1700000000}}}})",
+};
+
+// Fragments spliced in, the grammar the reader must get right
+static const char *const s_tokens[] = {
+    "{", "}", "[", "]", ",", ":", "\"", "\\", "\\u", "\\ud800", "null", "true", "false", "-", "0", "1e", "e-",
+    "1e-400", "1e309", "-0.0", "12345678901234567890", "\"state\":", "\"control\":{", "\"profiles\":{\"1\":",
+    "\"command\":{", "\"points\":[[", "\x80", "\xff", "\t", " ",
+};
+
+// The input under test, reported if a sanitizer stops the run
+static std::string s_current;
+
+static telemetry_cfg_t s_telemetry_cfg = {.status_interval_s = 1, .metrics_interval_s = 1800};
+static local_server_cfg_t s_local_cfg = {.enabled = false, .port = LOCAL_SERVER_DEFAULT_PORT, .key = {}};
+
+// No control loop runs here
+void sim_on_tick(const control_state_t &) {}
+
+void sim_on_roast(const roast_summary_t &) {}
+
+// As telemetry.cpp and local_server.cpp declare them, both only build for the device
+static const schema_field_t s_telemetry_fields[] = {
+    SCHEMA_FIELD_NAMED(telemetry_cfg_t, status_interval_s, "status_interval"),
+    SCHEMA_FIELD_NAMED(telemetry_cfg_t, metrics_interval_s, "metrics_interval"),
+};
+const schema_t telemetry_cfg_schema = SCHEMA_DEFINE(s_telemetry_fields);
+
+static const schema_field_t s_local_fields[] = {
+    SCHEMA_FIELD(local_server_cfg_t, enabled),
+    SCHEMA_FIELD(local_server_cfg_t, port),
+    SCHEMA_FIELD(local_server_cfg_t, key),
+};
+const schema_t local_server_cfg_schema = SCHEMA_DEFINE(s_local_fields);
+
+telemetry_cfg_t telemetry_get_cfg() {
+  return s_telemetry_cfg;
+}
+
+esp_err_t telemetry_set_cfg(telemetry_cfg_t cfg) {
+  s_telemetry_cfg = cfg;
+  return ESP_OK;
+}
+
+local_server_cfg_t local_server_get_cfg() {
+  return s_local_cfg;
+}
+
+esp_err_t local_server_set_cfg(const local_server_cfg_t &cfg) {
+  if (strnlen(cfg.key, sizeof(cfg.key)) == sizeof(cfg.key)) {
+    return ESP_FAIL;
+  }
+  s_local_cfg = cfg;
+  return ESP_OK;
+}
+
+esp_err_t shadow_handler_init(device_shadow_cfg_t, device_shadow_handle_t *handle) {
+  *handle = nullptr;
+  return ESP_OK;
+}
+
+void shadow_handler_update(device_shadow_handle_t, const char *, size_t) {}
+
+esp_err_t mqtt_client_publish(MQTTPublishInfo_t *, uint32_t) {
+  return ESP_OK;
+}
+
+const char *identity_thing_id() {
+  return "fuzz";
+}
+
+char *strnstr(const char *haystack, const char *needle, size_t len) {
+  size_t needle_len = strlen(needle);
+  for (size_t i = 0; i + needle_len <= len && haystack[i]; i++) {
+    if (!strncmp(haystack + i, needle, needle_len)) {
+      return (char *) haystack + i;
+    }
+  }
+  return nullptr;
+}
+
+static void _report_input() {
+  fprintf(stderr, "Input of %zu bytes:\n", s_current.size());
+  for (unsigned char c: s_current) {
+    fprintf(stderr, c >= 0x20 && c < 0x7f && c != '\\' ? "%c" : "\\x%02x", c);
+  }
+  fprintf(stderr, "\n");
+}
+
+static void _fail(const char *what) {
+  fprintf(stderr, "FAILED: %s\n", what);
+  _report_input();
+  exit(1);
+}
+
+/* Walks every token, checking the reader stops on its own within its budget */
+static bool _walk(const char *doc, size_t len) {
+  json_reader_t reader;
+  json_token_t token;
+  json_reader_init(&reader, doc, len, APP_CONFIG_DELTA_MAX_TOKENS);
+  for (uint32_t i = 0; i <= APP_CONFIG_DELTA_MAX_TOKENS + 1; i++) {
+    switch (json_next(&reader, &token)) {
+      case JSON_TOKEN_END:
+        return true;
+      case JSON_TOKEN_ERROR:
+        return false;
+      case JSON_TOKEN_KEY:
+      case JSON_TOKEN_STRING:
+        if (token.str < doc || token.str + token.len > doc + len) {
+          _fail("string token outside the document");
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  _fail("reader did not stop within its token budget");
+  return false;
+}
+
+/* One input, in a buffer of exactly its size */
+static bool _run_one(const std::string &input) {
+  s_current = input;
+  auto *doc = (char *) malloc(std::max<size_t>(input.size(), 1));
+  memcpy(doc, input.data(), input.size());
+
+  bool valid = json_validate(doc, input.size(), APP_CONFIG_DELTA_MAX_TOKENS);
+  if (_walk(doc, input.size()) != valid) {
+    _fail("json_validate() and a walk of the tokens disagree");
+  }
+  esp_err_t err = app_config_apply_delta(doc, input.size());
+  if (!valid && err == ESP_OK) {
+    _fail("app_config_apply_delta() took a document json_validate() refused");
+  }
+
+  free(doc);
+  return valid;
+}
+
+static void _mutate(std::string &input, const std::vector<std::string> &corpus, std::mt19937 &rng) {
+  uint32_t mutations = 1 + rng() % FUZZ_MAX_MUTATIONS;
+  for (uint32_t i = 0; i < mutations; i++) {
+    size_t pos = input.empty() ? 0 : rng() % (input.size() + 1);
+    switch (rng() % 7) {
+      case 0:
+        if (pos < input.size()) {
+          input[pos] ^= (char) (1 << rng() % 8);
+        }
+        break;
+      case 1:
+        input.insert(pos, 1, (char) (rng() % 256));
+        break;
+      case 2:
+        input.erase(pos, 1 + rng() % 8);
+        break;
+      case 3:
+        input.insert(pos, s_tokens[rng() % (sizeof(s_tokens) / sizeof(s_tokens[0]))]);
+        break;
+      case 4:
+        if (pos < input.size()) {
+          size_t len = 1 + rng() % std::min<size_t>(32, input.size() - pos);
+          input.insert(rng() % (input.size() + 1), input.substr(pos, len));
+        }
+        break;
+      case 5:
+        input.resize(pos);
+        break;
+      default: {
+        // Splice the tail of another input in
+        const std::string &other = corpus[rng() % corpus.size()];
+        input = input.substr(0, pos) + other.substr(rng() % (other.size() + 1));
+        break;
+      }
+    }
+  }
+  if (input.size() > FUZZ_MAX_INPUT) {
+    input.resize(FUZZ_MAX_INPUT);
+  }
+}
+
+static void _usage(const char *argv0) {
+  printf("Usage: %s [options]\n"
+         "  -n, --iterations N    Mutated inputs to run, %d by default\n"
+         "      --seed S          Random seed, 1 by default\n"
+         "  -v                    Firmware log verbosity, repeat for more\n", argv0, FUZZ_DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = FUZZ_DEFAULT_ITERATIONS;
+  uint32_t seed = 1;
+  esp_log_level_t log_level = ESP_LOG_NONE;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if ((!strcmp(arg, "-n") || !strcmp(arg, "--iterations")) && value) {
+      iterations = strtoul(value, nullptr, 10);
+      i++;
+    } else if (!strcmp(arg, "--seed") && value) {
+      seed = strtoul(value, nullptr, 10);
+      i++;
+    } else if (!strncmp(arg, "-v", 2) && strspn(arg + 1, "v") == strlen(arg + 1)) {
+      log_level = (esp_log_level_t) std::min<int>(ESP_LOG_VERBOSE, ESP_LOG_ERROR + (int) strlen(arg + 1));
+    } else {
+      _usage(argv[0]);
+      return 2;
+    }
+  }
+
+  sim_set_log_level(log_level);
+  __sanitizer_set_death_callback(_report_input);
+  command_topic_init();
+  app_config_init();
+
+  std::vector<std::string> corpus;
+  for (const char *doc: s_seeds) {
+    corpus.emplace_back(doc);
+    if (!_run_one(corpus.back())) {
+      _fail("seed does not validate");
+    }
+  }
+
+  // The seeds stay, mutants replace each other once the corpus is full
+  const size_t seeds = corpus.size();
+  std::mt19937 rng(seed);
+  uint32_t valid = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    std::string input = corpus[rng() % corpus.size()];
+    _mutate(input, corpus, rng);
+    if (_run_one(input)) {
+      valid++;
+      // Still a document, worth mutating further
+      if (corpus.size() < FUZZ_MAX_CORPUS) {
+        corpus.push_back(input);
+      } else {
+        corpus[seeds + rng() % (FUZZ_MAX_CORPUS - seeds)] = input;
+      }
+    }
+  }
+
+  printf("%u inputs, %u valid, corpus of %zu, no findings\n", iterations, valid, corpus.size());
+  return 0;
+}
@@ -0,0 +1,176 @@
+#include <cmath>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <esp_event_base.h>
+#include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_cali_scheme.h>
+#include "board.h"
+#include "input_pwm_duty.h"
+#include "max31850.h"
+#include "events.h"
+#include "pm_control.h"
+#include "telemetry.h"
+#include "app_metrics.h"
+#include "local_server.h"
+#include "supervisor.h"
+#include "task_plan.h"
+#include "world.h"
+
+/*
+ * Simulated peripherals behind the component and driver APIs the firmware uses, plus the firmware modules
+ * that only talk to the network and are left out of the simulator.
+ */
+
+#define SIM_HEAT_SIGNAL_PIN   BOARD.heat_signal
+#define SIM_FAN_SIGNAL_PIN    BOARD.fan_signal
+#define SIM_MAX31850_ADDR     0x3b00000000a1b2c3ULL
+
+ESP_EVENT_DEFINE_BASE(MAIN_APP_EVENT);
+
+sim_world_t sim_world = {};
+
+/* ---- Panel PWM inputs ---- */
+
+struct input_pwm_t {
+  gpio_num_t gpio;
+};
+
+esp_err_t input_pwm_new(input_pwm_config_t cfg, input_pwm_handle_t *ret_handle) {
+  if (cfg.gpio != SIM_HEAT_SIGNAL_PIN && cfg.gpio != SIM_FAN_SIGNAL_PIN) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  *ret_handle = new input_pwm_t{cfg.gpio};
+  return ESP_OK;
+}
+
+esp_err_t input_pwm_get_duty(input_pwm_handle_t handle, uint8_t &duty) {
+  if (!handle) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // A read stuck for as long as the scenario holds it, holding the control task up with it
+  while (sim_world.control_stall) {
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  duty = handle->gpio == SIM_HEAT_SIGNAL_PIN ? sim_world.heat_duty : sim_world.fan_duty;
+  return ESP_OK;
+}
+
+esp_err_t input_pwm_del(input_pwm_handle_t handle) {
+  delete handle;
+  return ESP_OK;
+}
+
+/* ---- Thermocouple amplifier ---- */
+
+max3185_devices_t max31850_list(gpio_num_t) {
+  max3185_devices_t devices = {};
+  devices.devices_address_length = 1;
+  devices.devices_address[0] = SIM_MAX31850_ADDR;
+  return devices;
+}
+
+max31850_data_t max31850_read(gpio_num_t, uint64_t addr) {
+  max31850_data_t data = {};
+  if (sim_world.tc_missing || addr != SIM_MAX31850_ADDR) {
+    return data;
+  }
+
+  // Resolution of the MAX31850, 0.25C for the thermocouple and 0.0625C for the cold junction
+  data.is_valid = true;
+  data.thermocouple_status = sim_world.tc_fault;
+  data.tc_temp = sim_world.tc_fault ? 0 : (float) (std::round(sim_world.plant.tc_c * 4) / 4);
+  data.junction_temp = (float) (std::round((sim_world.plant.board_c + sim_world.board_offset_c) * 16) / 16);
+  return data;
+}
+
+/* ---- Balance potentiometer ADC, calibrated straight to millivolts ---- */
+
+esp_err_t adc_oneshot_new_unit(const adc_oneshot_unit_init_cfg_t *, adc_oneshot_unit_handle_t *ret_unit) {
+  static int unit;
+  *ret_unit = (adc_oneshot_unit_handle_t) &unit;
+  return ESP_OK;
+}
+
+esp_err_t adc_oneshot_config_channel(adc_oneshot_unit_handle_t, adc_channel_t, const adc_oneshot_chan_cfg_t *) {
+  return ESP_OK;
+}
+
+esp_err_t adc_oneshot_read(adc_oneshot_unit_handle_t, adc_channel_t, int *out_raw) {
+  *out_raw = sim_world.balance_mv;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_create_scheme_curve_fitting(const adc_cali_curve_fitting_config_t *,
+                                               adc_cali_handle_t *ret_handle) {
+  static int cali;
+  *ret_handle = (adc_cali_handle_t) &cali;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t, int raw, int *voltage) {
+  *voltage = raw;
+  return ESP_OK;
+}
+
+/* ---- Firmware modules left out of the simulator ---- */
+
+static void _on_supervisor_alarm(void *) {
+  supervisor_check();
+}
+
+/*
+ * One task only, the supervisor's loop is a timer calling its check instead, firing whenever the control task
+ * blocks or waits
+ */
+esp_err_t task_plan_create(task_id_t task, TaskFunction_t, void *, TaskHandle_t *handle) {
+  if (handle) {
+    *handle = nullptr;
+  }
+  if (task != TASK_SUPERVISOR) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  esp_timer_handle_t timer;
+  esp_timer_create_args_t timer_args = {.callback = _on_supervisor_alarm, .name = "supervisor"};
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+  return esp_timer_start_periodic(timer, SUPERVISOR_PERIOD_MS * 1000);
+}
+
+static bool s_pm_held[PM_WINDOW_COUNT] = {};
+
+void pm_control_init(uint8_t) {}
+
+void pm_control_hold(pm_window_t window, bool hold) {
+  s_pm_held[window] = hold;
+}
+
+esp_err_t pm_control_set_profile(uint8_t) {
+  return ESP_OK;
+}
+
+bool sim_pm_held(pm_window_t window) {
+  return s_pm_held[window];
+}
+
+void telemetry_init(EventGroupHandle_t) {}
+
+void telemetry_roast_done(const roast_summary_t &summary) {
+  sim_on_roast(summary);
+}
+
+void local_server_notify(const control_state_t &) {}
+
+void app_metrics_init() {}
+
+void app_metrics_record_command(float) {}
+
+void app_metrics_record_element(metrics_element_t, const ssr_ctrl_counters_t &, float, uint16_t) {}
+
+bool app_metrics_lifetime_save_required() {
+  return false;
+}
+
+void app_metrics_lifetime_save() {}
+
+void app_metrics_record_tick(const control_state_t &state, float, float, float) {
+  sim_on_tick(state);
+}
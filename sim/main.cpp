@@ -0,0 +1,1266 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include "sim_platform.h"
+#include "control_loop.h"
+#include "board.h"
+#include "ssr_ctrl.h"
+#include "max31850.h"
+#include "control_record.h"
+#include "thermal_model.h"
+#include "profile.h"
+#include "json_reader.h"
+#include "app_config.h"
+#include "stats.h"
+#include "cbor_writer.h"
+#include "supervisor.h"
+#include "flight_recorder.h"
+#include "boot_profile.h"
+#include "world.h"
+
+/*
+ * Host simulator: runs the real control loop against the thermal model, in virtual time, through a set of
+ * roast and fault scenarios, checking the safety cut-offs behave.
+ */
+
+#define LS_EN_PIN           BOARD.level_shifter_en
+#define DRUM_MOTOR_PIN      BOARD.drum_motor_signal
+#define SSR1_PIN            BOARD.ssr1
+#define SSR2_PIN            BOARD.ssr2
+
+// Period at which the operator and fault injection run, in virtual time
+#define OPERATOR_PERIOD_NS  100000000LL
+
+// Roast plan followed by the simulated operator
+#define CHARGE_TEMP         180.0
+#define BEAN_MASS_G         300.0
+#define DROP_TEMP           212.0
+#define COOL_TIME_S         60.0
+
+// Time into the roast at which faults are injected
+#define FAULT_AFTER_CHARGE_S  120.0
+
+// Elements must be off within one control tick and a half-cycle of a fault
+#define MAX_REACTION_S      1.05
+
+// A stalled control task is left to the supervisor, which cuts both elements once the last sample it published is
+// SUPERVISOR_STALE_US old, up to a tick after the stall started, on its next check
+#define MAX_STALL_REACTION_S  (TICK_S + SUPERVISOR_STALE_US / 1e6 + SUPERVISOR_PERIOD_MS / 1e3 + 0.05)
+
+// A heat off command, or the drum motor input settling off, wakes the control task, so the elements go off on the
+// next half-cycle instead of the next tick
+#define MAX_COMMAND_REACTION_S  0.05
+
+// Overshoot of the chamber above the TC limit tolerated when the operator holds full heat
+#define MAX_OVERSHOOT_C     15.0
+
+// Setpoint mode: the operator holds the main element where it cannot reach the setpoint on its own
+#define HOLD_HEAT_DUTY      80
+#define HOLD_FAN_DUTY       30
+// Tracking is judged this long after the chamber first reached the setpoint, or after the autotune if one ran
+#define SETTLE_S            300.0
+#define MAX_TRACKING_ERROR_C  1.0
+#define MAX_SETPOINT_OVERSHOOT_C  5.0
+
+// Identified model against the plant linearised at the mean fan duty of the identify scenario, the element
+// lag shows up as dead time
+#define IDENTIFY_MEAN_FAN   0.35
+#define MAX_MODEL_ERROR     0.3
+
+// Profile scenario: the ratio profile played from charge, in seconds and fractions, the error allowed in when
+// charge is put, and the error allowed in the target from applying it in whole percent
+static const float s_profile_points[][2] = {{0, 0.3f}, {150, 0.8f}, {300, 0.6f}, {400, 0.5f}};
+#define MAX_CHARGE_ERROR_S  5.0
+#define MAX_TARGET_ERROR    0.0051
+
+// Control tick period of the firmware, loop counts are seconds
+#define TICK_S              1.0
+
+// Roast summary against the plant: peak reading, element energy asked for in seconds at full power, and the
+// energy delivered as counted by the SSRs
+#define MAX_SUMMARY_PEAK_ERROR_C  0.5
+#define MAX_SUMMARY_ENERGY_ERROR  0.02
+#define MAX_SUMMARY_WH_ERROR      0.005
+
+// Seeds of each stream the P² check runs
+#define P2_SEEDS            8
+
+enum roast_phase_t {
+  PHASE_PREHEAT,
+  PHASE_ROAST,
+  PHASE_COOL,
+  PHASE_DONE,
+};
+
+enum fault_t {
+  FAULT_NONE,
+  FAULT_TC_OPEN,
+  FAULT_TC_MISSING,
+  FAULT_BOARD_HOT,
+  FAULT_MOTOR_STOP,
+  // Not a fault, a heat off command as the local server would queue it
+  FAULT_HEAT_OFF,
+  FAULT_CONTROL_STALL,
+};
+
+struct scenario_t {
+  const char *name;
+  const char *description;
+  double duration_s;
+  // Operator holds full heat with the fan low instead of following the roast plan
+  bool full_heat;
+  fault_t fault;
+  // Whether the fault must cut the main element as well as the secondary
+  bool cuts_main;
+  // Secondary in setpoint mode with the main element held, running an autotune first
+  bool setpoint;
+  bool autotune;
+  // Operator steps the main element and fan through a schedule instead of holding them
+  bool stepped;
+  // Secondary ratio follows a stored profile from charge
+  bool profile;
+};
+
+static const scenario_t s_scenarios[] = {
+    {"roast", "Preheat, charge and roast to drop temperature", 1800, false, FAULT_NONE, false, false, false, false,
+     false},
+    {"runaway", "Operator holds 100% heat with the fan low", 2400, true, FAULT_NONE, false, false, false, false,
+     false},
+    {"tc_open", "Thermocouple goes open circuit mid roast", 900, false, FAULT_TC_OPEN, false, false, false, false,
+     false},
+    {"tc_missing", "Thermocouple amplifier stops answering mid roast", 900, false, FAULT_TC_MISSING, true, false,
+     false, false, false},
+    {"board_hot", "Board temperature jumps past its limit mid roast", 900, false, FAULT_BOARD_HOT, true, false,
+     false, false, false},
+    {"motor_stop", "Drum motor stops mid roast", 900, false, FAULT_MOTOR_STOP, true, false, false, false, false},
+    {"heat_off", "Heat off command mid roast", 900, false, FAULT_HEAT_OFF, true, false, false, false, false},
+    {"stall", "Control task stalls in a panel read mid roast", 900, false, FAULT_CONTROL_STALL, true, false, false,
+     false, false},
+    {"setpoint", "Secondary holds the setpoint with the main element at 80%", 1800, false, FAULT_NONE, false, true,
+     false, false, false},
+    {"autotune", "Relay autotune at the setpoint, then holding it on the gains found", 3600, false, FAULT_NONE,
+     false, true, true, false, false},
+    {"identify", "Operator steps heat, fan and balance, identifying the chamber model", 5400, false, FAULT_NONE,
+     false, false, false, true, false},
+    {"profile", "Roast with the secondary ratio played from a stored profile", 1800, false, FAULT_NONE, false,
+     false, false, false, true},
+};
+
+struct sim_options_t {
+  control_cfg_t cfg;
+  plant_params_t plant;
+  double balance_pct;
+  const char *trace_dir;
+  const char *record_dir;
+  esp_log_level_t log_level;
+};
+
+struct sim_run_t {
+  const scenario_t *scenario;
+  sim_options_t opts;
+  roast_phase_t phase;
+  double phase_start_s;
+  int64_t next_operator_ns;
+  bool stopped;
+
+  double fault_s;
+  double energy_at_fault[2];
+  // Time each element last stopped conducting
+  double last_on_s[2];
+
+  double peak_tc;
+  // Profile playback: charge, when playback put it, and the worst target error and ratio overrun seen
+  double charge_s;
+  double playing_s;
+  double target_error_max;
+  uint32_t ratio_overruns;
+  uint8_t profile_phase;
+  // Roast summaries handed to telemetry, and the last one
+  uint32_t roasts;
+  roast_summary_t roast;
+  // Setpoint mode: when the chamber first got to the setpoint and the autotune finished, and the tracking error
+  // after settling
+  double reached_s;
+  double tuned_s;
+  double tracking_error_sum;
+  double tracking_error_max;
+  uint32_t tracking_ticks;
+  double peak_chamber;
+  double peak_beans;
+  uint32_t ticks;
+  uint32_t secondary_ticks;
+  // Ticks where the secondary ran although a safety condition was not met
+  uint32_t violations;
+  // Time an SSR conducted with light sleep allowed, which would stop its alarms
+  double unheld_s;
+  FILE *trace;
+  FILE *record;
+};
+
+static sim_run_t s_run;
+
+static double _now_s() {
+  return (double) sim_now_ns() / 1e9;
+}
+
+static void _set_motor(bool on) {
+  // Active low, the input is pulled up when the motor is off
+  sim_gpio_set_input(DRUM_MOTOR_PIN, on ? 0 : 1);
+}
+
+static void _set_phase(roast_phase_t phase, double t) {
+  s_run.phase = phase;
+  s_run.phase_start_s = t;
+}
+
+static void _inject_fault(double t) {
+  s_run.fault_s = t;
+  s_run.energy_at_fault[0] = sim_world.plant.energy1_j;
+  s_run.energy_at_fault[1] = sim_world.plant.energy2_j;
+  switch (s_run.scenario->fault) {
+    case FAULT_TC_OPEN:
+      sim_world.tc_fault = MAX31850_TC_STATUS_OPEN_CIRCUIT;
+      break;
+    case FAULT_TC_MISSING:
+      sim_world.tc_missing = true;
+      break;
+    case FAULT_BOARD_HOT:
+      sim_world.board_offset_c = s_run.opts.cfg.max_board_temp;
+      break;
+    case FAULT_MOTOR_STOP:
+      _set_motor(false);
+      break;
+    case FAULT_CONTROL_STALL:
+      sim_world.control_stall = true;
+      break;
+    case FAULT_HEAT_OFF:
+      control_loop_command({.type = CONTROL_COMMAND_HEAT_OFF, .ratio_permille = 0, .ttl_s = 0,
+                            .received_us = esp_timer_get_time()});
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * The Hottop's own controller and its user: preheat, charge, step the heat down through the roast, drop and
+ * cool. Runs every OPERATOR_PERIOD_NS of virtual time.
+ */
+static void _operate(double t) {
+  const scenario_t *sc = s_run.scenario;
+  plant_t *plant = &sim_world.plant;
+
+  if (sc->fault != FAULT_NONE && std::isnan(s_run.fault_s) && s_run.phase == PHASE_ROAST &&
+      t - s_run.phase_start_s >= FAULT_AFTER_CHARGE_S) {
+    _inject_fault(t);
+  }
+
+  if (sc->full_heat) {
+    sim_world.heat_duty = 100;
+    sim_world.fan_duty = 30;
+    _set_motor(true);
+  } else if (sc->stepped) {
+    // Periods that do not divide each other, so the three inputs move independently
+    static const uint8_t heat[] = {100, 70, 90, 60, 80};
+    static const uint8_t fan[] = {30, 50, 20, 40};
+    static const uint8_t balance[] = {100, 40, 70, 10};
+    sim_world.heat_duty = heat[(int) (t / 420) % 5];
+    sim_world.fan_duty = fan[(int) (t / 300) % 4];
+    sim_world.balance_mv = (int) std::lround(150 + balance[(int) (t / 540) % 4] / 100.0 * (2400 - 150));
+    _set_motor(true);
+  } else if (sc->setpoint) {
+    sim_world.heat_duty = HOLD_HEAT_DUTY;
+    sim_world.fan_duty = HOLD_FAN_DUTY;
+    _set_motor(true);
+  } else {
+    switch (s_run.phase) {
+      case PHASE_PREHEAT:
+        sim_world.heat_duty = 100;
+        sim_world.fan_duty = 10;
+        _set_motor(true);
+        if (plant->tc_c >= CHARGE_TEMP) {
+          plant_charge(plant, BEAN_MASS_G);
+          s_run.charge_s = t;
+          _set_phase(PHASE_ROAST, t);
+        }
+        break;
+      case PHASE_ROAST:
+        sim_world.fan_duty = 30;
+        sim_world.heat_duty = plant->beans_c < 150 ? 100 : plant->beans_c < 196 ? 80 : 60;
+        if (plant->beans_c >= DROP_TEMP) {
+          plant_drop(plant);
+          _set_phase(PHASE_COOL, t);
+        }
+        break;
+      case PHASE_COOL:
+        sim_world.heat_duty = 0;
+        sim_world.fan_duty = 100;
+        if (t - s_run.phase_start_s >= COOL_TIME_S) {
+          _set_motor(false);
+          _set_phase(PHASE_DONE, t);
+        }
+        break;
+      case PHASE_DONE:
+        break;
+    }
+  }
+
+  if (!s_run.stopped && (s_run.phase == PHASE_DONE || t >= sc->duration_s)) {
+    s_run.stopped = true;
+    // Lets a stalled control task run again to see it
+    sim_world.control_stall = false;
+    control_loop_stop();
+  }
+}
+
+static void _advance(int64_t now_ns, int64_t dt_ns) {
+  bool enabled = sim_gpio_output(LS_EN_PIN);
+  bool on[2] = {enabled && sim_gpio_output(SSR1_PIN), enabled && sim_gpio_output(SSR2_PIN)};
+  plant_step(&sim_world.plant, (double) dt_ns / 1e9, on[0], on[1], sim_world.fan_duty);
+
+  if ((on[0] || on[1]) && !sim_pm_held(PM_WINDOW_SSR)) {
+    s_run.unheld_s += (double) dt_ns / 1e9;
+  }
+
+  int64_t end_ns = now_ns + dt_ns;
+  for (int i = 0; i < 2; i++) {
+    if (on[i]) {
+      s_run.last_on_s[i] = (double) end_ns / 1e9;
+    }
+  }
+  s_run.peak_chamber = std::max(s_run.peak_chamber, sim_world.plant.chamber_c);
+  s_run.peak_beans = std::max(s_run.peak_beans, sim_world.plant.beans_c);
+
+  while (s_run.next_operator_ns <= end_ns) {
+    _operate((double) s_run.next_operator_ns / 1e9);
+    s_run.next_operator_ns += OPERATOR_PERIOD_NS;
+  }
+}
+
+/* Drains the control record to file in chunks, as the telemetry task would publish them */
+static void _drain_record() {
+  uint8_t chunk[2048];
+  size_t len;
+  while ((len = control_record_drain(chunk, sizeof(chunk))) > 0) {
+    fwrite(chunk, 1, len, s_run.record);
+  }
+}
+
+/* The profile target at `t` seconds from charge, interpolated without the firmware's lookup */
+static double _profile_expected(double t) {
+  const size_t n = sizeof(s_profile_points) / sizeof(s_profile_points[0]);
+  for (size_t i = 1; i < n; i++) {
+    const float *a = s_profile_points[i - 1], *b = s_profile_points[i];
+    if (t < b[0]) {
+      double f = std::max(0.0, (t - a[0]) / (b[0] - a[0]));
+      return a[1] + f * (b[1] - a[1]);
+    }
+  }
+  return s_profile_points[n - 1][1];
+}
+
+static void _check_profile(const control_state_t &state) {
+  s_run.profile_phase = state.profile_phase;
+  if (state.profile_phase < PROFILE_PLAYING) {
+    return;
+  }
+  if (std::isnan(s_run.playing_s)) {
+    s_run.playing_s = _now_s() - state.profile_elapsed_s;
+  }
+  double error = std::fabs(state.profile_target - _profile_expected(state.profile_elapsed_s));
+  s_run.target_error_max = std::max(s_run.target_error_max, std::isnan(error) ? INFINITY : error);
+  if (state.output_duty > state.input_duty * state.profile_target + 1e-3) {
+    s_run.ratio_overruns++;
+  }
+}
+
+/* Appends a slot to the profiles of a delta, or to its metadata which stamps each value where it was */
+static void _delta_slot(std::string &doc, uint8_t slot, const profile_t &profile, bool metadata) {
+  const char *stamp = R"({"timestamp":1700000000})";
+  char buf[128];
+  snprintf(buf, sizeof(buf), R"(%s"%u":{"index":%s,"target":%s,"points":[)", slot > 1 ? "," : "", slot,
+           metadata ? stamp : R"("time")", metadata ? stamp : R"("ratio")");
+  doc += buf;
+  for (int i = 0; i < profile.count; i++) {
+    if (metadata) {
+      snprintf(buf, sizeof(buf), "%s[%s,%s]", i ? "," : "", stamp, stamp);
+    } else {
+      snprintf(buf, sizeof(buf), "%s[%u,%.3f]", i ? "," : "", profile.points[i].x, profile.points[i].y / 1000.0);
+    }
+    doc += buf;
+  }
+  doc += "]}";
+}
+
+/*
+ * Stores the scenario's profile and selects it, read from a shadow delta as AWS sends it. Every slot is full and
+ * mirrored in the metadata, the largest delta the firmware has to take.
+ */
+static bool _store_profile() {
+  const size_t n = sizeof(s_profile_points) / sizeof(s_profile_points[0]);
+  profile_point_t points[n];
+  for (size_t i = 0; i < n; i++) {
+    points[i] = {(uint16_t) s_profile_points[i][0], (uint16_t) std::lround(s_profile_points[i][1] * 1000)};
+  }
+  // Filled up with breakpoints where a segment crosses a whole thousandth, the profile plays the same
+  profile_t profile = {.index = PROFILE_INDEX_TIME, .target = PROFILE_TARGET_RATIO};
+  int spare = PROFILE_MAX_POINTS - (int) n;
+  for (size_t i = 0; i < n; i++) {
+    const profile_point_t &a = points[i];
+    profile.points[profile.count++] = a;
+    for (int x = a.x + 1; i + 1 < n && x < points[i + 1].x && spare > 0; x++) {
+      const profile_point_t &b = points[i + 1];
+      int rise = (b.y - a.y) * (x - a.x);
+      if (rise % (b.x - a.x) == 0) {
+        profile.points[profile.count++] = {(uint16_t) x, (uint16_t) (a.y + rise / (b.x - a.x))};
+        spare--;
+      }
+    }
+  }
+
+  std::string doc = R"({"version":7,"timestamp":1700000000,"state":{"profiles":{)";
+  for (uint8_t slot = 1; slot <= PROFILE_SLOTS; slot++) {
+    _delta_slot(doc, slot, profile, false);
+  }
+  doc += R"(}},"metadata":{"profiles":{)";
+  for (uint8_t slot = 1; slot <= PROFILE_SLOTS; slot++) {
+    _delta_slot(doc, slot, profile, true);
+  }
+  doc += "}}}";
+  if (!json_validate(doc.data(), doc.size(), APP_CONFIG_DELTA_MAX_TOKENS)) {
+    fprintf(stderr, "Profile delta of %zu bytes over its budget of %d tokens\n", doc.size(),
+            APP_CONFIG_DELTA_MAX_TOKENS);
+    return false;
+  }
+
+  // Each slot of the state's profiles, the way app_config_apply_delta() reads them
+  json_reader_t reader;
+  json_token_t key, value;
+  json_reader_init(&reader, doc.data(), doc.size(), APP_CONFIG_DELTA_MAX_TOKENS);
+  json_next(&reader, &value);
+  while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+    json_next(&reader, &value);
+    if (!json_token_is(&key, "state")) {
+      json_skip(&reader, &value);
+      continue;
+    }
+    json_next(&reader, &key);
+    json_next(&reader, &value);
+    while (json_next(&reader, &key) == JSON_TOKEN_KEY) {
+      json_next(&reader, &value);
+      auto slot = (uint8_t) strtoul(std::string(key.str, key.len).c_str(), nullptr, 10);
+      profile_t read;
+      if (profile_json_read(&reader, &read) != ESP_OK || profile_store(slot, read) != ESP_OK) {
+        return false;
+      }
+    }
+    json_next(&reader, &value);
+  }
+  s_run.opts.cfg.profile = 1;
+  return key.type == JSON_TOKEN_OBJECT_END && profile_get(1).count == PROFILE_MAX_POINTS;
+}
+
+void sim_on_tick(const control_state_t &state) {
+  const control_cfg_t &cfg = s_run.opts.cfg;
+  s_run.ticks++;
+  s_run.peak_tc = std::max(s_run.peak_tc, (double) state.tc_temp);
+  if (state.output_duty > 0) {
+    s_run.secondary_ticks++;
+    if (state.tc_status != 0 || state.tc_temp >= cfg.max_tc_temp || state.junction_temp > cfg.max_board_temp ||
+        !state.motor_on) {
+      s_run.violations++;
+    }
+  }
+
+  if (s_run.scenario->setpoint) {
+    double t = _now_s();
+    if (std::isnan(s_run.reached_s) && state.tc_temp >= cfg.setpoint_c) {
+      s_run.reached_s = t;
+    }
+    if (std::isnan(s_run.tuned_s) && state.autotune_phase == AUTOTUNE_DONE) {
+      s_run.tuned_s = t;
+    }
+    double from = (s_run.scenario->autotune ? s_run.tuned_s : s_run.reached_s) + SETTLE_S;
+    if (t >= from) {
+      double error = std::fabs(state.tc_temp - cfg.setpoint_c);
+      s_run.tracking_error_sum += error;
+      s_run.tracking_error_max = std::max(s_run.tracking_error_max, error);
+      s_run.tracking_ticks++;
+    }
+  }
+
+  if (s_run.scenario->profile) {
+    _check_profile(state);
+  }
+
+  if (s_run.record && s_run.ticks % 100 == 0) {
+    _drain_record();
+  }
+
+  if (s_run.trace) {
+    const plant_t &p = sim_world.plant;
+    fprintf(s_run.trace, "%.3f,%u,%u,%u,%d,%.1f,%.2f,%.2f,%.2f,%.2f,%u,%.2f,%.2f,%.2f,%.2f,%.1f,%.1f,"
+                         "%.1f,%.1f,%.1f,%.0f,%.0f,%.3f\n", _now_s(),
+            state.input_duty, state.output_duty, state.fan_duty, state.motor_on, state.balance, state.tc_temp,
+            state.ror, state.secondary_taper, state.junction_temp, state.tc_status, p.chamber_c, p.beans_c,
+            p.element1_c, p.element2_c, p.energy1_j / 1000, p.energy2_j / 1000, state.model_gain_main,
+            state.model_gain_secondary, state.model_gain_fan, state.model_tau_s, state.model_dead_time_s,
+            state.model_rmse);
+  }
+}
+
+void sim_on_roast(const roast_summary_t &summary) {
+  s_run.roasts++;
+  s_run.roast = summary;
+}
+
+static bool _check(bool ok, const char *what) {
+  if (!ok) {
+    printf("    FAILED: %s\n", what);
+  }
+  return ok;
+}
+
+static double _reaction(int element) {
+  return std::max(0.0, s_run.last_on_s[element] - s_run.fault_s);
+}
+
+static bool _within(double value, double expected, double tolerance) {
+  return std::fabs(value - expected) <= std::fabs(expected) * tolerance;
+}
+
+/* First order plus dead time response of the plant, linearised around the identify scenario */
+static thermal_model_estimate_t _expected_model() {
+  const plant_params_t &p = s_run.opts.plant;
+  double loss = p.chamber_loss + p.fan_loss * IDENTIFY_MEAN_FAN;
+  thermal_model_estimate_t expected = {};
+  expected.gain_main = (float) (p.heater1_w / loss);
+  expected.gain_secondary = (float) (p.heater2_w / loss);
+  expected.tau_s = (float) (p.chamber_capacity / loss);
+  expected.dead_time_s = (float) (p.element_capacity / p.element_to_chamber);
+  return expected;
+}
+
+/* One summary for the roast, its charge where the operator put it and its totals matching the plant */
+static bool _check_roast_summary() {
+  const roast_summary_t &r = s_run.roast;
+  const plant_params_t &p = s_run.opts.plant;
+  bool ok = _check(s_run.roasts == 1, "not one roast summary");
+  ok &= _check(std::fabs(r.start_loop * TICK_S + r.charge_s - s_run.charge_s) <= MAX_CHARGE_ERROR_S,
+               "summary charge not seen");
+  ok &= _check(!std::isnan(r.drop_temp), "summary drop not seen");
+  ok &= _check(std::fabs(r.peak_tc - s_run.peak_tc) <= MAX_SUMMARY_PEAK_ERROR_C, "summary peak off");
+  ok &= _check(_within(r.main_full_s, sim_world.plant.energy1_j / p.heater1_w, MAX_SUMMARY_ENERGY_ERROR) &&
+               _within(r.secondary_full_s, sim_world.plant.energy2_j / p.heater2_w, MAX_SUMMARY_ENERGY_ERROR),
+               "summary energy off");
+  // Counted from the SSR half-cycles the plant was heated by, only the last tick's go uncounted
+  ok &= _check(_within(r.main_wh, sim_world.plant.energy1_j / 3600, MAX_SUMMARY_WH_ERROR) &&
+               _within(r.secondary_wh, sim_world.plant.energy2_j / 3600, MAX_SUMMARY_WH_ERROR),
+               "summary delivered energy off");
+  return ok;
+}
+
+/* What the supervisor should trip on for a fault, the control decision handles the others alone */
+static supervisor_trip_t _expected_trip(fault_t fault) {
+  switch (fault) {
+    case FAULT_TC_OPEN:
+      return SUPERVISOR_TRIP_TC_FAULT;
+    case FAULT_TC_MISSING:
+      return SUPERVISOR_TRIP_NO_READING;
+    case FAULT_BOARD_HOT:
+      return SUPERVISOR_TRIP_BOARD_TEMP;
+    case FAULT_CONTROL_STALL:
+      return SUPERVISOR_TRIP_STALE;
+    default:
+      return SUPERVISOR_TRIP_NONE;
+  }
+}
+
+/* What the next boot would keep from the flight recorder: a full ring, intact, ending on the last tick */
+static bool _check_flight_recorder() {
+  flight_recorder_init();
+  const flight_recorder_previous_t &previous = flight_recorder_previous();
+  const flight_record_t *last = nullptr;
+  for (int i = 0; i < previous.count; i++) {
+    if (previous.records[i].type == FLIGHT_RECORD_TICK) {
+      last = &previous.records[i];
+    }
+  }
+  control_state_t state = controller_get_state();
+  bool ok = _check(previous.valid && previous.count == FLIGHT_RECORDER_SLOTS && previous.corrupt == 0,
+                   "flight recorder ring not kept whole");
+  ok &= _check(last && last->tick.input_duty == state.input_duty && last->tick.output_duty == state.output_duty &&
+               last->tick.tc_temp == std::lround(state.tc_temp * 10), "flight recorder missed the last tick");
+  return ok;
+}
+
+static bool _evaluate() {
+  const scenario_t *sc = s_run.scenario;
+  const control_cfg_t &cfg = s_run.opts.cfg;
+  bool ok = _check(s_run.violations == 0, "secondary ran while a safety condition was not met");
+  ok &= _check(s_run.unheld_s == 0, "SSR on without the SSR power management window held");
+  ok &= _check_flight_recorder();
+  boot_metrics_t boot = boot_profile_get_metrics();
+  ok &= _check(boot.first_tick_ms <= boot.first_tick_target_ms, "first control tick past its boot target");
+  supervisor_metrics_t supervisor = supervisor_get_metrics();
+  supervisor_trip_t trip = _expected_trip(sc->fault);
+  if (trip == SUPERVISOR_TRIP_NONE) {
+    ok &= _check(sc->full_heat || supervisor.trips == 0, "supervisor tripped without a fault");
+  } else {
+    ok &= _check(supervisor.trips == 1 && supervisor.last_trip == trip, "supervisor did not trip on the fault");
+  }
+
+  if (sc->full_heat) {
+    ok &= _check(s_run.peak_chamber <= cfg.max_tc_temp + MAX_OVERSHOOT_C, "chamber overshoot above TC limit");
+  } else if (sc->stepped) {
+    control_state_t state = controller_get_state();
+    thermal_model_estimate_t expected = _expected_model();
+    ok &= _check(_within(state.model_gain_main, expected.gain_main, MAX_MODEL_ERROR), "main element gain");
+    ok &= _check(_within(state.model_gain_secondary, expected.gain_secondary, MAX_MODEL_ERROR),
+                 "secondary element gain");
+    ok &= _check(_within(state.model_tau_s, expected.tau_s, MAX_MODEL_ERROR), "time constant");
+    ok &= _check(state.model_dead_time_s >= expected.dead_time_s / 2 &&
+                 state.model_dead_time_s <= expected.dead_time_s * 2, "dead time");
+  } else if (sc->setpoint) {
+    if (sc->autotune) {
+      ok &= _check(!std::isnan(s_run.tuned_s), "autotune did not finish");
+      ok &= _check(!controller_get_cfg().autotune, "autotune flag not cleared");
+    }
+    ok &= _check(s_run.tracking_ticks > 0, "never settled");
+    ok &= _check(s_run.tracking_error_sum / std::max(s_run.tracking_ticks, 1u) <= MAX_TRACKING_ERROR_C,
+                 "mean tracking error too large");
+    ok &= _check(s_run.peak_tc <= cfg.setpoint_c + MAX_SETPOINT_OVERSHOOT_C, "overshoot above the setpoint");
+  } else if (sc->profile) {
+    ok &= _check(s_run.phase == PHASE_DONE, "roast did not reach drop temperature in time");
+    ok &= _check(std::fabs(s_run.playing_s - s_run.charge_s) <= MAX_CHARGE_ERROR_S, "charge not seen");
+    ok &= _check(s_run.target_error_max <= MAX_TARGET_ERROR, "target off the profile");
+    ok &= _check(s_run.ratio_overruns == 0, "secondary above the profile ratio");
+    ok &= _check(s_run.profile_phase == PROFILE_DONE, "profile not played to its end");
+    ok &= _check_roast_summary();
+  } else if (sc->fault == FAULT_NONE) {
+    ok &= _check(s_run.phase == PHASE_DONE, "roast did not reach drop temperature in time");
+    ok &= _check(s_run.secondary_ticks > 0, "secondary element never ran");
+    ok &= _check(s_run.peak_tc < cfg.max_tc_temp, "thermocouple reached its limit during a normal roast");
+    ok &= _check_roast_summary();
+  } else {
+    ok &= _check(!std::isnan(s_run.fault_s), "fault was never injected");
+    double max_reaction = sc->fault == FAULT_HEAT_OFF || sc->fault == FAULT_MOTOR_STOP ? MAX_COMMAND_REACTION_S
+                          : sc->fault == FAULT_CONTROL_STALL                       ? MAX_STALL_REACTION_S
+                                                                                   : MAX_REACTION_S;
+    ok &= _check(_reaction(1) <= max_reaction, "secondary not cut in time");
+    if (sc->cuts_main) {
+      ok &= _check(_reaction(0) <= max_reaction, "main element not cut in time");
+    } else {
+      ok &= _check(sim_world.plant.energy1_j > s_run.energy_at_fault[0], "main element stopped needlessly");
+    }
+  }
+  return ok;
+}
+
+static int _run(const scenario_t *sc, const sim_options_t &opts) {
+  s_run = {};
+  s_run.scenario = sc;
+  s_run.opts = opts;
+  s_run.fault_s = NAN;
+  s_run.reached_s = NAN;
+  s_run.tuned_s = NAN;
+  s_run.charge_s = NAN;
+  s_run.playing_s = NAN;
+  if (sc->setpoint) {
+    s_run.opts.cfg.mode = CONTROL_MODE_SETPOINT;
+    s_run.opts.cfg.autotune = sc->autotune;
+  }
+  s_run.next_operator_ns = OPERATOR_PERIOD_NS;
+
+  plant_init(&sim_world.plant, opts.plant);
+  sim_world.balance_mv = (int) std::lround(150 + opts.balance_pct / 100 * (2400 - 150));
+  sim_set_log_level(opts.log_level);
+  sim_set_advance_hook(_advance);
+
+  if (opts.trace_dir) {
+    std::string path = std::string(opts.trace_dir) + "/" + sc->name + ".csv";
+    s_run.trace = fopen(path.c_str(), "w");
+    if (!s_run.trace) {
+      perror(path.c_str());
+      return 2;
+    }
+    fprintf(s_run.trace, "t,input_duty,output_duty,fan_duty,motor_on,balance,tc_temp,ror,secondary_taper,"
+                         "junction_temp,tc_status,chamber,beans,element1,element2,energy1_kj,energy2_kj,"
+                         "model_gain_main,model_gain_secondary,model_gain_fan,model_tau_s,model_dead_time_s,"
+                         "model_rmse\n");
+  }
+
+  if (opts.record_dir) {
+    std::string path = std::string(opts.record_dir) + "/" + sc->name + ".rcr";
+    s_run.record = fopen(path.c_str(), "wb");
+    if (!s_run.record) {
+      perror(path.c_str());
+      return 2;
+    }
+  }
+
+  if (sc->profile && !_store_profile()) {
+    fprintf(stderr, "Invalid profile\n");
+    return 2;
+  }
+
+  // The elements rated as the plant has them, so delivered energy compares
+  s_run.opts.cfg.main_watts = (uint16_t) s_run.opts.plant.heater1_w;
+  s_run.opts.cfg.secondary_watts = (uint16_t) s_run.opts.plant.heater2_w;
+
+  // Persisted like a shadow update would, so control_loop_init() picks it up
+  if (controller_set_cfg(s_run.opts.cfg) != ESP_OK) {
+    fprintf(stderr, "Invalid controller configuration\n");
+    return 2;
+  }
+
+  auto wall_start = std::chrono::steady_clock::now();
+  flight_recorder_init();
+  control_loop_safe_state();
+  control_loop_init();
+  control_loop_run();
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+  if (s_run.trace) {
+    fclose(s_run.trace);
+  }
+  if (s_run.record) {
+    _drain_record();
+    fclose(s_run.record);
+  }
+
+  bool ok = _evaluate();
+  double sim_s = _now_s();
+  printf("%-11s %s  %7.1fs simulated in %.3fs (%.0fx), %u ticks, peak tc=%.1fC chamber=%.1fC beans=%.1fC, "
+         "energy main=%.0fkJ secondary=%.0fkJ", sc->name, ok ? "PASS" : "FAIL", sim_s, wall_s,
+         sim_s / std::max(wall_s, 1e-9), s_run.ticks, s_run.peak_tc, s_run.peak_chamber, s_run.peak_beans,
+         sim_world.plant.energy1_j / 1000, sim_world.plant.energy2_j / 1000);
+  if (sc->full_heat) {
+    printf(", tc overshoot=%.1fC", s_run.peak_tc - opts.cfg.max_tc_temp);
+  }
+  if (sc->stepped) {
+    control_state_t state = controller_get_state();
+    thermal_model_estimate_t expected = _expected_model();
+    printf(", model gains main=%.0fC (%.0fC) secondary=%.0fC (%.0fC) fan=%.0fC tau=%.0fs (%.0fs) "
+           "dead time=%.0fs (%.0fs)",
+           state.model_gain_main, expected.gain_main, state.model_gain_secondary, expected.gain_secondary,
+           state.model_gain_fan, state.model_tau_s, expected.tau_s, state.model_dead_time_s, expected.dead_time_s);
+  }
+  if (sc->setpoint) {
+    if (sc->autotune) {
+      control_cfg_t tuned = controller_get_cfg();
+      printf(", tuned in %.0fs kp=%.3f ki=%.4f kd=%.2f", s_run.tuned_s, tuned.kp, tuned.ki, tuned.kd);
+    }
+    printf(", tracking error mean=%.2fC max=%.2fC, setpoint overshoot=%.1fC",
+           s_run.tracking_error_sum / std::max(s_run.tracking_ticks, 1u), s_run.tracking_error_max,
+           s_run.peak_tc - s_run.opts.cfg.setpoint_c);
+  }
+  if (sc->profile) {
+    printf(", charge put %+.0fs off, target error max=%.4f", s_run.playing_s - s_run.charge_s,
+           s_run.target_error_max);
+  }
+  if (s_run.roasts) {
+    const roast_summary_t &r = s_run.roast;
+    printf(", roast %.0fs charge %.1fC at %.0fs drop %.1fC max ror=%.1fC/min delivered main=%.1fWh "
+           "secondary=%.1fWh", r.duration_s, r.charge_temp, r.charge_s, r.drop_temp, r.max_ror, r.main_wh,
+           r.secondary_wh);
+  }
+  if (!std::isnan(s_run.fault_s)) {
+    printf(", reaction secondary=%.3fs", _reaction(1));
+    if (sc->cuts_main) {
+      printf(" main=%.3fs", _reaction(0));
+    }
+  }
+  if (_expected_trip(sc->fault) != SUPERVISOR_TRIP_NONE) {
+    printf(", supervisor reaction=%.3fs", supervisor_get_metrics().last_reaction_us / 1e6);
+  }
+  if (sc->fault == FAULT_HEAT_OFF) {
+    printf(", command latency=%.3fs", controller_get_state().command_latency_us / 1e6);
+  }
+  printf("\n");
+  fflush(stdout);
+  return ok ? 0 : 1;
+}
+
+/*
+ * An 8 byte configuration as the first firmware saved it, untagged and without the fields added since. Loading it
+ * must keep its limits and mains frequency, default the rest and save it back tagged.
+ */
+static bool _check_legacy_cfg() {
+  control_cfg_t defaults = controller_get_cfg();
+  const struct {
+    float max_heat_ratio;
+    uint16_t max_tc_temp;
+    uint8_t max_board_temp;
+    uint8_t mains_hz;
+  } legacy = {0.6f, 250, 70, MAINS_60_HZ};
+  static_assert(sizeof(legacy) == 8, "first configuration layout");
+
+  nvs_handle_t nvs;
+  nvs_open("controller", NVS_READWRITE, &nvs);
+  nvs_set_blob(nvs, "cfg", &legacy, sizeof(legacy));
+  control_loop_init();
+  size_t size = 0;
+  nvs_get_blob(nvs, "cfg", nullptr, &size);
+  nvs_close(nvs);
+
+  control_cfg_t cfg = controller_get_cfg();
+  control_cfg_t expected = defaults;
+  expected.max_heat_ratio = legacy.max_heat_ratio;
+  expected.max_tc_temp = legacy.max_tc_temp;
+  expected.max_board_temp = legacy.max_board_temp;
+  expected.mains_hz = legacy.mains_hz;
+  bool ok = _check(!schema_diff(control_cfg_schema, &cfg, &expected), "fields kept, the rest at their defaults");
+  ok &= _check(size == sizeof(uint16_t) + schema_struct_end(control_cfg_schema), "saved back tagged");
+  return ok;
+}
+
+enum stream_t {
+  STREAM_NORMAL,
+  STREAM_EXPONENTIAL,
+  STREAM_UNIFORM,
+  STREAM_RAMP,
+};
+
+/* Fraction of the samples below the estimate, less the quantile it estimates */
+static double _rank_error(const std::vector<float> &sorted, float estimate, double p) {
+  auto below = std::lower_bound(sorted.begin(), sorted.end(), estimate) - sorted.begin();
+  return (double) below / (double) sorted.size() - p;
+}
+
+/*
+ * P² against the exact quantiles of the same samples, sorted, over a default metrics interval of ticks and a day
+ * of them. The error is in rank, the fraction of samples between the estimate and the exact quantile, so one
+ * tolerance holds whatever the scale of the stream. The tolerances sit above the worst of 400 seeds per stream.
+ */
+static bool _check_p2() {
+  const struct {
+    uint32_t samples;
+    double tolerance;
+  } lengths[] = {{1800, 0.015}, {86400, 0.004}};
+  const char *names[] = {"normal", "exponential", "uniform", "ramp"};
+  bool ok = true;
+  for (const auto &length: lengths) {
+    for (uint32_t seed = 1; seed <= P2_SEEDS * (STREAM_RAMP + 1); seed++) {
+      auto stream = (stream_t) (seed % (STREAM_RAMP + 1));
+      // The raw generator output is the same on every standard library, unlike its distributions
+      std::mt19937 rng(seed);
+      auto uniform = [&rng]() { return (rng() + 0.5) / 4294967296.0; };
+      stream_stats_t stats;
+      stream_stats_reset(&stats);
+      std::vector<float> samples;
+      for (uint32_t i = 0; i < length.samples; i++) {
+        double x;
+        switch (stream) {
+          case STREAM_NORMAL:
+            x = std::sqrt(-2 * std::log(uniform())) * std::cos(2 * M_PI * uniform());
+            break;
+          case STREAM_EXPONENTIAL:
+            x = -std::log(uniform());
+            break;
+          case STREAM_UNIFORM:
+            x = uniform();
+            break;
+          default:
+            x = i;
+            break;
+        }
+        stream_stats_add(&stats, (float) x);
+        samples.push_back((float) x);
+      }
+      std::sort(samples.begin(), samples.end());
+
+      stats_summary_t summary = stream_stats_summary(&stats);
+      const struct {
+        const char *name;
+        float estimate;
+        double p;
+      } quantiles[] = {{"p50", summary.p50, 0.50}, {"p95", summary.p95, 0.95}, {"p99", summary.p99, 0.99}};
+      for (const auto &q: quantiles) {
+        double error = _rank_error(samples, q.estimate, q.p);
+        char what[128];
+        snprintf(what, sizeof(what), "%s of %u %s samples, seed %u, off by %.4f in rank, tolerance %.4f",
+                 q.name, length.samples, names[stream], seed, error, length.tolerance);
+        ok &= _check(std::fabs(error) <= length.tolerance, what);
+      }
+    }
+  }
+  return ok;
+}
+
+// Every type a schema field can have, at the edges of their CBOR encodings
+struct cbor_sample_t {
+  bool flag;
+  uint8_t u8;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+  int8_t i8;
+  int16_t i16;
+  int32_t i32;
+  int64_t i64;
+  float f;
+  double d;
+  char chars[12];
+  const char *cstr;
+};
+
+static const schema_field_t s_cbor_sample_fields[] = {
+    SCHEMA_FIELD(cbor_sample_t, flag),
+    SCHEMA_FIELD(cbor_sample_t, u8),
+    SCHEMA_FIELD(cbor_sample_t, u16),
+    SCHEMA_FIELD(cbor_sample_t, u32),
+    SCHEMA_FIELD(cbor_sample_t, u64),
+    SCHEMA_FIELD(cbor_sample_t, i8),
+    SCHEMA_FIELD(cbor_sample_t, i16),
+    SCHEMA_FIELD(cbor_sample_t, i32),
+    SCHEMA_FIELD(cbor_sample_t, i64),
+    SCHEMA_FIELD(cbor_sample_t, f),
+    SCHEMA_FIELD(cbor_sample_t, d),
+    SCHEMA_FIELD(cbor_sample_t, chars),
+    SCHEMA_FIELD_NAMED(cbor_sample_t, cstr, "a_longer_key_past_23_bytes"),
+};
+static const schema_t s_cbor_sample_schema = SCHEMA_DEFINE(s_cbor_sample_fields);
+
+struct cbor_reader_t {
+  const uint8_t *pos;
+  const uint8_t *end;
+  bool error;
+};
+
+/* Major type and argument of the next item, the argument is the raw bits of a float */
+static uint8_t _cbor_head(cbor_reader_t *r, uint64_t *arg) {
+  if (r->pos >= r->end) {
+    r->error = true;
+    return 0;
+  }
+  uint8_t initial = *r->pos++;
+  uint8_t info = initial & 0x1f;
+  int bytes = info < 24 ? 0 : info <= 27 ? 1 << (info - 24) : -1;
+  if (bytes < 0 || r->end - r->pos < bytes) {
+    r->error = true;
+    return 0;
+  }
+  *arg = bytes ? 0 : info;
+  for (int i = 0; i < bytes; i++) {
+    *arg = *arg << 8 | *r->pos++;
+  }
+  return initial >> 5;
+}
+
+/* Reads the next item into a field, as the field's type asks for */
+static void _cbor_read_field(cbor_reader_t *r, const schema_field_t &f, uint8_t *p) {
+  uint64_t arg = 0;
+  uint8_t major = _cbor_head(r, &arg);
+  int64_t value = major == 1 ? (int64_t) ~arg : (int64_t) arg;
+  switch (f.type) {
+    case SCHEMA_BOOL:
+      r->error |= major != 7 || (arg != 20 && arg != 21);
+      *(bool *) p = arg == 21;
+      return;
+    case SCHEMA_FLOAT: {
+      auto bits = (uint32_t) arg;
+      r->error |= major != 7;
+      memcpy(p, &bits, sizeof(bits));
+      return;
+    }
+    case SCHEMA_DOUBLE:
+      r->error |= major != 7;
+      memcpy(p, &arg, sizeof(arg));
+      return;
+    case SCHEMA_CHARS:
+    case SCHEMA_CSTR: {
+      r->error |= major != 3 || (uint64_t) (r->end - r->pos) < arg;
+      if (r->error) {
+        return;
+      }
+      static char strings[SCHEMA_MAX_FIELDS][64];
+      char *str = f.type == SCHEMA_CHARS ? (char *) p : strings[&f - s_cbor_sample_fields];
+      size_t room = f.type == SCHEMA_CHARS ? f.size : sizeof(strings[0]);
+      r->error |= arg >= room;
+      memcpy(str, r->pos, std::min<size_t>(arg, room - 1));
+      r->pos += arg;
+      if (f.type == SCHEMA_CSTR) {
+        *(const char **) p = str;
+      }
+      return;
+    }
+    default:
+      r->error |= major > 1 || (major == 1 && f.type <= SCHEMA_U64);
+      memcpy(p, &value, f.size);
+      return;
+  }
+}
+
+/* Decodes a flat map as schema_cbor_write() encodes it, back into a struct */
+static uint32_t _cbor_read_fields(const uint8_t *buf, size_t len, const schema_t &schema, void *obj) {
+  cbor_reader_t r = {.pos = buf, .end = buf + len, .error = false};
+  uint32_t read = 0;
+  uint64_t count = 0;
+  r.error |= _cbor_head(&r, &count) != 5;
+  for (uint64_t i = 0; i < count && !r.error; i++) {
+    uint64_t key_len = 0;
+    r.error |= _cbor_head(&r, &key_len) != 3 || (uint64_t) (r.end - r.pos) < key_len;
+    int index = -1;
+    for (int j = 0; j < schema.count && !r.error; j++) {
+      if (strlen(schema.fields[j].name) == key_len && !memcmp(schema.fields[j].name, r.pos, key_len)) {
+        index = j;
+      }
+    }
+    r.pos += r.error ? 0 : key_len;
+    r.error |= index < 0 || (read & (1UL << index));
+    if (!r.error) {
+      _cbor_read_field(&r, schema.fields[index], (uint8_t *) obj + schema.fields[index].offset);
+      read |= 1UL << index;
+    }
+  }
+  return r.error || r.pos != r.end ? 0 : read;
+}
+
+/* Encoding of a single item against RFC 8949 appendix A */
+static bool _check_cbor_item(void (*write)(cbor_writer_t *), const char *expected_hex, const char *what) {
+  uint8_t buf[16];
+  cbor_writer_t w;
+  cbor_writer_init(&w, buf, sizeof(buf));
+  write(&w);
+  size_t len = cbor_writer_finish(&w);
+  char hex[2 * sizeof(buf) + 1] = "";
+  for (size_t i = 0; i < len; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", buf[i]);
+  }
+  return _check(!strcmp(hex, expected_hex), what);
+}
+
+/*
+ * schema_cbor_write() against a decoder written from the RFC, over every field type and the configuration, then
+ * with a mask and with buffers one byte short and just long enough.
+ */
+static bool _check_cbor() {
+  bool ok = true;
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_uint(w, 23); }, "17", "uint 23");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_uint(w, 24); }, "1818", "uint 24");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_uint(w, 1000); }, "1903e8", "uint 1000");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_uint(w, 1000000); }, "1a000f4240", "uint 1000000");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_uint(w, UINT64_MAX); }, "1bffffffffffffffff",
+                         "uint 2^64 - 1");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_int(w, -1); }, "20", "int -1");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_int(w, -1000); }, "3903e7", "int -1000");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_int(w, INT64_MIN); }, "3b7fffffffffffffff",
+                         "int -2^63");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_float(w, 100000.0f); }, "fa47c35000",
+                         "float 100000.0");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_double(w, 1.1); }, "fb3ff199999999999a", "double 1.1");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_bool(w, true); }, "f5", "true");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_null(w); }, "f6", "null");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_write_str(w, "IETF"); }, "6449455446", "text \"IETF\"");
+  ok &= _check_cbor_item([](cbor_writer_t *w) { cbor_begin_array(w, 0); }, "80", "empty array");
+
+  cbor_sample_t sample = {};
+  sample.flag = true;
+  sample.u8 = 23;
+  sample.u16 = 256;
+  sample.u32 = 65536;
+  sample.u64 = UINT64_MAX;
+  sample.i8 = -24;
+  sample.i16 = -25;
+  sample.i32 = INT32_MIN;
+  sample.i64 = INT64_MIN;
+  sample.f = -0.1f;
+  sample.d = 1e300;
+  strcpy(sample.chars, "chamber");
+  sample.cstr = "roaster";
+
+  uint8_t buf[256];
+  size_t len = schema_cbor_write(buf, sizeof(buf), s_cbor_sample_schema, &sample);
+  cbor_sample_t decoded = {};
+  uint32_t read = _cbor_read_fields(buf, len, s_cbor_sample_schema, &decoded);
+  uint32_t cstr_bit = 1UL << (s_cbor_sample_schema.count - 1);
+  ok &= _check(read == (1UL << s_cbor_sample_schema.count) - 1, "every field type decodes");
+  ok &= _check(!(schema_diff(s_cbor_sample_schema, &sample, &decoded) & ~cstr_bit) && decoded.cstr &&
+               !strcmp(decoded.cstr, sample.cstr), "every field type round trips");
+
+  control_cfg_t cfg = controller_get_cfg();
+  control_cfg_t cfg_decoded = {};
+  len = schema_cbor_write(buf, sizeof(buf), control_cfg_schema, &cfg);
+  read = _cbor_read_fields(buf, len, control_cfg_schema, &cfg_decoded);
+  ok &= _check(read == (1UL << control_cfg_schema.count) - 1 &&
+               !schema_diff(control_cfg_schema, &cfg, &cfg_decoded), "configuration round trips");
+
+  uint32_t mask = 1UL << 2 | 1UL << 11;
+  decoded = {};
+  len = schema_cbor_write(buf, sizeof(buf), s_cbor_sample_schema, &sample, mask);
+  ok &= _check(_cbor_read_fields(buf, len, s_cbor_sample_schema, &decoded) == mask &&
+               decoded.u16 == sample.u16 && !strcmp(decoded.chars, sample.chars), "masked fields round trip");
+
+  size_t full = schema_cbor_write(buf, sizeof(buf), s_cbor_sample_schema, &sample);
+  ok &= _check(schema_cbor_write(buf, full - 1, s_cbor_sample_schema, &sample) == 0, "a byte short writes nothing");
+  ok &= _check(schema_cbor_write(buf, full, s_cbor_sample_schema, &sample) == full, "an exact buffer fits");
+  return ok;
+}
+
+struct check_t {
+  const char *name;
+  const char *description;
+  bool (*run)();
+};
+
+static const check_t s_checks[] = {
+    {"legacy_cfg", "Configuration saved by the first firmware upgraded on load", _check_legacy_cfg},
+    {"p2", "Streaming p50, p95 and p99 against the exact quantiles", _check_p2},
+    {"cbor", "Schema CBOR documents decoded back into their structs", _check_cbor},
+};
+
+static int _run_check(const check_t *check, const sim_options_t &opts) {
+  sim_set_log_level(opts.log_level);
+  bool ok = check->run();
+  printf("%-11s %s  %s\n", check->name, ok ? "PASS" : "FAIL", check->description);
+  fflush(stdout);
+  return ok ? 0 : 1;
+}
+
+/* Each scenario runs in its own process, the firmware keeps its state in statics */
+template<typename T>
+static int _run_isolated(const T *item, int (*run)(const T *, const sim_options_t &), const sim_options_t &opts) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 2;
+  } else if (pid == 0) {
+    _exit(run(item, opts));
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+    printf("%-11s CRASHED\n", item->name);
+    return 2;
+  }
+  return WEXITSTATUS(status);
+}
+
+static void _usage(const char *argv0) {
+  printf("Usage: %s [options]\n"
+         "  -s, --scenario NAME   Run a single scenario or check, all by default\n"
+         "  -l, --list            List scenarios and checks\n"
+         "      --mains HZ        Mains frequency, 50 or 60\n"
+         "      --max-tc C        Thermocouple limit for the secondary element\n"
+         "      --max-board C     Board temperature limit\n"
+         "      --ratio R         Maximum secondary heat ratio [0, 1]\n"
+         "      --horizon S       Predictive cutoff horizon, 0 to only cut at the TC limit\n"
+         "      --taper C         Degrees below the TC limit the predictive cutoff starts tapering from\n"
+         "      --setpoint C      Setpoint of the setpoint scenarios\n"
+         "      --gains P,I,D     PID gains of setpoint mode\n"
+         "      --balance PCT     Balance potentiometer position [0, 100]\n"
+         "      --secondary-w W   Secondary element rating, lower to simulate a worn element\n"
+         "      --trace DIR       Write a CSV trace per scenario to DIR\n"
+         "      --record DIR      Write the control record per scenario to DIR, for roaster_replay\n"
+         "  -v                    Firmware log verbosity, repeat for more\n", argv0);
+}
+
+int main(int argc, char **argv) {
+  sim_options_t opts = {
+      // The firmware defaults, before anything is loaded from NVS
+      .cfg = controller_get_cfg(),
+      .plant = plant_default_params(),
+      .balance_pct = 100,
+      .trace_dir = nullptr,
+      .record_dir = nullptr,
+      .log_level = ESP_LOG_NONE,
+  };
+  const char *only = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool takes_value = true;
+    if ((!strcmp(arg, "-s") || !strcmp(arg, "--scenario")) && value) {
+      only = value;
+    } else if (!strcmp(arg, "--mains") && value) {
+      opts.cfg.mains_hz = (uint8_t) atoi(value);
+    } else if (!strcmp(arg, "--max-tc") && value) {
+      opts.cfg.max_tc_temp = (uint16_t) atoi(value);
+    } else if (!strcmp(arg, "--max-board") && value) {
+      opts.cfg.max_board_temp = (uint8_t) atoi(value);
+    } else if (!strcmp(arg, "--ratio") && value) {
+      opts.cfg.max_heat_ratio = strtof(value, nullptr);
+    } else if (!strcmp(arg, "--horizon") && value) {
+      opts.cfg.cutoff_horizon_s = (uint8_t) atoi(value);
+    } else if (!strcmp(arg, "--taper") && value) {
+      opts.cfg.cutoff_taper_c = (uint8_t) atoi(value);
+    } else if (!strcmp(arg, "--setpoint") && value) {
+      opts.cfg.setpoint_c = (uint16_t) atoi(value);
+    } else if (!strcmp(arg, "--gains") && value) {
+      if (sscanf(value, "%f,%f,%f", &opts.cfg.kp, &opts.cfg.ki, &opts.cfg.kd) != 3) {
+        _usage(argv[0]);
+        return 2;
+      }
+    } else if (!strcmp(arg, "--secondary-w") && value) {
+      opts.plant.heater2_w = strtod(value, nullptr);
+    } else if (!strcmp(arg, "--balance") && value) {
+      opts.balance_pct = strtod(value, nullptr);
+    } else if (!strcmp(arg, "--trace") && value) {
+      opts.trace_dir = value;
+    } else if (!strcmp(arg, "--record") && value) {
+      opts.record_dir = value;
+    } else if (!strncmp(arg, "-v", 2) && strspn(arg + 1, "v") == strlen(arg + 1)) {
+      opts.log_level = (esp_log_level_t) std::min<int>(ESP_LOG_VERBOSE, ESP_LOG_ERROR + (int) strlen(arg + 1));
+      takes_value = false;
+    } else if (!strcmp(arg, "-l") || !strcmp(arg, "--list")) {
+      for (const auto &sc: s_scenarios) {
+        printf("%-11s %s\n", sc.name, sc.description);
+      }
+      for (const auto &check: s_checks) {
+        printf("%-11s %s\n", check.name, check.description);
+      }
+      return 0;
+    } else {
+      _usage(argv[0]);
+      return 2;
+    }
+    i += takes_value ? 1 : 0;
+  }
+
+  // The checks first, they take no time
+  int checks_failed = 0;
+  int checks_run = 0;
+  for (const auto &check: s_checks) {
+    if (only && strcmp(only, check.name) != 0) {
+      continue;
+    }
+    checks_run++;
+    checks_failed += _run_isolated(&check, _run_check, opts) != 0 ? 1 : 0;
+  }
+
+  int failed = 0;
+  int run = 0;
+  for (const auto &sc: s_scenarios) {
+    if (only && strcmp(only, sc.name) != 0) {
+      continue;
+    }
+    run++;
+    failed += _run_isolated(&sc, _run, opts) != 0 ? 1 : 0;
+  }
+
+  if (checks_run) {
+    printf("%d of %d checks passed\n", checks_run - checks_failed, checks_run);
+  }
+  if (run == 0 && checks_run) {
+    return checks_failed ? 1 : 0;
+  }
+  if (run == 0) {
+    fprintf(stderr, "Unknown scenario: %s\n", only);
+    return 2;
+  }
+  printf("%d of %d scenarios passed\n", run - failed, run);
+  return failed || checks_failed ? 1 : 0;
+}
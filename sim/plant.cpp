@@ -0,0 +1,73 @@
+#include <algorithm>
+#include "plant.h"
+
+plant_params_t plant_default_params() {
+  return {
+      .ambient_c = 25,
+      .heater1_w = 1300,
+      .heater2_w = 1300,
+      .element_capacity = 400,
+      .element_to_chamber = 12,
+      .chamber_capacity = 4000,
+      .chamber_loss = 4,
+      .fan_loss = 6,
+      .bean_specific_heat = 1.6,
+      .chamber_to_beans = 8,
+      .tc_tau_s = 3,
+      .board_coupling = 0.12,
+      .board_tau_s = 60,
+  };
+}
+
+void plant_init(plant_t *plant, const plant_params_t &params) {
+  *plant = {};
+  plant->params = params;
+  plant->element1_c = params.ambient_c;
+  plant->element2_c = params.ambient_c;
+  plant->chamber_c = params.ambient_c;
+  plant->beans_c = params.ambient_c;
+  plant->tc_c = params.ambient_c;
+  plant->board_c = params.ambient_c;
+}
+
+static void _integrate(plant_t *plant, double dt, bool heater1_on, bool heater2_on, double fan_duty) {
+  const plant_params_t &p = plant->params;
+  double p1 = heater1_on ? p.heater1_w : 0;
+  double p2 = heater2_on ? p.heater2_w : 0;
+
+  double q1 = p.element_to_chamber * (plant->element1_c - plant->chamber_c);
+  double q2 = p.element_to_chamber * (plant->element2_c - plant->chamber_c);
+  double q_loss = (p.chamber_loss + p.fan_loss * fan_duty / 100.0) * (plant->chamber_c - p.ambient_c);
+  double q_beans = plant->bean_mass_g > 0 ? p.chamber_to_beans * (plant->chamber_c - plant->beans_c) : 0;
+
+  plant->element1_c += (p1 - q1) * dt / p.element_capacity;
+  plant->element2_c += (p2 - q2) * dt / p.element_capacity;
+  plant->chamber_c += (q1 + q2 - q_loss - q_beans) * dt / p.chamber_capacity;
+  if (plant->bean_mass_g > 0) {
+    plant->beans_c += q_beans * dt / (plant->bean_mass_g * p.bean_specific_heat);
+  }
+  plant->tc_c += (plant->chamber_c - plant->tc_c) * dt / p.tc_tau_s;
+  double board_target = p.ambient_c + p.board_coupling * (plant->chamber_c - p.ambient_c);
+  plant->board_c += (board_target - plant->board_c) * dt / p.board_tau_s;
+
+  plant->energy1_j += p1 * dt;
+  plant->energy2_j += p2 * dt;
+}
+
+void plant_step(plant_t *plant, double dt_s, bool heater1_on, bool heater2_on, double fan_duty) {
+  while (dt_s > 0) {
+    double dt = std::min(dt_s, PLANT_MAX_STEP_S);
+    _integrate(plant, dt, heater1_on, heater2_on, fan_duty);
+    dt_s -= dt;
+  }
+}
+
+void plant_charge(plant_t *plant, double mass_g) {
+  plant->bean_mass_g = mass_g;
+  plant->beans_c = plant->params.ambient_c;
+}
+
+void plant_drop(plant_t *plant) {
+  plant->bean_mass_g = 0;
+  plant->beans_c = plant->params.ambient_c;
+}
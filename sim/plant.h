@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Lumped thermal model of the roaster: two heater elements, the drum/chamber air, the beans, the chamber
+ * thermocouple and the sidecar board.
+ *
+ * Each body is a single heat capacity exchanging heat through fixed conductances, integrated with forward
+ * Euler in steps no longer than PLANT_MAX_STEP_S. Values are rough fits for a Hottop with a second element,
+ * close enough to exercise the control loop and its safety limits, not to predict a roast.
+ */
+
+#define PLANT_MAX_STEP_S  0.01
+
+struct plant_params_t {
+  double ambient_c;
+  // Element ratings at full conduction
+  double heater1_w;
+  double heater2_w;
+  // J/K and W/K
+  double element_capacity;
+  double element_to_chamber;
+  double chamber_capacity;
+  double chamber_loss;
+  // Extra loss to ambient with the exhaust fan at 100%
+  double fan_loss;
+  // Specific heat of the beans, J/(g.K)
+  double bean_specific_heat;
+  double chamber_to_beans;
+  // First order lag of the thermocouple, s
+  double tc_tau_s;
+  // Board sits at ambient plus this fraction of the chamber rise, with its own lag
+  double board_coupling;
+  double board_tau_s;
+};
+
+struct plant_t {
+  plant_params_t params;
+  double element1_c;
+  double element2_c;
+  double chamber_c;
+  double beans_c;
+  double bean_mass_g;
+  double tc_c;
+  double board_c;
+  // Electrical energy delivered to each element since init
+  double energy1_j;
+  double energy2_j;
+};
+
+plant_params_t plant_default_params();
+
+void plant_init(plant_t *plant, const plant_params_t &params);
+
+/**
+ * Advances the model by `dt_s` with each element either conducting or not for the whole span.
+ */
+void plant_step(plant_t *plant, double dt_s, bool heater1_on, bool heater2_on, double fan_duty);
+
+/**
+ * Drops `mass_g` of beans at ambient temperature into the drum.
+ */
+void plant_charge(plant_t *plant, double mass_g);
+
+/**
+ * Empties the drum.
+ */
+void plant_drop(plant_t *plant);
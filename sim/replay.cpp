@@ -0,0 +1,272 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "sim_platform.h"
+#include "control_loop.h"
+#include "control_record.h"
+#include "thermal_model.h"
+#include "roast_session.h"
+#include "world.h"
+
+/*
+ * Replays a control record through control_decide() and diffs the element duties against those recorded.
+ *
+ * With no overrides any difference means the code under test does not behave like the build that recorded
+ * the stream. With overrides, the diff shows how that configuration would have behaved on the same roast.
+ */
+
+// Mismatching ticks listed in full before only being counted
+#define MAX_LISTED_MISMATCHES 20
+
+struct replay_overrides_t {
+  bool max_tc;
+  uint16_t max_tc_temp;
+  bool max_board;
+  uint8_t max_board_temp;
+  bool ratio;
+  float max_heat_ratio;
+  bool horizon;
+  uint8_t cutoff_horizon_s;
+  bool taper;
+  uint8_t cutoff_taper_c;
+  bool setpoint;
+  uint16_t setpoint_c;
+  bool gains;
+  float kp, ki, kd;
+};
+
+// The replay drives no hardware, there are no ticks to observe
+void sim_on_tick(const control_state_t &) {}
+
+void sim_on_roast(const roast_summary_t &) {}
+
+static bool _load(const char *path, std::vector<uint8_t> &buf) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  uint8_t block[4096];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+    buf.insert(buf.end(), block, block + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static void _apply_overrides(control_cfg_t &cfg, const replay_overrides_t &o) {
+  if (o.max_tc) {
+    cfg.max_tc_temp = o.max_tc_temp;
+  }
+  if (o.max_board) {
+    cfg.max_board_temp = o.max_board_temp;
+  }
+  if (o.ratio) {
+    cfg.max_heat_ratio = o.max_heat_ratio;
+  }
+  if (o.horizon) {
+    cfg.cutoff_horizon_s = o.cutoff_horizon_s;
+  }
+  if (o.taper) {
+    cfg.cutoff_taper_c = o.cutoff_taper_c;
+  }
+  if (o.setpoint) {
+    cfg.mode = CONTROL_MODE_SETPOINT;
+    cfg.setpoint_c = o.setpoint_c;
+  }
+  if (o.gains) {
+    cfg.kp = o.kp;
+    cfg.ki = o.ki;
+    cfg.kd = o.kd;
+  }
+}
+
+static void _usage(const char *argv0) {
+  printf("Usage: %s [options] RECORD...\n"
+         "  Records are chunks as published on the telemetry/record topic, concatenated in order.\n"
+         "      --max-tc C        Replay with this thermocouple limit\n"
+         "      --max-board C     Replay with this board temperature limit\n"
+         "      --ratio R         Replay with this maximum secondary heat ratio\n"
+         "      --horizon S       Replay with this predictive cutoff horizon, 0 disables it\n"
+         "      --taper C         Replay with this predictive cutoff taper\n"
+         "      --setpoint C      Replay in setpoint mode holding C\n"
+         "      --gains P,I,D     Replay with these setpoint mode gains\n"
+         "      --csv FILE        Write recorded and replayed duties per tick to FILE\n"
+         "  -v                    Firmware log verbosity, repeat for more\n", argv0);
+}
+
+int main(int argc, char **argv) {
+  replay_overrides_t overrides = {};
+  const char *csv_path = nullptr;
+  std::vector<uint8_t> buf;
+  int files = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--max-tc") && value) {
+      overrides.max_tc = true;
+      overrides.max_tc_temp = (uint16_t) atoi(value);
+      i++;
+    } else if (!strcmp(arg, "--max-board") && value) {
+      overrides.max_board = true;
+      overrides.max_board_temp = (uint8_t) atoi(value);
+      i++;
+    } else if (!strcmp(arg, "--ratio") && value) {
+      overrides.ratio = true;
+      overrides.max_heat_ratio = strtof(value, nullptr);
+      i++;
+    } else if (!strcmp(arg, "--horizon") && value) {
+      overrides.horizon = true;
+      overrides.cutoff_horizon_s = (uint8_t) atoi(value);
+      i++;
+    } else if (!strcmp(arg, "--taper") && value) {
+      overrides.taper = true;
+      overrides.cutoff_taper_c = (uint8_t) atoi(value);
+      i++;
+    } else if (!strcmp(arg, "--setpoint") && value) {
+      overrides.setpoint = true;
+      overrides.setpoint_c = (uint16_t) atoi(value);
+      i++;
+    } else if (!strcmp(arg, "--gains") && value) {
+      overrides.gains = sscanf(value, "%f,%f,%f", &overrides.kp, &overrides.ki, &overrides.kd) == 3;
+      if (!overrides.gains) {
+        _usage(argv[0]);
+        return 2;
+      }
+      i++;
+    } else if (!strcmp(arg, "--csv") && value) {
+      csv_path = value;
+      i++;
+    } else if (!strncmp(arg, "-v", 2) && strspn(arg + 1, "v") == strlen(arg + 1)) {
+      sim_set_log_level((esp_log_level_t) std::min<int>(ESP_LOG_VERBOSE, ESP_LOG_ERROR + (int) strlen(arg + 1)));
+    } else if (arg[0] == '-') {
+      _usage(argv[0]);
+      return 2;
+    } else if (_load(arg, buf)) {
+      files++;
+    } else {
+      return 2;
+    }
+  }
+  if (files == 0) {
+    _usage(argv[0]);
+    return 2;
+  }
+
+  FILE *csv = nullptr;
+  if (csv_path) {
+    csv = fopen(csv_path, "w");
+    if (!csv) {
+      perror(csv_path);
+      return 2;
+    }
+    fprintf(csv, "loop_count,heat_ok,heat_duty,fan_ok,fan_duty,balance_mv,motor_on,tc_valid,tc_status,tc_temp,"
+                 "junction_temp,cfg_version,recorded_input,recorded_output,replayed_input,replayed_output\n");
+  }
+
+  control_record_reader_t reader;
+  control_record_reader_init(&reader, buf.data(), buf.size());
+  control_record_t record;
+  control_cfg_t cfg = {};
+  control_state_t state = {};
+  uint16_t cfg_version = 0;
+  bool have_cfg = false;
+  bool started = false;
+  uint32_t ticks = 0, gaps = 0, configs = 0, mismatches = 0;
+  // Duty percent seconds, a proxy for energy delivered to each element
+  uint64_t recorded_duty[2] = {}, replayed_duty[2] = {};
+  // Identified from the recorded duties, as the device would have
+  static thermal_model_t model;
+  thermal_model_reset(&model);
+  // Roasts told apart as the device would, their start times are not in the record
+  roast_session_t session;
+  roast_session_reset(&session);
+  roast_summary_t summary;
+  char summary_json[512];
+
+  esp_err_t err;
+  while ((err = control_record_next(&reader, &record)) == ESP_OK) {
+    if (record.type == CONTROL_RECORD_CONFIG) {
+      cfg = record.cfg;
+      cfg_version = record.cfg_version;
+      _apply_overrides(cfg, overrides);
+      have_cfg = true;
+      configs++;
+      continue;
+    }
+    if (!have_cfg) {
+      fprintf(stderr, "Tick %u before any configuration\n", record.loop_count);
+      return 2;
+    }
+
+    // The decision counts loops itself, line it up with the recording and note any records lost
+    if (!started || record.loop_count != state.loop_count + 1) {
+      if (started && record.loop_count <= state.loop_count) {
+        printf("restart: ticks numbered from %u again after %u\n", record.loop_count, state.loop_count);
+        state = {};
+        thermal_model_reset(&model);
+        roast_session_reset(&session);
+        gaps++;
+      } else if (started) {
+        printf("gap: ticks %u to %u missing\n", state.loop_count + 1, record.loop_count - 1);
+        // The model must not fit a step across the missing ticks
+        thermal_model_update(&model, false, 0, state.input_duty, state.output_duty, state.fan_duty);
+        gaps++;
+      }
+      state.loop_count = record.loop_count - 1;
+      started = true;
+    }
+
+    control_decide(record.inputs, cfg, state);
+    const control_inputs_t &tick = record.inputs;
+    thermal_model_update(&model, tick.tc.is_valid && tick.tc.thermocouple_status == MAX31850_TC_STATUS_OK,
+                         tick.tc.tc_temp, record.input_duty, record.output_duty, tick.fan_duty);
+    if (roast_session_update(&session, tick, state, cfg, 0, 1, &summary) &&
+        roast_summary_format(summary_json, sizeof(summary_json), summary)) {
+      printf("roast: %s\n", summary_json);
+    }
+    ticks++;
+    recorded_duty[0] += record.input_duty;
+    recorded_duty[1] += record.output_duty;
+    replayed_duty[0] += state.input_duty;
+    replayed_duty[1] += state.output_duty;
+
+    if (state.input_duty != record.input_duty || state.output_duty != record.output_duty) {
+      if (mismatches++ < MAX_LISTED_MISMATCHES) {
+        printf("tick %u: recorded input=%u output=%u, replayed input=%u output=%u (tc=%.2f status=%u board=%.2f)\n",
+               record.loop_count, record.input_duty, record.output_duty, state.input_duty, state.output_duty,
+               record.inputs.tc.tc_temp, record.inputs.tc.thermocouple_status, record.inputs.tc.junction_temp);
+      }
+    }
+
+    if (csv) {
+      const control_inputs_t &in = record.inputs;
+      fprintf(csv, "%u,%d,%u,%d,%u,%u,%d,%d,%u,%.4f,%.4f,%u,%u,%u,%u,%u\n", record.loop_count, in.heat_ok,
+              in.heat_duty, in.fan_ok, in.fan_duty, in.balance_mv, in.motor_on, in.tc.is_valid,
+              in.tc.thermocouple_status, in.tc.tc_temp, in.tc.junction_temp, cfg_version, record.input_duty,
+              record.output_duty, state.input_duty, state.output_duty);
+    }
+  }
+  if (csv) {
+    fclose(csv);
+  }
+
+  if (err != ESP_ERR_NOT_FOUND) {
+    fprintf(stderr, "Malformed record after %u ticks: %s\n", ticks, esp_err_to_name(err));
+    return 2;
+  }
+
+  printf("%u ticks, %u config records, %u gaps, %u mismatching ticks\n", ticks, configs, gaps, mismatches);
+  printf("duty seconds main: recorded=%llu replayed=%llu, secondary: recorded=%llu replayed=%llu\n",
+         (unsigned long long) recorded_duty[0], (unsigned long long) replayed_duty[0],
+         (unsigned long long) recorded_duty[1], (unsigned long long) replayed_duty[1]);
+  thermal_model_estimate_t estimate = thermal_model_estimate(&model, 1);
+  printf("model: gain main=%.1fC secondary=%.1fC fan=%.1fC, tau=%.0fs, dead time=%.0fs, rmse=%.2fC\n",
+         estimate.gain_main, estimate.gain_secondary, estimate.gain_fan, estimate.tau_s, estimate.dead_time_s,
+         estimate.rmse);
+  return mismatches ? 1 : 0;
+}
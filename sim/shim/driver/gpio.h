@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "hal/gpio_types.h"
+
+typedef struct {
+  uint64_t pin_bit_mask;
+  gpio_mode_t mode;
+  gpio_pullup_t pull_up_en;
+  gpio_pulldown_t pull_down_en;
+  gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void (*gpio_isr_t)(void *);
+
+esp_err_t gpio_config(const gpio_config_t *cfg);
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
+
+int gpio_get_level(gpio_num_t gpio);
+
+esp_err_t gpio_install_isr_service(int flags);
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_event_base.h"
+#include "freertos/FreeRTOS.h"
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data, size_t size, TickType_t wait);
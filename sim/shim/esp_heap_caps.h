@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_8BIT     (1 << 2)
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t) {
+  return calloc(n, size);
+}
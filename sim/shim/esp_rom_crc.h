@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * CRC-16/CCITT and CRC-32 as the ROM computes them, little endian, `crc` is the value to carry on from.
+ */
+uint16_t esp_rom_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len);
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+uint32_t esp_get_free_heap_size();
+
+uint32_t esp_get_minimum_free_heap_size();
+
+[[noreturn]] void esp_restart();
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+
+/**
+ * Simulated time in microseconds, advanced by the simulator rather than the wall clock.
+ */
+int64_t esp_timer_get_time();
+
+typedef struct sim_esp_timer_t *esp_timer_handle_t;
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+  ESP_TIMER_TASK,
+  ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void *arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char *name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+/**
+ * Fired at its alarms in virtual time like a gptimer, either dispatch method runs the callback in place.
+ */
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+inline void esp_timer_isr_dispatch_need_yield() {}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE      1
+#define pdFALSE     0
+#define pdPASS      pdTRUE
+#define pdFAIL      pdFALSE
+#define portMAX_DELAY   UINT32_MAX
+#define configTICK_RATE_HZ  100
+#define pdMS_TO_TICKS(ms)   ((TickType_t) ((uint64_t) (ms) * configTICK_RATE_HZ / 1000))
+#define portYIELD_FROM_ISR(x) ((void) (x))
+
+// Single threaded simulation, critical sections have nothing to protect against
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void) (mux))
+#define portEXIT_CRITICAL(mux) ((void) (mux))
+#define portENTER_CRITICAL_ISR(mux) ((void) (mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void) (mux))
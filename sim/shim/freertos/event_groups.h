@@ -0,0 +1,6 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct sim_event_group_t *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
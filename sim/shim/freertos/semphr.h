@@ -0,0 +1,13 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct sim_semaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
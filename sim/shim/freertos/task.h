@@ -0,0 +1,29 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#define tskNO_AFFINITY  0x7FFFFFFF
+
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+
+/**
+ * Lets virtual time run for `ticks`, firing any timer alarms due in the meantime.
+ */
+void vTaskDelay(TickType_t ticks);
+
+/**
+ * Nothing else runs to notify, waits out `ticks` as vTaskDelay() and returns 0.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+/**
+ * The single task runs on the host's stack, not one of its own, so 0.
+ */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
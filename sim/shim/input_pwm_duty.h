@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "hal/gpio_types.h"
+
+/*
+ * API of the esp32-input-pwm-duty component, backed by the simulated panel signals.
+ */
+
+typedef struct input_pwm_t *input_pwm_handle_t;
+
+typedef enum {
+  PWM_INPUT_UP_EDGE_ON,
+  PWM_INPUT_DOWN_EDGE_ON,
+} input_pwm_edge_t;
+
+struct input_pwm_config_t {
+  gpio_num_t gpio;
+  input_pwm_edge_t edge_type;
+  uint32_t period_us;
+};
+
+esp_err_t input_pwm_new(input_pwm_config_t cfg, input_pwm_handle_t *ret_handle);
+
+esp_err_t input_pwm_get_duty(input_pwm_handle_t handle, uint8_t &duty);
+
+esp_err_t input_pwm_del(input_pwm_handle_t handle);
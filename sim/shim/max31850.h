@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "hal/gpio_types.h"
+
+/*
+ * API of the esp32-max31850 component, backed by the simulated thermocouple.
+ */
+
+#define MAX31850_TC_STATUS_OK             0x00
+#define MAX31850_TC_STATUS_OPEN_CIRCUIT   0x01
+#define MAX31850_TC_STATUS_SHORT_GND      0x02
+#define MAX31850_TC_STATUS_SHORT_VCC      0x04
+
+#define MAX31850_MAX_DEVICES  8
+
+struct max31850_data_t {
+  bool is_valid;
+  uint8_t thermocouple_status;
+  float tc_temp;
+  float junction_temp;
+};
+
+struct max3185_devices_t {
+  uint8_t devices_address_length;
+  uint64_t devices_address[MAX31850_MAX_DEVICES];
+};
+
+max3185_devices_t max31850_list(gpio_num_t pin);
+
+max31850_data_t max31850_read(gpio_num_t pin, uint64_t addr);
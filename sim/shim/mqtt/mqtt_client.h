@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+
+/*
+ * The part of the esp32-aws-connector MQTT client the shadow and command handling call, for roaster_fuzz.
+ * Nothing connects, publishes go nowhere.
+ */
+
+struct MQTTContext_t;
+
+enum class MQTTQoS_t {
+  MQTTQoS0 = 0,
+  MQTTQoS1 = 1,
+  MQTTQoS2 = 2,
+};
+
+struct MQTTPublishInfo_t {
+  MQTTQoS_t qos;
+  bool retain;
+  bool dup;
+  const char *pTopicName;
+  uint16_t topicNameLength;
+  const void *pPayload;
+  size_t payloadLength;
+};
+
+esp_err_t mqtt_client_publish(MQTTPublishInfo_t *info, uint32_t timeout_ms);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+  NVS_READONLY,
+  NVS_READWRITE,
+} nvs_open_mode_t;
+
+/*
+ * In memory store, contents last for the life of the process.
+ */
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle);
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out, size_t *length);
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out);
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+void nvs_close(nvs_handle_t handle);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+#include "mqtt/mqtt_client.h"
+
+/*
+ * The part of the esp32-aws-connector shadow API main/app_config.cpp calls, for roaster_fuzz. Nothing connects,
+ * deltas are handed straight to app_config_apply_delta().
+ */
+
+typedef void (*device_shadow_callback_t)(MQTTContext_t *ctx, MQTTPublishInfo_t *info);
+
+struct device_shadow_cfg_t {
+  const char *name;
+  device_shadow_callback_t get;
+  device_shadow_callback_t updated;
+  device_shadow_callback_t deleted;
+};
+
+typedef void *device_shadow_handle_t;
+
+esp_err_t shadow_handler_init(device_shadow_cfg_t cfg, device_shadow_handle_t *handle);
+
+void shadow_handler_update(device_shadow_handle_t handle, const char *payload, size_t len);
+
+// newlib has it in string.h, glibc does not. The shadow handlers match their topics with it.
+char *strnstr(const char *haystack, const char *needle, size_t len);
@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_event.h"
+#include "esp_task_wdt.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+#include "driver/gptimer.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "sim_platform.h"
+
+struct sim_gptimer_t {
+  uint32_t resolution_hz;
+  uint64_t alarm_count;
+  bool auto_reload;
+  bool enabled;
+  bool running;
+  gptimer_alarm_cb_t on_alarm;
+  void *user_ctx;
+  // Alarms are scheduled as start + n * period computed exactly, so 60Hz periods do not drift
+  int64_t start_ns;
+  uint64_t alarm_index;
+  int64_t next_ns;
+};
+
+// An esp_timer is a 1MHz gptimer underneath
+struct sim_esp_timer_t {
+  gptimer_handle_t timer;
+  esp_timer_cb_t callback;
+  void *arg;
+};
+
+struct sim_semaphore_t {
+  uint32_t count;
+};
+
+struct sim_gpio_t {
+  gpio_mode_t mode;
+  gpio_int_type_t intr_type;
+  gpio_isr_t isr;
+  void *isr_arg;
+  int level;
+};
+
+static int64_t s_now_ns = 0;
+static sim_advance_hook_t s_advance_hook = nullptr;
+static std::vector<sim_gptimer_t *> s_timers;
+static sim_gpio_t s_gpio[GPIO_NUM_MAX] = {};
+static esp_log_level_t s_log_level = ESP_LOG_NONE;
+static std::map<std::string, std::vector<uint8_t>> s_nvs;
+static std::vector<std::string> s_nvs_handles;
+
+/* ---- Virtual time ---- */
+
+static void _schedule(sim_gptimer_t *timer) {
+  timer->alarm_index++;
+  timer->next_ns = timer->start_ns +
+                   (int64_t) (timer->alarm_index * timer->alarm_count * 1000000000ULL / timer->resolution_hz);
+}
+
+static void _advance_to(int64_t t_ns) {
+  if (t_ns <= s_now_ns) {
+    return;
+  }
+  if (s_advance_hook) {
+    s_advance_hook(s_now_ns, t_ns - s_now_ns);
+  }
+  s_now_ns = t_ns;
+}
+
+/*
+ * Fires the next alarm due no later than `limit_ns`, otherwise moves time to `limit_ns`.
+ * Returns false when nothing was due.
+ */
+static bool _step(int64_t limit_ns) {
+  sim_gptimer_t *next = nullptr;
+  for (auto timer: s_timers) {
+    if (timer->running && (!next || timer->next_ns < next->next_ns)) {
+      next = timer;
+    }
+  }
+  if (!next || next->next_ns > limit_ns) {
+    _advance_to(limit_ns);
+    return false;
+  }
+
+  _advance_to(next->next_ns);
+  gptimer_alarm_event_data_t edata = {
+      .count_value = next->alarm_count,
+      .alarm_value = next->alarm_count,
+  };
+  if (next->auto_reload) {
+    _schedule(next);
+  } else {
+    next->running = false;
+  }
+  if (next->on_alarm) {
+    next->on_alarm(next, &edata, next->user_ctx);
+  }
+  return true;
+}
+
+static int64_t _deadline(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return INT64_MAX;
+  }
+  return s_now_ns + (int64_t) ticks * (1000000000LL / configTICK_RATE_HZ);
+}
+
+void sim_set_advance_hook(sim_advance_hook_t hook) {
+  s_advance_hook = hook;
+}
+
+int64_t sim_now_ns() {
+  return s_now_ns;
+}
+
+int64_t esp_timer_get_time() {
+  return s_now_ns / 1000;
+}
+
+/* ---- Logging ---- */
+
+void sim_set_log_level(esp_log_level_t level) {
+  s_log_level = level;
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...) {
+  static const char levels[] = "NEWIDV";
+  if (level > s_log_level) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%c (%.3f) %s: ", levels[level], (double) s_now_ns / 1e9, tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_FAIL:
+      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+      return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+      return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+      return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+      return "ESP_ERR_INVALID_RESPONSE";
+    default:
+      return "UNKNOWN ERROR";
+  }
+}
+
+/* ---- System ---- */
+
+uint32_t esp_get_free_heap_size() {
+  return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+  return 0;
+}
+
+void esp_restart() {
+  fprintf(stderr, "esp_restart() at %.3fs\n", (double) s_now_ns / 1e9);
+  exit(3);
+}
+
+esp_err_t esp_event_post(esp_event_base_t, int32_t, const void *, size_t, TickType_t) {
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t) {
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset() {
+  return ESP_OK;
+}
+
+/* Bitwise, reflected, inverted in and out as the ROM does */
+static uint32_t _crc_le(uint32_t crc, uint32_t poly, uint32_t mask, uint8_t const *buf, uint32_t len) {
+  crc = ~crc & mask;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+    }
+  }
+  return ~crc & mask;
+}
+
+uint16_t esp_rom_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len) {
+  return (uint16_t) _crc_le(crc, 0x8408, 0xFFFF, buf, len);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+  return _crc_le(crc, 0xEDB88320, 0xFFFFFFFF, buf, len);
+}
+
+/* ---- FreeRTOS, a single task ---- */
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  static int task;
+  return &task;
+}
+
+void vTaskPrioritySet(TaskHandle_t, UBaseType_t) {}
+
+void vTaskDelay(TickType_t ticks) {
+  int64_t deadline = _deadline(ticks);
+  while (_step(deadline)) {}
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t ticks) {
+  vTaskDelay(ticks);
+  return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t) {
+  return pdPASS;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+  return 0;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new sim_semaphore_t{};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+  // Nothing else can give the semaphore while we block, so run the timers until one does
+  int64_t deadline = _deadline(wait);
+  while (sem->count == 0) {
+    if (!_step(deadline)) {
+      return pdFALSE;
+    }
+  }
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  if (sem->count) {
+    return pdFALSE;
+  }
+  sem->count = 1;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+  if (woken) {
+    *woken = pdTRUE;
+  }
+  return xSemaphoreGive(sem);
+}
+
+/* ---- GPTimer ---- */
+
+esp_err_t gptimer_new_timer(const gptimer_config_t *config, gptimer_handle_t *ret_timer) {
+  if (!config || !ret_timer || config->resolution_hz == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  auto timer = new sim_gptimer_t{};
+  timer->resolution_hz = config->resolution_hz;
+  s_timers.push_back(timer);
+  *ret_timer = timer;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_del_timer(gptimer_handle_t timer) {
+  if (!timer || timer->enabled) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  s_timers.erase(std::remove(s_timers.begin(), s_timers.end(), timer), s_timers.end());
+  delete timer;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t *config) {
+  if (!timer || !config || config->alarm_count == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  timer->alarm_count = config->alarm_count;
+  timer->auto_reload = config->flags.auto_reload_on_alarm;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t *cbs,
+                                           void *user_data) {
+  if (!timer || !cbs || timer->enabled) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->on_alarm = cbs->on_alarm;
+  timer->user_ctx = user_data;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_enable(gptimer_handle_t timer) {
+  if (!timer || timer->enabled) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->enabled = true;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_disable(gptimer_handle_t timer) {
+  if (!timer || !timer->enabled || timer->running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->enabled = false;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_start(gptimer_handle_t timer) {
+  if (!timer || !timer->enabled || timer->running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->running = true;
+  timer->start_ns = s_now_ns;
+  timer->alarm_index = 0;
+  _schedule(timer);
+  return ESP_OK;
+}
+
+esp_err_t gptimer_stop(gptimer_handle_t timer) {
+  if (!timer || !timer->enabled || !timer->running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->running = false;
+  return ESP_OK;
+}
+
+/* ---- esp_timer ---- */
+
+static bool _on_esp_timer_alarm(gptimer_handle_t, const gptimer_alarm_event_data_t *, void *user_ctx) {
+  auto timer = (sim_esp_timer_t *) user_ctx;
+  timer->callback(timer->arg);
+  return false;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+  if (!create_args || !create_args->callback || !out_handle) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  auto timer = new sim_esp_timer_t{.callback = create_args->callback, .arg = create_args->arg};
+  gptimer_config_t config = {.clk_src = GPTIMER_CLK_SRC_DEFAULT, .direction = GPTIMER_COUNT_UP,
+                             .resolution_hz = 1000000};
+  gptimer_event_callbacks_t cbs = {.on_alarm = _on_esp_timer_alarm};
+  ESP_ERROR_CHECK(gptimer_new_timer(&config, &timer->timer));
+  ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer->timer, &cbs, timer));
+  ESP_ERROR_CHECK(gptimer_enable(timer->timer));
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  if (!timer || period == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  gptimer_alarm_config_t alarm = {.alarm_count = period, .flags = {.auto_reload_on_alarm = true}};
+  gptimer_set_alarm_action(timer->timer, &alarm);
+  return gptimer_start(timer->timer);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  if (!timer || timeout_us == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  gptimer_alarm_config_t alarm = {.alarm_count = timeout_us, .flags = {.auto_reload_on_alarm = false}};
+  gptimer_set_alarm_action(timer->timer, &alarm);
+  return gptimer_start(timer->timer);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  return timer ? gptimer_stop(timer->timer) : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (timer->timer->running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  gptimer_disable(timer->timer);
+  gptimer_del_timer(timer->timer);
+  delete timer;
+  return ESP_OK;
+}
+
+/* ---- GPIO ---- */
+
+static bool _valid_gpio(gpio_num_t gpio) {
+  return gpio >= 0 && gpio < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *cfg) {
+  for (int i = 0; i < GPIO_NUM_MAX; i++) {
+    if (cfg->pin_bit_mask & (1ULL << i)) {
+      s_gpio[i].mode = cfg->mode;
+      s_gpio[i].intr_type = cfg->intr_type;
+      if (cfg->mode == GPIO_MODE_INPUT) {
+        s_gpio[i].level = cfg->pull_up_en == GPIO_PULLUP_ENABLE ? 1 : 0;
+      }
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level) {
+  if (!_valid_gpio(gpio)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  s_gpio[gpio].level = level ? 1 : 0;
+  return ESP_OK;
+}
+
+gpio_dev_t GPIO;
+
+sim_gpio_reg_t &sim_gpio_reg_t::operator=(uint32_t mask) {
+  for (; mask; mask &= mask - 1) {
+    s_gpio[__builtin_ctz(mask)].level = set ? 1 : 0;
+  }
+  return *this;
+}
+
+int gpio_get_level(gpio_num_t gpio) {
+  return _valid_gpio(gpio) ? s_gpio[gpio].level : 0;
+}
+
+esp_err_t gpio_install_isr_service(int) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg) {
+  if (!_valid_gpio(gpio)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  s_gpio[gpio].isr = handler;
+  s_gpio[gpio].isr_arg = arg;
+  return ESP_OK;
+}
+
+int sim_gpio_output(gpio_num_t gpio) {
+  return gpio_get_level(gpio);
+}
+
+void sim_gpio_set_input(gpio_num_t gpio, int level) {
+  if (!_valid_gpio(gpio)) {
+    return;
+  }
+  sim_gpio_t &pin = s_gpio[gpio];
+  int previous = pin.level;
+  pin.level = level ? 1 : 0;
+
+  // Level interrupts fire once per change here, the hardware would keep firing while the level holds
+  bool fire = false;
+  switch (pin.intr_type) {
+    case GPIO_INTR_POSEDGE:
+      fire = !previous && pin.level;
+      break;
+    case GPIO_INTR_NEGEDGE:
+      fire = previous && !pin.level;
+      break;
+    case GPIO_INTR_ANYEDGE:
+      fire = previous != pin.level;
+      break;
+    case GPIO_INTR_LOW_LEVEL:
+      fire = !pin.level;
+      break;
+    case GPIO_INTR_HIGH_LEVEL:
+      fire = pin.level;
+      break;
+    default:
+      break;
+  }
+  if (fire && pin.isr) {
+    pin.isr(pin.isr_arg);
+  }
+}
+
+/* ---- NVS ---- */
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t, nvs_handle_t *handle) {
+  s_nvs_handles.emplace_back(ns);
+  *handle = s_nvs_handles.size();
+  return ESP_OK;
+}
+
+static std::string _nvs_key(nvs_handle_t handle, const char *key) {
+  return s_nvs_handles.at(handle - 1) + "/" + key;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out, size_t *length) {
+  auto it = s_nvs.find(_nvs_key(handle, key));
+  if (it == s_nvs.end()) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (out) {
+    if (*length < it->second.size()) {
+      return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out, it->second.data(), it->second.size());
+  }
+  *length = it->second.size();
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+  auto bytes = (const uint8_t *) value;
+  s_nvs[_nvs_key(handle, key)].assign(bytes, bytes + length);
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out) {
+  size_t length = sizeof(*out);
+  return nvs_get_blob(handle, key, out, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+  return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include "esp_log.h"
+#include "hal/gpio_types.h"
+
+/**
+ * Controls for the shimmed platform, used by the simulator only.
+ *
+ * Time is virtual: it stands still while firmware code runs and moves forward when the firmware blocks on a
+ * semaphore or delay, at which point due timer alarms are fired in order. The world is told about each span of
+ * time before it elapses, outputs are constant within a span.
+ */
+
+/**
+ * Called before virtual time advances from `now_ns` by `dt_ns`.
+ */
+typedef void (*sim_advance_hook_t)(int64_t now_ns, int64_t dt_ns);
+
+void sim_set_advance_hook(sim_advance_hook_t hook);
+
+int64_t sim_now_ns();
+
+/**
+ * Level last driven on an output pin.
+ */
+int sim_gpio_output(gpio_num_t gpio);
+
+/**
+ * Drives an input pin, firing its interrupt handler if the change matches its interrupt type.
+ */
+void sim_gpio_set_input(gpio_num_t gpio, int level);
+
+void sim_set_log_level(esp_log_level_t level);
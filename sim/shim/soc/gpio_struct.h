@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * GPIO set and clear registers of the first bank, a mask stored to one sets or clears the simulated pins it holds,
+ * as gpio_set_level() does.
+ */
+struct sim_gpio_reg_t {
+  bool set;
+
+  sim_gpio_reg_t &operator=(uint32_t mask);
+};
+
+struct gpio_dev_t {
+  sim_gpio_reg_t out_w1ts{true};
+  sim_gpio_reg_t out_w1tc{false};
+};
+
+extern gpio_dev_t GPIO;
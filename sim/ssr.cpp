@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "sim_platform.h"
+#include "board.h"
+#include "ssr_ctrl.h"
+#include "world.h"
+
+/*
+ * Drives the SSR controller half-cycle by half-cycle through every change of duty, from every point of the
+ * pattern being output, and checks what the output does until the new duty settles:
+ *
+ *   - the pattern under way is finished as it was and the new one then starts from its beginning, so no pattern
+ *     ever mixes two duties
+ *   - how long that takes, and the energy delivered over and under the new duty applying at once
+ *   - ssr_ctrl_force_off() cutting the output on the very next half-cycle from anywhere in any pattern
+ *   - the controller's counters agreeing with the output seen and the duties set, half-cycle for half-cycle
+ */
+
+#define SSR_PIN             BOARD.ssr1
+// Longest pattern the duty map holds, 99 and 1 at two half-cycles minimum on or off
+#define MAX_PATTERN         200
+
+// Runs of one duty held steadily, high then low, 0 for the one a duty of 0 or 100 never has
+struct pattern_t {
+  int high;
+  int low;
+};
+
+struct worst_t {
+  int value;
+  int from;
+  int to;
+};
+
+static ssr_ctrl_handle_t s_ssr;
+static pattern_t s_patterns[101];
+// What the controller's counters should read, from the duties set and the output seen
+static ssr_ctrl_counters_t s_expected;
+static int s_duty_set = 0;
+
+// No control loop runs here
+void sim_on_tick(const control_state_t &) {}
+
+void sim_on_roast(const roast_summary_t &) {}
+
+static int _step() {
+  int was_on = sim_gpio_output(SSR_PIN);
+  ssr_ctrl_half_cycle(s_ssr);
+  int on = sim_gpio_output(SSR_PIN);
+  s_expected.half_cycles++;
+  s_expected.on_half_cycles += on;
+  s_expected.commanded += s_duty_set;
+  s_expected.switch_count += on && !was_on;
+  return on;
+}
+
+static void _set_duty(int duty) {
+  ssr_ctrl_set_duty(s_ssr, duty);
+  s_duty_set = duty;
+}
+
+static void _force_off() {
+  ssr_ctrl_force_off(s_ssr);
+  s_duty_set = 0;
+}
+
+/* Output cut and the duty at zero, as from ssr_ctrl_new() */
+static void _reset() {
+  _force_off();
+  _step();
+}
+
+static int _period(int duty) {
+  return s_patterns[duty].high + s_patterns[duty].low > 0 ? s_patterns[duty].high + s_patterns[duty].low : 1;
+}
+
+/* Level of the steady pattern of `duty`, `phase` half-cycles into it */
+static int _expected(int duty, int phase) {
+  if (duty <= 0 || duty >= 100) {
+    return duty >= 100;
+  }
+  return phase % _period(duty) < s_patterns[duty].high;
+}
+
+/* Learns each duty's runs from the middle of a steady output */
+static void _learn() {
+  for (int duty = 1; duty < 100; duty++) {
+    _reset();
+    _set_duty(duty);
+    for (int i = 0; i < 2 * MAX_PATTERN; i++) {
+      _step();
+    }
+    int level = sim_gpio_output(SSR_PIN), next;
+    // Up to the next rising edge, then count the high run and the low run after it
+    while ((next = _step()) <= level) {
+      level = next;
+    }
+    int high = 1, low = 0;
+    while (_step()) {
+      high++;
+    }
+    low++;
+    while (!_step()) {
+      low++;
+    }
+    s_patterns[duty] = {high, low};
+  }
+}
+
+static void _track(worst_t &worst, int value, int from, int to) {
+  if (value > worst.value) {
+    worst = {value, from, to};
+  }
+}
+
+int main(int argc, char **argv) {
+  int mains_hz = 50;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mains") == 0 && i + 1 < argc) {
+      mains_hz = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--mains 50|60]\n", argv[0]);
+      return 2;
+    }
+  }
+  sim_set_log_level(ESP_LOG_NONE);
+  ESP_ERROR_CHECK(ssr_ctrl_new({.gpio = SSR_PIN, .mains_hz = (main_hertz_t) mains_hz}, &s_ssr));
+  _learn();
+
+  worst_t latency = {-1}, excess = {-1}, shortfall = {-1};
+  uint32_t transitions = 0, mixed = 0, force_off_failures = 0;
+  std::vector<int> out(4 * MAX_PATTERN);
+
+  for (int from = 0; from <= 100; from++) {
+    int period_from = _period(from);
+    // Phase is how many half-cycles of the pattern were output before the change, all of it included
+    for (int phase = 1; phase <= period_from; phase++) {
+      for (int to = 0; to <= 100; to++) {
+        if (to == from) {
+          continue;
+        }
+        // A fresh controller starts the first pattern on the first half-cycle
+        _reset();
+        _set_duty(from);
+        for (int i = 0; i < phase; i++) {
+          _step();
+        }
+        _set_duty(to);
+        int period_to = _period(to);
+        int n = period_from + 2 * period_to;
+        for (int i = 0; i < n; i++) {
+          out[i] = _step();
+        }
+
+        // Earliest point from which the old pattern's remainder then whole new patterns match the output
+        int boundary = -1;
+        for (int b = 0; b <= period_from && boundary < 0; b++) {
+          bool match = true;
+          for (int i = 0; i < n && match; i++) {
+            match = out[i] == (i < b ? _expected(from, phase + i) : _expected(to, i - b));
+          }
+          boundary = match ? b : -1;
+        }
+        int window = period_from + period_to, on = 0;
+        for (int i = 0; i < window; i++) {
+          on += out[i];
+        }
+        auto error = (int) std::lround(on - to / 100.0 * window);
+        _track(excess, error, from, to);
+        _track(shortfall, -error, from, to);
+
+        transitions++;
+        if (boundary < 0) {
+          if (mixed++ < 10) {
+            printf("mixed pattern: %d%% to %d%% at phase %d\n", from, to, phase);
+          }
+        } else {
+          _track(latency, boundary, from, to);
+        }
+      }
+
+      // The cut is immediate, and the next duty set starts a fresh pattern
+      if (from > 0) {
+        _reset();
+        _set_duty(from);
+        for (int i = 0; i < phase; i++) {
+          _step();
+        }
+        _force_off();
+        bool ok = _step() == 0;
+        _set_duty(from);
+        ok &= _step() == 1;
+        if (!ok && force_off_failures++ < 10) {
+          printf("force off failed: %d%% at phase %d\n", from, phase);
+        }
+      }
+    }
+  }
+
+  ssr_ctrl_counters_t counters;
+  ssr_ctrl_get_counters(s_ssr, counters);
+  bool counted = counters.half_cycles == s_expected.half_cycles &&
+                 counters.on_half_cycles == s_expected.on_half_cycles &&
+                 counters.commanded == s_expected.commanded && counters.switch_count == s_expected.switch_count;
+
+  double half_cycle_ms = 1000.0 / (2 * mains_hz);
+  printf("%u transitions at %dHz, %u mixed patterns, %u force off failures\n", transitions, mains_hz, mixed,
+         force_off_failures);
+  printf("worst latency to the new pattern: %d half-cycles (%.0fms), %d%% to %d%%\n", latency.value,
+         latency.value * half_cycle_ms, latency.from, latency.to);
+  // Against the new duty applying at once, over a whole old pattern and a whole new one
+  printf("worst energy excess: %d half-cycles at full power (%.0fms), %d%% to %d%%\n", excess.value,
+         excess.value * half_cycle_ms, excess.from, excess.to);
+  printf("worst energy shortfall: %d half-cycles at full power (%.0fms), %d%% to %d%%\n", shortfall.value,
+         shortfall.value * half_cycle_ms, shortfall.from, shortfall.to);
+  printf("counters %s: %llu half-cycles, %llu on, %llu switch cycles\n", counted ? "match" : "MISMATCH",
+         (unsigned long long) counters.half_cycles, (unsigned long long) counters.on_half_cycles,
+         (unsigned long long) counters.switch_count);
+  ssr_ctrl_del(s_ssr);
+  return mixed || force_off_failures || !counted ? 1 : 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include "control_loop.h"
+#include "plant.h"
+#include "pm_control.h"
+#include "roast_session.h"
+
+/**
+ * Everything the firmware can sense, written by the scenario and the plant and read by the simulated
+ * peripherals.
+ */
+struct sim_world_t {
+  plant_t plant;
+
+  // Panel signals from the Hottop's own controller
+  uint8_t heat_duty;
+  uint8_t fan_duty;
+
+  // Balance potentiometer wiper voltage
+  int balance_mv;
+
+  // Fault injection: thermocouple status reported instead of a reading, reads failing altogether and an
+  // offset added to the board temperature
+  uint8_t tc_fault;
+  bool tc_missing;
+  double board_offset_c;
+
+  // Panel PWM reads block while set, stalling the control task
+  bool control_stall;
+};
+
+extern sim_world_t sim_world;
+
+/**
+ * Called with the controller state at the end of every control tick.
+ */
+void sim_on_tick(const control_state_t &state);
+
+/**
+ * Called with each roast summary the firmware hands to telemetry.
+ */
+void sim_on_roast(const roast_summary_t &summary);
+
+/**
+ * Whether the firmware holds a power management window open, pm_control itself is left out.
+ */
+bool sim_pm_held(pm_window_t window);